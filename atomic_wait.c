@@ -0,0 +1,109 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+
+#include "atomic_wait.h"
+
+#ifdef __linux__
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int
+atomicWait(atomic_uint* const word, const unsigned expected, const struct timespec* const abs_deadline) {
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout, so retries don't stretch the deadline.
+    if (syscall(SYS_futex, (uint32_t*) word, FUTEX_WAIT_BITSET_PRIVATE, expected, abs_deadline,
+                NULL, FUTEX_BITSET_MATCH_ANY) == 0) {
+        return 0;
+    }
+    return errno == EAGAIN ? 0 : errno;
+}
+
+void
+atomicWakeOne(atomic_uint* const word) {
+    syscall(SYS_futex, (uint32_t*) word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+void
+atomicWakeAll(atomic_uint* const word) {
+    syscall(SYS_futex, (uint32_t*) word, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+#else
+
+// Poll interval without futex.
+#define ATOMIC_WAIT_POLL_NSEC 50000
+
+int
+atomicWait(atomic_uint* const word, const unsigned expected, const struct timespec* const abs_deadline) {
+    if (atomic_load(word) != expected) {
+        return 0;
+    }
+    if (abs_deadline != NULL) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > abs_deadline->tv_sec
+            || (now.tv_sec == abs_deadline->tv_sec && now.tv_nsec >= abs_deadline->tv_nsec)) {
+            return ETIMEDOUT;
+        }
+    }
+    const struct timespec interval = {0, ATOMIC_WAIT_POLL_NSEC};
+    nanosleep(&interval, NULL);
+    return 0;
+}
+
+void
+atomicWakeOne(atomic_uint* const word) {
+}
+
+void
+atomicWakeAll(atomic_uint* const word) {
+}
+
+#endif
+
+struct timespec
+monotonicDeadlineNsec(const long long int timeout_in_nsec) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_in_nsec / 1000000000;
+    deadline.tv_nsec += timeout_in_nsec % 1000000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    } else if (deadline.tv_nsec < 0) {
+        deadline.tv_sec--;
+        deadline.tv_nsec += 1000000000;
+    }
+    return deadline;
+}
+
+struct timespec
+monotonicDeadline(const long int timeout_in_msec) {
+    return monotonicDeadlineNsec(timeout_in_msec * 1000000LL);
+}
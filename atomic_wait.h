@@ -0,0 +1,44 @@
+#ifndef ATOMIC_WAIT_H
+#define ATOMIC_WAIT_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  Block on and wake up waiters of a 32 bit atomic word.  Futex on Linux, a short sleep poll elsewhere.
+//
+#include <stdatomic.h>
+#include <time.h>
+
+// Block while *word equals expected, until woken or the CLOCK_MONOTONIC abs_deadline passes (NULL waits forever).
+// Returns 0 when woken or when *word already differs, ETIMEDOUT, EINTR, or EINVAL for an abs_deadline the
+// kernel rejects.  Wakeups may be spurious; callers re-check their own predicate and give up on anything but
+// 0 and EINTR.
+int atomicWait(atomic_uint* const word, const unsigned expected, const struct timespec* const abs_deadline);
+void atomicWakeOne(atomic_uint* const word);
+void atomicWakeAll(atomic_uint* const word);
+// CLOCK_MONOTONIC time timeout_in_msec or timeout_in_nsec from now.
+struct timespec monotonicDeadline(const long int timeout_in_msec);
+struct timespec monotonicDeadlineNsec(const long long int timeout_in_nsec);
+
+#endif
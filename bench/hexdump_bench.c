@@ -0,0 +1,151 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  hexdump throughput over input sizes from 16 bytes up to max_size, growing by 4 times, with max_size itself
+//  measured last when the steps miss it.  The default max_size of 1 GiB is a step.
+//
+//  buffer      hexdump() into a buffer of hexdump_output_size(), for inputs up to 16 MiB.
+//  parallel    hexdump_parallel() with one thread per CPU, same sizes.
+//  stream      hexdump_stream_feed() of the whole input to a sink which discards the text, for every size.
+//              Inputs beyond 16 MiB are fed as repeats of a 16 MiB buffer, so 1 GiB needs no 5 GiB of memory.
+//
+//  Every measurement repeats until it has run for at least 0.2 s.  MB/s counts input bytes, 10^6 per MB.
+//
+//  Usage: hexdump_bench [max_size]
+//  Prints one JSON document.
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hexdump.h"
+
+#define BENCH_BUFFER_MAX ((size_t) 16 << 20)
+#define BENCH_MIN_SEC 0.2
+
+typedef enum {
+    MODE_BUFFER,
+    MODE_PARALLEL,
+    MODE_STREAM,
+} Mode;
+
+static const char* const mode_names[] = {"buffer", "parallel", "stream"};
+
+static double
+now_sec(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static int
+discard_sink(void* const sink_context, const char* const text, const size_t len) {
+    *(size_t*) sink_context += len;
+    return 0;
+}
+
+// Format size bytes once.
+static void
+run_once(const Mode mode, const uint8_t* const src, const size_t size, char* const out, const size_t out_len) {
+    switch (mode) {
+    case MODE_BUFFER:
+        hexdump(out, out_len, src, size);
+        break;
+    case MODE_PARALLEL:
+        hexdump_parallel(out, out_len, src, size, 0);
+        break;
+    case MODE_STREAM: {
+        size_t written = 0;
+        hexdump_stream stream;
+        hexdump_stream_init(&stream, 0, discard_sink, &written);
+        for (size_t done = 0; done < size; done += BENCH_BUFFER_MAX) {
+            const size_t n = size - done < BENCH_BUFFER_MAX ? size - done : BENCH_BUFFER_MAX;
+            hexdump_stream_feed(&stream, src, n);
+        }
+        hexdump_stream_finish(&stream);
+        break;
+    }
+    }
+}
+
+// Input MB per second.
+static double
+measure(const Mode mode, const uint8_t* const src, const size_t size, char* const out, const size_t out_len) {
+    long rounds = 0;
+    const double t0 = now_sec();
+    double elapsed;
+    do {
+        run_once(mode, src, size, out, out_len);
+        rounds++;
+        elapsed = now_sec() - t0;
+    } while (elapsed < BENCH_MIN_SEC);
+    return (double) size * rounds / elapsed / 1e6;
+}
+
+// The size measured after size, 0 after max_size.
+static size_t
+next_size(const size_t size, const size_t max_size) {
+    if (size >= max_size) {
+        return 0;
+    }
+    return size > max_size / 4 ? max_size : size * 4;
+}
+
+int
+main(int argc, char** argv) {
+    const size_t max_size = argc > 1 ? strtoull(argv[1], NULL, 0) : (size_t) 1 << 30;
+    const size_t src_len = max_size < BENCH_BUFFER_MAX ? max_size : BENCH_BUFFER_MAX;
+    uint8_t* const src = malloc(src_len);
+    const size_t out_len = hexdump_output_size(src_len);
+    char* const out = malloc(out_len);
+    if (src == NULL || out == NULL) {
+        fprintf(stderr, "hexdump_bench: out of memory\n");
+        return 1;
+    }
+    uint32_t x = 1;
+    for (size_t i = 0; i < src_len; i++) {
+        x = x * 1103515245u + 12345u;
+        src[i] = (uint8_t) (x >> 24);
+    }
+
+    printf("{\"benchmark\": \"hexdump\", \"results\": [");
+    const char* sep = "";
+    for (size_t size = 16; size <= max_size && size != 0; size = next_size(size, max_size)) {
+        for (Mode mode = MODE_BUFFER; mode <= MODE_STREAM; mode++) {
+            if (mode != MODE_STREAM && size > BENCH_BUFFER_MAX) {
+                continue;
+            }
+            printf("%s\n  {\"mode\": \"%s\", \"bytes\": %zu, \"mb_per_sec\": %.1f}", sep, mode_names[mode], size,
+                   measure(mode, src, size, out, out_len));
+            fflush(stdout);
+            sep = ",";
+        }
+    }
+    printf("\n]}\n");
+    free(out);
+    free(src);
+    return 0;
+}
@@ -0,0 +1,161 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  Per thread MVar arrays from allocMVarArray(): MVar_abs against FastMVar.  Every thread hands values to
+//  itself through its own MVar, so any slowdown as threads are added comes from neighbouring elements sharing
+//  cache lines, which the alignment of both types and of the array should rule out.
+//
+//  Usage: mvar_array [max_threads [iterations]]
+//  Prints one JSON document.
+//
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fastmvar.h"
+#include "mvar.h"
+
+typedef struct {
+    MVar_abs base;
+    long value;
+} LongMVar;
+
+typedef struct {
+    FastMVar base;
+    long value;
+} LongFastMVar;
+
+static void
+long_mvar_write(void* const mvar_context, const void* const user_data) {
+    ((LongMVar*) mvar_context)->value = *(const long*) user_data;
+}
+
+static void
+long_mvar_read(void* const out_user_data, void* const mvar_context) {
+    *(long*) out_user_data = ((LongMVar*) mvar_context)->value;
+}
+
+static void
+long_fastmvar_write(void* const mvar_context, const void* const user_data) {
+    ((LongFastMVar*) mvar_context)->value = *(const long*) user_data;
+}
+
+static void
+long_fastmvar_read(void* const out_user_data, void* const mvar_context) {
+    *(long*) out_user_data = ((LongFastMVar*) mvar_context)->value;
+}
+
+typedef enum {
+    LAYOUT_MVAR,
+    LAYOUT_FASTMVAR,
+} Layout;
+
+static const char* const layout_names[] = {"mvar", "fastmvar"};
+
+typedef struct {
+    pthread_t thread;
+    Layout layout;
+    void* mvar;
+    long iterations;
+    pthread_barrier_t* start;
+} Worker;
+
+static void*
+worker_run(void* const arg) {
+    Worker* const w = arg;
+    pthread_barrier_wait(w->start);
+    long out;
+    if (w->layout == LAYOUT_FASTMVAR) {
+        for (long i = 0; i < w->iterations; i++) {
+            putFastMVar(w->mvar, &i);
+            takeFastMVar(&out, w->mvar);
+        }
+    } else {
+        for (long i = 0; i < w->iterations; i++) {
+            putMVar(w->mvar, &i);
+            takeMVar(&out, w->mvar);
+        }
+    }
+    return NULL;
+}
+
+static double
+now_sec(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+// Aggregate put+take pairs per second with nthreads threads on the given layout.
+static double
+run(const Layout layout, const int nthreads, const long iterations) {
+    size_t stride;
+    void* const array = allocMVarArray(nthreads, layout == LAYOUT_FASTMVAR ? sizeof(LongFastMVar)
+                                                                          : sizeof(LongMVar), &stride);
+    Worker workers[nthreads];
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, nthreads + 1);
+    for (int i = 0; i < nthreads; i++) {
+        void* const mvar = mVarArrayAt(array, stride, i);
+        if (layout == LAYOUT_FASTMVAR) {
+            initFastMVar(mvar, long_fastmvar_write, long_fastmvar_read);
+        } else {
+            initMVar(mvar, long_mvar_write, long_mvar_read);
+        }
+        workers[i] = (Worker) {.layout = layout, .mvar = mvar, .iterations = iterations, .start = &start};
+        pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]);
+    }
+    pthread_barrier_wait(&start);
+    const double t0 = now_sec();
+    for (int i = 0; i < nthreads; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    const double elapsed = now_sec() - t0;
+    pthread_barrier_destroy(&start);
+    free(array);
+    return nthreads * iterations / elapsed;
+}
+
+int
+main(int argc, char** argv) {
+    const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    const int max_threads = argc > 1 ? atoi(argv[1]) : (int) ncpu;
+    const long iterations = argc > 2 ? atol(argv[2]) : 1000000;
+
+    printf("{\"benchmark\": \"mvar_array\", \"iterations\": %ld, \"results\": [", iterations);
+    const char* sep = "";
+    for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+        for (Layout layout = LAYOUT_MVAR; layout <= LAYOUT_FASTMVAR; layout++) {
+            printf("%s\n  {\"layout\": \"%s\", \"threads\": %d, \"ops_per_sec\": %.0f}",
+                   sep, layout_names[layout], nthreads, run(layout, nthreads, iterations));
+            sep = ",";
+        }
+    }
+    printf("\n]}\n");
+    return 0;
+}
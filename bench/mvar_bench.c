@@ -0,0 +1,357 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  MVar microbenchmarks.
+//
+//  pingpong        round trip latency between two threads pinned to different CPUs (the same one on a
+//                  single CPU host), handing a value there through one MVar and back through another.
+//  throughput      items per second from P producer to C consumer threads through one MVar, FastMVar or
+//                  MPMC BoundedQueue.
+//  timed_overhead  cost of an uncontended put+take pair through the plain, timed and try operations.
+//
+//  Usage: mvar_bench [iterations [max_threads]]
+//  Prints one JSON document.
+//
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atomic_wait.h"
+#include "boundedqueue.h"
+#include "fastmvar.h"
+#include "mvar.h"
+
+typedef struct {
+    MVar_abs base;
+    long value;
+} LongMVar;
+
+typedef struct {
+    FastMVar base;
+    long value;
+} LongFastMVar;
+
+static void
+long_mvar_write(void* const mvar_context, const void* const user_data) {
+    ((LongMVar*) mvar_context)->value = *(const long*) user_data;
+}
+
+static void
+long_mvar_read(void* const out_user_data, void* const mvar_context) {
+    *(long*) out_user_data = ((LongMVar*) mvar_context)->value;
+}
+
+static void
+long_fastmvar_write(void* const mvar_context, const void* const user_data) {
+    ((LongFastMVar*) mvar_context)->value = *(const long*) user_data;
+}
+
+static void
+long_fastmvar_read(void* const out_user_data, void* const mvar_context) {
+    *(long*) out_user_data = ((LongFastMVar*) mvar_context)->value;
+}
+
+static void
+long_slot_write(void* const slot, const void* const user_data) {
+    *(long*) slot = *(const long*) user_data;
+}
+
+static void
+long_slot_read(void* const out_user_data, void* const slot) {
+    *(long*) out_user_data = *(long*) slot;
+}
+
+typedef enum {
+    KIND_MVAR,
+    KIND_FASTMVAR,
+    KIND_QUEUE,
+} Kind;
+
+static const char* const kind_names[] = {"mvar", "fastmvar", "bounded_queue_mpmc"};
+
+// One channel of any kind.  Only the member for its kind is initialized.
+typedef struct {
+    Kind kind;
+    LongMVar* mvar;
+    LongFastMVar* fastmvar;
+    BoundedQueue queue;
+} Channel;
+
+static void
+channel_init(Channel* const c, const Kind kind) {
+    size_t stride;
+    c->kind = kind;
+    switch (kind) {
+    case KIND_MVAR:
+        c->mvar = allocMVarArray(1, sizeof *c->mvar, &stride);
+        initMVar(c->mvar, long_mvar_write, long_mvar_read);
+        break;
+    case KIND_FASTMVAR:
+        c->fastmvar = allocMVarArray(1, sizeof *c->fastmvar, &stride);
+        initFastMVar(c->fastmvar, long_fastmvar_write, long_fastmvar_read);
+        break;
+    case KIND_QUEUE:
+        initBoundedQueue(&c->queue, BOUNDED_QUEUE_MPMC, 1024, sizeof(long), long_slot_write, long_slot_read);
+        break;
+    }
+}
+
+static void
+channel_destroy(Channel* const c) {
+    switch (c->kind) {
+    case KIND_MVAR:
+        free(c->mvar);
+        break;
+    case KIND_FASTMVAR:
+        free(c->fastmvar);
+        break;
+    case KIND_QUEUE:
+        destroyBoundedQueue(&c->queue);
+        break;
+    }
+}
+
+static void
+channel_put(Channel* const c, const long value) {
+    switch (c->kind) {
+    case KIND_MVAR:
+        putMVar(c->mvar, &value);
+        break;
+    case KIND_FASTMVAR:
+        putFastMVar(c->fastmvar, &value);
+        break;
+    case KIND_QUEUE:
+        putBoundedQueue(&c->queue, &value);
+        break;
+    }
+}
+
+static long
+channel_take(Channel* const c) {
+    long value = 0;
+    switch (c->kind) {
+    case KIND_MVAR:
+        takeMVar(&value, c->mvar);
+        break;
+    case KIND_FASTMVAR:
+        takeFastMVar(&value, c->fastmvar);
+        break;
+    case KIND_QUEUE:
+        takeBoundedQueue(&value, &c->queue);
+        break;
+    }
+    return value;
+}
+
+static double
+now_sec(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void
+pin_to_cpu(const long cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof set, &set);
+}
+
+typedef struct {
+    Channel* there;
+    Channel* back;
+    long iterations;
+    long cpu;
+} PingPong;
+
+static void*
+pong_run(void* const arg) {
+    PingPong* const p = arg;
+    pin_to_cpu(p->cpu);
+    for (long i = 0; i < p->iterations; i++) {
+        channel_put(p->back, channel_take(p->there));
+    }
+    return NULL;
+}
+
+// Nanoseconds per round trip.
+static double
+pingpong(const Kind kind, const long iterations, const long ncpu) {
+    Channel there, back;
+    channel_init(&there, kind);
+    channel_init(&back, kind);
+    PingPong p = {&there, &back, iterations, ncpu > 1 ? 1 : 0};
+    // Threads inherit affinity; restore ours afterwards so later benchmarks aren't pinned.
+    cpu_set_t saved;
+    pthread_getaffinity_np(pthread_self(), sizeof saved, &saved);
+    pin_to_cpu(0);
+    pthread_t pong;
+    pthread_create(&pong, NULL, pong_run, &p);
+    const double t0 = now_sec();
+    for (long i = 0; i < iterations; i++) {
+        channel_put(&there, i);
+        channel_take(&back);
+    }
+    const double elapsed = now_sec() - t0;
+    pthread_join(pong, NULL);
+    pthread_setaffinity_np(pthread_self(), sizeof saved, &saved);
+    channel_destroy(&there);
+    channel_destroy(&back);
+    return elapsed * 1e9 / iterations;
+}
+
+typedef struct {
+    Channel* channel;
+    long count;
+    pthread_barrier_t* start;
+} Endpoint;
+
+static void*
+producer_run(void* const arg) {
+    Endpoint* const e = arg;
+    pthread_barrier_wait(e->start);
+    for (long i = 0; i < e->count; i++) {
+        channel_put(e->channel, i);
+    }
+    return NULL;
+}
+
+static void*
+consumer_run(void* const arg) {
+    Endpoint* const e = arg;
+    pthread_barrier_wait(e->start);
+    for (long i = 0; i < e->count; i++) {
+        channel_take(e->channel);
+    }
+    return NULL;
+}
+
+// Items per second from nproducers to nconsumers threads.  iterations is rounded down to a multiple of both.
+static double
+throughput(const Kind kind, const int nproducers, const int nconsumers, long iterations) {
+    iterations -= iterations % ((long) nproducers * nconsumers);
+    Channel channel;
+    channel_init(&channel, kind);
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, nproducers + nconsumers + 1);
+    pthread_t threads[nproducers + nconsumers];
+    Endpoint producer = {&channel, iterations / nproducers, &start};
+    Endpoint consumer = {&channel, iterations / nconsumers, &start};
+    for (int i = 0; i < nproducers + nconsumers; i++) {
+        pthread_create(&threads[i], NULL, i < nproducers ? producer_run : consumer_run,
+                       i < nproducers ? &producer : &consumer);
+    }
+    pthread_barrier_wait(&start);
+    const double t0 = now_sec();
+    for (int i = 0; i < nproducers + nconsumers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    const double elapsed = now_sec() - t0;
+    pthread_barrier_destroy(&start);
+    channel_destroy(&channel);
+    return iterations / elapsed;
+}
+
+typedef enum {
+    OP_PLAIN,
+    OP_TIMED,
+    OP_TIMED_UNTIL,
+    OP_TRY,
+} Op;
+
+static const char* const op_names[] = {"plain", "timed", "timed_until", "try"};
+
+// Nanoseconds per uncontended put+take pair through MVar_abs.
+static double
+timed_overhead(const Op op, const long iterations) {
+    size_t stride;
+    LongMVar* const m = allocMVarArray(1, sizeof *m, &stride);
+    initMVar(m, long_mvar_write, long_mvar_read);
+    const struct timespec deadline = monotonicDeadline(60 * 1000);
+    long out;
+    const double t0 = now_sec();
+    for (long i = 0; i < iterations; i++) {
+        switch (op) {
+        case OP_PLAIN:
+            putMVar(m, &i);
+            takeMVar(&out, m);
+            break;
+        case OP_TIMED:
+            timedPutMVar(m, 1000, &i);
+            timedTakeMVar(&out, m, 1000);
+            break;
+        case OP_TIMED_UNTIL:
+            timedPutMVarUntil(m, &deadline, &i);
+            timedTakeMVarUntil(&out, m, &deadline);
+            break;
+        case OP_TRY:
+            tryPutMVar(m, &i);
+            tryTakeMVar(&out, m);
+            break;
+        }
+    }
+    const double elapsed = now_sec() - t0;
+    free(m);
+    return elapsed * 1e9 / iterations;
+}
+
+int
+main(int argc, char** argv) {
+    const long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    const long iterations = argc > 1 ? atol(argv[1]) : 1000000;
+    const int max_threads = argc > 2 ? atoi(argv[2]) : (int) (ncpu > 1 ? ncpu / 2 : 1);
+
+    printf("{\"benchmark\": \"mvar\", \"iterations\": %ld, \"cpus\": %ld,", iterations, ncpu);
+    printf("\n \"pingpong\": [");
+    const char* sep = "";
+    for (Kind kind = KIND_MVAR; kind <= KIND_QUEUE; kind++) {
+        printf("%s\n  {\"kind\": \"%s\", \"pinned_apart\": %s, \"ns_per_round_trip\": %.1f}", sep,
+               kind_names[kind], ncpu > 1 ? "true" : "false", pingpong(kind, iterations, ncpu));
+        sep = ",";
+    }
+    printf("\n ],\n \"throughput\": [");
+    sep = "";
+    for (int n = 1; n <= max_threads; n *= 2) {
+        for (Kind kind = KIND_MVAR; kind <= KIND_QUEUE; kind++) {
+            printf("%s\n  {\"kind\": \"%s\", \"producers\": %d, \"consumers\": %d, \"items_per_sec\": %.0f}", sep,
+                   kind_names[kind], n, n, throughput(kind, n, n, iterations));
+            sep = ",";
+        }
+    }
+    printf("\n ],\n \"timed_overhead\": [");
+    sep = "";
+    for (Op op = OP_PLAIN; op <= OP_TRY; op++) {
+        printf("%s\n  {\"op\": \"%s\", \"ns_per_put_take\": %.1f}", sep, op_names[op], timed_overhead(op, iterations));
+        sep = ",";
+    }
+    printf("\n ]}\n");
+    return 0;
+}
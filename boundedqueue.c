@@ -0,0 +1,381 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "atomic_wait.h"
+#include "boundedqueue.h"
+#include "eventnotify.h"
+#include "numaalloc.h"
+
+// The slot sequence number comes first; the payload follows at the next max_align_t boundary.
+#define BOUNDED_QUEUE_PAYLOAD_OFFSET \
+    ((sizeof(atomic_size_t) + _Alignof(max_align_t) - 1) / _Alignof(max_align_t) * _Alignof(max_align_t))
+
+static size_t
+round_up(const size_t n, const size_t unit) {
+    return (n + unit - 1) / unit * unit;
+}
+
+static atomic_size_t*
+slot_seq(const BoundedQueue* const q, const size_t pos) {
+    return (atomic_size_t*) (q->slots + (pos & q->mask) * q->stride);
+}
+
+static void*
+slot_payload(const BoundedQueue* const q, const size_t pos) {
+    return q->slots + (pos & q->mask) * q->stride + BOUNDED_QUEUE_PAYLOAD_OFFSET;
+}
+
+// Allocate the slots of q on node, or anywhere for node < 0, and initialize the rest.
+static int
+bounded_queue_init(BoundedQueue* const q, const BoundedQueueKind kind, const size_t capacity,
+                   const size_t slot_size, write_callback write, read_callback read, const int node) {
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return EINVAL;
+    }
+    q->stride = round_up(BOUNDED_QUEUE_PAYLOAD_OFFSET + slot_size, _Alignof(max_align_t));
+    const size_t size = round_up(capacity * q->stride, MVAR_CACHE_LINE_SIZE);
+    if (node < 0) {
+        q->slots = aligned_alloc(MVAR_CACHE_LINE_SIZE, size);
+        q->slotsMapped = 0;
+    } else {
+        q->slots = allocOnNumaNode(size, node);
+        q->slotsMapped = size;
+    }
+    if (q->slots == NULL) {
+        return ENOMEM;
+    }
+    q->mask = capacity - 1;
+    q->kind = kind;
+    q->write = write;
+    q->read = read;
+    q->notEmptyNotify = NULL;
+    q->notFullNotify = NULL;
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(slot_seq(q, i), i);
+    }
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    q->cachedHead = 0;
+    q->cachedTail = 0;
+    atomic_init(&q->notEmpty, 0);
+    atomic_init(&q->takeWaiters, 0);
+    atomic_init(&q->notFull, 0);
+    atomic_init(&q->putWaiters, 0);
+    return 0;
+}
+
+int
+initBoundedQueue(BoundedQueue* const out_queue, const BoundedQueueKind kind, const size_t capacity,
+                 const size_t slot_size, write_callback write, read_callback read) {
+    return bounded_queue_init(out_queue, kind, capacity, slot_size, write, read, -1);
+}
+
+int
+initBoundedQueueOnNode(BoundedQueue* const out_queue, const BoundedQueueKind kind, const size_t capacity,
+                       const size_t slot_size, write_callback write, read_callback read, const int node) {
+    return bounded_queue_init(out_queue, kind, capacity, slot_size, write, read, node < 0 ? 0 : node);
+}
+
+void
+setBoundedQueueNotify(BoundedQueue* const queue, struct EventNotify* const on_not_empty,
+                      struct EventNotify* const on_not_full) {
+    queue->notEmptyNotify = on_not_empty;
+    queue->notFullNotify = on_not_full;
+}
+
+void
+destroyBoundedQueue(BoundedQueue* const queue) {
+    if (queue->slotsMapped != 0) {
+        freeOnNumaNode(queue->slots, queue->slotsMapped);
+    } else {
+        free(queue->slots);
+    }
+    queue->slots = NULL;
+}
+
+bool
+isEmptyBoundedQueue(const BoundedQueue* const queue) {
+    BoundedQueue* const q = (BoundedQueue*) queue;
+    return atomic_load_explicit(&q->head, memory_order_relaxed) == atomic_load_explicit(&q->tail, memory_order_relaxed);
+}
+
+// Tell sleepers on event, if any, that moved elements went in or out.
+static void
+bounded_queue_notify(atomic_uint* const event, atomic_uint* const waiters, const size_t moved) {
+    // Pairs with the fence in bounded_queue_wait().  Either the sleeper sees our slots or we see the sleeper.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiters, memory_order_relaxed) != 0) {
+        atomic_fetch_add_explicit(event, 1, memory_order_relaxed);
+        if (moved == 1) {
+            atomicWakeOne(event);
+        } else {
+            atomicWakeAll(event);
+        }
+    }
+}
+
+static size_t
+spsc_try_put(BoundedQueue* const q, const unsigned char* user_data, const size_t stride, const size_t n) {
+    const size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t room = q->mask + 1 - (tail - q->cachedHead);
+    if (room < n) {
+        q->cachedHead = atomic_load_explicit(&q->head, memory_order_acquire);
+        room = q->mask + 1 - (tail - q->cachedHead);
+    }
+    const size_t count = room < n ? room : n;
+    for (size_t i = 0; i < count; i++, user_data += stride) {
+        q->write(slot_payload(q, tail + i), user_data);
+    }
+    if (count > 0) {
+        atomic_store_explicit(&q->tail, tail + count, memory_order_release);
+    }
+    return count;
+}
+
+static size_t
+spsc_try_take(unsigned char* out_user_data, const size_t stride, BoundedQueue* const q, const size_t n) {
+    const size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    size_t ready = q->cachedTail - head;
+    if (ready < n) {
+        q->cachedTail = atomic_load_explicit(&q->tail, memory_order_acquire);
+        ready = q->cachedTail - head;
+    }
+    const size_t count = ready < n ? ready : n;
+    for (size_t i = 0; i < count; i++, out_user_data += stride) {
+        q->read(out_user_data, slot_payload(q, head + i));
+    }
+    if (count > 0) {
+        atomic_store_explicit(&q->head, head + count, memory_order_release);
+    }
+    return count;
+}
+
+// Claim up to n consecutive slots whose sequence is pos + i + lap with one CAS on index.  Returns how many.
+static size_t
+mpmc_claim(BoundedQueue* const q, atomic_size_t* const index, const size_t lap, const size_t n, size_t* const out_pos) {
+    // Claiming none would take a ready slot at index for one somebody else claimed, and retry forever.
+    if (n == 0) {
+        return 0;
+    }
+    size_t pos = atomic_load_explicit(index, memory_order_relaxed);
+    for (;;) {
+        size_t count = 0;
+        while (count < n && count <= q->mask) {
+            const size_t seq = atomic_load_explicit(slot_seq(q, pos + count), memory_order_acquire);
+            const intptr_t dif = (intptr_t) seq - (intptr_t) (pos + count + lap);
+            if (dif != 0) {
+                break;
+            }
+            count++;
+        }
+        if (count == 0) {
+            const size_t seq = atomic_load_explicit(slot_seq(q, pos), memory_order_acquire);
+            if ((intptr_t) seq - (intptr_t) (pos + lap) < 0) {
+                // put: the slot still holds the previous lap's element.  take: nothing written for this lap yet.
+                return 0;
+            }
+            // Another thread claimed pos meanwhile.
+            pos = atomic_load_explicit(index, memory_order_relaxed);
+            continue;
+        }
+        if (atomic_compare_exchange_weak_explicit(index, &pos, pos + count,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+            *out_pos = pos;
+            return count;
+        }
+    }
+}
+
+static size_t
+mpmc_try_put(BoundedQueue* const q, const unsigned char* user_data, const size_t stride, const size_t n) {
+    size_t pos;
+    const size_t count = mpmc_claim(q, &q->tail, 0, n, &pos);
+    for (size_t i = 0; i < count; i++, user_data += stride) {
+        q->write(slot_payload(q, pos + i), user_data);
+        atomic_store_explicit(slot_seq(q, pos + i), pos + i + 1, memory_order_release);
+    }
+    return count;
+}
+
+static size_t
+mpmc_try_take(unsigned char* out_user_data, const size_t stride, BoundedQueue* const q, const size_t n) {
+    size_t pos;
+    const size_t count = mpmc_claim(q, &q->head, 1, n, &pos);
+    for (size_t i = 0; i < count; i++, out_user_data += stride) {
+        q->read(out_user_data, slot_payload(q, pos + i));
+        atomic_store_explicit(slot_seq(q, pos + i), pos + i + q->mask + 1, memory_order_release);
+    }
+    return count;
+}
+
+static size_t
+bounded_queue_try_put(BoundedQueue* const q, const void* const user_data, const size_t stride, const size_t n) {
+    const size_t count = q->kind == BOUNDED_QUEUE_SPSC
+                             ? spsc_try_put(q, user_data, stride, n)
+                             : mpmc_try_put(q, user_data, stride, n);
+    if (count > 0) {
+        bounded_queue_notify(&q->notEmpty, &q->takeWaiters, count);
+        if (q->notEmptyNotify != NULL) {
+            signalEventNotify(q->notEmptyNotify);
+        }
+    }
+    return count;
+}
+
+static size_t
+bounded_queue_try_take(void* const out_user_data, const size_t stride, BoundedQueue* const q, const size_t n) {
+    const size_t count = q->kind == BOUNDED_QUEUE_SPSC
+                             ? spsc_try_take(out_user_data, stride, q, n)
+                             : mpmc_try_take(out_user_data, stride, q, n);
+    if (count > 0) {
+        bounded_queue_notify(&q->notFull, &q->putWaiters, count);
+        if (q->notFullNotify != NULL) {
+            signalEventNotify(q->notFullNotify);
+        }
+    }
+    return count;
+}
+
+// A batch in progress for bounded_queue_wait().
+typedef struct {
+    unsigned char* data;
+    size_t stride;
+    size_t n;
+    size_t done;
+} bounded_queue_batch;
+
+typedef int (*bounded_queue_op)(bounded_queue_batch* const batch, BoundedQueue* const q);
+
+// Done when all of the batch is in.
+static int
+bounded_queue_put_op(bounded_queue_batch* const batch, BoundedQueue* const q) {
+    const size_t count = bounded_queue_try_put(q, batch->data, batch->stride, batch->n - batch->done);
+    batch->data += count * batch->stride;
+    batch->done += count;
+    return batch->done == batch->n ? 0 : EBUSY;
+}
+
+// Done as soon as anything came out.
+static int
+bounded_queue_take_op(bounded_queue_batch* const batch, BoundedQueue* const q) {
+    batch->done = bounded_queue_try_take(batch->data, batch->stride, q, batch->n);
+    return batch->done > 0 ? 0 : EBUSY;
+}
+
+// Retry op until it stops returning EBUSY, sleeping on event in between.  deadline NULL waits forever.
+static int
+bounded_queue_wait(BoundedQueue* const q, bounded_queue_op op, bounded_queue_batch* const batch,
+                   atomic_uint* const event, atomic_uint* const waiters, const struct timespec* const deadline) {
+    int err = op(batch, q);
+    if (err != EBUSY) {
+        return err;
+    }
+    atomic_fetch_add_explicit(waiters, 1, memory_order_relaxed);
+    for (;;) {
+        const unsigned seen = atomic_load_explicit(event, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        err = op(batch, q);
+        if (err != EBUSY) {
+            break;
+        }
+        const int wait_err = atomicWait(event, seen, deadline);
+        if (wait_err != 0 && wait_err != EINTR) {
+            err = wait_err;
+            break;
+        }
+    }
+    atomic_fetch_sub_explicit(waiters, 1, memory_order_relaxed);
+    return err;
+}
+
+int
+putBoundedQueue(BoundedQueue* const queue, const void* const user_data) {
+    bounded_queue_batch batch = {(unsigned char*) user_data, 0, 1, 0};
+    return bounded_queue_wait(queue, bounded_queue_put_op, &batch, &queue->notFull, &queue->putWaiters, NULL);
+}
+
+int
+takeBoundedQueue(void* const out_user_data, BoundedQueue* const queue) {
+    bounded_queue_batch batch = {out_user_data, 0, 1, 0};
+    return bounded_queue_wait(queue, bounded_queue_take_op, &batch, &queue->notEmpty, &queue->takeWaiters, NULL);
+}
+
+int
+timedPutBoundedQueue(BoundedQueue* const queue, const long int timeout_in_msec, const void* const user_data) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    bounded_queue_batch batch = {(unsigned char*) user_data, 0, 1, 0};
+    return bounded_queue_wait(queue, bounded_queue_put_op, &batch, &queue->notFull, &queue->putWaiters, &deadline);
+}
+
+int
+timedTakeBoundedQueue(void* const out_user_data, BoundedQueue* const queue, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    bounded_queue_batch batch = {out_user_data, 0, 1, 0};
+    return bounded_queue_wait(queue, bounded_queue_take_op, &batch, &queue->notEmpty, &queue->takeWaiters,
+                              &deadline);
+}
+
+int
+tryPutBoundedQueue(BoundedQueue* const queue, const void* const user_data) {
+    return bounded_queue_try_put(queue, user_data, 0, 1) == 1 ? 0 : EBUSY;
+}
+
+int
+tryTakeBoundedQueue(void* const out_user_data, BoundedQueue* const queue) {
+    return bounded_queue_try_take(out_user_data, 0, queue, 1) == 1 ? 0 : EBUSY;
+}
+
+int
+putManyBoundedQueue(BoundedQueue* const queue, const void* const user_data, const size_t stride, const size_t n) {
+    bounded_queue_batch batch = {(unsigned char*) user_data, stride, n, 0};
+    return bounded_queue_wait(queue, bounded_queue_put_op, &batch, &queue->notFull, &queue->putWaiters, NULL);
+}
+
+int
+takeManyBoundedQueue(void* const out_user_data, const size_t stride, BoundedQueue* const queue, const size_t n,
+                     size_t* const taken) {
+    // Nothing to wait for.  The take op is only done once something came out, which n == 0 never lets happen.
+    if (n == 0) {
+        *taken = 0;
+        return 0;
+    }
+    bounded_queue_batch batch = {out_user_data, stride, n, 0};
+    int err = bounded_queue_wait(queue, bounded_queue_take_op, &batch, &queue->notEmpty, &queue->takeWaiters, NULL);
+    *taken = batch.done;
+    return err;
+}
+
+size_t
+tryPutManyBoundedQueue(BoundedQueue* const queue, const void* const user_data, const size_t stride, const size_t n) {
+    return bounded_queue_try_put(queue, user_data, stride, n);
+}
+
+size_t
+tryTakeManyBoundedQueue(void* const out_user_data, const size_t stride, BoundedQueue* const queue, const size_t n) {
+    return bounded_queue_try_take(out_user_data, stride, queue, n);
+}
@@ -0,0 +1,112 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  BoundedQueue is a fixed capacity thread safe queue, the multi element sibling of MVar.
+//  Payloads are moved in and out of slots by the same write_callback and read_callback as MVar, with the
+//  slot payload passed where MVar passes itself.  The ring has a power of two number of slots, and the
+//  consumer index, the producer index and the wait state each sit in their own cache line.
+//
+//  BOUNDED_QUEUE_SPSC allows one producer thread and one consumer thread and needs no read-modify-write
+//  on the fast path.  BOUNDED_QUEUE_MPMC allows any number of both and follows Dmitry Vyukov's bounded
+//  MPMC queue: every slot carries a sequence number telling which lap of the ring it is ready for.
+//  Blocking operations sleep on atomic_wait.h futexes and only cost a wakeup syscall when somebody sleeps.
+//
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "mvar.h"
+
+struct EventNotify;
+
+typedef enum {
+    BOUNDED_QUEUE_SPSC,
+    BOUNDED_QUEUE_MPMC,
+} BoundedQueueKind;
+
+typedef struct {
+    // Consumer side.
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_size_t head;
+    size_t cachedTail;          // SPSC only.  Last tail the consumer saw.
+    // Producer side.
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_size_t tail;
+    size_t cachedHead;          // SPSC only.  Last head the producer saw.
+    // Blocked threads.  Only touched when somebody blocks.
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_uint notEmpty;
+    atomic_uint takeWaiters;
+    atomic_uint notFull;
+    atomic_uint putWaiters;
+    // Read only after init.
+    _Alignas(MVAR_CACHE_LINE_SIZE) unsigned char* slots;
+    size_t slotsMapped;         // Bytes of slots from allocOnNumaNode(), 0 when from aligned_alloc().
+    size_t mask;
+    size_t stride;
+    BoundedQueueKind kind;
+    write_callback write;
+    read_callback read;
+    struct EventNotify* notEmptyNotify;
+    struct EventNotify* notFullNotify;
+} BoundedQueue;
+
+// capacity must be a power of two.  Returns 0, EINVAL or ENOMEM.  Each slot holds slot_size bytes of payload.
+int initBoundedQueue(BoundedQueue* const out_queue, const BoundedQueueKind kind, const size_t capacity,
+                     const size_t slot_size, write_callback write, read_callback read);
+// Same with the slots on NUMA node (numaalloc.h), for a queue mostly used by threads running there.  The
+// BoundedQueue itself lives wherever the caller put it; allocMVarOnNumaNode() places it on node as well.
+int initBoundedQueueOnNode(BoundedQueue* const out_queue, const BoundedQueueKind kind, const size_t capacity,
+                           const size_t slot_size, write_callback write, read_callback read, const int node);
+// Signal on_not_empty after every put and on_not_full after every take, for event loops polling their
+// descriptors (eventnotify.h).  Either may be NULL, as both are after init.  Call before the queue is shared.
+void setBoundedQueueNotify(BoundedQueue* const queue, struct EventNotify* const on_not_empty,
+                           struct EventNotify* const on_not_full);
+void destroyBoundedQueue(BoundedQueue* const queue);
+bool isEmptyBoundedQueue(const BoundedQueue* const queue);
+int putBoundedQueue(BoundedQueue* const queue, const void* const user_data);
+int takeBoundedQueue(void* const out_user_data, BoundedQueue* const queue);
+int timedPutBoundedQueue(BoundedQueue* const queue, const long int timeout_in_msec, const void* const user_data);
+int timedTakeBoundedQueue(void* const out_user_data, BoundedQueue* const queue, const long int timeout_in_msec);
+// Return EBUSY when the queue is full (put) or empty (take).
+int tryPutBoundedQueue(BoundedQueue* const queue, const void* const user_data);
+int tryTakeBoundedQueue(void* const out_user_data, BoundedQueue* const queue);
+
+//
+//  Batch operations.  Element i is at user_data + i * stride.  A batch claims as many slots as it can with one
+//  index update and wakes the other side once, rather than once per element.
+//
+// Put all n elements, blocking while the queue is full.
+int putManyBoundedQueue(BoundedQueue* const queue, const void* const user_data, const size_t stride, const size_t n);
+// Block until at least one element is available, then take up to n.  The number taken is stored in *taken.
+// n == 0 returns at once with *taken 0, as putManyBoundedQueue() does with nothing to put.
+int takeManyBoundedQueue(void* const out_user_data, const size_t stride, BoundedQueue* const queue, const size_t n,
+                         size_t* const taken);
+// Move as many of n elements as possible without blocking and return how many were moved.
+size_t tryPutManyBoundedQueue(BoundedQueue* const queue, const void* const user_data, const size_t stride,
+                              const size_t n);
+size_t tryTakeManyBoundedQueue(void* const out_user_data, const size_t stride, BoundedQueue* const queue,
+                               const size_t n);
+
+#endif
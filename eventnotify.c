@@ -0,0 +1,106 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "eventnotify.h"
+
+int
+initEventNotify(EventNotify* const out_notify) {
+#ifdef __linux__
+    const int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    out_notify->readFd = fd;
+    out_notify->writeFd = fd;
+#else
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return errno;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    out_notify->readFd = fds[0];
+    out_notify->writeFd = fds[1];
+#endif
+    atomic_init(&out_notify->pending, false);
+    return 0;
+}
+
+void
+destroyEventNotify(EventNotify* const notify) {
+    if (notify->writeFd != notify->readFd) {
+        close(notify->writeFd);
+    }
+    close(notify->readFd);
+}
+
+int
+eventNotifyFd(const EventNotify* const notify) {
+    return notify->readFd;
+}
+
+void
+signalEventNotify(EventNotify* const notify) {
+    if (atomic_exchange_explicit(&notify->pending, true, memory_order_acq_rel)) {
+        return;
+    }
+    // A full counter or pipe is readable already, so EAGAIN is fine to ignore.
+#ifdef __linux__
+    const uint64_t one = 1;
+#else
+    const char one = 1;
+#endif
+    while (write(notify->writeFd, &one, sizeof one) < 0 && errno == EINTR) {
+    }
+}
+
+void
+drainEventNotify(EventNotify* const notify) {
+    uint64_t buf[8];
+    for (;;) {
+        const ssize_t n = read(notify->readFd, buf, sizeof buf);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+    }
+    // Clear pending only once the descriptor is empty.  Cleared first, a notification between the two steps
+    // would set pending and write, the reads would swallow the write, and pending would stay set on an empty
+    // descriptor, so no later notification would write again.  In this order a notification between the
+    // steps finds pending set and skips its write, but the exchange acquires what it published and the
+    // caller, which consumes after draining, finds it.
+    atomic_exchange_explicit(&notify->pending, false, memory_order_acq_rel);
+}
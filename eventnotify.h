@@ -0,0 +1,61 @@
+#ifndef EVENTNOTIFY_H
+#define EVENTNOTIFY_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  EventNotify is a file descriptor that turns readable when notified, so that an epoll / poll / select
+//  based event loop can wait for MVars and BoundedQueues along with its sockets.  It is an eventfd on Linux
+//  and the read end of a non blocking pipe elsewhere.
+//
+//  Notifications coalesce: once notified the descriptor stays readable and further notifications cost no
+//  syscall until the loop calls drainEventNotify().  A loop therefore drains first and then consumes with
+//  the try operations until there is nothing left.  Note that tryTakeMVar() also returns EBUSY while another
+//  thread merely holds the lock, so test for emptiness rather than for EBUSY:
+//
+//      drainEventNotify(&n);
+//      while (!isEmptyMVar(&mvar)) {
+//          if (tryTakeMVar(&item, &mvar) == 0) {
+//              ...
+//          }
+//      }
+//
+#include <stdatomic.h>
+#include <stdbool.h>
+
+typedef struct EventNotify {
+    int readFd;
+    int writeFd;                // == readFd for eventfd
+    atomic_bool pending;        // notified since the last drain
+} EventNotify;
+
+// Returns 0 or the errno of eventfd() / pipe().
+int initEventNotify(EventNotify* const out_notify);
+void destroyEventNotify(EventNotify* const notify);
+// Descriptor to poll for readability.  Never read it directly; use drainEventNotify().
+int eventNotifyFd(const EventNotify* const notify);
+void signalEventNotify(EventNotify* const notify);
+void drainEventNotify(EventNotify* const notify);
+
+#endif
@@ -0,0 +1,355 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "executor.h"
+
+// How often a waiting worker looks for tasks to help with while the future it waits for is not done.
+#define EXECUTOR_HELP_INTERVAL_MSEC 1
+
+// Chase-Lev deque of fixed capacity ("Correct and Efficient Work-Stealing for Weak Memory Models",
+// Le et al. 2013).  top and bottom only grow; their difference is the number of tasks, read as signed
+// because pop briefly moves bottom below top.
+typedef struct {
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_size_t top;
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_size_t bottom;
+    ExecutorFuture* _Atomic* tasks;
+    size_t mask;
+} executor_deque;
+
+struct executor_worker {
+    executor_deque deque;
+    // Unit MVar the worker parks on.
+    _Alignas(MVAR_CACHE_LINE_SIZE) MVar_abs wake;
+    atomic_bool parked;
+    Executor* executor;
+    uint64_t rng;
+    pthread_t thread;
+};
+
+// The worker the current thread is, NULL outside any pool.
+static _Thread_local struct executor_worker* executor_self;
+
+static bool
+executor_deque_push(executor_deque* const d, ExecutorFuture* const task) {
+    const size_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed);
+    const size_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    if (b - t > d->mask) {
+        return false;
+    }
+    atomic_store_explicit(&d->tasks[b & d->mask], task, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    return true;
+}
+
+// Owner only.
+static ExecutorFuture*
+executor_deque_pop(executor_deque* const d) {
+    const size_t b = atomic_load_explicit(&d->bottom, memory_order_relaxed) - 1;
+    atomic_store_explicit(&d->bottom, b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    size_t t = atomic_load_explicit(&d->top, memory_order_relaxed);
+    if ((ptrdiff_t) (b - t) < 0) {
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+        return NULL;
+    }
+    ExecutorFuture* task = atomic_load_explicit(&d->tasks[b & d->mask], memory_order_relaxed);
+    if (b == t) {
+        // Last task.  Race the thieves for it.
+        if (!atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst,
+                                                     memory_order_relaxed)) {
+            task = NULL;
+        }
+        atomic_store_explicit(&d->bottom, b + 1, memory_order_relaxed);
+    }
+    return task;
+}
+
+static ExecutorFuture*
+executor_deque_steal(executor_deque* const d) {
+    size_t t = atomic_load_explicit(&d->top, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    const size_t b = atomic_load_explicit(&d->bottom, memory_order_acquire);
+    if ((ptrdiff_t) (b - t) <= 0) {
+        return NULL;
+    }
+    ExecutorFuture* const task = atomic_load_explicit(&d->tasks[t & d->mask], memory_order_relaxed);
+    return atomic_compare_exchange_strong_explicit(&d->top, &t, t + 1, memory_order_seq_cst, memory_order_relaxed)
+               ? task
+               : NULL;
+}
+
+static void
+executor_ptr_write(void* const mvar_context, const void* const user_data) {
+    *(ExecutorFuture**) mvar_context = *(ExecutorFuture* const*) user_data;
+}
+
+static void
+executor_ptr_read(void* const out_user_data, void* const mvar_context) {
+    *(ExecutorFuture**) out_user_data = *(ExecutorFuture**) mvar_context;
+}
+
+static void
+executor_future_write(void* const mvar_context, const void* const user_data) {
+    ((ExecutorFuture*) mvar_context)->result = *(void* const*) user_data;
+}
+
+static void
+executor_future_read(void* const out_user_data, void* const mvar_context) {
+    *(void**) out_user_data = ((ExecutorFuture*) mvar_context)->result;
+}
+
+// xorshift64, good enough to spread thieves over victims.
+static size_t
+executor_random(struct executor_worker* const w, const size_t bound) {
+    w->rng ^= w->rng << 13;
+    w->rng ^= w->rng >> 7;
+    w->rng ^= w->rng << 17;
+    return (size_t) (w->rng % bound);
+}
+
+// Own deque first, then the injection queue, then one round over the other workers from a random start.
+static ExecutorFuture*
+executor_find_task(struct executor_worker* const self) {
+    Executor* const e = self->executor;
+    ExecutorFuture* task = executor_deque_pop(&self->deque);
+    if (task != NULL || tryTakeBoundedQueue(&task, &e->injection) == 0) {
+        return task;
+    }
+    const size_t start = executor_random(self, e->nworkers);
+    for (size_t i = 0; i < e->nworkers; i++) {
+        struct executor_worker* const victim = &e->workers[(start + i) % e->nworkers];
+        if (victim != self && (task = executor_deque_steal(&victim->deque)) != NULL) {
+            return task;
+        }
+    }
+    return NULL;
+}
+
+static bool
+executor_has_work(Executor* const e) {
+    if (!isEmptyBoundedQueue(&e->injection)) {
+        return true;
+    }
+    for (size_t i = 0; i < e->nworkers; i++) {
+        executor_deque* const d = &e->workers[i].deque;
+        if ((ptrdiff_t) (atomic_load_explicit(&d->bottom, memory_order_relaxed) -
+                         atomic_load_explicit(&d->top, memory_order_relaxed)) > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Unpark w if it is parked.  Whoever clears parked accounts for the sleeper.
+static bool
+executor_unpark(Executor* const e, struct executor_worker* const w) {
+    bool expected = true;
+    if (!atomic_compare_exchange_strong_explicit(&w->parked, &expected, false, memory_order_acq_rel,
+                                                 memory_order_relaxed)) {
+        return false;
+    }
+    atomic_fetch_sub_explicit(&e->sleepers, 1, memory_order_relaxed);
+    putMVar(&w->wake, NULL);
+    return true;
+}
+
+// Wake one parked worker, if any, after making a task visible.
+static void
+executor_notify(Executor* const e) {
+    // Pairs with the fence in executor_park().  Either the parking worker sees our task or we see it parked.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&e->sleepers, memory_order_relaxed) == 0) {
+        return;
+    }
+    const size_t start = executor_self != NULL ? executor_random(executor_self, e->nworkers) : 0;
+    for (size_t i = 0; i < e->nworkers; i++) {
+        if (executor_unpark(e, &e->workers[(start + i) % e->nworkers])) {
+            return;
+        }
+    }
+}
+
+static void
+executor_park(struct executor_worker* const self) {
+    Executor* const e = self->executor;
+    atomic_store_explicit(&self->parked, true, memory_order_relaxed);
+    atomic_fetch_add_explicit(&e->sleepers, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (executor_has_work(e) || atomic_load_explicit(&e->stopping, memory_order_relaxed)) {
+        bool expected = true;
+        if (atomic_compare_exchange_strong_explicit(&self->parked, &expected, false, memory_order_acq_rel,
+                                                    memory_order_relaxed)) {
+            atomic_fetch_sub_explicit(&e->sleepers, 1, memory_order_relaxed);
+            return;
+        }
+        // A submitter unparked us already; consume its wakeup below.
+    }
+    takeMVar(NULL, &self->wake);
+}
+
+static void
+executor_run(ExecutorFuture* const task) {
+    void* const result = task->fn(task->arg);
+    putMVar(&task->done, &result);
+}
+
+static void*
+executor_worker_main(void* const arg) {
+    struct executor_worker* const self = arg;
+    Executor* const e = self->executor;
+    executor_self = self;
+    for (;;) {
+        ExecutorFuture* const task = executor_find_task(self);
+        if (task != NULL) {
+            executor_run(task);
+        } else if (atomic_load_explicit(&e->stopping, memory_order_acquire) && !executor_has_work(e)) {
+            return NULL;
+        } else {
+            executor_park(self);
+        }
+    }
+}
+
+// Stop the threads of workers [0, n) and wait for them.  The others have none.
+static void
+executor_stop_workers(Executor* const e, const size_t n) {
+    atomic_store_explicit(&e->stopping, true, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst);
+    for (size_t i = 0; i < n; i++) {
+        executor_unpark(e, &e->workers[i]);
+    }
+    for (size_t i = 0; i < n; i++) {
+        pthread_join(e->workers[i].thread, NULL);
+    }
+}
+
+static void
+executor_destroy_workers(Executor* const e, const size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        free((void*) e->workers[i].deque.tasks);
+    }
+    free(e->workers);
+}
+
+int
+initExecutor(Executor* const out_executor, const size_t nworkers, const size_t capacity) {
+    Executor* const e = out_executor;
+    if (nworkers == 0 || capacity == 0 || (capacity & (capacity - 1)) != 0) {
+        return EINVAL;
+    }
+    int err = initBoundedQueue(&e->injection, BOUNDED_QUEUE_MPMC, capacity, sizeof(ExecutorFuture*),
+                               executor_ptr_write, executor_ptr_read);
+    if (err != 0) {
+        return err;
+    }
+    e->workers = aligned_alloc(_Alignof(struct executor_worker), nworkers * sizeof *e->workers);
+    if (e->workers == NULL) {
+        destroyBoundedQueue(&e->injection);
+        return ENOMEM;
+    }
+    e->nworkers = nworkers;
+    atomic_init(&e->sleepers, 0);
+    atomic_init(&e->stopping, false);
+    for (size_t i = 0; i < nworkers; i++) {
+        struct executor_worker* const w = &e->workers[i];
+        w->deque.tasks = malloc(capacity * sizeof *w->deque.tasks);
+        if (w->deque.tasks == NULL) {
+            executor_destroy_workers(e, i);
+            destroyBoundedQueue(&e->injection);
+            return ENOMEM;
+        }
+        atomic_init(&w->deque.top, 0);
+        atomic_init(&w->deque.bottom, 0);
+        w->deque.mask = capacity - 1;
+        initMVar_unit(&w->wake);
+        atomic_init(&w->parked, false);
+        w->executor = e;
+        w->rng = 0x9e3779b97f4a7c15u * (i + 1);
+    }
+    for (size_t i = 0; i < nworkers; i++) {
+        err = pthread_create(&e->workers[i].thread, NULL, executor_worker_main, &e->workers[i]);
+        if (err != 0) {
+            // Let the ones started so far finish.  They still look at every worker's deque, all allocated.
+            executor_stop_workers(e, i);
+            executor_destroy_workers(e, nworkers);
+            destroyBoundedQueue(&e->injection);
+            return err;
+        }
+    }
+    return 0;
+}
+
+void
+destroyExecutor(Executor* const executor) {
+    Executor* const e = executor;
+    executor_stop_workers(e, e->nworkers);
+    executor_destroy_workers(e, e->nworkers);
+    destroyBoundedQueue(&e->injection);
+}
+
+int
+submitExecutor(Executor* const executor, ExecutorFuture* const future, executor_fn fn, void* const arg) {
+    initMVar(&future->done, executor_future_write, executor_future_read);
+    future->fn = fn;
+    future->arg = arg;
+    struct executor_worker* const self = executor_self;
+    if (self == NULL || self->executor != executor) {
+        const int err = putBoundedQueue(&executor->injection, &future);
+        if (err != 0) {
+            return err;
+        }
+    } else if (!executor_deque_push(&self->deque, future) &&
+               tryPutBoundedQueue(&executor->injection, &future) != 0) {
+        // Both full.  A worker blocking on the injection queue could leave it with nobody to drain it, so
+        // the submitting worker runs the task itself.
+        executor_run(future);
+        return 0;
+    }
+    executor_notify(executor);
+    return 0;
+}
+
+int
+waitExecutorFuture(void** const out_result, ExecutorFuture* const future) {
+    struct executor_worker* const self = executor_self;
+    if (self == NULL) {
+        return readMVar(out_result, &future->done);
+    }
+    // Blocking a worker could leave the task we wait for with nobody to run it.  Help instead, and only
+    // sleep for short whiles in between.
+    while (tryReadMVar(out_result, &future->done) != 0) {
+        ExecutorFuture* const task = executor_find_task(self);
+        if (task != NULL) {
+            executor_run(task);
+        } else if (timedReadMVar(out_result, &future->done, EXECUTOR_HELP_INTERVAL_MSEC) == 0) {
+            break;
+        }
+    }
+    return 0;
+}
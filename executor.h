@@ -0,0 +1,78 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  Executor is a work stealing thread pool.  Every worker owns a Chase-Lev deque: it pushes and pops tasks
+//  at the bottom end while idle workers steal from the top end of randomly chosen victims, so workers which
+//  keep busy never touch a shared cache line.  Tasks submitted from outside the pool go through a shared
+//  MPMC BoundedQueue.  A worker finding no work parks in takeMVar() on an MVar of its own until a
+//  submission wakes it.
+//
+//  Results come back through ExecutorFuture, a one shot MVar filled when the task returns.
+//
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "boundedqueue.h"
+#include "mvar.h"
+
+typedef void* (*executor_fn)(void* const arg);
+
+// Caller owned.  Keep alive until waitExecutorFuture() returns.
+typedef struct {
+    MVar_abs done;              // full once the task returned
+    void* result;
+    executor_fn fn;
+    void* arg;
+} ExecutorFuture;
+
+struct executor_worker;
+
+typedef struct {
+    struct executor_worker* workers;
+    size_t nworkers;
+    BoundedQueue injection;
+    // Workers parked or about to park.  Submitters only look for one to wake when this is non zero.
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_uint sleepers;
+    atomic_bool stopping;
+} Executor;
+
+// Start nworkers threads.  capacity, a power of two, is the size of every worker's deque and of the
+// injection queue.  Returns 0, EINVAL, ENOMEM or the error of pthread_create().
+int initExecutor(Executor* const out_executor, const size_t nworkers, const size_t capacity);
+// Run everything submitted so far, then stop and join the workers.
+void destroyExecutor(Executor* const executor);
+// Run fn(arg) on the pool.  From a worker of the same pool the task goes to the worker's own deque, from
+// elsewhere to the injection queue, blocking while that is full.  A worker whose deque and the injection
+// queue are both full runs fn(arg) itself before returning.  Returns 0 or the error of the put.
+int submitExecutor(Executor* const executor, ExecutorFuture* const future, executor_fn fn, void* const arg);
+// Wait for the task to return and store what it returned in *out_result.  Any number of threads may wait
+// on one future.  A worker of the pool waiting runs other tasks meanwhile rather than blocking its thread.
+int waitExecutorFuture(void** const out_result, ExecutorFuture* const future);
+
+#endif
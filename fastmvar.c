@@ -0,0 +1,178 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "atomic_wait.h"
+#include "fastmvar.h"
+
+// Only its address matters.
+const struct timespec fastMVarNoWait = {0, 0};
+
+void
+initFastMVar(void* const out_mvar, write_callback write, read_callback read) {
+    FastMVar* const v = out_mvar;
+    atomic_init(&v->state, FASTMVAR_EMPTY);
+    v->write = write;
+    v->read = read;
+}
+
+static void
+fastMVar_unit_write(void* const mvar_context, const void* const user_data) {
+}
+
+static void
+fastMVar_unit_read(void* const out_user_data, void* const mvar_context) {
+}
+
+void
+initFastMVar_unit(FastMVar* const out_mvar) {
+    initFastMVar(out_mvar, fastMVar_unit_write, fastMVar_unit_read);
+}
+
+bool
+isEmptyFastMVar(const void* const mvar) {
+    FastMVar* const v = (FastMVar*) mvar;
+    return (atomic_load_explicit(&v->state, memory_order_relaxed) & FASTMVAR_STATE_MASK) == FASTMVAR_EMPTY;
+}
+
+int
+acquireFastMVar(FastMVar* const v, const unsigned from, const unsigned to, const struct timespec* const deadline) {
+    for (;;) {
+        unsigned s = atomic_load_explicit(&v->state, memory_order_relaxed);
+        while ((s & FASTMVAR_STATE_MASK) == from) {
+            if (atomic_compare_exchange_weak_explicit(&v->state, &s, (s & ~FASTMVAR_STATE_MASK) | to,
+                                                      memory_order_acquire, memory_order_relaxed)) {
+                return 0;
+            }
+        }
+        if (deadline == FASTMVAR_NO_WAIT) {
+            return EBUSY;
+        }
+
+        // Slow path.  Count ourselves in so the releasing thread knows to wake us, then sleep on the word.
+        s = atomic_fetch_add_explicit(&v->state, FASTMVAR_WAITER, memory_order_relaxed) + FASTMVAR_WAITER;
+        int err = 0;
+        while ((s & FASTMVAR_STATE_MASK) != from && (err == 0 || err == EINTR)) {
+            err = atomicWait(&v->state, s, deadline);
+            s = atomic_load_explicit(&v->state, memory_order_relaxed);
+        }
+        atomic_fetch_sub_explicit(&v->state, FASTMVAR_WAITER, memory_order_relaxed);
+        if (err != 0 && err != EINTR && (s & FASTMVAR_STATE_MASK) != from) {
+            return err;
+        }
+    }
+}
+
+void
+releaseFastMVar(FastMVar* const v, const unsigned from, const unsigned to) {
+    const unsigned s = atomic_fetch_sub_explicit(&v->state, from - to, memory_order_release);
+    if (s >= FASTMVAR_WAITER) {
+        // Putters and takers share the word, so wake all of them and let each re-check.
+        atomicWakeAll(&v->state);
+    }
+}
+
+static int
+fastMVar_put(FastMVar* const v, const void* const user_data, const struct timespec* const deadline) {
+    int err = acquireFastMVar(v, FASTMVAR_EMPTY, FASTMVAR_WRITING, deadline);
+    if (err != 0) {
+        return err;
+    }
+    v->write(v, user_data);
+    releaseFastMVar(v, FASTMVAR_WRITING, FASTMVAR_FULL);
+    return 0;
+}
+
+static int
+fastMVar_read(void* const out_user_data, FastMVar* const v, const struct timespec* const deadline) {
+    int err = acquireFastMVar(v, FASTMVAR_FULL, FASTMVAR_READING, deadline);
+    if (err != 0) {
+        return err;
+    }
+    v->read(out_user_data, v);
+    releaseFastMVar(v, FASTMVAR_READING, FASTMVAR_FULL);
+    return 0;
+}
+
+static int
+fastMVar_take(void* const out_user_data, FastMVar* const v, const struct timespec* const deadline) {
+    int err = acquireFastMVar(v, FASTMVAR_FULL, FASTMVAR_READING, deadline);
+    if (err != 0) {
+        return err;
+    }
+    v->read(out_user_data, v);
+    releaseFastMVar(v, FASTMVAR_READING, FASTMVAR_EMPTY);
+    return 0;
+}
+
+int
+putFastMVar(void* const mvar, const void* const user_data) {
+    return fastMVar_put(mvar, user_data, NULL);
+}
+
+int
+readFastMVar(void* const out_user_data, void* const mvar) {
+    return fastMVar_read(out_user_data, mvar, NULL);
+}
+
+int
+takeFastMVar(void* const out_user_data, void* const mvar) {
+    return fastMVar_take(out_user_data, mvar, NULL);
+}
+
+int
+timedPutFastMVar(void* const mvar, const long int timeout_in_msec, const void* const user_data) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return fastMVar_put(mvar, user_data, &deadline);
+}
+
+int
+timedReadFastMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return fastMVar_read(out_user_data, mvar, &deadline);
+}
+
+int
+timedTakeFastMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return fastMVar_take(out_user_data, mvar, &deadline);
+}
+
+int
+tryPutFastMVar(void* const mvar, const void* const user_data) {
+    // Like tryPutMVar(), EBUSY also covers another thread being in the middle of an operation.
+    return fastMVar_put(mvar, user_data, FASTMVAR_NO_WAIT);
+}
+
+int
+tryReadFastMVar(void* const out_user_data, void* const mvar) {
+    return fastMVar_read(out_user_data, mvar, FASTMVAR_NO_WAIT);
+}
+
+int
+tryTakeFastMVar(void* const out_user_data, void* const mvar) {
+    return fastMVar_take(out_user_data, mvar, FASTMVAR_NO_WAIT);
+}
@@ -0,0 +1,83 @@
+#ifndef FASTMVAR_H
+#define FASTMVAR_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  FastMVar is MVar with its lock, condition variables and empty flag replaced by one atomic state word.
+//  Uncontended put and take are a single compare and swap; a thread only enters the kernel (futex) when
+//  it has to block or when somebody is blocked.  Operations and return values are those of MVar_abs.
+//
+//  The layout is cache line aware.  The read only callbacks take one line and the state word another,
+//  shared only with the payload of the enclosing struct, which travels with the state anyway.  FastMVar
+//  is aligned to MVAR_CACHE_LINE_SIZE, so structs built on it never share a line with their neighbours in
+//  an array.  Allocate them dynamically with allocMVarArray() or aligned_alloc().
+//
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "mvar.h"
+
+// Low two bits of FastMVar.state.  WRITING and READING are held while the write or read callback runs.
+#define FASTMVAR_EMPTY 0u
+#define FASTMVAR_FULL 1u
+#define FASTMVAR_WRITING 2u
+#define FASTMVAR_READING 3u
+#define FASTMVAR_STATE_MASK 3u
+// Number of blocked threads is kept above the state bits.
+#define FASTMVAR_WAITER 4u
+
+typedef struct {
+    // Read only after init.
+    _Alignas(MVAR_CACHE_LINE_SIZE) write_callback write;
+    read_callback read;
+    // Written by every operation.
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_uint state;
+} FastMVar;
+
+void initFastMVar(void* const out_mvar, write_callback write, read_callback read);
+void initFastMVar_unit(FastMVar* const out_mvar);
+bool isEmptyFastMVar(const void* const mvar);
+int putFastMVar(void* const mvar, const void* const user_data);
+int readFastMVar(void* const out_user_data, void* const mvar);
+int takeFastMVar(void* const out_user_data, void* const mvar);
+int timedPutFastMVar(void* const mvar, const long int timeout_in_msec, const void* const user_data);
+int timedReadFastMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec);
+int timedTakeFastMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec);
+int tryPutFastMVar(void* const mvar, const void* const user_data);
+int tryReadFastMVar(void* const out_user_data, void* const mvar);
+int tryTakeFastMVar(void* const out_user_data, void* const mvar);
+
+// Building blocks of the operations above, for MVars that move their payload without callbacks (typedmvar.h).
+// acquireFastMVar() moves the state from `from` to the transient WRITING or READING state `to`, blocking
+// until `from` is seen or the CLOCK_MONOTONIC deadline passes (ETIMEDOUT, EINVAL for a malformed deadline).
+// deadline NULL waits forever and FASTMVAR_NO_WAIT returns EBUSY instead of blocking.  releaseFastMVar()
+// leaves the transient state `from` for `to` and wakes blocked threads if there are any.
+extern const struct timespec fastMVarNoWait;
+#define FASTMVAR_NO_WAIT (&fastMVarNoWait)
+int acquireFastMVar(FastMVar* const v, const unsigned from, const unsigned to, const struct timespec* const deadline);
+void releaseFastMVar(FastMVar* const v, const unsigned from, const unsigned to);
+
+#endif
@@ -22,87 +22,1018 @@
  * SOFTWARE.
  */
 
+#include <errno.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "hexdump.h"
+#include "hexdump_simd.h"
+
+#define HEXDUMP_BYTES_PER_LINE 16
+#define HEXDUMP_BYTES_PER_GROUP 8
+// Full lines handed to the body kernel at once.  Keeps the offset pass within what the kernel just wrote to cache.
+#define HEXDUMP_BATCH_LINES 256
+// Stack buffer a stream formats into before handing the text to its sink.
+#define HEXDUMP_STREAM_BUF_LEN 8192
+// hexdump_fd() and hexdump_file() fill this many pages of whole lines before each write.
+#define HEXDUMP_IO_PAGES 8
+#define HEXDUMP_IO_PAGE_LEN 4096
+// Smallest share of source bytes worth a thread of its own in hexdump_parallel().
+#define HEXDUMP_PARALLEL_MIN_SLICE (256 * 1024)
+#define HEXDUMP_PARALLEL_MAX_THREADS 256
+
+// One line is the offset, two spaces, 16 "xx " cells, a gap, two 8 char ASCII groups split by a space and '\n'.
+#define HEXDUMP_LINE_LEN(offset_width) ((offset_width) + 2 + HEXDUMP_BYTES_PER_LINE * 3 + 1 + 1 + HEXDUMP_BYTES_PER_LINE + 1 + 1)
+
+#define HEXDUMP_PAIR_ROW(h) \
+    {h, '0'}, {h, '1'}, {h, '2'}, {h, '3'}, {h, '4'}, {h, '5'}, {h, '6'}, {h, '7'}, \
+    {h, '8'}, {h, '9'}, {h, 'a'}, {h, 'b'}, {h, 'c'}, {h, 'd'}, {h, 'e'}, {h, 'f'}
+#define HEXDUMP_UPPER_PAIR_ROW(h) \
+    {h, '0'}, {h, '1'}, {h, '2'}, {h, '3'}, {h, '4'}, {h, '5'}, {h, '6'}, {h, '7'}, \
+    {h, '8'}, {h, '9'}, {h, 'A'}, {h, 'B'}, {h, 'C'}, {h, 'D'}, {h, 'E'}, {h, 'F'}
+
+// Two lowercase hex digits of every byte value.  hexdump_byte_pair[b] is what "%02x" prints for b.
+static const char hexdump_byte_pair[256][2] = {
+    HEXDUMP_PAIR_ROW('0'), HEXDUMP_PAIR_ROW('1'), HEXDUMP_PAIR_ROW('2'), HEXDUMP_PAIR_ROW('3'),
+    HEXDUMP_PAIR_ROW('4'), HEXDUMP_PAIR_ROW('5'), HEXDUMP_PAIR_ROW('6'), HEXDUMP_PAIR_ROW('7'),
+    HEXDUMP_PAIR_ROW('8'), HEXDUMP_PAIR_ROW('9'), HEXDUMP_PAIR_ROW('a'), HEXDUMP_PAIR_ROW('b'),
+    HEXDUMP_PAIR_ROW('c'), HEXDUMP_PAIR_ROW('d'), HEXDUMP_PAIR_ROW('e'), HEXDUMP_PAIR_ROW('f'),
+};
+
+// The same in uppercase, for "%02X".
+static const char hexdump_upper_pair[256][2] = {
+    HEXDUMP_UPPER_PAIR_ROW('0'), HEXDUMP_UPPER_PAIR_ROW('1'), HEXDUMP_UPPER_PAIR_ROW('2'),
+    HEXDUMP_UPPER_PAIR_ROW('3'), HEXDUMP_UPPER_PAIR_ROW('4'), HEXDUMP_UPPER_PAIR_ROW('5'),
+    HEXDUMP_UPPER_PAIR_ROW('6'), HEXDUMP_UPPER_PAIR_ROW('7'), HEXDUMP_UPPER_PAIR_ROW('8'),
+    HEXDUMP_UPPER_PAIR_ROW('9'), HEXDUMP_UPPER_PAIR_ROW('A'), HEXDUMP_UPPER_PAIR_ROW('B'),
+    HEXDUMP_UPPER_PAIR_ROW('C'), HEXDUMP_UPPER_PAIR_ROW('D'), HEXDUMP_UPPER_PAIR_ROW('E'),
+    HEXDUMP_UPPER_PAIR_ROW('F'),
+};
+
+// Number of digits "%0*lx" prints for offset with at least min_width of them.
+static size_t
+hexdump_offset_width_min(const uint64_t offset, const size_t min_width) {
+    size_t width = min_width;
+    while (width < 16 && (offset >> (width * 4)) != 0) {
+        width++;
+    }
+    return width;
+}
+
+// Number of digits "%04lx" prints for offset.
+static size_t
+hexdump_offset_width(const uint64_t offset) {
+    return hexdump_offset_width_min(offset, 4);
+}
+
+static char
+hexdump_printable(const uint8_t c) {
+    return 0x20 <= c && c <= 0x7e ? (char) c : '.';
+}
+
+static void
+hexdump_put_digits(char* const outp, const uint64_t offset, const size_t width, const char (*const pairs)[2]) {
+    for (size_t i = 0; i < width; i++) {
+        outp[i] = pairs[(offset >> ((width - 1 - i) * 4)) & 0x0f][1];
+    }
+}
+
+static void
+hexdump_put_offset(char* const outp, const uint64_t offset, const size_t width) {
+    hexdump_put_digits(outp, offset, width, hexdump_byte_pair);
+}
+
+// The scalar body formatter.  Used when the CPU has none of the vector kernels in hexdump_simd.c.
+static void
+hexdump_body_scalar(char* out, const size_t stride, const uint8_t* src, size_t nlines) {
+    for (; nlines > 0; nlines--, src += HEXDUMP_BYTES_PER_LINE, out += stride) {
+        char* const ascii = out + HEXDUMP_BYTES_PER_LINE * 3 + 1 + 1;
+        out[HEXDUMP_BYTES_PER_GROUP * 3] = ' ';
+        ascii[-1] = ' ';
+        ascii[HEXDUMP_BYTES_PER_GROUP] = ' ';
+        for (size_t i = 0; i < HEXDUMP_BYTES_PER_LINE; i++) {
+            const size_t gap = i < HEXDUMP_BYTES_PER_GROUP ? 0 : 1;
+            char* const cell = out + i * 3 + gap;
+            memcpy(cell, hexdump_byte_pair[src[i]], 2);
+            cell[2] = ' ';
+            ascii[i + gap] = hexdump_printable(src[i]);
+        }
+    }
+}
+
+// Picked on first use.  Threads racing here all store the same kernel.
+static _Atomic(hexdump_body_kernel) hexdump_kernel;
+
+static hexdump_body_kernel
+hexdump_get_kernel(void) {
+    hexdump_body_kernel kernel = atomic_load_explicit(&hexdump_kernel, memory_order_relaxed);
+    if (kernel == NULL) {
+        kernel = hexdump_simd_body_kernel();
+        if (kernel == NULL) {
+            kernel = hexdump_body_scalar;
+        }
+        atomic_store_explicit(&hexdump_kernel, kernel, memory_order_relaxed);
+    }
+    return kernel;
+}
+
+// Write nlines full lines whose offsets all print in width digits.  Caller guarantees room for all of them.
+static char*
+hexdump_full_lines(char* outp, const uint8_t* const src, const size_t nlines, uint64_t offset, const size_t width) {
+    const size_t stride = HEXDUMP_LINE_LEN(width);
+    hexdump_get_kernel()(outp + width + 2, stride, src, nlines);
+    for (size_t i = 0; i < nlines; i++, offset += HEXDUMP_BYTES_PER_LINE, outp += stride) {
+        hexdump_put_offset(outp, offset, width);
+        outp[width] = ' ';
+        outp[width + 1] = ' ';
+        outp[stride - 1] = '\n';
+    }
+    return outp;
+}
+
+// Number of full lines of bytes_per_line from offset on whose offsets still print in width digits.
+static size_t
+hexdump_lines_in_width(const uint64_t offset, const size_t width, const size_t bytes_per_line) {
+    if (width >= 16) {
+        return SIZE_MAX;
+    }
+    const uint64_t width_fence = (uint64_t) 1 << (width * 4);
+    return (width_fence - offset + bytes_per_line - 1) / bytes_per_line;
+}
+
+// Format as many of the *nlines full lines at *inp as fit before out_fence.  Advances *inp, *nlines and *offset
+// past what was formatted and returns the end of the text.
+static char*
+hexdump_fill(char* outp, const char* const out_fence,
+             const uint8_t** const inp, size_t* const nlines, uint64_t* const offset) {
+    while (*nlines > 0) {
+        const size_t width = hexdump_offset_width(*offset);
+        const size_t stride = HEXDUMP_LINE_LEN(width);
+        size_t n = (out_fence - outp) / stride;
+        if (n == 0) {
+            break;
+        }
+        const size_t in_width = hexdump_lines_in_width(*offset, width, HEXDUMP_BYTES_PER_LINE);
+        n = n < *nlines ? n : *nlines;
+        n = n < in_width ? n : in_width;
+        n = n < HEXDUMP_BATCH_LINES ? n : HEXDUMP_BATCH_LINES;
+        outp = hexdump_full_lines(outp, *inp, n, *offset, width);
+        *inp += n * HEXDUMP_BYTES_PER_LINE;
+        *offset += n * HEXDUMP_BYTES_PER_LINE;
+        *nlines -= n;
+    }
+    return outp;
+}
+
+// Write one complete line of len (1 to 16) bytes.  Caller guarantees room for HEXDUMP_LINE_LEN(width) chars.
+static char*
+hexdump_line(char* outp, const uint8_t* const line, const size_t len, const uint64_t offset, const size_t width) {
+    hexdump_put_offset(outp, offset, width);
+    outp += width;
+    *outp++ = ' ';
+    *outp++ = ' ';
+
+    char* const hex = outp;
+    char* const ascii = hex + HEXDUMP_BYTES_PER_LINE * 3 + 1 + 1;
+    if (len < HEXDUMP_BYTES_PER_LINE) {
+        memset(hex, ' ', ascii - hex + HEXDUMP_BYTES_PER_LINE + 1);
+    } else {
+        hex[HEXDUMP_BYTES_PER_GROUP * 3] = ' ';
+        ascii[-1] = ' ';
+        ascii[HEXDUMP_BYTES_PER_GROUP] = ' ';
+    }
+    for (size_t i = 0; i < len; i++) {
+        const size_t gap = i < HEXDUMP_BYTES_PER_GROUP ? 0 : 1;
+        char* const cell = hex + i * 3 + gap;
+        memcpy(cell, hexdump_byte_pair[line[i]], 2);
+        cell[2] = ' ';
+        ascii[i + gap] = hexdump_printable(line[i]);
+    }
+    outp = ascii + HEXDUMP_BYTES_PER_LINE + 1;
+    *outp++ = '\n';
+    return outp;
+}
+
+// Write a line which may not fit in the remaining room, truncating it exactly as snprintf does.
+static char*
+hexdump_truncated_line(char* outp, const char* const outp_fence,
+                       const uint8_t* const line_head, const uint8_t* const inp_fence, const uint64_t offset) {
+    const uint8_t* inp = line_head;
+
+    size_t room = outp_fence - outp;
+    int needed = snprintf(outp, room, "%04lx  ", (unsigned long) offset);
+    outp += room - 1 < needed ? room - 1 : needed;
+
+    const uint8_t* const inp_block1_fence = line_head + 8;
+    while (outp < outp_fence && inp < inp_fence && inp < inp_block1_fence) {
+        size_t room = outp_fence - outp;
+        int needed = snprintf(outp, room, "%02x ", *inp++);
+        outp += room - 1 < needed ? room - 1 : needed;
+    }
+    while (outp < outp_fence && inp < inp_block1_fence) {
+        size_t room = outp_fence - outp;
+        int needed = snprintf(outp, room, "   ");
+        outp += room - 1 < needed ? room - 1 : needed;
+        inp++;
+    }
+
+    if (outp < outp_fence) {
+        *outp++ = ' ';
+    }
+
+    const uint8_t* const inp_block2_fence = line_head + 16;
+    while (outp < outp_fence && inp < inp_fence && inp < inp_block2_fence) {
+        size_t room = outp_fence - outp;
+        int needed = snprintf(outp, room, "%02x ", *inp++);
+        outp += room - 1 < needed ? room - 1 : needed;
+    }
+    while (outp < outp_fence && inp < inp_block2_fence) {
+        size_t room = outp_fence - outp;
+        int needed = snprintf(outp, room, "   ");
+        outp += room - 1 < needed ? room - 1 : needed;
+        inp++;
+    }
+
+    if (outp < outp_fence) {
+        *outp++ = ' ';
+    }
+
+    inp = line_head;
+    while (outp < outp_fence && inp < inp_fence && inp < inp_block1_fence) {
+        *outp++ = hexdump_printable(*inp++);
+    }
+    while (outp < outp_fence && inp < inp_block1_fence) {
+        *outp++ = ' ';
+        inp++;
+    }
+
+    if (outp < outp_fence) {
+        *outp++ = ' ';
+    }
+
+    while (outp < outp_fence && inp < inp_fence && inp < inp_block2_fence) {
+        *outp++ = hexdump_printable(*inp++);
+    }
+    while (outp < outp_fence && inp < inp_block2_fence) {
+        *outp++ = ' ';
+        inp++;
+    }
+    if (outp < outp_fence) {
+        *outp++ = '\n';
+    }
+    return outp;
+}
+
+// Length of the first nlines lines of a dump starting at offset 0.  Constant time: a line is 70 chars
+// plus its offset, and offsets grow a digit at 16^3 lines, 16^4 lines and so on.
+static size_t
+hexdump_text_len(const size_t nlines) {
+    size_t len = (HEXDUMP_LINE_LEN(4)) * nlines;
+    size_t lines_fence = (size_t) 1 << 12;
+    for (size_t w = 4; w < 16 && lines_fence < nlines; w++, lines_fence <<= 4) {
+        len += nlines - lines_fence;
+    }
+    return len;
+}
+
+size_t
+hexdump_output_size(const size_t src_len) {
+    return hexdump_text_len(src_len / HEXDUMP_BYTES_PER_LINE + (src_len % HEXDUMP_BYTES_PER_LINE != 0)) + 1;
+}
 
 size_t
 hexdump(char* const out_str, const size_t max_len, const uint8_t* const src, const size_t src_len) {
+    if (out_str == NULL) {
+        return hexdump_output_size(src_len);
+    }
     if (max_len == 0) {
         return 0;
     }
 
     char* outp = out_str;
-    const char* const out_str_fence = out_str + max_len;
     const char* const outp_fence = out_str + max_len - 1;
     const uint8_t* inp = src;
     const uint8_t* const inp_fence = src + src_len;
 
     while (outp < outp_fence && inp < inp_fence) {
-        const uint8_t* const line_head = inp;
+        const uint64_t offset = inp - src;
+        const size_t width = hexdump_offset_width(offset);
+        const size_t stride = HEXDUMP_LINE_LEN(width);
+        const size_t room = outp_fence - outp;
+        const size_t rest = inp_fence - inp;
+        if (room < stride) {
+            // Only the last line can be cut short.  Leave it to the snprintf based formatter.
+            outp = hexdump_truncated_line(outp, outp_fence, inp, inp_fence, offset);
+            inp += rest < HEXDUMP_BYTES_PER_LINE ? rest : HEXDUMP_BYTES_PER_LINE;
+        } else if (rest < HEXDUMP_BYTES_PER_LINE) {
+            outp = hexdump_line(outp, inp, rest, offset, width);
+            inp += rest;
+        } else {
+            size_t nlines = rest / HEXDUMP_BYTES_PER_LINE;
+            uint64_t next_offset = offset;
+            outp = hexdump_fill(outp, outp_fence, &inp, &nlines, &next_offset);
+        }
+    }
+    *outp = '\0';
+    return outp - out_str;
+}
 
-        size_t room = outp_fence - outp;
-        int needed = snprintf(outp, room, "%04lx  ", line_head - src);
-        outp += room - 1 < needed ? room - 1 : needed;
+// Writes out the filled pages.  Returns 0 or an errno value.
+typedef int (*hexdump_io_flush)(void* const io_context, struct iovec* const iov, const int iovcnt);
+
+// Format src page by page into a stack buffer and flush it every HEXDUMP_IO_PAGES pages.
+static int
+hexdump_io(const uint8_t* const src, const size_t src_len, hexdump_io_flush flush, void* const io_context) {
+    char pages[HEXDUMP_IO_PAGES][HEXDUMP_IO_PAGE_LEN];
+    struct iovec iov[HEXDUMP_IO_PAGES];
+    const uint8_t* inp = src;
+    const uint8_t* const inp_fence = src + src_len;
+    size_t nlines = src_len / HEXDUMP_BYTES_PER_LINE;
+    uint64_t offset = 0;
+
+    while (inp < inp_fence) {
+        int iovcnt = 0;
+        while (iovcnt < HEXDUMP_IO_PAGES && inp < inp_fence) {
+            char* const page = pages[iovcnt];
+            char* outp = hexdump_fill(page, page + HEXDUMP_IO_PAGE_LEN, &inp, &nlines, &offset);
+            const size_t rest = inp_fence - inp;
+            const size_t width = hexdump_offset_width(offset);
+            if (nlines == 0 && rest > 0 && page + HEXDUMP_IO_PAGE_LEN - outp >= HEXDUMP_LINE_LEN(width)) {
+                outp = hexdump_line(outp, inp, rest, offset, width);
+                inp += rest;
+            }
+            iov[iovcnt].iov_base = page;
+            iov[iovcnt].iov_len = outp - page;
+            iovcnt++;
+        }
+        int err = flush(io_context, iov, iovcnt);
+        if (err != 0) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+static int
+hexdump_fd_flush(void* const io_context, struct iovec* iov, int iovcnt) {
+    const int fd = *(const int*) io_context;
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        // Skip what a short write took and retry with the rest.
+        while (iovcnt > 0 && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+int
+hexdump_fd(const int fd, const uint8_t* const src, const size_t src_len) {
+    return hexdump_io(src, src_len, hexdump_fd_flush, (void*) &fd);
+}
+
+static int
+hexdump_file_flush(void* const io_context, struct iovec* const iov, const int iovcnt) {
+    FILE* const stream = io_context;
+    for (int i = 0; i < iovcnt; i++) {
+        // fwrite() needn't set errno, so clear it first lest an old error be reported.
+        errno = 0;
+        if (fwrite(iov[i].iov_base, 1, iov[i].iov_len, stream) != iov[i].iov_len) {
+            return errno != 0 ? errno : EIO;
+        }
+    }
+    return 0;
+}
+
+int
+hexdump_file(FILE* const stream, const uint8_t* const src, const size_t src_len) {
+    return hexdump_io(src, src_len, hexdump_file_flush, stream);
+}
+
+typedef struct {
+    pthread_t thread;
+    char* out;
+    const uint8_t* src;
+    size_t src_len;
+    size_t first_line;
+    size_t end_line;
+} hexdump_slice;
+
+// Format lines [first_line, end_line) of the dump of src into out, which starts where the first of them goes.
+static void*
+hexdump_slice_run(void* const arg) {
+    const hexdump_slice* const slice = arg;
+    const uint8_t* inp = slice->src + slice->first_line * HEXDUMP_BYTES_PER_LINE;
+    const size_t end = slice->end_line * HEXDUMP_BYTES_PER_LINE;
+    const size_t last = end < slice->src_len ? end : slice->src_len;
+    size_t nlines = (last - slice->first_line * HEXDUMP_BYTES_PER_LINE) / HEXDUMP_BYTES_PER_LINE;
+    uint64_t offset = slice->first_line * HEXDUMP_BYTES_PER_LINE;
+    const size_t len = hexdump_text_len(slice->end_line) - hexdump_text_len(slice->first_line);
+
+    char* outp = hexdump_fill(slice->out, slice->out + len, &inp, &nlines, &offset);
+    const size_t rest = slice->src + last - inp;
+    if (rest > 0) {
+        hexdump_line(outp, inp, rest, offset, hexdump_offset_width(offset));
+    }
+    return NULL;
+}
+
+size_t
+hexdump_parallel(char* const out_str, const size_t max_len, const uint8_t* const src, const size_t src_len,
+                 const unsigned nthreads) {
+    if (out_str == NULL) {
+        return hexdump_output_size(src_len);
+    }
+    if (max_len == 0) {
+        return 0;
+    }
 
-        const uint8_t* const inp_block1_fence = line_head + 8;
-        while (outp < outp_fence && inp < inp_fence && inp < inp_block1_fence) {
-            size_t room = outp_fence - outp;
-            int needed = snprintf(outp, room, "%02x ", *inp++);
-            outp += room - 1 < needed ? room - 1 : needed;
+    // Lines which fit whole go to the threads.  The line after them, if any, is the truncated one.
+    const size_t total_lines = src_len / HEXDUMP_BYTES_PER_LINE + (src_len % HEXDUMP_BYTES_PER_LINE != 0);
+    size_t lo = 0;
+    size_t hi = total_lines;
+    while (lo < hi) {
+        const size_t mid = hi - (hi - lo) / 2;
+        if (hexdump_text_len(mid) <= max_len - 1) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
         }
-        while (outp < outp_fence && inp < inp_block1_fence) {
-            size_t room = outp_fence - outp;
-            int needed = snprintf(outp, room, "   ");
-            outp += room - 1 < needed ? room - 1 : needed;
-            inp++;
+    }
+    const size_t whole_lines = lo;
+
+    const size_t max_workers = src_len / HEXDUMP_PARALLEL_MIN_SLICE;
+    // sysconf() reads sysfs, too slow to pay for inputs which get one worker anyway.
+    size_t workers = nthreads != 0 || max_workers <= 1 ? nthreads : (size_t) sysconf(_SC_NPROCESSORS_ONLN);
+    workers = workers < max_workers ? workers : max_workers;
+    workers = workers < HEXDUMP_PARALLEL_MAX_THREADS ? workers : HEXDUMP_PARALLEL_MAX_THREADS;
+    workers = workers > 0 ? workers : 1;
+
+    hexdump_slice slices[HEXDUMP_PARALLEL_MAX_THREADS];
+    for (size_t i = 0; i < workers; i++) {
+        hexdump_slice* const slice = &slices[i];
+        slice->src = src;
+        slice->src_len = src_len;
+        slice->first_line = whole_lines * i / workers;
+        slice->end_line = whole_lines * (i + 1) / workers;
+        slice->out = out_str + hexdump_text_len(slice->first_line);
+    }
+    // Slice 0 runs on the caller.  A slice whose thread can't be started runs there as well.
+    bool started[HEXDUMP_PARALLEL_MAX_THREADS];
+    for (size_t i = 1; i < workers; i++) {
+        started[i] = pthread_create(&slices[i].thread, NULL, hexdump_slice_run, &slices[i]) == 0;
+    }
+    hexdump_slice_run(&slices[0]);
+    for (size_t i = 1; i < workers; i++) {
+        if (started[i]) {
+            pthread_join(slices[i].thread, NULL);
+        } else {
+            hexdump_slice_run(&slices[i]);
         }
+    }
+
+    char* outp = out_str + hexdump_text_len(whole_lines);
+    const char* const outp_fence = out_str + max_len - 1;
+    if (whole_lines < total_lines && outp < outp_fence) {
+        const size_t first = whole_lines * HEXDUMP_BYTES_PER_LINE;
+        outp = hexdump_truncated_line(outp, outp_fence, src + first, src + src_len, first);
+    }
+    *outp = '\0';
+    return outp - out_str;
+}
+
+//
+//  hexdump_ex().  A layout is formatted like the default one: a body function writes the body of a batch of
+//  full lines, then the offsets and '\n' go around it.  The common layouts get body functions of their own,
+//  generated from one always inlined template with the layout as compile time constants.  The rest share
+//  the template with the layout passed at run time.
+//
 
-        if (outp < outp_fence) {
-            *outp++ = ' ';
+// Bytes per extra space in the hex and ASCII columns.
+#define HEXDUMP_EX_BLOCK 8
+// Longest line: 16 offset digits and a 32 byte line of single byte words with the ASCII column.
+#define HEXDUMP_EX_MAX_LINE_LEN (16 + 2 + 32 * 3 + 32 / HEXDUMP_EX_BLOCK - 1 + 32 + 32 / HEXDUMP_EX_BLOCK + 1)
+
+typedef struct {
+    size_t bytes_per_line;
+    size_t min_width;
+    size_t group;
+    bool big_endian;
+    bool ascii;
+    const char (*pairs)[2];
+    size_t body_len;            // After the offset and its two spaces, excluding the '\n'.
+    hexdump_body_kernel body;   // NULL for the generic body.
+} hexdump_layout;
+
+static inline __attribute__((always_inline)) void
+hexdump_ex_body_template(char* out, const size_t stride, const uint8_t* src, size_t nlines,
+                         const size_t bytes_per_line, const size_t group, const bool big_endian,
+                         const char (*const pairs)[2], const bool ascii) {
+    for (; nlines > 0; nlines--, src += bytes_per_line, out += stride) {
+        char* p = out;
+        for (size_t i = 0; i < bytes_per_line; i += group) {
+            if (i != 0 && i % HEXDUMP_EX_BLOCK == 0) {
+                *p++ = ' ';
+            }
+            for (size_t j = 0; j < group; j++, p += 2) {
+                memcpy(p, pairs[src[big_endian ? i + j : i + group - 1 - j]], 2);
+            }
+            // Hex only lines end here, and the caller's '\n' overwrites this.
+            *p++ = ' ';
         }
+        if (ascii) {
+            for (size_t i = 0; i < bytes_per_line; i++) {
+                if (i % HEXDUMP_EX_BLOCK == 0) {
+                    *p++ = ' ';
+                }
+                *p++ = hexdump_printable(src[i]);
+            }
+        }
+    }
+}
+
+// The common layouts: bytes per line, group size, big endian, uppercase, ASCII column.
+#define HEXDUMP_EX_COMMON_LAYOUTS(X) \
+    X(16, 1, 0, 1, 1) \
+    X(16, 1, 0, 0, 0) \
+    X(16, 2, 0, 0, 1) \
+    X(16, 4, 0, 0, 1) \
+    X(16, 8, 0, 0, 1) \
+    X(16, 2, 1, 0, 1) \
+    X(16, 4, 1, 0, 1) \
+    X(32, 1, 0, 0, 1) \
+    X(32, 1, 0, 1, 1) \
+    X(32, 1, 0, 0, 0) \
+    X(32, 4, 0, 0, 0) \
+    X(32, 4, 1, 0, 0)
+
+#define HEXDUMP_EX_BODY_NAME(b, g, e, u, a) hexdump_ex_body_##b##_##g##_##e##_##u##_##a
+
+#define HEXDUMP_EX_DEFINE_BODY(b, g, e, u, a) \
+    static void \
+    HEXDUMP_EX_BODY_NAME(b, g, e, u, a)(char* out, const size_t stride, const uint8_t* src, size_t nlines) { \
+        hexdump_ex_body_template(out, stride, src, nlines, b, g, e, u ? hexdump_upper_pair : hexdump_byte_pair, a); \
+    }
+
+HEXDUMP_EX_COMMON_LAYOUTS(HEXDUMP_EX_DEFINE_BODY)
+
+typedef struct {
+    unsigned char bytes_per_line;
+    unsigned char group;
+    bool big_endian;
+    bool uppercase;
+    bool ascii;
+    hexdump_body_kernel body;
+} hexdump_ex_variant;
+
+#define HEXDUMP_EX_VARIANT(b, g, e, u, a) {b, g, e, u, a, HEXDUMP_EX_BODY_NAME(b, g, e, u, a)},
+
+static const hexdump_ex_variant hexdump_ex_variants[] = {HEXDUMP_EX_COMMON_LAYOUTS(HEXDUMP_EX_VARIANT)};
+
+static void
+hexdump_ex_body_generic(const hexdump_layout* const l, char* out, const size_t stride, const uint8_t* src,
+                        size_t nlines) {
+    hexdump_ex_body_template(out, stride, src, nlines, l->bytes_per_line, l->group, l->big_endian, l->pairs,
+                             l->ascii);
+}
 
-        const uint8_t* const inp_block2_fence = line_head + 16;
-        while (outp < outp_fence && inp < inp_fence && inp < inp_block2_fence) {
-            size_t room = outp_fence - outp;
-            int needed = snprintf(outp, room, "%02x ", *inp++);
-            outp += room - 1 < needed ? room - 1 : needed;
+static bool
+hexdump_opts_is_default(const hexdump_opts* const opts) {
+    return opts->bytes_per_line == HEXDUMP_BYTES_PER_LINE && opts->offset_digits == 4 && opts->group_size == 1 &&
+           !opts->uppercase && !opts->hex_only && !opts->squeeze;
+}
+
+// Returns 0 or EINVAL.
+static int
+hexdump_layout_init(hexdump_layout* const l, const hexdump_opts* const opts) {
+    if ((opts->bytes_per_line != 16 && opts->bytes_per_line != 32) ||
+        (opts->offset_digits != 4 && opts->offset_digits != 8 && opts->offset_digits != 16) ||
+        (opts->group_size != 1 && opts->group_size != 2 && opts->group_size != 4 && opts->group_size != 8)) {
+        return EINVAL;
+    }
+    l->bytes_per_line = opts->bytes_per_line;
+    l->min_width = opts->offset_digits;
+    l->group = opts->group_size;
+    l->big_endian = opts->group_size > 1 && opts->big_endian;
+    l->ascii = !opts->hex_only;
+    l->pairs = opts->uppercase ? hexdump_upper_pair : hexdump_byte_pair;
+    const size_t blocks = l->bytes_per_line / HEXDUMP_EX_BLOCK;
+    const size_t hex_len = l->bytes_per_line / l->group * (2 * l->group + 1) + blocks - 1;
+    l->body_len = l->ascii ? hex_len + blocks + l->bytes_per_line : hex_len - 1;
+    l->body = NULL;
+    if (l->bytes_per_line == HEXDUMP_BYTES_PER_LINE && l->group == 1 && !opts->uppercase && l->ascii) {
+        // The default layout with a wider offset.  The vector kernels format its body.
+        l->body = hexdump_get_kernel();
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof hexdump_ex_variants / sizeof hexdump_ex_variants[0]; i++) {
+        const hexdump_ex_variant* const v = &hexdump_ex_variants[i];
+        if (v->bytes_per_line == l->bytes_per_line && v->group == l->group && v->big_endian == l->big_endian &&
+            v->uppercase == opts->uppercase && v->ascii == l->ascii) {
+            l->body = v->body;
+            break;
         }
-        while (outp < outp_fence && inp < inp_block2_fence) {
-            size_t room = outp_fence - outp;
-            int needed = snprintf(outp, room, "   ");
-            outp += room - 1 < needed ? room - 1 : needed;
-            inp++;
+    }
+    return 0;
+}
+
+static size_t
+hexdump_ex_stride(const hexdump_layout* const l, const size_t width) {
+    return width + 2 + l->body_len + 1;
+}
+
+// Length of the hex column of a hex only line of len bytes, up to the last digit.
+static size_t
+hexdump_ex_hex_end(const hexdump_layout* const l, const size_t len) {
+    const size_t last = (len - 1) / l->group;
+    const size_t start = last * (2 * l->group + 1) + last * l->group / HEXDUMP_EX_BLOCK;
+    // Little endian words print their first byte last, so a partial last word still ends in a digit.
+    return start + 2 * (l->big_endian ? len - last * l->group : l->group);
+}
+
+// Length of the first nlines lines of a dump starting at offset 0, all of them full length.
+static size_t
+hexdump_ex_text_len(const hexdump_layout* const l, const size_t nlines) {
+    size_t len = hexdump_ex_stride(l, l->min_width) * nlines;
+    for (size_t w = l->min_width; w < 16; w++) {
+        // Lines from here on print more than w digits.
+        const uint64_t first = (((uint64_t) 1 << (w * 4)) + l->bytes_per_line - 1) / l->bytes_per_line;
+        if (first >= nlines) {
+            break;
         }
+        len += nlines - first;
+    }
+    return len;
+}
 
-        if (outp < outp_fence) {
-            *outp++ = ' ';
+// Write one complete line of len (1 to bytes_per_line) bytes.  Room for HEXDUMP_EX_MAX_LINE_LEN is needed.
+static char*
+hexdump_ex_line(const hexdump_layout* const l, char* const outp, const uint8_t* const line, const size_t len,
+                const uint64_t offset) {
+    const size_t width = hexdump_offset_width_min(offset, l->min_width);
+    hexdump_put_digits(outp, offset, width, l->pairs);
+    outp[width] = ' ';
+    outp[width + 1] = ' ';
+    char* const body = outp + width + 2;
+    memset(body, ' ', l->body_len);
+    char* p = body;
+    for (size_t i = 0; i < l->bytes_per_line; i += l->group, p++) {
+        if (i != 0 && i % HEXDUMP_EX_BLOCK == 0) {
+            p++;
+        }
+        for (size_t j = 0; j < l->group; j++, p += 2) {
+            const size_t k = l->big_endian ? i + j : i + l->group - 1 - j;
+            if (k < len) {
+                memcpy(p, l->pairs[line[k]], 2);
+            }
         }
+    }
+    if (l->ascii) {
+        for (size_t i = 0; i < len; i++) {
+            if (i % HEXDUMP_EX_BLOCK == 0) {
+                p++;
+            }
+            *p++ = hexdump_printable(line[i]);
+        }
+        p = body + l->body_len;
+    } else {
+        p = body + hexdump_ex_hex_end(l, len);
+    }
+    *p++ = '\n';
+    return p;
+}
+
+// Write nlines full lines whose offsets all print in width digits.  Caller guarantees room for all of them.
+static char*
+hexdump_ex_full_lines(const hexdump_layout* const l, char* outp, const uint8_t* const src, const size_t nlines,
+                      uint64_t offset, const size_t width) {
+    const size_t stride = hexdump_ex_stride(l, width);
+    if (l->body != NULL) {
+        l->body(outp + width + 2, stride, src, nlines);
+    } else {
+        hexdump_ex_body_generic(l, outp + width + 2, stride, src, nlines);
+    }
+    for (size_t i = 0; i < nlines; i++, offset += l->bytes_per_line, outp += stride) {
+        hexdump_put_digits(outp, offset, width, l->pairs);
+        outp[width] = ' ';
+        outp[width + 1] = ' ';
+        outp[stride - 1] = '\n';
+    }
+    return outp;
+}
+
+//
+//  Squeezing.  A line repeating last is elided.  The "*" standing for a run goes out when the second line of
+//  the run is elided, or when a line of other bytes follows a run of one.  At the end of the input the run's
+//  last line is printed instead, so a run of one at the end prints as a plain line.
+//
+typedef struct {
+    const uint8_t* last;    // The last full line, NULL before the first.
+    size_t run;             // Lines repeating last elided since last was printed.
+} hexdump_squeeze;
 
-        inp = line_head;
-        while (outp < outp_fence && inp < inp_fence && inp < inp_block1_fence) {
-            char c = *inp++;
-            *outp++ = 0x20 <= c && c <= 0x7e ? c : '.';
+// Word wise compare of two lines, cheaper than a call to memcmp() for 16 or 32 bytes.
+static bool
+hexdump_line_equal(const uint8_t* const a, const uint8_t* const b, const size_t bytes_per_line) {
+    uint64_t diff = 0;
+    for (size_t i = 0; i < bytes_per_line; i += sizeof(uint64_t)) {
+        uint64_t x, y;
+        memcpy(&x, a + i, sizeof x);
+        memcpy(&y, b + i, sizeof y);
+        diff |= x ^ y;
+    }
+    return diff == 0;
+}
+
+// Number of the nlines lines at src, from the first on, which repeat last.
+static size_t
+hexdump_squeeze_same(const uint8_t* const last, const uint8_t* const src, const size_t nlines,
+                     const size_t bytes_per_line) {
+    size_t n = 0;
+    while (n < nlines && hexdump_line_equal(src + n * bytes_per_line, last, bytes_per_line)) {
+        n++;
+    }
+    return n;
+}
+
+// Number of the nlines lines at src, from the first on, which don't repeat the line before them.  The first
+// is known not to.
+static size_t
+hexdump_squeeze_distinct(const uint8_t* const src, const size_t nlines, const size_t bytes_per_line) {
+    size_t n = 1;
+    while (n < nlines && !hexdump_line_equal(src + n * bytes_per_line, src + (n - 1) * bytes_per_line,
+                                             bytes_per_line)) {
+        n++;
+    }
+    return n;
+}
+
+static char*
+hexdump_squeeze_mark(char* const outp) {
+    outp[0] = '*';
+    outp[1] = '\n';
+    return outp + 2;
+}
+
+// hexdump_fill() for layout l, squeezing runs when sq isn't NULL.  Lines may be consumed without any text.
+static char*
+hexdump_ex_fill(const hexdump_layout* const l, hexdump_squeeze* const sq, char* outp, const char* const out_fence,
+                const uint8_t** const inp, size_t* const nlines, uint64_t* const offset) {
+    const size_t bytes_per_line = l->bytes_per_line;
+    while (*nlines > 0) {
+        size_t n = *nlines < HEXDUMP_BATCH_LINES ? *nlines : HEXDUMP_BATCH_LINES;
+        if (sq != NULL) {
+            const size_t same = sq->last == NULL ? 0 : hexdump_squeeze_same(sq->last, *inp, *nlines, bytes_per_line);
+            if (same > 0) {
+                if (sq->run < 2 && sq->run + same >= 2) {
+                    if (out_fence - outp < 2) {
+                        break;
+                    }
+                    outp = hexdump_squeeze_mark(outp);
+                }
+                sq->run += same;
+                *inp += same * bytes_per_line;
+                *offset += same * bytes_per_line;
+                *nlines -= same;
+                continue;
+            }
+            if (sq->run == 1) {
+                if (out_fence - outp < 2) {
+                    break;
+                }
+                outp = hexdump_squeeze_mark(outp);
+            }
+            sq->run = 0;
+            n = hexdump_squeeze_distinct(*inp, n, bytes_per_line);
         }
-        while (outp < outp_fence && inp < inp_block1_fence) {
-            *outp++ = ' ';
-            inp++;
+        const size_t width = hexdump_offset_width_min(*offset, l->min_width);
+        const size_t stride = hexdump_ex_stride(l, width);
+        const size_t room = (out_fence - outp) / stride;
+        if (room == 0) {
+            break;
         }
+        const size_t in_width = hexdump_lines_in_width(*offset, width, bytes_per_line);
+        n = n < room ? n : room;
+        n = n < in_width ? n : in_width;
+        outp = hexdump_ex_full_lines(l, outp, *inp, n, *offset, width);
+        if (sq != NULL) {
+            sq->last = *inp + (n - 1) * bytes_per_line;
+        }
+        *inp += n * bytes_per_line;
+        *offset += n * bytes_per_line;
+        *nlines -= n;
+    }
+    return outp;
+}
+
+// Longest text hexdump_ex_fill() or hexdump_ex_tail() produce before one line: the "*" of a run.
+#define HEXDUMP_EX_MAX_ITEM_LEN (2 + HEXDUMP_EX_MAX_LINE_LEN)
 
-        if (outp < outp_fence) {
-            *outp++ = ' ';
+// The end of the input: the partial line of len bytes at line, if any, or the last line of a squeezed run.
+// offset is that of line, or of the end of the run.
+static char*
+hexdump_ex_tail(const hexdump_layout* const l, hexdump_squeeze* const sq, char* outp, const uint8_t* const line,
+                const size_t len, const uint64_t offset) {
+    if (len > 0) {
+        if (sq != NULL && sq->run == 1) {
+            outp = hexdump_squeeze_mark(outp);
         }
+        outp = hexdump_ex_line(l, outp, line, len, offset);
+    } else if (sq != NULL && sq->run > 0) {
+        outp = hexdump_ex_line(l, outp, sq->last, l->bytes_per_line, offset - l->bytes_per_line);
+    }
+    if (sq != NULL) {
+        sq->run = 0;
+    }
+    return outp;
+}
+
+// Copy the text from item to item_fence, cut short at outp_fence.
+static char*
+hexdump_ex_copy(char* const outp, const char* const outp_fence, const char* const item, const char* const item_fence) {
+    const size_t room = outp_fence - outp;
+    size_t len = item_fence - item;
+    len = len < room ? len : room;
+    memcpy(outp, item, len);
+    return outp + len;
+}
 
-        while (outp < outp_fence && inp < inp_fence && inp < inp_block2_fence) {
-            char c = *inp++;
-            *outp++ = 0x20 <= c && c <= 0x7e ? c : '.';
+size_t
+hexdump_ex_output_size(const size_t src_len, const hexdump_opts* const opts) {
+    if (opts == NULL || hexdump_opts_is_default(opts)) {
+        return hexdump_output_size(src_len);
+    }
+    hexdump_layout l;
+    if (hexdump_layout_init(&l, opts) != 0) {
+        return 0;
+    }
+    const size_t rest = src_len % l.bytes_per_line;
+    size_t len = hexdump_ex_text_len(&l, src_len / l.bytes_per_line + (rest != 0));
+    if (rest != 0 && !l.ascii) {
+        len -= l.body_len - hexdump_ex_hex_end(&l, rest);
+    }
+    return len + 1;
+}
+
+size_t
+hexdump_ex(char* const out_str, const size_t max_len, const uint8_t* const src, const size_t src_len,
+           const hexdump_opts* const opts) {
+    if (opts == NULL || hexdump_opts_is_default(opts)) {
+        return hexdump(out_str, max_len, src, src_len);
+    }
+    hexdump_layout l;
+    if (hexdump_layout_init(&l, opts) != 0) {
+        if (out_str != NULL && max_len > 0) {
+            *out_str = '\0';
         }
-        while (outp < outp_fence && inp < inp_block2_fence) {
-            *outp++ = ' ';
-            inp++;
+        return 0;
+    }
+    if (out_str == NULL) {
+        return hexdump_ex_output_size(src_len, opts);
+    }
+    if (max_len == 0) {
+        return 0;
+    }
+
+    hexdump_squeeze squeeze = {NULL, 0};
+    hexdump_squeeze* const sq = opts->squeeze ? &squeeze : NULL;
+    char* outp = out_str;
+    const char* const outp_fence = out_str + max_len - 1;
+    const uint8_t* inp = src;
+    size_t nlines = src_len / l.bytes_per_line;
+    uint64_t offset = 0;
+    char item[HEXDUMP_EX_MAX_ITEM_LEN];
+
+    while (outp < outp_fence && nlines > 0) {
+        const size_t before = nlines;
+        char* const filled = hexdump_ex_fill(&l, sq, outp, outp_fence, &inp, &nlines, &offset);
+        if (filled == outp && nlines == before) {
+            // No room for the next line.  Format it aside and copy what fits.
+            char* const item_fence = hexdump_ex_fill(&l, sq, item, item + sizeof item, &inp, &nlines, &offset);
+            outp = hexdump_ex_copy(outp, outp_fence, item, item_fence);
+            break;
         }
-        *outp++ = '\n';
+        outp = filled;
+    }
+    if (outp < outp_fence) {
+        char* const item_fence = hexdump_ex_tail(&l, sq, item, inp, src + src_len - inp, offset);
+        outp = hexdump_ex_copy(outp, outp_fence, item, item_fence);
     }
     *outp = '\0';
     return outp - out_str;
 }
+
+void
+hexdump_stream_init(hexdump_stream* const stream, const uint64_t base_offset,
+                    hexdump_sink sink, void* const sink_context) {
+    hexdump_stream_init_ex(stream, base_offset, NULL, sink, sink_context);
+}
+
+int
+hexdump_stream_init_ex(hexdump_stream* const stream, const uint64_t base_offset, const hexdump_opts* const opts,
+                       hexdump_sink sink, void* const sink_context) {
+    static const hexdump_opts default_opts = HEXDUMP_OPTS_DEFAULT;
+    hexdump_layout l;
+    if (opts != NULL && hexdump_layout_init(&l, opts) != 0) {
+        return EINVAL;
+    }
+    stream->offset = base_offset;
+    stream->line_len = 0;
+    stream->sink = sink;
+    stream->sink_context = sink_context;
+    stream->opts = opts != NULL ? *opts : default_opts;
+    stream->has_last = false;
+    stream->run = 0;
+    return 0;
+}
+
+int
+hexdump_stream_feed(hexdump_stream* const stream, const uint8_t* const src, const size_t src_len) {
+    hexdump_layout l;
+    hexdump_layout_init(&l, &stream->opts);
+    const size_t bytes_per_line = l.bytes_per_line;
+    hexdump_squeeze squeeze = {stream->has_last ? stream->last : NULL, stream->run};
+    hexdump_squeeze* const sq = stream->opts.squeeze ? &squeeze : NULL;
+    char buf[HEXDUMP_STREAM_BUF_LEN];
+    char* outp = buf;
+    const uint8_t* inp = src;
+    const uint8_t* const inp_fence = src + src_len;
+
+    if (stream->line_len > 0) {
+        const size_t rest = inp_fence - inp;
+        const size_t wanted = bytes_per_line - stream->line_len;
+        const size_t len = rest < wanted ? rest : wanted;
+        memcpy(stream->line + stream->line_len, inp, len);
+        stream->line_len += len;
+        inp += len;
+        if (stream->line_len < bytes_per_line) {
+            return 0;
+        }
+        const uint8_t* line = stream->line;
+        size_t one = 1;
+        outp = hexdump_ex_fill(&l, sq, outp, buf + sizeof buf, &line, &one, &stream->offset);
+        stream->line_len = 0;
+    }
+
+    size_t nlines = (inp_fence - inp) / bytes_per_line;
+    while (nlines > 0) {
+        const size_t before = nlines;
+        char* const filled = hexdump_ex_fill(&l, sq, outp, buf + sizeof buf, &inp, &nlines, &stream->offset);
+        if (filled == outp && nlines == before) {
+            int err = stream->sink(stream->sink_context, buf, outp - buf);
+            if (err != 0) {
+                return err;
+            }
+            outp = buf;
+            continue;
+        }
+        outp = filled;
+    }
+
+    // last may point into src or stream->line.  Keep it before either goes.
+    if (sq != NULL && sq->last != NULL) {
+        if (sq->last != stream->last) {
+            memcpy(stream->last, sq->last, bytes_per_line);
+        }
+        stream->has_last = true;
+        stream->run = sq->run;
+    }
+    stream->line_len = inp_fence - inp;
+    memcpy(stream->line, inp, stream->line_len);
+    return outp == buf ? 0 : stream->sink(stream->sink_context, buf, outp - buf);
+}
+
+int
+hexdump_stream_finish(hexdump_stream* const stream) {
+    hexdump_layout l;
+    hexdump_layout_init(&l, &stream->opts);
+    hexdump_squeeze squeeze = {stream->has_last ? stream->last : NULL, stream->run};
+    hexdump_squeeze* const sq = stream->opts.squeeze ? &squeeze : NULL;
+    char buf[HEXDUMP_EX_MAX_ITEM_LEN];
+    const char* const outp = hexdump_ex_tail(&l, sq, buf, stream->line, stream->line_len, stream->offset);
+    stream->run = 0;
+    if (stream->line_len > 0) {
+        // A partial line breaks any run.
+        stream->offset += stream->line_len;
+        stream->line_len = 0;
+        stream->has_last = false;
+    }
+    return outp == buf ? 0 : stream->sink(stream->sink_context, buf, outp - buf);
+}
@@ -24,9 +24,100 @@
  * SOFTWARE.
  */
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
+// Format src into out_str, truncating to max_len including the terminating '\0'.  Returns the length written.
+// When out_str is NULL nothing is written and hexdump_output_size(src_len) is returned instead.
 size_t hexdump(char* const out_str, const size_t max_len, const uint8_t* const src, const size_t src_len);
+// Exact buffer size, including the terminating '\0', hexdump() needs to format src_len bytes untruncated.
+size_t hexdump_output_size(const size_t src_len);
+// Same output as hexdump(), with the lines split over nthreads threads writing straight into out_str.
+// nthreads 0 means one per online CPU.  Inputs too small to be worth the threads are formatted by the caller.
+size_t hexdump_parallel(char* const out_str, const size_t max_len, const uint8_t* const src, const size_t src_len,
+                        const unsigned nthreads);
+// Write the hexdump of src to fd or stream.  Text is formatted into a fixed stack buffer of a few pages and
+// written out with one writev() or a few fwrite() calls per buffer fill, whatever the size of src.
+// Return 0 on success or the errno of the failed write.
+int hexdump_fd(const int fd, const uint8_t* const src, const size_t src_len);
+int hexdump_file(FILE* const stream, const uint8_t* const src, const size_t src_len);
+
+//
+//  Configurable layouts.  hexdump() prints 16 byte lines of two 8 byte blocks, each byte as "xx ", a 4 digit
+//  offset which grows as needed, and an ASCII column.  hexdump_ex() prints the same with the choices below.
+//  The hex and ASCII columns keep an extra space every 8 bytes.  Common layouts are formatted by functions
+//  specialized for them and the default layout by hexdump() itself; the others take a slower generic path.
+//
+typedef struct {
+    unsigned bytes_per_line;    // 16 or 32.
+    unsigned offset_digits;     // 4, 8 or 16.  Offsets too large for it print wider, as with hexdump().
+    unsigned group_size;        // Bytes per hex word: 1, 2, 4 or 8.
+    bool big_endian;            // Byte order of words.  Little endian prints the last byte first, as od -x.
+    bool uppercase;             // Hex digits of the words and the offset.
+    bool hex_only;              // No ASCII column.  The last line isn't padded.
+    // Print a single "*" line in place of lines repeating the line before them, as hexdump -C does.  The
+    // last line of the input is printed even when it is a repeat, so the dump still shows where it ends.
+    bool squeeze;
+} hexdump_opts;
+
+// The layout of hexdump().
+#define HEXDUMP_OPTS_DEFAULT {16, 4, 1, false, false, false, false}
+
+// hexdump() in the layout of opts, NULL for the default.  With invalid opts nothing is formatted: out_str is
+// left an empty string and 0 is returned.
+size_t hexdump_ex(char* const out_str, const size_t max_len, const uint8_t* const src, const size_t src_len,
+                  const hexdump_opts* const opts);
+// Exact buffer size for hexdump_ex(), including the '\0', or with squeeze the size without it, which is an
+// upper bound.  0 when opts are invalid.
+size_t hexdump_ex_output_size(const size_t src_len, const hexdump_opts* const opts);
+
+//
+//  Decoding.  hex_decode() turns plain hex of either case back into bytes, and hexundump() the text of
+//  hexdump(), or hexdump_ex() with only squeeze set, back into the bytes dumped.  Both validate every char
+//  and run vector kernels where the CPU has them.
+//
+// Decode the src_len / 2 bytes of the src_len hex digits at src into out.  Returns 0, or EINVAL when src_len
+// is odd or src holds anything but hex digits, with out partially written.
+int hex_decode(uint8_t* const out, const char* const src, const size_t src_len);
+// Decode text_len chars of hexdump text into out, storing the number of bytes decoded in *out_len.  The bytes
+// are the ones dumped from the first line's offset on; the ASCII column is skipped.  Returns 0, EINVAL when
+// the text isn't well formed hexdump() output, or ENOBUFS when the bytes don't fit into max_len.  On error
+// *out_len is what was decoded up to the line in error.
+int hexundump(uint8_t* const out, const size_t max_len, const char* const text, const size_t text_len,
+              size_t* const out_len);
+
+//
+//  Streaming hexdump.  Source bytes are fed in chunks of any size; complete lines are formatted and handed
+//  to the sink as they become available, a trailing partial line is kept in the stream until more bytes
+//  or hexdump_stream_finish() arrive.  Offsets continue from base_offset across chunks.  Feeding a buffer
+//  in any split with base_offset 0 produces the same text as hexdump() on the whole buffer, or as hexdump_ex()
+//  for a stream initialized with hexdump_stream_init_ex().  Squeezed runs carry across chunks.
+//
+// Receives formatted text.  Returning non zero stops formatting and the value is returned from feed/finish.
+typedef int (*hexdump_sink)(void* const sink_context, const char* const text, const size_t len);
+
+typedef struct {
+    uint64_t offset;        // Offset of line[0].
+    uint8_t line[32];       // Partial line carried over to the next feed.
+    size_t line_len;
+    hexdump_sink sink;
+    void* sink_context;
+    hexdump_opts opts;
+    uint8_t last[32];       // Squeeze only.  The last full line, when has_last.
+    bool has_last;
+    size_t run;             // Lines repeating last elided since it was printed.
+} hexdump_stream;
+
+void hexdump_stream_init(hexdump_stream* const stream, const uint64_t base_offset,
+                         hexdump_sink sink, void* const sink_context);
+// Stream in the layout of opts, NULL for the default.  Returns 0, or EINVAL for invalid opts.
+int hexdump_stream_init_ex(hexdump_stream* const stream, const uint64_t base_offset, const hexdump_opts* const opts,
+                           hexdump_sink sink, void* const sink_context);
+int hexdump_stream_feed(hexdump_stream* const stream, const uint8_t* const src, const size_t src_len);
+// Format the carried partial line, if any, or the last line of a squeezed run.  The stream can be fed again
+// afterwards, continuing the offsets.
+int hexdump_stream_finish(hexdump_stream* const stream);
 
 #endif
\ No newline at end of file
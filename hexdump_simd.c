@@ -0,0 +1,438 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  SSE2, AVX2 and NEON versions of the hexdump line body formatter, and of the hex decoder going back.
+//
+//  A line body is 16 "xx " cells with an extra space after the 8th, then the two 8 char ASCII groups
+//  split by a space.  The hex digits are computed from the nibbles of all 16 bytes at once and the
+//  ASCII column by a range compare.  Where a byte shuffle is available (AVX2, NEON) the digits are
+//  laid out into their cells by the table below instead of one by one.
+//
+#include <string.h>
+
+#include "hexdump_simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HEXDUMP_SIMD_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define HEXDUMP_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#if defined(HEXDUMP_SIMD_X86) || defined(HEXDUMP_SIMD_NEON)
+
+#define Z 0x80
+
+// Shuffle indices placing the digits of bytes 0-7 (A), bytes 8-15 (B) and the ASCII column (X) into the
+// five 16 char stores making up a body: out[0], out[16], out[32], out[48] and the overlapping out[51].
+// Z selects zero.  The S rows are the spaces OR'ed into the positions no source fills.
+static const uint8_t hexdump_layout_a0[16] = {0, 1, Z, 2, 3, Z, 4, 5, Z, 6, 7, Z, 8, 9, Z, 10};
+static const uint8_t hexdump_layout_s0[16] = {0, 0, 32, 0, 0, 32, 0, 0, 32, 0, 0, 32, 0, 0, 32, 0};
+static const uint8_t hexdump_layout_a1[16] = {11, Z, 12, 13, Z, 14, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z};
+static const uint8_t hexdump_layout_b1[16] = {Z, Z, Z, Z, Z, Z, Z, Z, Z, 0, 1, Z, 2, 3, Z, 4};
+static const uint8_t hexdump_layout_s1[16] = {0, 32, 0, 0, 32, 0, 0, 32, 32, 0, 0, 32, 0, 0, 32, 0};
+static const uint8_t hexdump_layout_b2[16] = {5, Z, 6, 7, Z, 8, 9, Z, 10, 11, Z, 12, 13, Z, 14, 15};
+static const uint8_t hexdump_layout_s2[16] = {0, 32, 0, 0, 32, 0, 0, 32, 0, 0, 32, 0, 0, 32, 0, 0};
+static const uint8_t hexdump_layout_x3[16] = {Z, Z, 0, 1, 2, 3, 4, 5, 6, 7, Z, 8, 9, 10, 11, 12};
+static const uint8_t hexdump_layout_s3[16] = {32, 32, 0, 0, 0, 0, 0, 0, 0, 0, 32, 0, 0, 0, 0, 0};
+static const uint8_t hexdump_layout_x4[16] = {1, 2, 3, 4, 5, 6, 7, Z, 8, 9, 10, 11, 12, 13, 14, 15};
+static const uint8_t hexdump_layout_s4[16] = {0, 0, 0, 0, 0, 0, 0, 32, 0, 0, 0, 0, 0, 0, 0, 0};
+
+#undef Z
+
+static const uint8_t hexdump_digits[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f'
+};
+
+#endif
+
+#ifdef HEXDUMP_SIMD_X86
+
+// SSE2 has no byte shuffle.  Digits and ASCII column are computed in vectors and then copied into their cells.
+__attribute__((target("sse2")))
+static void
+hexdump_body_sse2(char* out, const size_t stride, const uint8_t* src, size_t nlines) {
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero_digit = _mm_set1_epi8('0');
+    const __m128i alpha_gap = _mm_set1_epi8('a' - '0' - 10);
+    const __m128i below_printable = _mm_set1_epi8(0x1f);
+    const __m128i above_printable = _mm_set1_epi8(0x7f);
+    const __m128i dot = _mm_set1_epi8('.');
+    char digits[32];
+    char ascii[16];
+
+    for (; nlines > 0; nlines--, src += 16, out += stride) {
+        const __m128i v = _mm_loadu_si128((const __m128i*) src);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low_mask);
+        __m128i lo = _mm_and_si128(v, low_mask);
+        hi = _mm_add_epi8(_mm_add_epi8(hi, zero_digit), _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alpha_gap));
+        lo = _mm_add_epi8(_mm_add_epi8(lo, zero_digit), _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alpha_gap));
+        _mm_storeu_si128((__m128i*) digits, _mm_unpacklo_epi8(hi, lo));
+        _mm_storeu_si128((__m128i*) (digits + 16), _mm_unpackhi_epi8(hi, lo));
+
+        // Signed compare: bytes 0x80 and above are negative and fail the lower bound.
+        const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, below_printable),
+                                                _mm_cmplt_epi8(v, above_printable));
+        _mm_storeu_si128((__m128i*) ascii,
+                         _mm_or_si128(_mm_and_si128(printable, v), _mm_andnot_si128(printable, dot)));
+
+        memset(out, ' ', HEXDUMP_BODY_LEN);
+        for (size_t i = 0; i < 16; i++) {
+            memcpy(out + i * 3 + (i < 8 ? 0 : 1), digits + i * 2, 2);
+        }
+        memcpy(out + 50, ascii, 8);
+        memcpy(out + 59, ascii + 8, 8);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline void
+hexdump_body_avx2_one(char* out, const uint8_t* src) {
+    const __m128i low_mask = _mm_set1_epi8(0x0f);
+    const __m128i digits = _mm_loadu_si128((const __m128i*) hexdump_digits);
+    const __m128i v = _mm_loadu_si128((const __m128i*) src);
+    const __m128i hi = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), low_mask));
+    const __m128i lo = _mm_shuffle_epi8(digits, _mm_and_si128(v, low_mask));
+    const __m128i a = _mm_unpacklo_epi8(hi, lo);
+    const __m128i b = _mm_unpackhi_epi8(hi, lo);
+    const __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)),
+                                            _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+    const __m128i x = _mm_blendv_epi8(_mm_set1_epi8('.'), v, printable);
+
+#define LAYOUT(name) _mm_loadu_si128((const __m128i*) hexdump_layout_##name)
+    _mm_storeu_si128((__m128i*) out,
+                     _mm_or_si128(_mm_shuffle_epi8(a, LAYOUT(a0)), LAYOUT(s0)));
+    _mm_storeu_si128((__m128i*) (out + 16),
+                     _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(a, LAYOUT(a1)), _mm_shuffle_epi8(b, LAYOUT(b1))),
+                                  LAYOUT(s1)));
+    _mm_storeu_si128((__m128i*) (out + 32),
+                     _mm_or_si128(_mm_shuffle_epi8(b, LAYOUT(b2)), LAYOUT(s2)));
+    _mm_storeu_si128((__m128i*) (out + 48),
+                     _mm_or_si128(_mm_shuffle_epi8(x, LAYOUT(x3)), LAYOUT(s3)));
+    _mm_storeu_si128((__m128i*) (out + 51),
+                     _mm_or_si128(_mm_shuffle_epi8(x, LAYOUT(x4)), LAYOUT(s4)));
+#undef LAYOUT
+}
+
+// Two lines per iteration, one in each 128 bit lane.  vpshufb shuffles within lanes so the layout tables apply as is.
+__attribute__((target("avx2")))
+static void
+hexdump_body_avx2(char* out, const size_t stride, const uint8_t* src, size_t nlines) {
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    const __m256i digits = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) hexdump_digits));
+    const __m256i below_printable = _mm256_set1_epi8(0x1f);
+    const __m256i above_printable = _mm256_set1_epi8(0x7f);
+    const __m256i dot = _mm256_set1_epi8('.');
+
+#define LAYOUT(name) _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) hexdump_layout_##name))
+    const __m256i a0 = LAYOUT(a0), s0 = LAYOUT(s0);
+    const __m256i a1 = LAYOUT(a1), b1 = LAYOUT(b1), s1 = LAYOUT(s1);
+    const __m256i b2 = LAYOUT(b2), s2 = LAYOUT(s2);
+    const __m256i x3 = LAYOUT(x3), s3 = LAYOUT(s3);
+    const __m256i x4 = LAYOUT(x4), s4 = LAYOUT(s4);
+#undef LAYOUT
+
+    for (; nlines >= 2; nlines -= 2, src += 32, out += stride * 2) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*) src);
+        const __m256i hi = _mm256_shuffle_epi8(digits, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask));
+        const __m256i lo = _mm256_shuffle_epi8(digits, _mm256_and_si256(v, low_mask));
+        const __m256i a = _mm256_unpacklo_epi8(hi, lo);
+        const __m256i b = _mm256_unpackhi_epi8(hi, lo);
+        const __m256i printable = _mm256_and_si256(_mm256_cmpgt_epi8(v, below_printable),
+                                                   _mm256_cmpgt_epi8(above_printable, v));
+        const __m256i x = _mm256_blendv_epi8(dot, v, printable);
+
+        const __m256i c0 = _mm256_or_si256(_mm256_shuffle_epi8(a, a0), s0);
+        const __m256i c1 = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(a, a1), _mm256_shuffle_epi8(b, b1)), s1);
+        const __m256i c2 = _mm256_or_si256(_mm256_shuffle_epi8(b, b2), s2);
+        const __m256i c3 = _mm256_or_si256(_mm256_shuffle_epi8(x, x3), s3);
+        const __m256i c4 = _mm256_or_si256(_mm256_shuffle_epi8(x, x4), s4);
+
+        char* const out2 = out + stride;
+        _mm_storeu_si128((__m128i*) out, _mm256_castsi256_si128(c0));
+        _mm_storeu_si128((__m128i*) (out + 16), _mm256_castsi256_si128(c1));
+        _mm_storeu_si128((__m128i*) (out + 32), _mm256_castsi256_si128(c2));
+        _mm_storeu_si128((__m128i*) (out + 48), _mm256_castsi256_si128(c3));
+        _mm_storeu_si128((__m128i*) (out + 51), _mm256_castsi256_si128(c4));
+        _mm_storeu_si128((__m128i*) out2, _mm256_extracti128_si256(c0, 1));
+        _mm_storeu_si128((__m128i*) (out2 + 16), _mm256_extracti128_si256(c1, 1));
+        _mm_storeu_si128((__m128i*) (out2 + 32), _mm256_extracti128_si256(c2, 1));
+        _mm_storeu_si128((__m128i*) (out2 + 48), _mm256_extracti128_si256(c3, 1));
+        _mm_storeu_si128((__m128i*) (out2 + 51), _mm256_extracti128_si256(c4, 1));
+    }
+    if (nlines > 0) {
+        hexdump_body_avx2_one(out, src);
+    }
+}
+
+hexdump_body_kernel
+hexdump_simd_body_kernel(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return hexdump_body_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return hexdump_body_sse2;
+    }
+    return NULL;
+}
+
+//
+//  Decoding.  A char is a digit when c - '0' is at most 9 and a letter when (c | 0x20) - 'a' is at most 5,
+//  both unsigned, which chars of 0x80 and above fail too.  Digit pairs are packed by 16 bit lanes: the pair
+//  "hl" loads as h | l << 8, which (x << 4 | x >> 8) & 0xff turns into the byte h << 4 | l.
+//
+
+// Nibble values of the 16 chars of c into *nibbles.  Returns the movemask of which chars are hex digits.
+__attribute__((target("sse2")))
+static inline int
+hex_nibbles_sse2(const __m128i c, __m128i* const nibbles) {
+    const __m128i digit = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    const __m128i alpha = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+    const __m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), digit);
+    const __m128i is_alpha = _mm_cmpeq_epi8(_mm_min_epu8(alpha, _mm_set1_epi8(5)), alpha);
+    *nibbles = _mm_or_si128(_mm_and_si128(is_digit, digit),
+                            _mm_and_si128(is_alpha, _mm_add_epi8(alpha, _mm_set1_epi8(10))));
+    return _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha));
+}
+
+// The 16 bytes of the 32 nibbles n0, n1.
+__attribute__((target("sse2")))
+static inline __m128i
+hex_pack_sse2(const __m128i n0, const __m128i n1) {
+    const __m128i byte_mask = _mm_set1_epi16(0xff);
+    const __m128i w0 = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(n0, 4), _mm_srli_epi16(n0, 8)), byte_mask);
+    const __m128i w1 = _mm_and_si128(_mm_or_si128(_mm_slli_epi16(n1, 4), _mm_srli_epi16(n1, 8)), byte_mask);
+    return _mm_packus_epi16(w0, w1);
+}
+
+__attribute__((target("sse2")))
+static size_t
+hex_decode_sse2(uint8_t* out, const char* src, size_t n) {
+    size_t done = 0;
+    for (; n - done >= HEX_DECODE_BLOCK; done += HEX_DECODE_BLOCK, src += 32) {
+        __m128i n0, n1;
+        const int valid0 = hex_nibbles_sse2(_mm_loadu_si128((const __m128i*) src), &n0);
+        const int valid1 = hex_nibbles_sse2(_mm_loadu_si128((const __m128i*) (src + 16)), &n1);
+        if ((valid0 & valid1) != 0xffff) {
+            break;
+        }
+        _mm_storeu_si128((__m128i*) (out + done), hex_pack_sse2(n0, n1));
+    }
+    return done;
+}
+
+// 64 digits per iteration.  packus packs within lanes, so the 64 bit quarters come out as 0, 2, 1, 3.
+__attribute__((target("avx2")))
+static size_t
+hex_decode_avx2(uint8_t* out, const char* src, size_t n) {
+    const __m256i zero_digit = _mm256_set1_epi8('0');
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i alpha_base = _mm256_set1_epi8('a');
+    const __m256i nine = _mm256_set1_epi8(9);
+    const __m256i five = _mm256_set1_epi8(5);
+    const __m256i ten = _mm256_set1_epi8(10);
+    const __m256i byte_mask = _mm256_set1_epi16(0xff);
+    size_t done = 0;
+    for (; n - done >= 2 * HEX_DECODE_BLOCK; done += 2 * HEX_DECODE_BLOCK, src += 64) {
+        __m256i w[2];
+        __m256i valid = _mm256_set1_epi8(-1);
+        for (int i = 0; i < 2; i++) {
+            const __m256i c = _mm256_loadu_si256((const __m256i*) (src + i * 32));
+            const __m256i digit = _mm256_sub_epi8(c, zero_digit);
+            const __m256i alpha = _mm256_sub_epi8(_mm256_or_si256(c, case_bit), alpha_base);
+            const __m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(digit, nine), digit);
+            const __m256i is_alpha = _mm256_cmpeq_epi8(_mm256_min_epu8(alpha, five), alpha);
+            valid = _mm256_and_si256(valid, _mm256_or_si256(is_digit, is_alpha));
+            const __m256i nibbles = _mm256_or_si256(_mm256_and_si256(is_digit, digit),
+                                                    _mm256_and_si256(is_alpha, _mm256_add_epi8(alpha, ten)));
+            w[i] = _mm256_and_si256(_mm256_or_si256(_mm256_slli_epi16(nibbles, 4), _mm256_srli_epi16(nibbles, 8)),
+                                    byte_mask);
+        }
+        if (_mm256_movemask_epi8(valid) != -1) {
+            break;
+        }
+        _mm256_storeu_si256((__m256i*) (out + done),
+                            _mm256_permute4x64_epi64(_mm256_packus_epi16(w[0], w[1]), _MM_SHUFFLE(3, 1, 2, 0)));
+    }
+    return done + hex_decode_sse2(out + done, src, n - done);
+}
+
+#define Z 0x80
+
+// Shuffle indices gathering the 32 digits of a hex column out of its three 16 char loads h0, h1 and h2:
+// digits of bytes 0-7 (d0) from h0 and h1, of bytes 8-15 (d1) from h1 and h2.  The space masks are the
+// movemask bits of the separators in each load; the last separator, hex[48], is checked on its own.
+static const uint8_t hexundump_d0_h0[16] = {0, 1, 3, 4, 6, 7, 9, 10, 12, 13, 15, Z, Z, Z, Z, Z};
+static const uint8_t hexundump_d0_h1[16] = {Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, 0, 2, 3, 5, 6};
+static const uint8_t hexundump_d1_h1[16] = {9, 10, 12, 13, 15, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z, Z};
+static const uint8_t hexundump_d1_h2[16] = {Z, Z, Z, Z, Z, 0, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15};
+#define HEXUNDUMP_SPACES_H0 0x4924
+#define HEXUNDUMP_SPACES_H1 0x4992
+#define HEXUNDUMP_SPACES_H2 0x2492
+
+#undef Z
+
+__attribute__((target("ssse3")))
+static bool
+hexundump_line_ssse3(uint8_t* out, const char* hex) {
+    const __m128i h0 = _mm_loadu_si128((const __m128i*) hex);
+    const __m128i h1 = _mm_loadu_si128((const __m128i*) (hex + 16));
+    const __m128i h2 = _mm_loadu_si128((const __m128i*) (hex + 32));
+    const __m128i space = _mm_set1_epi8(' ');
+    if ((_mm_movemask_epi8(_mm_cmpeq_epi8(h0, space)) & HEXUNDUMP_SPACES_H0) != HEXUNDUMP_SPACES_H0 ||
+        (_mm_movemask_epi8(_mm_cmpeq_epi8(h1, space)) & HEXUNDUMP_SPACES_H1) != HEXUNDUMP_SPACES_H1 ||
+        (_mm_movemask_epi8(_mm_cmpeq_epi8(h2, space)) & HEXUNDUMP_SPACES_H2) != HEXUNDUMP_SPACES_H2 ||
+        hex[48] != ' ') {
+        return false;
+    }
+#define LAYOUT(name) _mm_loadu_si128((const __m128i*) hexundump_##name)
+    const __m128i d0 = _mm_or_si128(_mm_shuffle_epi8(h0, LAYOUT(d0_h0)), _mm_shuffle_epi8(h1, LAYOUT(d0_h1)));
+    const __m128i d1 = _mm_or_si128(_mm_shuffle_epi8(h1, LAYOUT(d1_h1)), _mm_shuffle_epi8(h2, LAYOUT(d1_h2)));
+#undef LAYOUT
+    __m128i n0, n1;
+    if ((hex_nibbles_sse2(d0, &n0) & hex_nibbles_sse2(d1, &n1)) != 0xffff) {
+        return false;
+    }
+    _mm_storeu_si128((__m128i*) out, hex_pack_sse2(n0, n1));
+    return true;
+}
+
+hex_decode_kernel
+hexdump_simd_decode_kernel(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return hex_decode_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return hex_decode_sse2;
+    }
+    return NULL;
+}
+
+hexundump_line_kernel
+hexdump_simd_undump_kernel(void) {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3") ? hexundump_line_ssse3 : NULL;
+}
+
+#elif defined(HEXDUMP_SIMD_NEON)
+
+static void
+hexdump_body_neon(char* out, const size_t stride, const uint8_t* src, size_t nlines) {
+    const uint8x16_t digits = vld1q_u8(hexdump_digits);
+    const uint8x16_t low_mask = vdupq_n_u8(0x0f);
+    const uint8x16_t dot = vdupq_n_u8('.');
+    const uint8x16_t a0 = vld1q_u8(hexdump_layout_a0), s0 = vld1q_u8(hexdump_layout_s0);
+    const uint8x16_t a1 = vld1q_u8(hexdump_layout_a1), b1 = vld1q_u8(hexdump_layout_b1);
+    const uint8x16_t s1 = vld1q_u8(hexdump_layout_s1);
+    const uint8x16_t b2 = vld1q_u8(hexdump_layout_b2), s2 = vld1q_u8(hexdump_layout_s2);
+    const uint8x16_t x3 = vld1q_u8(hexdump_layout_x3), s3 = vld1q_u8(hexdump_layout_s3);
+    const uint8x16_t x4 = vld1q_u8(hexdump_layout_x4), s4 = vld1q_u8(hexdump_layout_s4);
+
+    for (; nlines > 0; nlines--, src += 16, out += stride) {
+        const uint8x16_t v = vld1q_u8(src);
+        const uint8x16_t hi = vqtbl1q_u8(digits, vshrq_n_u8(v, 4));
+        const uint8x16_t lo = vqtbl1q_u8(digits, vandq_u8(v, low_mask));
+        const uint8x16_t a = vzip1q_u8(hi, lo);
+        const uint8x16_t b = vzip2q_u8(hi, lo);
+        const uint8x16_t printable = vandq_u8(vcgeq_u8(v, vdupq_n_u8(0x20)), vcleq_u8(v, vdupq_n_u8(0x7e)));
+        const uint8x16_t x = vbslq_u8(printable, v, dot);
+
+        // tbl yields zero for out of range indices, so the 0x80 entries of the tables work as for pshufb.
+        vst1q_u8((uint8_t*) out, vorrq_u8(vqtbl1q_u8(a, a0), s0));
+        vst1q_u8((uint8_t*) out + 16, vorrq_u8(vorrq_u8(vqtbl1q_u8(a, a1), vqtbl1q_u8(b, b1)), s1));
+        vst1q_u8((uint8_t*) out + 32, vorrq_u8(vqtbl1q_u8(b, b2), s2));
+        vst1q_u8((uint8_t*) out + 48, vorrq_u8(vqtbl1q_u8(x, x3), s3));
+        vst1q_u8((uint8_t*) out + 51, vorrq_u8(vqtbl1q_u8(x, x4), s4));
+    }
+}
+
+hexdump_body_kernel
+hexdump_simd_body_kernel(void) {
+    return hexdump_body_neon;
+}
+
+// vld2q splits the digit pairs into high and low digits, so no packing shuffle is needed.  See the x86
+// version for the digit test.
+static size_t
+hex_decode_neon(uint8_t* out, const char* src, size_t n) {
+    const uint8x16_t zero_digit = vdupq_n_u8('0');
+    const uint8x16_t case_bit = vdupq_n_u8(0x20);
+    const uint8x16_t alpha_base = vdupq_n_u8('a');
+    const uint8x16_t nine = vdupq_n_u8(9);
+    const uint8x16_t five = vdupq_n_u8(5);
+    const uint8x16_t ten = vdupq_n_u8(10);
+    size_t done = 0;
+    for (; n - done >= HEX_DECODE_BLOCK; done += HEX_DECODE_BLOCK, src += 32) {
+        const uint8x16x2_t c = vld2q_u8((const uint8_t*) src);
+        uint8x16_t nibbles[2];
+        uint8x16_t valid = vdupq_n_u8(0xff);
+        for (int i = 0; i < 2; i++) {
+            const uint8x16_t digit = vsubq_u8(c.val[i], zero_digit);
+            const uint8x16_t alpha = vsubq_u8(vorrq_u8(c.val[i], case_bit), alpha_base);
+            const uint8x16_t is_digit = vcleq_u8(digit, nine);
+            const uint8x16_t is_alpha = vcleq_u8(alpha, five);
+            valid = vandq_u8(valid, vorrq_u8(is_digit, is_alpha));
+            nibbles[i] = vbslq_u8(is_digit, digit, vaddq_u8(alpha, ten));
+        }
+        if (vminvq_u8(valid) != 0xff) {
+            break;
+        }
+        vst1q_u8(out + done, vorrq_u8(vshlq_n_u8(nibbles[0], 4), nibbles[1]));
+    }
+    return done;
+}
+
+hex_decode_kernel
+hexdump_simd_decode_kernel(void) {
+    return hex_decode_neon;
+}
+
+hexundump_line_kernel
+hexdump_simd_undump_kernel(void) {
+    return NULL;
+}
+
+#else
+
+hexdump_body_kernel
+hexdump_simd_body_kernel(void) {
+    return NULL;
+}
+
+hex_decode_kernel
+hexdump_simd_decode_kernel(void) {
+    return NULL;
+}
+
+hexundump_line_kernel
+hexdump_simd_undump_kernel(void) {
+    return NULL;
+}
+
+#endif
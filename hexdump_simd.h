@@ -0,0 +1,60 @@
+#ifndef HEXDUMP_SIMD_H
+#define HEXDUMP_SIMD_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  Vectorized hexdump line kernels.  Internal to hexdump.c and hexundump.c.
+//
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Length of the part of a full line after the offset and its two spaces, excluding the '\n'.
+#define HEXDUMP_BODY_LEN 67
+
+// Write the HEXDUMP_BODY_LEN char body of nlines full 16 byte lines.  Body of line i goes to out + i * stride.
+typedef void (*hexdump_body_kernel)(char* out, size_t stride, const uint8_t* src, size_t nlines);
+
+// Return the fastest kernel the running CPU supports, or NULL when only the scalar formatter is available.
+hexdump_body_kernel hexdump_simd_body_kernel(void);
+
+// Length of the hex column of a full line: 16 "xx " cells and the extra space after the 8th.
+#define HEXDUMP_HEX_LEN 49
+// Bytes hex_decode_kernel decodes per block.
+#define HEX_DECODE_BLOCK 16
+
+// Decode the 2 * n hex digits at src into n bytes at out, whole blocks of HEX_DECODE_BLOCK bytes at a time,
+// stopping at the first block holding anything but hex digits.  Returns the number of bytes decoded.  The
+// caller decodes the rest, and finds the bad digit if there is one.
+typedef size_t (*hex_decode_kernel)(uint8_t* out, const char* src, size_t n);
+// Decode the HEXDUMP_HEX_LEN char hex column of a full line into its 16 bytes.  false when it is anything but
+// 16 cells of two hex digits, either case, separated as hexdump() separates them.
+typedef bool (*hexundump_line_kernel)(uint8_t* out, const char* hex);
+
+// As hexdump_simd_body_kernel(), NULL when the scalar versions are the fastest.
+hex_decode_kernel hexdump_simd_decode_kernel(void);
+hexundump_line_kernel hexdump_simd_undump_kernel(void);
+
+#endif
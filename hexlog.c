@@ -0,0 +1,241 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hexdump.h"
+#include "hexlog.h"
+
+// Records the background thread takes at once.
+#define HEXLOG_BATCH 64
+// Formatted text buffered before a write().  A record whose dump doesn't fit goes out with hexdump_fd().
+#define HEXLOG_BUF_LEN (256 * 1024)
+// Room for the header line of a record.
+#define HEXLOG_HEADER_LEN 128
+
+typedef struct {
+    HexLogProducer* producer;   // NULL for control records.
+    const char* tag;
+    size_t pos;                 // Arena position of the bytes.
+    size_t len;
+    size_t end;                 // Arena position freed once the record is written, past any wrap padding.
+    MVar_abs* flushed;          // Control: put when everything before is written.  NULL stops the thread.
+} hexlog_record;
+
+static void
+hexlog_record_write(void* const mvar_context, const void* const user_data) {
+    memcpy(mvar_context, user_data, sizeof(hexlog_record));
+}
+
+static void
+hexlog_record_read(void* const out_user_data, void* const mvar_context) {
+    memcpy(out_user_data, mvar_context, sizeof(hexlog_record));
+}
+
+// Write all of buf to fd, retrying short writes.  Returns 0 or an errno value.
+static int
+hexlog_write(const int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        const ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+// Text formatted but not yet written.  Records are formatted back to back, so it is the one span
+// log->buf[0 ... len - 1].
+typedef struct {
+    size_t len;
+} hexlog_pending;
+
+static void
+hexlog_fail(HexLog* const log, const int err) {
+    int none = 0;
+    if (err != 0) {
+        atomic_compare_exchange_strong(&log->err, &none, err);
+    }
+}
+
+static void
+hexlog_flush(HexLog* const log, hexlog_pending* const pending) {
+    if (pending->len > 0) {
+        hexlog_fail(log, hexlog_write(log->fd, log->buf, pending->len));
+    }
+    pending->len = 0;
+}
+
+// Format one record, or write it out directly when its dump is larger than the buffer, and free its bytes.
+static void
+hexlog_format(HexLog* const log, hexlog_pending* const pending, const hexlog_record* const rec) {
+    HexLogProducer* const p = rec->producer;
+    const uint8_t* const data = p->arena + (rec->pos & p->mask);
+    const size_t text_len = HEXLOG_HEADER_LEN + hexdump_output_size(rec->len);
+    if (HEXLOG_BUF_LEN - pending->len < text_len) {
+        hexlog_flush(log, pending);
+    }
+    char* const outp = log->buf + pending->len;
+    int header = snprintf(outp, HEXLOG_HEADER_LEN, "%s %zu bytes\n", rec->tag, rec->len);
+    if (header >= HEXLOG_HEADER_LEN) {
+        // A clipped tag still ends its header line.
+        header = HEXLOG_HEADER_LEN - 1;
+        outp[header - 1] = '\n';
+    }
+    if (text_len <= HEXLOG_BUF_LEN) {
+        pending->len += header + hexdump(outp + header, HEXLOG_BUF_LEN - pending->len - header, data, rec->len);
+    } else {
+        hexlog_fail(log, hexlog_write(log->fd, outp, header));
+        hexlog_fail(log, hexdump_fd(log->fd, data, rec->len));
+    }
+    atomic_store_explicit(&p->head, rec->end, memory_order_release);
+}
+
+static void*
+hexlog_run(void* const arg) {
+    HexLog* const log = arg;
+    hexlog_pending pending = {.len = 0};
+    hexlog_record recs[HEXLOG_BATCH];
+    for (;;) {
+        size_t n;
+        takeManyBoundedQueue(recs, sizeof recs[0], &log->records, HEXLOG_BATCH, &n);
+        for (size_t i = 0; i < n; i++) {
+            if (recs[i].producer != NULL) {
+                hexlog_format(log, &pending, &recs[i]);
+                continue;
+            }
+            hexlog_flush(log, &pending);
+            if (recs[i].flushed == NULL) {
+                return NULL;
+            }
+            putMVar(recs[i].flushed, NULL);
+        }
+        hexlog_flush(log, &pending);
+    }
+}
+
+int
+initHexLog(HexLog* const out_log, const int fd, const size_t queue_capacity) {
+    HexLog* const log = out_log;
+    int err = initBoundedQueue(&log->records, BOUNDED_QUEUE_MPMC, queue_capacity, sizeof(hexlog_record),
+                               hexlog_record_write, hexlog_record_read);
+    if (err != 0) {
+        return err;
+    }
+    log->fd = fd;
+    atomic_init(&log->err, 0);
+    log->buf = malloc(HEXLOG_BUF_LEN);
+    if (log->buf == NULL) {
+        destroyBoundedQueue(&log->records);
+        return ENOMEM;
+    }
+    err = pthread_create(&log->thread, NULL, hexlog_run, log);
+    if (err != 0) {
+        free(log->buf);
+        destroyBoundedQueue(&log->records);
+    }
+    return err;
+}
+
+void
+destroyHexLog(HexLog* const log) {
+    const hexlog_record stop = {NULL, NULL, 0, 0, 0, NULL};
+    putBoundedQueue(&log->records, &stop);
+    pthread_join(log->thread, NULL);
+    free(log->buf);
+    destroyBoundedQueue(&log->records);
+}
+
+int
+flushHexLog(HexLog* const log) {
+    MVar_abs flushed;
+    initMVar_unit(&flushed);
+    const hexlog_record flush = {NULL, NULL, 0, 0, 0, &flushed};
+    putBoundedQueue(&log->records, &flush);
+    takeMVar(NULL, &flushed);
+    return atomic_load(&log->err);
+}
+
+int
+initHexLogProducer(HexLogProducer* const out_producer, HexLog* const log, const size_t arena_size) {
+    HexLogProducer* const p = out_producer;
+    if (arena_size == 0 || (arena_size & (arena_size - 1)) != 0) {
+        return EINVAL;
+    }
+    p->arena = malloc(arena_size);
+    if (p->arena == NULL) {
+        return ENOMEM;
+    }
+    p->mask = arena_size - 1;
+    p->log = log;
+    atomic_init(&p->head, 0);
+    p->tail = 0;
+    p->cachedHead = 0;
+    atomic_init(&p->dropped, 0);
+    return 0;
+}
+
+void
+destroyHexLogProducer(HexLogProducer* const producer) {
+    flushHexLog(producer->log);
+    free(producer->arena);
+    producer->arena = NULL;
+}
+
+int
+writeHexLog(HexLogProducer* const producer, const char* const tag, const void* const data, const size_t len) {
+    HexLogProducer* const p = producer;
+    const size_t capacity = p->mask + 1;
+    if (len > capacity) {
+        return EINVAL;
+    }
+    // Records are contiguous in the arena.  One which would wrap starts over at the beginning instead.
+    const size_t at = p->tail & p->mask;
+    const size_t pos = at + len > capacity ? p->tail + capacity - at : p->tail;
+    const size_t end = pos + len;
+    if (end - p->cachedHead > capacity) {
+        p->cachedHead = atomic_load_explicit(&p->head, memory_order_acquire);
+        if (end - p->cachedHead > capacity) {
+            atomic_fetch_add_explicit(&p->dropped, 1, memory_order_relaxed);
+            return EBUSY;
+        }
+    }
+    memcpy(p->arena + (pos & p->mask), data, len);
+    const hexlog_record rec = {p, tag, pos, len, end, NULL};
+    if (tryPutBoundedQueue(&p->log->records, &rec) != 0) {
+        atomic_fetch_add_explicit(&p->dropped, 1, memory_order_relaxed);
+        return EBUSY;
+    }
+    p->tail = end;
+    return 0;
+}
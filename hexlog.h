@@ -0,0 +1,86 @@
+#ifndef HEXLOG_H
+#define HEXLOG_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  HexLog is an asynchronous log of binary records.  Request threads copy the bytes of a record into an arena
+//  ring of their own and hand a (position, length, tag) record to a background thread through an MPMC
+//  BoundedQueue.  Neither step blocks or takes a lock: a record costs a memcpy() and a queue put.  The
+//  background thread takes records in batches, formats each as a header line and its hexdump() into a
+//  buffer, frees its arena space and writes the buffer out with write().
+//
+//  A record goes out as
+//
+//      <tag> <length> bytes
+//      0000  00 01 02 ...
+//
+//  When the arena or the queue is full the record is dropped and counted rather than making its thread wait.
+//
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#include "boundedqueue.h"
+
+typedef struct {
+    BoundedQueue records;
+    pthread_t thread;
+    int fd;
+    // Background thread only.
+    char* buf;
+    atomic_int err;                     // First write error.
+} HexLog;
+
+typedef struct {
+    // Freed by the background thread up to here.
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_size_t head;
+    // Owner thread only.
+    _Alignas(MVAR_CACHE_LINE_SIZE) size_t tail;
+    size_t cachedHead;
+    atomic_size_t dropped;              // Records dropped for want of room.
+    // Read only after init.
+    _Alignas(MVAR_CACHE_LINE_SIZE) unsigned char* arena;
+    size_t mask;
+    HexLog* log;
+} HexLogProducer;
+
+// Start the background thread writing to fd.  queue_capacity, a power of two, is the number of records in
+// flight for all producers together.  Returns 0, EINVAL, ENOMEM or the error of pthread_create().
+int initHexLog(HexLog* const out_log, const int fd, const size_t queue_capacity);
+// Write out everything logged so far and stop the background thread.  Destroy the producers first.
+void destroyHexLog(HexLog* const log);
+// Block until every record logged before the call is written.  Returns 0 or the errno of the first failed write.
+int flushHexLog(HexLog* const log);
+
+// A producer for one thread, with an arena of arena_size (a power of two) bytes.  Returns 0, EINVAL or ENOMEM.
+int initHexLogProducer(HexLogProducer* const out_producer, HexLog* const log, const size_t arena_size);
+// Flush the log and free the arena.
+void destroyHexLogProducer(HexLogProducer* const producer);
+// Log the len bytes at data under tag, a string which must outlive the record, a literal typically.  Called by
+// the producer's thread only.  Returns 0, EBUSY when the record was dropped, or EINVAL when len is more than
+// the arena holds.
+int writeHexLog(HexLogProducer* const producer, const char* const tag, const void* const data, const size_t len);
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "hexdump.h"
+#include "hexdump_simd.h"
+
+#define HEXDUMP_BYTES_PER_LINE 16
+// Body of a line after the offset and its two spaces, up to the '\n': hex column, gap, ASCII column.
+#define HEXUNDUMP_BODY_LEN (HEXDUMP_HEX_LEN + 1 + HEXDUMP_BYTES_PER_LINE + 1)
+
+#define HEX_INVALID 0xff
+#define HEX_ROW_INVALID \
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, \
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID
+
+// Value of every hex digit of either case, HEX_INVALID for the other chars.
+static const uint8_t hex_value[256] = {
+    HEX_ROW_INVALID, HEX_ROW_INVALID, HEX_ROW_INVALID,
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID,
+    HEX_INVALID, 10, 11, 12, 13, 14, 15, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID,
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID,
+    HEX_ROW_INVALID,
+    HEX_INVALID, 10, 11, 12, 13, 14, 15, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID,
+    HEX_INVALID, HEX_INVALID, HEX_INVALID, HEX_INVALID,
+    HEX_ROW_INVALID, HEX_ROW_INVALID, HEX_ROW_INVALID, HEX_ROW_INVALID, HEX_ROW_INVALID,
+    HEX_ROW_INVALID, HEX_ROW_INVALID, HEX_ROW_INVALID, HEX_ROW_INVALID,
+};
+
+// Byte of the two hex digits at src, or -1.
+static int
+hex_pair(const char* const src) {
+    const uint8_t hi = hex_value[(uint8_t) src[0]];
+    const uint8_t lo = hex_value[(uint8_t) src[1]];
+    return hi > 15 || lo > 15 ? -1 : hi << 4 | lo;
+}
+
+// Returns the number of bytes decoded before the first pair with anything but hex digits.
+static size_t
+hex_decode_scalar(uint8_t* const out, const char* const src, const size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        const int byte = hex_pair(src + i * 2);
+        if (byte < 0) {
+            return i;
+        }
+        out[i] = (uint8_t) byte;
+    }
+    return n;
+}
+
+// Decode the hex column of a full line.  The fallback of the vector kernels.
+static bool
+hexundump_line_scalar(uint8_t* const out, const char* const hex) {
+    for (size_t i = 0; i < HEXDUMP_BYTES_PER_LINE; i++) {
+        const char* const cell = hex + i * 3 + (i < 8 ? 0 : 1);
+        const int byte = hex_pair(cell);
+        if (byte < 0 || cell[2] != ' ') {
+            return false;
+        }
+        out[i] = (uint8_t) byte;
+    }
+    return hex[8 * 3] == ' ';
+}
+
+// Picked on first use, as hexdump.c picks its body kernel.  A scalar function when there is no vector one.
+static _Atomic(hex_decode_kernel) hex_decoder;
+static _Atomic(hexundump_line_kernel) hexundump_decoder;
+
+static hex_decode_kernel
+hex_get_decoder(void) {
+    hex_decode_kernel kernel = atomic_load_explicit(&hex_decoder, memory_order_relaxed);
+    if (kernel == NULL) {
+        kernel = hexdump_simd_decode_kernel();
+        if (kernel == NULL) {
+            kernel = hex_decode_scalar;
+        }
+        atomic_store_explicit(&hex_decoder, kernel, memory_order_relaxed);
+    }
+    return kernel;
+}
+
+static hexundump_line_kernel
+hexundump_get_decoder(void) {
+    hexundump_line_kernel kernel = atomic_load_explicit(&hexundump_decoder, memory_order_relaxed);
+    if (kernel == NULL) {
+        kernel = hexdump_simd_undump_kernel();
+        if (kernel == NULL) {
+            kernel = hexundump_line_scalar;
+        }
+        atomic_store_explicit(&hexundump_decoder, kernel, memory_order_relaxed);
+    }
+    return kernel;
+}
+
+int
+hex_decode(uint8_t* const out, const char* const src, const size_t src_len) {
+    if (src_len % 2 != 0) {
+        return EINVAL;
+    }
+    const size_t n = src_len / 2;
+    const size_t done = hex_get_decoder()(out, src, n);
+    return hex_decode_scalar(out + done, src + done * 2, n - done) == n - done ? 0 : EINVAL;
+}
+
+// Decode the cells of the hex column of a line with len chars at hex, which may be the last
+// one and have fewer than 16 cells, the rest blank.  Returns the number of bytes or -1 when malformed.
+static int
+hexundump_partial_line(uint8_t* const out, const char* const hex, const size_t len) {
+    if (len < HEXDUMP_HEX_LEN) {
+        return -1;
+    }
+    int n = 0;
+    for (size_t i = 0; i < HEXDUMP_BYTES_PER_LINE; i++) {
+        const char* const cell = hex + i * 3 + (i < 8 ? 0 : 1);
+        if (cell[2] != ' ') {
+            return -1;
+        }
+        if (cell[0] == ' ' && cell[1] == ' ') {
+            continue;
+        }
+        const int byte = hex_pair(cell);
+        // A byte after a blank cell can't be.
+        if (byte < 0 || n != (int) i) {
+            return -1;
+        }
+        out[n++] = (uint8_t) byte;
+    }
+    return hex[8 * 3] == ' ' ? n : -1;
+}
+
+int
+hexundump(uint8_t* const out, const size_t max_len, const char* const text, const size_t text_len,
+          size_t* const out_len) {
+    const hexundump_line_kernel decode_line = hexundump_get_decoder();
+    const char* inp = text;
+    const char* const inp_fence = text + text_len;
+    size_t len = 0;
+    uint64_t base = 0;
+    bool first = true;
+    bool squeezed = false;
+    bool ended = false;
+
+    *out_len = 0;
+    while (inp < inp_fence) {
+        const char* const eol = memchr(inp, '\n', inp_fence - inp);
+        const char* const line_fence = eol != NULL ? eol : inp_fence;
+        if (ended) {
+            return EINVAL;
+        }
+        if (line_fence - inp == 1 && *inp == '*') {
+            // hexdump_ex() squeeze: lines repeating the last one, up to the next offset.
+            if (first || len < HEXDUMP_BYTES_PER_LINE || squeezed) {
+                return EINVAL;
+            }
+            squeezed = true;
+            inp = line_fence + 1;
+            continue;
+        }
+
+        uint64_t offset = 0;
+        const char* p = inp;
+        while (p < line_fence && *p != ' ') {
+            const uint8_t digit = hex_value[(uint8_t) *p++];
+            if (digit > 15 || p - inp > 16) {
+                return EINVAL;
+            }
+            offset = offset << 4 | digit;
+        }
+        if (p - inp < 4 || line_fence - p < 2 || p[1] != ' ') {
+            return EINVAL;
+        }
+        p += 2;
+        if (first) {
+            base = offset;
+            first = false;
+        }
+        uint64_t expected = base + len;
+        if (squeezed) {
+            if (offset < expected || (offset - expected) % HEXDUMP_BYTES_PER_LINE != 0 ||
+                offset - expected > max_len - len) {
+                return offset < expected ? EINVAL : ENOBUFS;
+            }
+            for (; expected < offset; expected += HEXDUMP_BYTES_PER_LINE, len += HEXDUMP_BYTES_PER_LINE) {
+                memcpy(out + len, out + len - HEXDUMP_BYTES_PER_LINE, HEXDUMP_BYTES_PER_LINE);
+            }
+            squeezed = false;
+        }
+        if (offset != expected) {
+            return EINVAL;
+        }
+
+        // The ASCII column only repeats the bytes and is skipped, but a line must have its length.
+        if ((size_t) (line_fence - p) != HEXUNDUMP_BODY_LEN) {
+            return EINVAL;
+        }
+        if (max_len - len >= HEXDUMP_BYTES_PER_LINE && decode_line(out + len, p)) {
+            len += HEXDUMP_BYTES_PER_LINE;
+        } else {
+            uint8_t bytes[HEXDUMP_BYTES_PER_LINE];
+            const int n = hexundump_partial_line(bytes, p, line_fence - p);
+            if (n <= 0) {
+                return EINVAL;
+            }
+            if ((size_t) n > max_len - len) {
+                return ENOBUFS;
+            }
+            memcpy(out + len, bytes, n);
+            len += n;
+            // Only the last line is short.
+            ended = n < HEXDUMP_BYTES_PER_LINE;
+        }
+        *out_len = len;
+        inp = eol != NULL ? eol + 1 : inp_fence;
+    }
+    // A "*" must be followed by the line ending its run.
+    return squeezed ? EINVAL : 0;
+}
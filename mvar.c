@@ -26,20 +26,174 @@
 //  MVar is one element only thread safe queue.
 //  This is MVar implementation in C and pthread.
 //
+// pthread_mutex_clocklock() is a GNU extension.
+#define _GNU_SOURCE
+
 #include <errno.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
 
+#include "atomic_wait.h"
+#include "eventnotify.h"
 #include "mvar.h"
 
+// Spinning starts from this budget and never adapts below it, so it can grow back after a run of misses.
+#define MVAR_SPIN_MIN 16
+// Longest run of pause instructions between two looks at the MVar.  Beyond this the spinner yields instead.
+#define MVAR_SPIN_MAX_STEP 64
+
+// A selectTakeMVar() caller blocked on the MVar, linked into MVar_abs.selectWaiters under the lock.  Lives on
+// the selector's stack.
+struct mvar_select_waiter {
+    struct mvar_select_waiter* prev;
+    struct mvar_select_waiter* next;
+    // Bumped by every put to any MVar of the selector's set.  The selector sleeps on it.
+    atomic_uint* event;
+};
+
+#ifdef MVAR_STATS
+#define MVAR_STAT_ADD(v, counter) atomic_fetch_add_explicit(&(v)->stats.counter, 1, memory_order_relaxed)
+
+static uint64_t
+mvar_now_nsec(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+static void
+mvar_stat_time(atomic_size_t* const histogram, const uint64_t nsec) {
+    const unsigned bucket = nsec == 0 ? 0 : 64 - (unsigned) __builtin_clzll(nsec);
+    atomic_fetch_add_explicit(&histogram[bucket < MVAR_STATS_BUCKETS ? bucket : MVAR_STATS_BUCKETS - 1], 1,
+                              memory_order_relaxed);
+}
+#else
+#define MVAR_STAT_ADD(v, counter) ((void) 0)
+#endif
+
+// empty is only written under the lock.  It is atomic so that spinners and isEmptyMVar() can look at it without.
+static inline bool
+mvar_is_empty(MVar_abs* const v) {
+    return atomic_load_explicit(&v->empty, memory_order_relaxed);
+}
+
+static inline void
+mvar_set_empty(MVar_abs* const v, const bool empty) {
+    atomic_store_explicit(&v->empty, empty, memory_order_relaxed);
+}
+
+static inline void
+cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Spin while the MVar is not in the wanted state, for at most the current spin budget, before the caller
+// takes the lock and blocks.  Finding the state in time grows the budget towards spinLimit; running out
+// halves it.  The caller re-checks under the lock either way.
+static void
+mvar_spin(MVar_abs* const v, const bool want_empty) {
+    const unsigned budget = atomic_load_explicit(&v->spinBudget, memory_order_relaxed);
+    if (budget == 0 || mvar_is_empty(v) == want_empty) {
+        return;
+    }
+    unsigned spent = 0;
+    unsigned step = 1;
+    while (spent < budget) {
+        if (step < MVAR_SPIN_MAX_STEP) {
+            for (unsigned i = 0; i < step; i++) {
+                cpu_relax();
+            }
+            spent += step;
+            step <<= 1;
+        } else {
+            sched_yield();
+            spent += step;
+        }
+        if (mvar_is_empty(v) == want_empty) {
+            const unsigned grown = budget * 2;
+            atomic_store_explicit(&v->spinBudget, grown < v->spinLimit ? grown : v->spinLimit, memory_order_relaxed);
+            return;
+        }
+    }
+    // The floor of init: a spinLimit below MVAR_SPIN_MIN is the floor itself.
+    const unsigned floor = v->spinLimit < MVAR_SPIN_MIN ? v->spinLimit : MVAR_SPIN_MIN;
+    const unsigned shrunk = budget / 2;
+    atomic_store_explicit(&v->spinBudget, shrunk > floor ? shrunk : floor, memory_order_relaxed);
+}
+
+// sysconf() reads sysfs; MVars created per task (e.g. executor futures) can't afford that every time.
+static bool
+mvar_multi_cpu(void) {
+    static atomic_int cached;   // 0 unknown, 1 single, 2 multi
+    int c = atomic_load_explicit(&cached, memory_order_relaxed);
+    if (c == 0) {
+        c = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? 2 : 1;
+        atomic_store_explicit(&cached, c, memory_order_relaxed);
+    }
+    return c == 2;
+}
+
 void
-initMVar(void* const out_mvar, write_callback write, read_callback read) {
+initMVarAttr(MVarAttr* const out_attr) {
+    out_attr->spinLimit = MVAR_DEFAULT_SPIN_LIMIT;
+    out_attr->waitOrder = MVAR_WAIT_ANY;
+    out_attr->priorityInherit = false;
+}
+
+void
+initMVarWithAttr(void* const out_mvar, write_callback write, read_callback read, const MVarAttr* const attr) {
     MVar_abs* const v = out_mvar;
-    pthread_mutex_init(&v->lock, NULL);
-    pthread_cond_init(&v->putCond, NULL);
-    pthread_cond_init(&v->takeCond, NULL);
-    v->empty = true;
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    if (attr->priorityInherit) {
+        pthread_mutexattr_setprotocol(&mutex_attr, PTHREAD_PRIO_INHERIT);
+    }
+    pthread_mutex_init(&v->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    // Timed operations wait for CLOCK_MONOTONIC deadlines so that wall clock steps don't move them.
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&v->putCond, &cond_attr);
+    pthread_cond_init(&v->takeCond, &cond_attr);
+    pthread_cond_init(&v->readCond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    v->putWaiters = 0;
+    v->takeWaiters = 0;
+    v->readWaiters = 0;
+    v->selectWaiters = NULL;
+    v->asyncPutters = (MVarAsyncQueue) {NULL, NULL};
+    v->asyncTakers = (MVarAsyncQueue) {NULL, NULL};
+    v->asyncDone = (MVarAsyncQueue) {NULL, NULL};
+    v->executor = NULL;
+    v->executorContext = NULL;
+    v->fullNotify = NULL;
+    v->emptyNotify = NULL;
+    atomic_init(&v->empty, true);
     v->write = write;
     v->read = read;
+    // Nobody else can make progress while we spin on a single CPU.
+    v->spinLimit = mvar_multi_cpu() ? attr->spinLimit : 0;
+    atomic_init(&v->spinBudget, v->spinLimit < MVAR_SPIN_MIN ? v->spinLimit : MVAR_SPIN_MIN);
+    v->waitOrder = attr->waitOrder;
+#ifdef MVAR_STATS
+    memset(&v->stats, 0, sizeof v->stats);
+#endif
+}
+
+void
+initMVar(void* const out_mvar, write_callback write, read_callback read) {
+    MVarAttr attr;
+    initMVarAttr(&attr);
+    initMVarWithAttr(out_mvar, write, read, &attr);
 }
 
 void
@@ -57,137 +211,497 @@ initMVar_unit(MVar_abs* const out_mvar) {
 
 bool
 isEmptyMVar(const void* const mvar) {
-    return ((const MVar_abs*) mvar)->empty;
+    return mvar_is_empty((MVar_abs*) mvar);
+}
+
+// Wait on cond until the MVar is empty (want_empty) or full, counting ourselves in *waiters while blocked so
+// the other side knows whether to signal.  deadline is CLOCK_MONOTONIC, NULL to wait forever.  Called and
+// returns with v->lock held.  Loops on the predicate, so spurious wakeups and other threads getting there
+// first are harmless.  Returns 0, ETIMEDOUT or any other error of pthread_cond_timedwait(), e.g. EINVAL for a
+// deadline with tv_nsec out of range, which would fail every retry alike.
+static int
+mvar_wait_locked(MVar_abs* const v, pthread_cond_t* const cond, unsigned* const waiters, const bool want_empty,
+                 const struct timespec* const deadline) {
+#ifdef MVAR_STATS
+    const bool blocked = mvar_is_empty(v) != want_empty;
+    if (cond == &v->putCond) {
+        blocked ? MVAR_STAT_ADD(v, blockedPuts) : MVAR_STAT_ADD(v, fastPuts);
+    } else if (cond == &v->readCond) {
+        blocked ? MVAR_STAT_ADD(v, blockedReads) : MVAR_STAT_ADD(v, fastReads);
+    } else {
+        blocked ? MVAR_STAT_ADD(v, blockedTakes) : MVAR_STAT_ADD(v, fastTakes);
+    }
+#endif
+    while (mvar_is_empty(v) != want_empty) {
+        (*waiters)++;
+#ifdef MVAR_STATS
+        const uint64_t start = mvar_now_nsec();
+#endif
+        int err = deadline == NULL ? pthread_cond_wait(cond, &v->lock)
+                                   : pthread_cond_timedwait(cond, &v->lock, deadline);
+#ifdef MVAR_STATS
+        mvar_stat_time(v->stats.condWait, mvar_now_nsec() - start);
+#endif
+        (*waiters)--;
+        if (err != 0 && mvar_is_empty(v) != want_empty) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+// Lock v->lock, recording how long that took.
+static int
+mvar_lock(MVar_abs* const v) {
+#ifdef MVAR_STATS
+    if (pthread_mutex_trylock(&v->lock) == 0) {
+        mvar_stat_time(v->stats.lockWait, 0);
+        return 0;
+    }
+    const uint64_t start = mvar_now_nsec();
+    const int err = pthread_mutex_lock(&v->lock);
+    mvar_stat_time(v->stats.lockWait, mvar_now_nsec() - start);
+    return err;
+#else
+    return pthread_mutex_lock(&v->lock);
+#endif
+}
+
+static void
+mvar_async_push(MVarAsyncQueue* const q, MVarAsyncOp* const op) {
+    op->next = NULL;
+    if (q->tail != NULL) {
+        q->tail->next = op;
+    } else {
+        q->head = op;
+    }
+    q->tail = op;
+}
+
+// Queue op behind everything of at least its priority.  Everything but MVAR_WAIT_PRIORITY MVars has only
+// MVAR_DEFAULT_PRIORITY, which makes this FIFO.
+static void
+mvar_async_insert(MVar_abs* const v, MVarAsyncQueue* const q, MVarAsyncOp* const op) {
+    if (v->waitOrder != MVAR_WAIT_PRIORITY || q->tail == NULL || q->tail->priority >= op->priority) {
+        mvar_async_push(q, op);
+        return;
+    }
+    MVarAsyncOp** link = &q->head;
+    while ((*link)->priority >= op->priority) {
+        link = &(*link)->next;
+    }
+    op->next = *link;
+    *link = op;
+}
+
+static MVarAsyncOp*
+mvar_async_pop(MVarAsyncQueue* const q) {
+    MVarAsyncOp* const op = q->head;
+    q->head = op->next;
+    if (q->head == NULL) {
+        q->tail = NULL;
+    }
+    return op;
+}
+
+// Unlink op from q.  Returns false if it isn't there.
+static bool
+mvar_async_remove(MVarAsyncQueue* const q, MVarAsyncOp* const op) {
+    MVarAsyncOp* prev = NULL;
+    for (MVarAsyncOp* p = q->head; p != NULL; prev = p, p = p->next) {
+        if (p == op) {
+            if (prev != NULL) {
+                prev->next = p->next;
+            } else {
+                q->head = p->next;
+            }
+            if (q->tail == p) {
+                q->tail = prev;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// A thread blocked in MVAR_WAIT_FIFO or MVAR_WAIT_PRIORITY put or take.  Queued with the async operations,
+// told apart by a NULL callback.  Lives on the blocked thread's stack.
+typedef struct {
+    MVarAsyncOp op;
+    pthread_cond_t cond;
+    bool done;
+} mvar_waiter;
+
+// op has been done on its behalf.  Blocked threads are woken right away, async callbacks left in asyncDone
+// for mvar_unlock().
+static void
+mvar_complete_locked(MVar_abs* const v, MVarAsyncOp* const op) {
+    if (op->callback == NULL) {
+        mvar_waiter* const w = (mvar_waiter*) op;
+        w->done = true;
+        pthread_cond_signal(&w->cond);
+    } else {
+        mvar_async_push(&v->asyncDone, op);
+    }
+}
+
+// Complete queued operations for as long as the MVar's state lets them.
+static void
+mvar_settle_locked(MVar_abs* const v) {
+    for (;;) {
+        if (!mvar_is_empty(v) && v->asyncTakers.head != NULL) {
+            MVarAsyncOp* const op = mvar_async_pop(&v->asyncTakers);
+            v->read(op->data, v);
+            mvar_set_empty(v, true);
+            mvar_complete_locked(v, op);
+        } else if (mvar_is_empty(v) && v->asyncPutters.head != NULL) {
+            MVarAsyncOp* const op = mvar_async_pop(&v->asyncPutters);
+            v->write(v, op->data);
+            mvar_set_empty(v, false);
+            mvar_complete_locked(v, op);
+        } else {
+            return;
+        }
+    }
+}
+
+// Wake whoever waits for the state the MVar is in now.  When full, all pending readers can go at once; of
+// the takers only one can succeed.  Signals nobody when nobody waits.
+static void
+mvar_signal_locked(MVar_abs* const v) {
+    if (mvar_is_empty(v)) {
+        if (v->putWaiters > 0) {
+            pthread_cond_signal(&v->putCond);
+        }
+        if (v->emptyNotify != NULL) {
+            signalEventNotify(v->emptyNotify);
+        }
+        return;
+    }
+    if (v->readWaiters > 0) {
+        pthread_cond_broadcast(&v->readCond);
+    }
+    if (v->takeWaiters > 0) {
+        pthread_cond_signal(&v->takeCond);
+    }
+    for (struct mvar_select_waiter* w = v->selectWaiters; w != NULL; w = w->next) {
+        atomic_fetch_add_explicit(w->event, 1, memory_order_relaxed);
+        atomicWakeOne(w->event);
+    }
+    if (v->fullNotify != NULL) {
+        signalEventNotify(v->fullNotify);
+    }
+}
+
+// Write user_data into the empty MVar, let queued async takers have it, and wake the waiters.
+static void
+mvar_put_locked(MVar_abs* const v, const void* const user_data) {
+    v->write(v, user_data);
+    mvar_set_empty(v, false);
+    mvar_settle_locked(v);
+    mvar_signal_locked(v);
+}
+
+static void
+mvar_take_locked(void* const out_user_data, MVar_abs* const v) {
+    v->read(out_user_data, v);
+    mvar_set_empty(v, true);
+    mvar_settle_locked(v);
+    mvar_signal_locked(v);
+}
+
+// Queue as a waiter on q and sleep until a put or take has done our operation for us.  Lock held.
+static int
+mvar_wait_handoff_locked(MVar_abs* const v, MVarAsyncQueue* const q, void* const data, const int priority,
+                         const struct timespec* const deadline) {
+    mvar_waiter w;
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&w.cond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    w.op.data = data;
+    w.op.priority = priority;
+    w.op.callback = NULL;
+    w.done = false;
+    mvar_async_insert(v, q, &w.op);
+    int err = 0;
+    while (!w.done) {
+#ifdef MVAR_STATS
+        const uint64_t start = mvar_now_nsec();
+#endif
+        err = deadline == NULL ? pthread_cond_wait(&w.cond, &v->lock)
+                               : pthread_cond_timedwait(&w.cond, &v->lock, deadline);
+#ifdef MVAR_STATS
+        mvar_stat_time(v->stats.condWait, mvar_now_nsec() - start);
+#endif
+        if (err != 0 && !w.done) {
+            mvar_async_remove(q, &w.op);
+            break;
+        }
+    }
+    pthread_cond_destroy(&w.cond);
+    return w.done ? 0 : err;
+}
+
+// Put user_data once the MVar is empty, or have it put for us in an ordered MVar.  Lock held.
+static int
+mvar_put_wait_locked(MVar_abs* const v, const void* const user_data, const struct timespec* const deadline) {
+    if (v->waitOrder == MVAR_WAIT_ANY) {
+        const int err = mvar_wait_locked(v, &v->putCond, &v->putWaiters, true, deadline);
+        if (err != 0) {
+            return err;
+        }
+    } else if (!mvar_is_empty(v)) {
+        MVAR_STAT_ADD(v, blockedPuts);
+        return mvar_wait_handoff_locked(v, &v->asyncPutters, (void*) user_data, MVAR_DEFAULT_PRIORITY, deadline);
+    } else {
+        MVAR_STAT_ADD(v, fastPuts);
+    }
+    mvar_put_locked(v, user_data);
+    return 0;
+}
+
+static int
+mvar_take_wait_locked(void* const out_user_data, MVar_abs* const v, const int priority,
+                      const struct timespec* const deadline) {
+    if (v->waitOrder == MVAR_WAIT_ANY) {
+        const int err = mvar_wait_locked(v, &v->takeCond, &v->takeWaiters, false, deadline);
+        if (err != 0) {
+            return err;
+        }
+    } else if (mvar_is_empty(v)) {
+        MVAR_STAT_ADD(v, blockedTakes);
+        return mvar_wait_handoff_locked(v, &v->asyncTakers, out_user_data, priority, deadline);
+    } else {
+        MVAR_STAT_ADD(v, fastTakes);
+    }
+    mvar_take_locked(out_user_data, v);
+    return 0;
+}
+
+// Unlock, then call back the async operations completed while we held the lock.  Callbacks may use the MVar.
+static void
+mvar_unlock(MVar_abs* const v) {
+    MVarAsyncOp* op = v->asyncDone.head;
+    if (op == NULL) {
+        pthread_mutex_unlock(&v->lock);
+        return;
+    }
+    v->asyncDone = (MVarAsyncQueue) {NULL, NULL};
+    const mvar_executor executor = v->executor;
+    void* const executor_context = v->executorContext;
+    pthread_mutex_unlock(&v->lock);
+    while (op != NULL) {
+        // The callback may reuse op.
+        MVarAsyncOp* const next = op->next;
+        if (executor != NULL) {
+            executor(executor_context, op);
+        } else {
+            op->callback(op);
+        }
+        op = next;
+    }
+}
+
+void
+setMVarNotify(MVar_abs* const mvar, struct EventNotify* const on_full, struct EventNotify* const on_empty) {
+    pthread_mutex_lock(&mvar->lock);
+    mvar->fullNotify = on_full;
+    mvar->emptyNotify = on_empty;
+    pthread_mutex_unlock(&mvar->lock);
 }
 
 int
 putMVar(void* const mvar, const void* const user_data) {
     MVar_abs* const v = mvar;
-    int err = pthread_mutex_lock(&v->lock);
+    mvar_spin(v, true);
+    int err = mvar_lock(v);
     if (err != 0) {
         return err;
     }
-    if (!v->empty) {
-        pthread_cond_wait(&v->putCond, &v->lock);
-    }
-    v->write(v, user_data);
-    v->empty = false;
-    pthread_cond_signal(&v->takeCond);
-    pthread_mutex_unlock(&v->lock);
+    mvar_put_wait_locked(v, user_data, NULL);
+    mvar_unlock(v);
     return 0;
 }
 
 int
 readMVar(void* const out_user_data, void* const mvar) {
     MVar_abs* const v = mvar;
-    int err = pthread_mutex_lock(&v->lock);
+    mvar_spin(v, false);
+    int err = mvar_lock(v);
     if (err != 0) {
         return err;
     }
-    if (v->empty) {
-        pthread_cond_wait(&v->takeCond, &v->lock);
-    }
+    mvar_wait_locked(v, &v->readCond, &v->readWaiters, false, NULL);
     v->read(out_user_data, v);
-    pthread_mutex_unlock(&v->lock);
+    mvar_unlock(v);
     return 0;
 }
 
 int
-takeMVar(void* const out_user_data, void* const mvar) {
+takeMVarPrio(void* const out_user_data, void* const mvar, const int priority) {
     MVar_abs* const v = mvar;
-    int err = pthread_mutex_lock(&v->lock);
+    mvar_spin(v, false);
+    int err = mvar_lock(v);
     if (err != 0) {
         return err;
     }
-    if (v->empty) {
-        pthread_cond_wait(&v->takeCond, &v->lock);
-    }
-    v->read(out_user_data, v);
-    v->empty = true;
-    pthread_cond_signal(&v->putCond);
-    pthread_mutex_unlock(&v->lock);
+    mvar_take_wait_locked(out_user_data, v, priority, NULL);
+    mvar_unlock(v);
     return 0;
 }
 
-struct timespec
-timespec_add(struct timespec already_normalized_timesec, long int nano_second) {
-    already_normalized_timesec.tv_nsec += nano_second;
-    already_normalized_timesec.tv_sec += already_normalized_timesec.tv_nsec / 1000000000;
-    already_normalized_timesec.tv_nsec %= 1000000000;
-    return already_normalized_timesec;
+int
+takeMVar(void* const out_user_data, void* const mvar) {
+    return takeMVarPrio(out_user_data, mvar, MVAR_DEFAULT_PRIORITY);
+}
+
+static int
+mvar_clocklock(MVar_abs* const v, const struct timespec* const deadline) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+    return pthread_mutex_clocklock(&v->lock, CLOCK_MONOTONIC, deadline);
+#else
+    // Without pthread_mutex_clocklock the mutex only knows CLOCK_REALTIME.  Translate the remaining time.
+    int err = pthread_mutex_trylock(&v->lock);
+    if (err != EBUSY) {
+        return err;
+    }
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    real.tv_sec += deadline->tv_sec - mono.tv_sec;
+    real.tv_nsec += deadline->tv_nsec - mono.tv_nsec;
+    if (real.tv_nsec >= 1000000000) {
+        real.tv_sec++;
+        real.tv_nsec -= 1000000000;
+    } else if (real.tv_nsec < 0) {
+        real.tv_sec--;
+        real.tv_nsec += 1000000000;
+    }
+    return pthread_mutex_timedlock(&v->lock, &real);
+#endif
+}
+
+// Lock v->lock, giving up with ETIMEDOUT at the CLOCK_MONOTONIC deadline.
+static int
+mvar_lock_until(MVar_abs* const v, const struct timespec* const deadline) {
+#ifdef MVAR_STATS
+    if (pthread_mutex_trylock(&v->lock) == 0) {
+        mvar_stat_time(v->stats.lockWait, 0);
+        return 0;
+    }
+    const uint64_t start = mvar_now_nsec();
+    const int err = mvar_clocklock(v, deadline);
+    mvar_stat_time(v->stats.lockWait, mvar_now_nsec() - start);
+    if (err == ETIMEDOUT) {
+        MVAR_STAT_ADD(v, timeouts);
+    }
+    return err;
+#else
+    return mvar_clocklock(v, deadline);
+#endif
 }
 
 int
-timedPutMVar(void* const mvar, const long int timeout_in_msec, const void* const user_data) {
-    struct timespec now;
-    timespec_get(&now, TIME_UTC);
-    struct timespec tout = timespec_add(now, timeout_in_msec * 1000000);
+timedPutMVarUntil(void* const mvar, const struct timespec* const deadline, const void* const user_data) {
     MVar_abs* const v = mvar;
-    int err = pthread_mutex_timedlock(&v->lock, &tout);
+    mvar_spin(v, true);
+    int err = mvar_lock_until(v, deadline);
     if (err != 0) {
         // When timer expired, ETIMEDOUT is returned.
         return err;
     }
-    if (!v->empty) {
-        err = pthread_cond_timedwait(&v->putCond, &v->lock, &tout);
-        if (!v->empty) {
-            pthread_mutex_unlock(&v->lock);
-            return err;
-        }
+    err = mvar_put_wait_locked(v, user_data, deadline);
+    if (err == ETIMEDOUT) {
+        MVAR_STAT_ADD(v, timeouts);
     }
-    v->write(v, user_data);
-    v->empty = false;
-    pthread_cond_signal(&v->takeCond);
-    pthread_mutex_unlock(&v->lock);
-    return 0;
+    mvar_unlock(v);
+    return err;
 }
 
 int
-timedReadMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec) {
-    struct timespec now;
-    timespec_get(&now, TIME_UTC);
-    struct timespec tout = timespec_add(now, timeout_in_msec * 1000000);
+timedReadMVarUntil(void* const out_user_data, void* const mvar, const struct timespec* const deadline) {
     MVar_abs* const v = mvar;
-    int err = pthread_mutex_timedlock(&v->lock, &tout);
+    mvar_spin(v, false);
+    int err = mvar_lock_until(v, deadline);
     if (err != 0) {
         // When timer expired, ETIMEDOUT is returned.
         return err;
     }
-    if (v->empty) {
-        err = pthread_cond_timedwait(&v->takeCond, &v->lock, &tout);
-        if (v->empty) {
-            pthread_mutex_unlock(&v->lock);
-            return err;
-        }
+    err = mvar_wait_locked(v, &v->readCond, &v->readWaiters, false, deadline);
+    if (err == ETIMEDOUT) {
+        MVAR_STAT_ADD(v, timeouts);
     }
-    v->read(out_user_data, v);
-    pthread_mutex_unlock(&v->lock);
-    return 0;
+    if (err == 0) {
+        v->read(out_user_data, v);
+    }
+    mvar_unlock(v);
+    return err;
 }
 
-int
-timedTakeMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec) {
-    struct timespec now;
-    timespec_get(&now, TIME_UTC);
-    struct timespec tout = timespec_add(now, timeout_in_msec * 1000000);
-    MVar_abs* const v = mvar;
-    int err = pthread_mutex_timedlock(&v->lock, &tout);
+static int
+mvar_timed_take(void* const out_user_data, MVar_abs* const v, const int priority,
+                const struct timespec* const deadline) {
+    mvar_spin(v, false);
+    int err = mvar_lock_until(v, deadline);
     if (err != 0) {
         // When timer expired, ETIMEDOUT is returned.
         return err;
     }
-    if (v->empty) {
-        err = pthread_cond_timedwait(&v->takeCond, &v->lock, &tout);
-        if (v->empty) {
-            pthread_mutex_unlock(&v->lock);
-            return err;
-        }
+    err = mvar_take_wait_locked(out_user_data, v, priority, deadline);
+    if (err == ETIMEDOUT) {
+        MVAR_STAT_ADD(v, timeouts);
     }
-    v->read(out_user_data, v);
-    v->empty = true;
-    pthread_cond_signal(&v->putCond);
-    pthread_mutex_unlock(&v->lock);
-    return 0;
+    mvar_unlock(v);
+    return err;
+}
+
+int
+timedTakeMVarUntil(void* const out_user_data, void* const mvar, const struct timespec* const deadline) {
+    return mvar_timed_take(out_user_data, mvar, MVAR_DEFAULT_PRIORITY, deadline);
+}
+
+int
+timedTakeMVarPrio(void* const out_user_data, void* const mvar, const long int timeout_in_msec, const int priority) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return mvar_timed_take(out_user_data, mvar, priority, &deadline);
+}
+
+int
+timedPutMVarNsec(void* const mvar, const long long int timeout_in_nsec, const void* const user_data) {
+    const struct timespec deadline = monotonicDeadlineNsec(timeout_in_nsec);
+    return timedPutMVarUntil(mvar, &deadline, user_data);
+}
+
+int
+timedReadMVarNsec(void* const out_user_data, void* const mvar, const long long int timeout_in_nsec) {
+    const struct timespec deadline = monotonicDeadlineNsec(timeout_in_nsec);
+    return timedReadMVarUntil(out_user_data, mvar, &deadline);
+}
+
+int
+timedTakeMVarNsec(void* const out_user_data, void* const mvar, const long long int timeout_in_nsec) {
+    const struct timespec deadline = monotonicDeadlineNsec(timeout_in_nsec);
+    return timedTakeMVarUntil(out_user_data, mvar, &deadline);
+}
+
+int
+timedPutMVar(void* const mvar, const long int timeout_in_msec, const void* const user_data) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return timedPutMVarUntil(mvar, &deadline, user_data);
+}
+
+int
+timedReadMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return timedReadMVarUntil(out_user_data, mvar, &deadline);
+}
+
+int
+timedTakeMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return timedTakeMVarUntil(out_user_data, mvar, &deadline);
 }
 
 int
@@ -197,17 +711,18 @@ tryPutMVar(void* mvar, const void* const user_data)
     int err = pthread_mutex_trylock(&v->lock);
     if (err != 0) {
         // return EBUSY if v->lock is already locked.
+        MVAR_STAT_ADD(v, busy);
         return err;
     }
-    if (!v->empty) {
+    if (!mvar_is_empty(v)) {
         // MVar is not empty.  Return without waiting.
-        pthread_mutex_unlock(&v->lock);
+        mvar_unlock(v);
+        MVAR_STAT_ADD(v, busy);
         return EBUSY;
     }
-    v->write(v, user_data);
-    v->empty = false;
-    pthread_cond_signal(&v->takeCond);
-    pthread_mutex_unlock(&v->lock);
+    MVAR_STAT_ADD(v, fastPuts);
+    mvar_put_locked(v, user_data);
+    mvar_unlock(v);
     return 0;
 }
 
@@ -218,15 +733,18 @@ tryReadMVar(void* const out_user_data, void* const mvar)
     int err = pthread_mutex_trylock(&v->lock);
     if (err != 0) {
         // return EBUSY if v->lock is already locked.
+        MVAR_STAT_ADD(v, busy);
         return err;
     }
-    if (v->empty) {
+    if (mvar_is_empty(v)) {
         // MVar is empty.  Return without waiting.
-        pthread_mutex_unlock(&v->lock);
+        mvar_unlock(v);
+        MVAR_STAT_ADD(v, busy);
         return EBUSY;
     }
+    MVAR_STAT_ADD(v, fastReads);
     v->read(out_user_data, v);
-    pthread_mutex_unlock(&v->lock);
+    mvar_unlock(v);
     return 0;
 }
 
@@ -237,16 +755,260 @@ tryTakeMVar(void* const out_user_data, void* const mvar)
     int err = pthread_mutex_trylock(&v->lock);
     if (err != 0) {
         // return EBUSY if v->lock is already locked.
+        MVAR_STAT_ADD(v, busy);
         return err;
     }
-    if (v->empty) {
+    if (mvar_is_empty(v)) {
         // MVar is empty.  Return without waiting.
-        pthread_mutex_unlock(&v->lock);
+        mvar_unlock(v);
+        MVAR_STAT_ADD(v, busy);
         return EBUSY;
     }
-    v->read(out_user_data, v);
-    v->empty = true;
-    pthread_cond_signal(&v->putCond);
-    pthread_mutex_unlock(&v->lock);
+    MVAR_STAT_ADD(v, fastTakes);
+    mvar_take_locked(out_user_data, v);
+    mvar_unlock(v);
+    return 0;
+}
+
+int
+putManyMVar(void* const mvar, const void* const user_data, const size_t stride, const size_t n) {
+    MVar_abs* const v = mvar;
+    mvar_spin(v, true);
+    int err = mvar_lock(v);
+    if (err != 0) {
+        return err;
+    }
+    const char* data = user_data;
+    for (size_t i = 0; i < n; i++, data += stride) {
+        mvar_put_wait_locked(v, data, NULL);
+    }
+    mvar_unlock(v);
+    return 0;
+}
+
+int
+takeManyMVar(void* const out_user_data, const size_t stride, void* const mvar, const size_t n) {
+    MVar_abs* const v = mvar;
+    mvar_spin(v, false);
+    int err = mvar_lock(v);
+    if (err != 0) {
+        return err;
+    }
+    char* out = out_user_data;
+    for (size_t i = 0; i < n; i++, out += stride) {
+        mvar_take_wait_locked(out, v, MVAR_DEFAULT_PRIORITY, NULL);
+    }
+    mvar_unlock(v);
     return 0;
 }
+
+int
+getMVarStats(const void* const mvar, MVarStats* const out_stats) {
+#ifdef MVAR_STATS
+    MVar_abs* const v = (MVar_abs*) mvar;
+    out_stats->fastPuts = atomic_load_explicit(&v->stats.fastPuts, memory_order_relaxed);
+    out_stats->blockedPuts = atomic_load_explicit(&v->stats.blockedPuts, memory_order_relaxed);
+    out_stats->fastReads = atomic_load_explicit(&v->stats.fastReads, memory_order_relaxed);
+    out_stats->blockedReads = atomic_load_explicit(&v->stats.blockedReads, memory_order_relaxed);
+    out_stats->fastTakes = atomic_load_explicit(&v->stats.fastTakes, memory_order_relaxed);
+    out_stats->blockedTakes = atomic_load_explicit(&v->stats.blockedTakes, memory_order_relaxed);
+    out_stats->timeouts = atomic_load_explicit(&v->stats.timeouts, memory_order_relaxed);
+    out_stats->busy = atomic_load_explicit(&v->stats.busy, memory_order_relaxed);
+    for (size_t i = 0; i < MVAR_STATS_BUCKETS; i++) {
+        out_stats->lockWait[i] = atomic_load_explicit(&v->stats.lockWait[i], memory_order_relaxed);
+        out_stats->condWait[i] = atomic_load_explicit(&v->stats.condWait[i], memory_order_relaxed);
+    }
+    return 0;
+#else
+    (void) mvar;
+    memset(out_stats, 0, sizeof *out_stats);
+    return ENOTSUP;
+#endif
+}
+
+void*
+allocMVarArray(const size_t count, const size_t elem_size, size_t* const out_stride) {
+    if (elem_size > SIZE_MAX - (MVAR_CACHE_LINE_SIZE - 1)) {
+        return NULL;
+    }
+    const size_t stride = (elem_size + MVAR_CACHE_LINE_SIZE - 1) / MVAR_CACHE_LINE_SIZE * MVAR_CACHE_LINE_SIZE;
+    *out_stride = stride;
+    if (stride != 0 && count > SIZE_MAX / stride) {
+        return NULL;
+    }
+    return aligned_alloc(MVAR_CACHE_LINE_SIZE, stride * count);
+}
+
+// Take from the first full MVar of the set.  try_lock skips MVars whose lock is busy instead of waiting for it.
+// Returns EBUSY when none is full.
+static int
+mvar_select_scan(void* const* const outs, MVar_abs* const* const set, const size_t n, const bool try_lock,
+                 size_t* const which) {
+    for (size_t i = 0; i < n; i++) {
+        MVar_abs* const v = set[i];
+        if (try_lock ? pthread_mutex_trylock(&v->lock) != 0 : pthread_mutex_lock(&v->lock) != 0) {
+            continue;
+        }
+        // Not a bypass of the ordered handoff: in an ordered MVar every put settles queued takers first, so a
+        // value still here when we hold the lock is one no queued taker wants.
+        if (!mvar_is_empty(v)) {
+            mvar_take_locked(outs[i], v);
+            mvar_unlock(v);
+            *which = i;
+            return 0;
+        }
+        mvar_unlock(v);
+    }
+    return EBUSY;
+}
+
+static void
+mvar_select_link(MVar_abs* const v, struct mvar_select_waiter* const w) {
+    pthread_mutex_lock(&v->lock);
+    w->prev = NULL;
+    w->next = v->selectWaiters;
+    if (w->next != NULL) {
+        w->next->prev = w;
+    }
+    v->selectWaiters = w;
+    mvar_unlock(v);
+}
+
+static void
+mvar_select_unlink(MVar_abs* const v, struct mvar_select_waiter* const w) {
+    pthread_mutex_lock(&v->lock);
+    if (w->prev != NULL) {
+        w->prev->next = w->next;
+    } else {
+        v->selectWaiters = w->next;
+    }
+    if (w->next != NULL) {
+        w->next->prev = w->prev;
+    }
+    mvar_unlock(v);
+}
+
+int
+timedSelectTakeMVarUntil(void* const* const outs, MVar_abs* const* const set, const size_t n,
+                         const struct timespec* const deadline, size_t* const which) {
+    if (n == 0 || n > MVAR_SELECT_MAX) {
+        return EINVAL;
+    }
+    int err = mvar_select_scan(outs, set, n, false, which);
+    if (err != EBUSY) {
+        return err;
+    }
+    atomic_uint event;
+    atomic_init(&event, 0);
+    struct mvar_select_waiter waiters[MVAR_SELECT_MAX];
+    for (size_t i = 0; i < n; i++) {
+        waiters[i].event = &event;
+        mvar_select_link(set[i], &waiters[i]);
+    }
+    for (;;) {
+        // A put after this load, even one racing with the scan, bumps event and fails the wait.
+        const unsigned seen = atomic_load_explicit(&event, memory_order_relaxed);
+        err = mvar_select_scan(outs, set, n, false, which);
+        if (err != EBUSY) {
+            break;
+        }
+        const int wait_err = atomicWait(&event, seen, deadline);
+        if (wait_err != 0 && wait_err != EINTR) {
+            err = wait_err;
+            break;
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        mvar_select_unlink(set[i], &waiters[i]);
+    }
+    return err;
+}
+
+int
+selectTakeMVar(void* const* const outs, MVar_abs* const* const set, const size_t n, size_t* const which) {
+    return timedSelectTakeMVarUntil(outs, set, n, NULL, which);
+}
+
+int
+timedSelectTakeMVar(void* const* const outs, MVar_abs* const* const set, const size_t n,
+                    const long int timeout_in_msec, size_t* const which) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return timedSelectTakeMVarUntil(outs, set, n, &deadline, which);
+}
+
+int
+trySelectTakeMVar(void* const* const outs, MVar_abs* const* const set, const size_t n, size_t* const which) {
+    if (n == 0 || n > MVAR_SELECT_MAX) {
+        return EINVAL;
+    }
+    return mvar_select_scan(outs, set, n, true, which);
+}
+
+static void
+mvar_async_init(MVarAsyncOp* const op, void* const data, mvar_async_callback callback, void* const context) {
+    op->next = NULL;
+    op->data = data;
+    op->priority = MVAR_DEFAULT_PRIORITY;
+    op->callback = callback;
+    op->context = context;
+}
+
+int
+putMVarAsync(void* const mvar, const void* const user_data, MVarAsyncOp* const op, mvar_async_callback callback,
+             void* const context) {
+    MVar_abs* const v = mvar;
+    int err = mvar_lock(v);
+    if (err != 0) {
+        return err;
+    }
+    if (mvar_is_empty(v)) {
+        MVAR_STAT_ADD(v, fastPuts);
+        mvar_put_locked(v, user_data);
+    } else {
+        mvar_async_init(op, (void*) user_data, callback, context);
+        mvar_async_insert(v, &v->asyncPutters, op);
+        MVAR_STAT_ADD(v, blockedPuts);
+        err = EINPROGRESS;
+    }
+    mvar_unlock(v);
+    return err;
+}
+
+int
+takeMVarAsync(void* const out_user_data, void* const mvar, MVarAsyncOp* const op, mvar_async_callback callback,
+              void* const context) {
+    MVar_abs* const v = mvar;
+    int err = mvar_lock(v);
+    if (err != 0) {
+        return err;
+    }
+    if (!mvar_is_empty(v)) {
+        MVAR_STAT_ADD(v, fastTakes);
+        mvar_take_locked(out_user_data, v);
+    } else {
+        mvar_async_init(op, out_user_data, callback, context);
+        mvar_async_insert(v, &v->asyncTakers, op);
+        MVAR_STAT_ADD(v, blockedTakes);
+        err = EINPROGRESS;
+    }
+    mvar_unlock(v);
+    return err;
+}
+
+int
+cancelMVarAsync(void* const mvar, MVarAsyncOp* const op) {
+    MVar_abs* const v = mvar;
+    pthread_mutex_lock(&v->lock);
+    const bool removed = mvar_async_remove(&v->asyncTakers, op) || mvar_async_remove(&v->asyncPutters, op);
+    mvar_unlock(v);
+    return removed ? 0 : ENOENT;
+}
+
+void
+setMVarExecutor(void* const mvar, mvar_executor executor, void* const executor_context) {
+    MVar_abs* const v = mvar;
+    pthread_mutex_lock(&v->lock);
+    v->executor = executor;
+    v->executorContext = executor_context;
+    mvar_unlock(v);
+}
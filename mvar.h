@@ -28,22 +28,149 @@
 //  MVar is one element only thread safe queue.
 //  This is MVar implementation in C and pthread.
 //
+//  MVar_abs keeps what every operation writes apart from what it only reads, each group starting on its own
+//  cache line, so threads spinning on or locking an MVar don't keep invalidating the callbacks and settings
+//  read by all the others.  MVar_abs is therefore aligned to MVAR_CACHE_LINE_SIZE, and so are structs built
+//  on it; allocate them dynamically with allocMVarArray() or aligned_alloc().
+//
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <pthread.h>
+#include <time.h>
+
+// Assumed cache line size for padding shared state apart.
+#define MVAR_CACHE_LINE_SIZE 64
 
 typedef void (*write_callback)(void* const mvar_context, const void* const user_data);
 typedef void (*read_callback)(void* const out_user_data, void* const mvar_context);
 
+struct mvar_select_waiter;
+struct EventNotify;
+
+typedef struct MVarAsyncOp MVarAsyncOp;
+typedef void (*mvar_async_callback)(MVarAsyncOp* const op);
+// Runs, or arranges to run, op->callback(op) on behalf of the thread which completed op.
+typedef void (*mvar_executor)(void* const executor_context, MVarAsyncOp* const op);
+
+// A pending putMVarAsync() or takeMVarAsync().  Owned by the caller, who keeps it alive and untouched until
+// the callback runs or cancelMVarAsync() succeeds.
+struct MVarAsyncOp {
+    MVarAsyncOp* next;
+    void* data;                 // out_user_data of a take, user_data of a put
+    int priority;               // MVAR_WAIT_PRIORITY order, MVAR_DEFAULT_PRIORITY for async operations
+    mvar_async_callback callback;
+    void* context;              // for the callback, untouched by MVar
+};
+
 typedef struct {
-    pthread_mutex_t lock;
+    MVarAsyncOp* head;
+    MVarAsyncOp* tail;
+} MVarAsyncQueue;
+
+// How threads blocked in put and take are woken.
+typedef enum {
+    // Condition variables.  Whoever the scheduler picks, or a thread arriving meanwhile, gets the value.
+    MVAR_WAIT_ANY,
+    // Blocked threads queue up in an explicit waiter list and a put or take hands the value directly to the
+    // first of them, which then owns it before it even runs.  Nobody can barge in.  Readers only see values
+    // no queued taker claims.
+    MVAR_WAIT_FIFO,
+    // As FIFO, ordered by the priority passed to the Prio operations, highest first, FIFO among equals.
+    MVAR_WAIT_PRIORITY,
+} MVarWaitOrder;
+
+// Priority of put, take and async operations that take none.
+#define MVAR_DEFAULT_PRIORITY 0
+
+// Histogram buckets of MVarStats.  Bucket 0 counts waits of no time at all, bucket i > 0 waits of 2^(i-1) to
+// 2^i - 1 nanoseconds, the last bucket everything longer.
+#define MVAR_STATS_BUCKETS 32
+
+// Snapshot of the counters an MVar keeps when the library is built with MVAR_STATS defined.  An operation
+// is fast when it never waited on a condition variable, blocked when it did; async operations count as
+// blocked when queued.  Lock waits are measured in every put, read, take and async operation.
+typedef struct {
+    size_t fastPuts;
+    size_t blockedPuts;
+    size_t fastReads;
+    size_t blockedReads;
+    size_t fastTakes;
+    size_t blockedTakes;
+    size_t timeouts;            // ETIMEDOUT from timed operations
+    size_t busy;                // EBUSY from try operations
+    size_t lockWait[MVAR_STATS_BUCKETS];
+    size_t condWait[MVAR_STATS_BUCKETS];
+} MVarStats;
+
+#ifdef MVAR_STATS
+typedef struct {
+    atomic_size_t fastPuts;
+    atomic_size_t blockedPuts;
+    atomic_size_t fastReads;
+    atomic_size_t blockedReads;
+    atomic_size_t fastTakes;
+    atomic_size_t blockedTakes;
+    atomic_size_t timeouts;
+    atomic_size_t busy;
+    atomic_size_t lockWait[MVAR_STATS_BUCKETS];
+    atomic_size_t condWait[MVAR_STATS_BUCKETS];
+} MVarStatsCounters;
+#endif
+
+typedef struct {
+    // Written by every operation, under the lock unless atomic.
+    _Alignas(MVAR_CACHE_LINE_SIZE) pthread_mutex_t lock;
     pthread_cond_t putCond;
     pthread_cond_t takeCond;
-    bool empty;
-    write_callback write;
+    pthread_cond_t readCond;
+    // Threads blocked in each condition.  Nobody gets signalled when nobody waits.
+    unsigned putWaiters;
+    unsigned takeWaiters;
+    unsigned readWaiters;
+    // Threads blocked in selectTakeMVar() with this MVar in their set.
+    struct mvar_select_waiter* selectWaiters;
+    // Pending async operations, in arrival order, and those completed but not yet called back.
+    MVarAsyncQueue asyncPutters;
+    MVarAsyncQueue asyncTakers;
+    MVarAsyncQueue asyncDone;
+    atomic_bool empty;
+    atomic_uint spinBudget;
+    // Read by every operation, written only by init and the set functions.
+    _Alignas(MVAR_CACHE_LINE_SIZE) write_callback write;
     read_callback read;
+    unsigned spinLimit;
+    MVarWaitOrder waitOrder;
+    mvar_executor executor;
+    void* executorContext;
+    // Optional pollable notifications, see setMVarNotify().
+    struct EventNotify* fullNotify;
+    struct EventNotify* emptyNotify;
+#ifdef MVAR_STATS
+    // MVAR_STATS changes the layout: define it for the library and all its users alike, or for neither.
+    _Alignas(MVAR_CACHE_LINE_SIZE) MVarStatsCounters stats;
+#endif
 } MVar_abs;
 
+// Default MVarAttr.spinLimit.  Roughly a few microseconds of pause instructions.
+#define MVAR_DEFAULT_SPIN_LIMIT 1024
+
+typedef struct {
+    // Blocking operations (put, read, take and their timed and many forms) first spin up to this many pause
+    // iterations, with exponential backoff, waiting for the other side.  The budget actually used adapts
+    // between a small floor and spinLimit by how often spinning paid off.  0 disables spinning; it is
+    // always disabled on a single CPU host.
+    unsigned spinLimit;
+    // MVAR_WAIT_ANY by default.
+    MVarWaitOrder waitOrder;
+    // Make the lock a PTHREAD_PRIO_INHERIT mutex, so that a low priority thread holding it runs at the
+    // priority of the highest one waiting for it.  false by default.
+    bool priorityInherit;
+} MVarAttr;
+
+void initMVarAttr(MVarAttr* const out_attr);
+void initMVarWithAttr(void* const out_mvar, write_callback write, read_callback read, const MVarAttr* const attr);
+// Initialize MVar with default attributes.
 void initMVar(void* const out_mvar, write_callback put, read_callback read);
 // Initialize MVar with no context.  Emulates MVar ().
 void initMVar_unit(MVar_abs* const out_mvar);
@@ -51,11 +178,83 @@ bool isEmptyMVar(const void* const mvar);
 int putMVar(void* const mvar, const void* const user_data);
 int readMVar(void* const out_user_data, void* const mvar);
 int takeMVar(void* const out_user_data, void* const mvar);
+// Take with the given priority.  Only MVAR_WAIT_PRIORITY MVars look at it.
+int takeMVarPrio(void* const out_user_data, void* const mvar, const int priority);
+int timedTakeMVarPrio(void* const out_user_data, void* const mvar, const long int timeout_in_msec, const int priority);
 int timedPutMVar(void* const mvar, const long int timeout_in_msec, const void* const user_data);
 int timedReadMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec);
 int timedTakeMVar(void* const out_user_data, void* const mvar, const long int timeout_in_msec);
+// Timed operations measure their timeouts on CLOCK_MONOTONIC.  The Until forms take an absolute
+// CLOCK_MONOTONIC deadline, e.g. from monotonicDeadline() in atomic_wait.h, which a retry loop can compute
+// once and reuse across calls.  The Nsec forms take a relative timeout in nanoseconds.  An operation which
+// has to wait on a deadline with tv_nsec outside 0 to 999999999 returns EINVAL.
+int timedPutMVarUntil(void* const mvar, const struct timespec* const deadline, const void* const user_data);
+int timedReadMVarUntil(void* const out_user_data, void* const mvar, const struct timespec* const deadline);
+int timedTakeMVarUntil(void* const out_user_data, void* const mvar, const struct timespec* const deadline);
+int timedPutMVarNsec(void* const mvar, const long long int timeout_in_nsec, const void* const user_data);
+int timedReadMVarNsec(void* const out_user_data, void* const mvar, const long long int timeout_in_nsec);
+int timedTakeMVarNsec(void* const out_user_data, void* const mvar, const long long int timeout_in_nsec);
 int tryPutMVar(void* mvar, const void* const user_data);
 int tryReadMVar(void* const out_user_data, void* const mvar);
 int tryTakeMVar(void* const out_user_data, void* const mvar);
+// Signal on_full whenever the MVar becomes full and on_empty whenever it becomes empty, so that an event loop
+// can poll their descriptors (eventnotify.h) and use the try operations when woken.  Either may be NULL, and
+// both are NULL after init.  Takes the lock, so notifiers can be attached to an MVar already in use.
+void setMVarNotify(MVar_abs* const mvar, struct EventNotify* const on_full, struct EventNotify* const on_empty);
+// Callback based put and take for user space schedulers.  When the operation can be done at once it is
+// done, the callback is not called and 0 is returned.  Otherwise op is queued in the MVar and EINPROGRESS
+// returned; the thread whose put or take later makes room for op completes it as part of that operation
+// and, after unlocking, calls callback(op) or hands op to the MVar's executor.  user_data of a put is copied
+// only at completion, so it must stay valid until then.  Queued operations are completed in arrival order
+// and ahead of threads blocked in the synchronous operations.
+int putMVarAsync(void* const mvar, const void* const user_data, MVarAsyncOp* const op, mvar_async_callback callback,
+                 void* const context);
+int takeMVarAsync(void* const out_user_data, void* const mvar, MVarAsyncOp* const op, mvar_async_callback callback,
+                  void* const context);
+// Withdraw a queued op.  Returns 0 if it was still queued, ENOENT if it has completed or is about to be called
+// back.
+int cancelMVarAsync(void* const mvar, MVarAsyncOp* const op);
+// Hand completed async operations to executor(executor_context, op) instead of calling them back inline.
+// executor NULL restores inline callbacks, which is the default.
+void setMVarExecutor(void* const mvar, mvar_executor executor, void* const executor_context);
+// Copy the MVar's counters to *out_stats.  Returns 0, or ENOTSUP when built without MVAR_STATS.
+int getMVarStats(const void* const mvar, MVarStats* const out_stats);
+// Allocate count MVars of elem_size bytes each, MVar_abs or FastMVar based structs, with every element
+// starting on its own cache line so that per thread MVars in the array don't false share.  The distance
+// between elements is stored in *out_stride; use mVarArrayAt() to index.  Release with free().  NULL when out
+// of memory or when count elements don't fit in a size_t.
+void* allocMVarArray(const size_t count, const size_t elem_size, size_t* const out_stride);
+
+static inline void*
+mVarArrayAt(void* const array, const size_t stride, const size_t index) {
+    return (char*) array + stride * index;
+}
+
+// Move n elements, element i at user_data + i * stride, through the MVar one after another under a single
+// acquisition of its lock.  Blocks until all n are moved; the lock is only given up while waiting.
+// Unlike takeManyBoundedQueue() these are all-or-nothing: an MVar holds one value, so a take that returned
+// what was available without waiting would always return exactly one element and save nothing over
+// takeMVar().  The batch win is the shared lock acquisition and the handoff between a putManyMVar() and a
+// takeManyMVar() running against each other, each element waking its peer directly.
+int putManyMVar(void* const mvar, const void* const user_data, const size_t stride, const size_t n);
+int takeManyMVar(void* const out_user_data, const size_t stride, void* const mvar, const size_t n);
+
+// Most MVars one selectTakeMVar() can wait on.
+#define MVAR_SELECT_MAX 64
+
+// Take from whichever of the n MVars set[0] ... set[n - 1] is full first, into outs[i] for set[i], and store
+// i in *which.  When several are full the lowest index wins, so put e.g. a shutdown MVar first to have it
+// served ahead of the others.  A blocked selector is registered with every MVar in the set and sleeps until
+// one of them is put to, without polling.  The timed forms return ETIMEDOUT, the try form EBUSY when none is
+// full.  n must be 1 to MVAR_SELECT_MAX, otherwise EINVAL.
+// Selectors ignore waitOrder.  They don't join the FIFO or priority queue of an MVAR_WAIT_FIFO or
+// MVAR_WAIT_PRIORITY MVar, so a put hands its value to a queued taker first, however long a selector has
+// waited.  A selector only gets a value no queued taker claims, and selectors are served in no particular order.
+int selectTakeMVar(void* const* const outs, MVar_abs* const* const set, const size_t n, size_t* const which);
+int timedSelectTakeMVar(void* const* const outs, MVar_abs* const* const set, const size_t n,
+                        const long int timeout_in_msec, size_t* const which);
+int timedSelectTakeMVarUntil(void* const* const outs, MVar_abs* const* const set, const size_t n,
+                             const struct timespec* const deadline, size_t* const which);
+int trySelectTakeMVar(void* const* const outs, MVar_abs* const* const set, const size_t n, size_t* const which);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,154 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// sched_getcpu() is a GNU extension.
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "numaalloc.h"
+
+// From <numaif.h>, which comes with libnuma rather than the C library.
+#define NUMA_MPOL_PREFERRED 1
+// Most CPUs the CPU to node table covers.  Any beyond count as node 0.
+#define NUMA_MAX_CPUS 4096
+
+static pthread_once_t numa_once = PTHREAD_ONCE_INIT;
+static int numa_nodes = 1;
+static unsigned short numa_cpu_node[NUMA_MAX_CPUS];
+
+#ifdef __linux__
+// Call mark(id, arg) for every id of a sysfs list such as "0-3,8,10-11".
+static void
+numa_parse_list(const char* const path, void (*mark)(const unsigned id, const int arg), const int arg) {
+    FILE* const f = fopen(path, "r");
+    if (f == NULL) {
+        return;
+    }
+    unsigned lo, hi;
+    int c;
+    while (fscanf(f, "%u", &lo) == 1) {
+        hi = lo;
+        c = fgetc(f);
+        if (c == '-') {
+            if (fscanf(f, "%u", &hi) != 1) {
+                break;
+            }
+            c = fgetc(f);
+        }
+        for (unsigned id = lo; id <= hi; id++) {
+            mark(id, arg);
+        }
+        if (c != ',') {
+            break;
+        }
+    }
+    fclose(f);
+}
+
+static void
+numa_mark_node(const unsigned node, const int arg) {
+    (void) arg;
+    if ((int) node + 1 > numa_nodes) {
+        numa_nodes = (int) node + 1;
+    }
+}
+
+static void
+numa_mark_cpu(const unsigned cpu, const int node) {
+    if (cpu < NUMA_MAX_CPUS) {
+        numa_cpu_node[cpu] = (unsigned short) node;
+    }
+}
+#endif
+
+static void
+numa_init(void) {
+#ifdef __linux__
+    numa_parse_list("/sys/devices/system/node/online", numa_mark_node, 0);
+    for (int node = 0; node < numa_nodes; node++) {
+        char path[64];
+        snprintf(path, sizeof path, "/sys/devices/system/node/node%d/cpulist", node);
+        numa_parse_list(path, numa_mark_cpu, node);
+    }
+#endif
+}
+
+int
+numaNodeCount(void) {
+    pthread_once(&numa_once, numa_init);
+    return numa_nodes;
+}
+
+int
+currentNumaNode(void) {
+    pthread_once(&numa_once, numa_init);
+#ifdef __linux__
+    const int cpu = sched_getcpu();
+    return cpu >= 0 && cpu < NUMA_MAX_CPUS ? numa_cpu_node[cpu] : 0;
+#else
+    return 0;
+#endif
+}
+
+void*
+allocOnNumaNode(const size_t size, const int node) {
+#ifdef __linux__
+    void* const memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+    if (node >= 0 && node < numaNodeCount() && numa_nodes > 1) {
+        unsigned long mask[(NUMA_MAX_CPUS + 8 * sizeof(unsigned long) - 1) / (8 * sizeof(unsigned long))] = {0};
+        mask[node / (8 * sizeof(unsigned long))] = 1ul << (node % (8 * sizeof(unsigned long)));
+        // Best effort.  Without it the pages land wherever first touched.
+        syscall(SYS_mbind, memory, size, NUMA_MPOL_PREFERRED, mask, (unsigned long) node + 2, 0u);
+    }
+    return memory;
+#else
+    (void) node;
+    return calloc(1, size);
+#endif
+}
+
+void
+freeOnNumaNode(void* const memory, const size_t size) {
+#ifdef __linux__
+    if (memory != NULL) {
+        munmap(memory, size);
+    }
+#else
+    (void) size;
+    free(memory);
+#endif
+}
@@ -0,0 +1,56 @@
+#ifndef NUMAALLOC_H
+#define NUMAALLOC_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  NUMA placement for MVars and queues.  Memory is mapped with mmap() and bound to the preferred node with
+//  mbind() before anything touches it, so its pages come from that node's memory.  Placement is best effort:
+//  the kernel may still fall back to other nodes, and where NUMA is unknown (single node hosts, no mbind,
+//  non Linux systems) everything behaves as node 0 and the memory is placed wherever it is first touched.
+//  No libnuma needed.
+//
+#include <stddef.h>
+
+// Number of online NUMA nodes, at least 1.
+int numaNodeCount(void);
+// Node of the CPU the calling thread runs on right now.  Cheap: sched_getcpu() and a table lookup.
+int currentNumaNode(void);
+// Page aligned, zero filled memory of size bytes preferably on node; node < 0 means no preference.  NULL
+// when out of memory.  Release with freeOnNumaNode() and the same size.
+void* allocOnNumaNode(const size_t size, const int node);
+void freeOnNumaNode(void* const memory, const size_t size);
+
+// An MVar_abs or FastMVar based struct of elem_size bytes on node.  Initialize it as usual.
+static inline void*
+allocMVarOnNumaNode(const size_t elem_size, const int node) {
+    return allocOnNumaNode(elem_size, node);
+}
+
+static inline void
+freeMVarOnNumaNode(void* const mvar, const size_t elem_size) {
+    freeOnNumaNode(mvar, elem_size);
+}
+
+#endif
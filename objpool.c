@@ -0,0 +1,185 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "objpool.h"
+
+#define OBJPOOL_TAG ((uint64_t) 1 << 32)
+#define OBJPOOL_LINK_MASK (OBJPOOL_TAG - 1)
+
+static size_t
+round_up(const size_t n, const size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+// Link `first` ... `last`, already chained through next[], onto the global list.
+static void
+obj_pool_push(ObjPool* const p, const uint32_t first, const uint32_t last) {
+    uint64_t top = atomic_load_explicit(&p->freeTop, memory_order_relaxed);
+    do {
+        atomic_store_explicit(&p->next[last], (uint32_t) (top & OBJPOOL_LINK_MASK), memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&p->freeTop, &top,
+                                                    ((top & ~OBJPOOL_LINK_MASK) + OBJPOOL_TAG) | (first + 1),
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+// Unlink up to n objects from the global list into out.  Returns how many.
+static size_t
+obj_pool_pop(ObjPool* const p, uint32_t* const out, const size_t n) {
+    uint64_t top = atomic_load_explicit(&p->freeTop, memory_order_acquire);
+    size_t got;
+    uint32_t link;
+    do {
+        // The links may change under us; the tag then fails the compare and swap and we walk them again.
+        got = 0;
+        link = (uint32_t) (top & OBJPOOL_LINK_MASK);
+        while (got < n && link != 0) {
+            out[got++] = link - 1;
+            link = atomic_load_explicit(&p->next[link - 1], memory_order_relaxed);
+        }
+        if (got == 0) {
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&p->freeTop, &top, ((top & ~OBJPOOL_LINK_MASK) + OBJPOOL_TAG) | link,
+                                                    memory_order_acquire, memory_order_acquire));
+    return got;
+}
+
+// Move the n least recently freed objects from the cache to the global list.  The hot ones stay.
+static void
+obj_pool_spill(ObjPoolCache* const c, const size_t n) {
+    ObjPool* const p = c->pool;
+    const uint32_t* const batch = c->objs;
+    for (size_t i = 0; i + 1 < n; i++) {
+        atomic_store_explicit(&p->next[batch[i]], batch[i + 1] + 1, memory_order_relaxed);
+    }
+    obj_pool_push(p, batch[0], batch[n - 1]);
+    c->len -= n;
+    memmove(c->objs, c->objs + n, c->len * sizeof c->objs[0]);
+}
+
+int
+initObjPool(ObjPool* const out_pool, const size_t obj_size, const size_t count) {
+    ObjPool* const p = out_pool;
+    if (obj_size == 0 || count == 0 || count >= OBJPOOL_LINK_MASK) {
+        return EINVAL;
+    }
+    p->stride = round_up(obj_size, MVAR_CACHE_LINE_SIZE);
+    p->count = count;
+    p->slab = aligned_alloc(MVAR_CACHE_LINE_SIZE, count * p->stride);
+    p->next = malloc(count * sizeof *p->next);
+    p->owner = calloc(count, sizeof *p->owner);
+    if (p->slab == NULL || p->next == NULL || p->owner == NULL) {
+        free(p->slab);
+        free((void*) p->next);
+        free(p->owner);
+        return ENOMEM;
+    }
+    for (size_t i = 0; i < count; i++) {
+        atomic_init(&p->next[i], i + 1 < count ? (uint32_t) (i + 2) : 0);
+    }
+    atomic_init(&p->freeTop, 1);
+    atomic_init(&p->hits, 0);
+    atomic_init(&p->misses, 0);
+    atomic_init(&p->crossReturns, 0);
+    atomic_init(&p->nextCacheId, 1);
+    return 0;
+}
+
+void
+destroyObjPool(ObjPool* const pool) {
+    free(pool->slab);
+    free((void*) pool->next);
+    free(pool->owner);
+}
+
+void
+initObjPoolCache(ObjPoolCache* const out_cache, ObjPool* const pool) {
+    out_cache->pool = pool;
+    out_cache->id = atomic_fetch_add_explicit(&pool->nextCacheId, 1, memory_order_relaxed);
+    out_cache->len = 0;
+    out_cache->stats = (ObjPoolStats) {0, 0, 0};
+}
+
+void
+destroyObjPoolCache(ObjPoolCache* const cache) {
+    ObjPool* const p = cache->pool;
+    if (cache->len > 0) {
+        obj_pool_spill(cache, cache->len);
+    }
+    atomic_fetch_add_explicit(&p->hits, cache->stats.hits, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->misses, cache->stats.misses, memory_order_relaxed);
+    atomic_fetch_add_explicit(&p->crossReturns, cache->stats.crossReturns, memory_order_relaxed);
+}
+
+void*
+objPoolAlloc(ObjPool* const pool, ObjPoolCache* const cache) {
+    uint32_t index;
+    if (cache == NULL) {
+        if (obj_pool_pop(pool, &index, 1) == 0) {
+            return NULL;
+        }
+        pool->owner[index] = 0;
+        return pool->slab + index * pool->stride;
+    }
+    if (cache->len > 0) {
+        cache->stats.hits++;
+    } else {
+        cache->stats.misses++;
+        cache->len = obj_pool_pop(pool, cache->objs, OBJPOOL_CACHE_SIZE / 2);
+        if (cache->len == 0) {
+            return NULL;
+        }
+    }
+    index = cache->objs[--cache->len];
+    pool->owner[index] = cache->id;
+    return pool->slab + index * pool->stride;
+}
+
+void
+objPoolFree(ObjPool* const pool, ObjPoolCache* const cache, void* const obj) {
+    const uint32_t index = (uint32_t) (((unsigned char*) obj - pool->slab) / pool->stride);
+    if (cache == NULL) {
+        obj_pool_push(pool, index, index);
+        return;
+    }
+    if (pool->owner[index] != cache->id) {
+        cache->stats.crossReturns++;
+    }
+    if (cache->len == OBJPOOL_CACHE_SIZE) {
+        obj_pool_spill(cache, OBJPOOL_CACHE_SIZE / 2);
+    }
+    cache->objs[cache->len++] = index;
+}
+
+void
+getObjPoolStats(const ObjPool* const pool, ObjPoolStats* const out_stats) {
+    ObjPool* const p = (ObjPool*) pool;
+    out_stats->hits = atomic_load_explicit(&p->hits, memory_order_relaxed);
+    out_stats->misses = atomic_load_explicit(&p->misses, memory_order_relaxed);
+    out_stats->crossReturns = atomic_load_explicit(&p->crossReturns, memory_order_relaxed);
+}
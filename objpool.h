@@ -0,0 +1,94 @@
+#ifndef OBJPOOL_H
+#define OBJPOOL_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  ObjPool is a fixed size object allocator for buffers handed between threads, e.g. through PtrMVar.
+//  All objects come from one slab allocated at init.  Free objects sit on a lock free global free list
+//  (a Treiber stack tagged against ABA) and in small per thread ObjPoolCache arrays in front of it, so the
+//  usual alloc and free touch no shared cache line at all.
+//
+//  A consumer that frees what a producer allocated fills its own cache; once that overflows, half of it
+//  moves to the global list in one compare and swap, where the producer's next refill picks it up.  A
+//  steady producer / consumer pipeline thus recycles the same buffers without malloc or free.
+//
+//  An ObjPoolCache belongs to one thread at a time; keep it on the thread's stack or in thread local
+//  storage.  Threads without one pass NULL and work on the global list directly.
+//
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mvar.h"
+
+// Objects an ObjPoolCache holds at most.  Refills and overflows move half of it at a time.
+#define OBJPOOL_CACHE_SIZE 32
+
+typedef struct {
+    size_t hits;                // alloc served from the cache
+    size_t misses;              // alloc which had to go to the global list, including failed ones
+    size_t crossReturns;        // free of an object allocated through a different cache
+} ObjPoolStats;
+
+typedef struct {
+    // (tag << 32) | (index + 1) of the first free object, index + 1 == 0 when the list is empty.
+    _Alignas(MVAR_CACHE_LINE_SIZE) _Atomic uint64_t freeTop;
+    // Stats of destroyed caches.
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_size_t hits;
+    atomic_size_t misses;
+    atomic_size_t crossReturns;
+    atomic_uint nextCacheId;
+    // Read only after init.
+    _Alignas(MVAR_CACHE_LINE_SIZE) unsigned char* slab;
+    size_t stride;
+    size_t count;
+    _Atomic uint32_t* next;     // index + 1 of the next free object, per object
+    uint32_t* owner;            // id of the cache which allocated the object, 0 for none
+} ObjPool;
+
+typedef struct {
+    ObjPool* pool;
+    uint32_t id;
+    size_t len;
+    uint32_t objs[OBJPOOL_CACHE_SIZE];
+    ObjPoolStats stats;
+} ObjPoolCache;
+
+// count objects of obj_size bytes each, every object starting on its own cache line.  Returns 0, EINVAL or
+// ENOMEM.
+int initObjPool(ObjPool* const out_pool, const size_t obj_size, const size_t count);
+// Every cache must be destroyed first.
+void destroyObjPool(ObjPool* const pool);
+void initObjPoolCache(ObjPoolCache* const out_cache, ObjPool* const pool);
+// Give the cached objects back to the global list and add the cache's stats to the pool's.
+void destroyObjPoolCache(ObjPoolCache* const cache);
+// Returns NULL when every object is in use.  cache may be NULL.
+void* objPoolAlloc(ObjPool* const pool, ObjPoolCache* const cache);
+// obj must have come from objPoolAlloc() on the same pool, through any cache or none.  cache may be NULL.
+void objPoolFree(ObjPool* const pool, ObjPoolCache* const cache, void* const obj);
+// Stats of the destroyed caches.  Live caches keep theirs in ObjPoolCache.stats.
+void getObjPoolStats(const ObjPool* const pool, ObjPoolStats* const out_stats);
+
+#endif
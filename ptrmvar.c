@@ -0,0 +1,248 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "atomic_wait.h"
+#include "ptrmvar.h"
+
+void
+initPtrMVar(PtrMVar* const out_mvar) {
+    atomic_init(&out_mvar->ptr, NULL);
+    atomic_init(&out_mvar->event, 0);
+    atomic_init(&out_mvar->waiters, 0);
+    atomic_init(&out_mvar->borrows, 0);
+}
+
+bool
+isEmptyPtrMVar(const PtrMVar* const mvar) {
+    return atomic_load_explicit(&((PtrMVar*) mvar)->ptr, memory_order_relaxed) == NULL;
+}
+
+static void
+ptr_mvar_notify(PtrMVar* const v) {
+    // Pairs with the fence in ptr_mvar_wait().  Either the sleeper sees our change or we see the sleeper.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&v->waiters, memory_order_relaxed) != 0) {
+        atomic_fetch_add_explicit(&v->event, 1, memory_order_relaxed);
+        // Putters, takers and borrowers share the event; waking just one could pick the wrong kind.
+        atomicWakeAll(&v->event);
+    }
+}
+
+static void
+ptr_mvar_unborrow(PtrMVar* const v) {
+    const unsigned prev = atomic_fetch_sub_explicit(&v->borrows, 1, memory_order_release);
+    if ((prev & PTRMVAR_BORROW_MASK) == 1 && prev >= PTRMVAR_DRAINER) {
+        atomicWakeAll(&v->borrows);
+    }
+}
+
+static void
+ptr_mvar_end_drain(PtrMVar* const v) {
+    atomic_fetch_sub_explicit(&v->borrows, PTRMVAR_DRAINER, memory_order_relaxed);
+    // Let borrowers that backed off retry.
+    atomic_fetch_add_explicit(&v->event, 1, memory_order_relaxed);
+    atomicWakeAll(&v->event);
+}
+
+// Wait for the borrows of a pointer just taken out to be released.  New borrows see the drainer and back off,
+// so a steady stream of readers can't hold the taker forever.
+static void
+ptr_mvar_drain(PtrMVar* const v) {
+    // seq_cst against the count in ptr_mvar_borrow_op(): a borrower we don't count loads ptr after our
+    // swap and never sees the pointer taken.
+    if ((atomic_load_explicit(&v->borrows, memory_order_seq_cst) & PTRMVAR_BORROW_MASK) == 0) {
+        return;
+    }
+    unsigned seen = atomic_fetch_add_explicit(&v->borrows, PTRMVAR_DRAINER, memory_order_seq_cst) + PTRMVAR_DRAINER;
+    while ((seen & PTRMVAR_BORROW_MASK) != 0) {
+        atomicWait(&v->borrows, seen, NULL);
+        seen = atomic_load_explicit(&v->borrows, memory_order_acquire);
+    }
+    ptr_mvar_end_drain(v);
+}
+
+typedef int (*ptr_mvar_op)(void** const io_ptr, PtrMVar* const v);
+
+static int
+ptr_mvar_put_op(void** const io_ptr, PtrMVar* const v) {
+    void* expected = NULL;
+    return atomic_compare_exchange_strong_explicit(&v->ptr, &expected, *io_ptr, memory_order_seq_cst,
+                                                   memory_order_relaxed)
+               ? 0
+               : EBUSY;
+}
+
+static int
+ptr_mvar_take_op(void** const io_ptr, PtrMVar* const v) {
+    void* p = atomic_load_explicit(&v->ptr, memory_order_relaxed);
+    while (p != NULL) {
+        if (atomic_compare_exchange_weak_explicit(&v->ptr, &p, NULL, memory_order_seq_cst, memory_order_relaxed)) {
+            ptr_mvar_drain(v);
+            *io_ptr = p;
+            return 0;
+        }
+    }
+    return EBUSY;
+}
+
+// Take only if there is nothing to drain.  New borrows are fenced off before the count is checked, so none can
+// start between the check and the swap.
+static int
+ptr_mvar_try_take_op(void** const io_ptr, PtrMVar* const v) {
+    if (atomic_load_explicit(&v->ptr, memory_order_relaxed) == NULL) {
+        return EBUSY;
+    }
+    unsigned b = atomic_load_explicit(&v->borrows, memory_order_relaxed);
+    do {
+        if ((b & PTRMVAR_BORROW_MASK) != 0) {
+            return EBUSY;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&v->borrows, &b, b + PTRMVAR_DRAINER, memory_order_seq_cst,
+                                                    memory_order_relaxed));
+    void* const p = atomic_exchange_explicit(&v->ptr, NULL, memory_order_seq_cst);
+    ptr_mvar_end_drain(v);
+    if (p == NULL) {
+        return EBUSY;
+    }
+    *io_ptr = p;
+    return 0;
+}
+
+static int
+ptr_mvar_borrow_op(void** const io_ptr, PtrMVar* const v) {
+    // Count the borrow only when no taker drains and the count has room; a full count would carry into the
+    // drainer bits.
+    unsigned b = atomic_load_explicit(&v->borrows, memory_order_relaxed);
+    do {
+        if (b >= PTRMVAR_DRAINER) {
+            return EBUSY;
+        }
+        if (b == PTRMVAR_BORROW_MASK) {
+            return EAGAIN;
+        }
+    } while (!atomic_compare_exchange_weak_explicit(&v->borrows, &b, b + 1, memory_order_seq_cst,
+                                                    memory_order_relaxed));
+    void* const p = atomic_load_explicit(&v->ptr, memory_order_seq_cst);
+    if (p == NULL) {
+        ptr_mvar_unborrow(v);
+        return EBUSY;
+    }
+    *io_ptr = p;
+    return 0;
+}
+
+// Run op once, waking whoever waits for the change it made.
+static int
+ptr_mvar_try(ptr_mvar_op op, void** const io_ptr, PtrMVar* const v) {
+    const int err = op(io_ptr, v);
+    // A borrow changes nothing others wait for.
+    if (err == 0 && op != ptr_mvar_borrow_op) {
+        ptr_mvar_notify(v);
+    }
+    return err;
+}
+
+// Retry op until it stops returning EBUSY, sleeping on the event in between.  deadline NULL waits forever.
+static int
+ptr_mvar_wait(ptr_mvar_op op, void** const io_ptr, PtrMVar* const v, const struct timespec* const deadline) {
+    int err = ptr_mvar_try(op, io_ptr, v);
+    if (err != EBUSY) {
+        return err;
+    }
+    atomic_fetch_add_explicit(&v->waiters, 1, memory_order_relaxed);
+    for (;;) {
+        const unsigned seen = atomic_load_explicit(&v->event, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        err = ptr_mvar_try(op, io_ptr, v);
+        if (err != EBUSY) {
+            break;
+        }
+        const int wait_err = atomicWait(&v->event, seen, deadline);
+        if (wait_err != 0 && wait_err != EINTR) {
+            err = wait_err;
+            break;
+        }
+    }
+    atomic_fetch_sub_explicit(&v->waiters, 1, memory_order_relaxed);
+    return err;
+}
+
+int
+putPtrMVar(PtrMVar* const mvar, void* const ptr) {
+    void* p = ptr;
+    return ptr == NULL ? EINVAL : ptr_mvar_wait(ptr_mvar_put_op, &p, mvar, NULL);
+}
+
+int
+takePtrMVar(void** const out_ptr, PtrMVar* const mvar) {
+    return ptr_mvar_wait(ptr_mvar_take_op, out_ptr, mvar, NULL);
+}
+
+int
+readPtrMVar(void** const out_ptr, PtrMVar* const mvar) {
+    return ptr_mvar_wait(ptr_mvar_borrow_op, out_ptr, mvar, NULL);
+}
+
+void
+releasePtrMVar(PtrMVar* const mvar) {
+    ptr_mvar_unborrow(mvar);
+}
+
+int
+timedPutPtrMVar(PtrMVar* const mvar, const long int timeout_in_msec, void* const ptr) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    void* p = ptr;
+    return ptr == NULL ? EINVAL : ptr_mvar_wait(ptr_mvar_put_op, &p, mvar, &deadline);
+}
+
+int
+timedTakePtrMVar(void** const out_ptr, PtrMVar* const mvar, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return ptr_mvar_wait(ptr_mvar_take_op, out_ptr, mvar, &deadline);
+}
+
+int
+timedReadPtrMVar(void** const out_ptr, PtrMVar* const mvar, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return ptr_mvar_wait(ptr_mvar_borrow_op, out_ptr, mvar, &deadline);
+}
+
+int
+tryPutPtrMVar(PtrMVar* const mvar, void* const ptr) {
+    void* p = ptr;
+    return ptr == NULL ? EINVAL : ptr_mvar_try(ptr_mvar_put_op, &p, mvar);
+}
+
+int
+tryTakePtrMVar(void** const out_ptr, PtrMVar* const mvar) {
+    return ptr_mvar_try(ptr_mvar_try_take_op, out_ptr, mvar);
+}
+
+int
+tryReadPtrMVar(void** const out_ptr, PtrMVar* const mvar) {
+    return ptr_mvar_try(ptr_mvar_borrow_op, out_ptr, mvar);
+}
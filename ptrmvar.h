@@ -0,0 +1,72 @@
+#ifndef PTRMVAR_H
+#define PTRMVAR_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  PtrMVar is MVar holding a pointer instead of a copy of the payload.  put hands the pointed object over
+//  to the MVar and take hands it on to the taker, so a buffer moves between threads without being copied.
+//  The pointer is swapped in and out with compare and swap; threads only enter the kernel (futex) to block.
+//  NULL means empty and cannot be put (EINVAL).
+//
+//  readPtrMVar() borrows the current pointer without taking it.  The object stays valid until the matching
+//  releasePtrMVar(): a take which races with borrows returns only after all borrows outstanding at that
+//  time are released, and new borrows wait meanwhile.  Keep borrows short; the timeout of a timed take
+//  covers waiting for a value, not for its borrowers.  tryTakePtrMVar() never waits for borrowers either:
+//  it returns EBUSY while the pointer is borrowed.  At most PTRMVAR_BORROW_MASK borrows can be outstanding;
+//  a read beyond that returns EAGAIN.
+//
+//  Other return values are those of MVar_abs.
+//
+#include <stdatomic.h>
+#include <stdbool.h>
+
+#include "mvar.h"
+
+// Borrows are counted in the low bits of PtrMVar.borrows, takers waiting for them to drain above.
+#define PTRMVAR_BORROW_MASK 0xffffu
+#define PTRMVAR_DRAINER 0x10000u
+
+typedef struct {
+    _Alignas(MVAR_CACHE_LINE_SIZE) void* _Atomic ptr;
+    // Bumped after a change of ptr or the end of a drain when somebody waits for one.
+    atomic_uint event;
+    atomic_uint waiters;
+    atomic_uint borrows;
+} PtrMVar;
+
+void initPtrMVar(PtrMVar* const out_mvar);
+bool isEmptyPtrMVar(const PtrMVar* const mvar);
+int putPtrMVar(PtrMVar* const mvar, void* const ptr);
+int takePtrMVar(void** const out_ptr, PtrMVar* const mvar);
+int readPtrMVar(void** const out_ptr, PtrMVar* const mvar);
+void releasePtrMVar(PtrMVar* const mvar);
+int timedPutPtrMVar(PtrMVar* const mvar, const long int timeout_in_msec, void* const ptr);
+int timedTakePtrMVar(void** const out_ptr, PtrMVar* const mvar, const long int timeout_in_msec);
+int timedReadPtrMVar(void** const out_ptr, PtrMVar* const mvar, const long int timeout_in_msec);
+int tryPutPtrMVar(PtrMVar* const mvar, void* const ptr);
+int tryTakePtrMVar(void** const out_ptr, PtrMVar* const mvar);
+int tryReadPtrMVar(void** const out_ptr, PtrMVar* const mvar);
+
+#endif
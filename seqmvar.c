@@ -0,0 +1,320 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+
+#include "atomic_wait.h"
+#include "seqmvar.h"
+
+#define SEQMVAR_WORD sizeof(uint64_t)
+
+static size_t
+seq_mvar_words(const size_t payload_size) {
+    return (payload_size + SEQMVAR_WORD - 1) / SEQMVAR_WORD;
+}
+
+size_t
+seqMVarSize(const size_t payload_size) {
+    const size_t size = sizeof(SeqMVar) + seq_mvar_words(payload_size) * SEQMVAR_WORD;
+    return (size + MVAR_CACHE_LINE_SIZE - 1) / MVAR_CACHE_LINE_SIZE * MVAR_CACHE_LINE_SIZE;
+}
+
+void
+initSeqMVar(SeqMVar* const out_mvar, const size_t payload_size) {
+    SeqMVar* const v = out_mvar;
+    pthread_mutex_init(&v->lock, NULL);
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&v->putCond, &cond_attr);
+    pthread_cond_init(&v->takeCond, &cond_attr);
+    pthread_cond_init(&v->readCond, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+    v->putWaiters = 0;
+    v->takeWaiters = 0;
+    v->readWaiters = 0;
+    v->payloadSize = payload_size;
+    atomic_init(&v->seq, 0);
+    atomic_init(&v->empty, true);
+    for (size_t i = 0; i < seq_mvar_words(payload_size); i++) {
+        atomic_init(&v->payload[i], 0);
+    }
+}
+
+void
+destroySeqMVar(SeqMVar* const mvar) {
+    pthread_cond_destroy(&mvar->readCond);
+    pthread_cond_destroy(&mvar->takeCond);
+    pthread_cond_destroy(&mvar->putCond);
+    pthread_mutex_destroy(&mvar->lock);
+}
+
+bool
+isEmptySeqMVar(const SeqMVar* const mvar) {
+    return atomic_load_explicit(&((SeqMVar*) mvar)->empty, memory_order_relaxed);
+}
+
+static inline void
+seq_mvar_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+// Copy the payload out word by word.  Only meaningful when the surrounding seq reads agree.
+static void
+seq_mvar_load(void* const out_user_data, SeqMVar* const v) {
+    unsigned char* out = out_user_data;
+    size_t left = v->payloadSize;
+    for (size_t i = 0; left > 0; i++) {
+        const uint64_t word = atomic_load_explicit(&v->payload[i], memory_order_relaxed);
+        const size_t n = left < SEQMVAR_WORD ? left : SEQMVAR_WORD;
+        memcpy(out, &word, n);
+        out += n;
+        left -= n;
+    }
+}
+
+static void
+seq_mvar_store(SeqMVar* const v, const void* const user_data) {
+    const unsigned char* in = user_data;
+    size_t left = v->payloadSize;
+    for (size_t i = 0; left > 0; i++) {
+        uint64_t word = 0;
+        const size_t n = left < SEQMVAR_WORD ? left : SEQMVAR_WORD;
+        memcpy(&word, in, n);
+        atomic_store_explicit(&v->payload[i], word, memory_order_relaxed);
+        in += n;
+        left -= n;
+    }
+}
+
+// Read without the lock.  Returns EBUSY when empty.
+static int
+seq_mvar_read(void* const out_user_data, SeqMVar* const v) {
+    for (;;) {
+        const unsigned before = atomic_load_explicit(&v->seq, memory_order_acquire);
+        if ((before & 1) != 0) {
+            seq_mvar_relax();
+            continue;
+        }
+        const bool empty = atomic_load_explicit(&v->empty, memory_order_relaxed);
+        if (!empty) {
+            seq_mvar_load(out_user_data, v);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&v->seq, memory_order_relaxed) == before) {
+            return empty ? EBUSY : 0;
+        }
+    }
+}
+
+// Change empty and, unless user_data is NULL, the payload, inside a write section.  Lock held.
+static void
+seq_mvar_write_locked(SeqMVar* const v, const void* const user_data, const bool empty) {
+    const unsigned seq = atomic_load_explicit(&v->seq, memory_order_relaxed);
+    atomic_store_explicit(&v->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    if (user_data != NULL) {
+        seq_mvar_store(v, user_data);
+    }
+    atomic_store_explicit(&v->empty, empty, memory_order_relaxed);
+    atomic_store_explicit(&v->seq, seq + 2, memory_order_release);
+}
+
+// As mvar_wait_locked() in mvar.c.
+static int
+seq_mvar_wait_locked(SeqMVar* const v, pthread_cond_t* const cond, unsigned* const waiters, const bool want_empty,
+                     const struct timespec* const deadline) {
+    while (isEmptySeqMVar(v) != want_empty) {
+        (*waiters)++;
+        int err = deadline == NULL ? pthread_cond_wait(cond, &v->lock)
+                                   : pthread_cond_timedwait(cond, &v->lock, deadline);
+        (*waiters)--;
+        if (err != 0 && isEmptySeqMVar(v) != want_empty) {
+            return err;
+        }
+    }
+    return 0;
+}
+
+static void
+seq_mvar_put_locked(SeqMVar* const v, const void* const user_data) {
+    seq_mvar_write_locked(v, user_data, false);
+    if (v->readWaiters > 0) {
+        pthread_cond_broadcast(&v->readCond);
+    }
+    if (v->takeWaiters > 0) {
+        pthread_cond_signal(&v->takeCond);
+    }
+}
+
+static void
+seq_mvar_take_locked(void* const out_user_data, SeqMVar* const v) {
+    seq_mvar_load(out_user_data, v);
+    seq_mvar_write_locked(v, NULL, true);
+    if (v->putWaiters > 0) {
+        pthread_cond_signal(&v->putCond);
+    }
+}
+
+static int
+seq_mvar_put(SeqMVar* const v, const void* const user_data, const struct timespec* const deadline) {
+    int err = pthread_mutex_lock(&v->lock);
+    if (err != 0) {
+        return err;
+    }
+    err = seq_mvar_wait_locked(v, &v->putCond, &v->putWaiters, true, deadline);
+    if (err == 0) {
+        seq_mvar_put_locked(v, user_data);
+    }
+    pthread_mutex_unlock(&v->lock);
+    return err;
+}
+
+static int
+seq_mvar_take(void* const out_user_data, SeqMVar* const v, const struct timespec* const deadline) {
+    int err = pthread_mutex_lock(&v->lock);
+    if (err != 0) {
+        return err;
+    }
+    err = seq_mvar_wait_locked(v, &v->takeCond, &v->takeWaiters, false, deadline);
+    if (err == 0) {
+        seq_mvar_take_locked(out_user_data, v);
+    }
+    pthread_mutex_unlock(&v->lock);
+    return err;
+}
+
+// Lock free unless empty, in which case wait under the lock for a put.
+static int
+seq_mvar_read_wait(void* const out_user_data, SeqMVar* const v, const struct timespec* const deadline) {
+    if (seq_mvar_read(out_user_data, v) == 0) {
+        return 0;
+    }
+    int err = pthread_mutex_lock(&v->lock);
+    if (err != 0) {
+        return err;
+    }
+    err = seq_mvar_wait_locked(v, &v->readCond, &v->readWaiters, false, deadline);
+    if (err == 0) {
+        seq_mvar_load(out_user_data, v);
+    }
+    pthread_mutex_unlock(&v->lock);
+    return err;
+}
+
+int
+putSeqMVar(SeqMVar* const mvar, const void* const user_data) {
+    return seq_mvar_put(mvar, user_data, NULL);
+}
+
+int
+readSeqMVar(void* const out_user_data, SeqMVar* const mvar) {
+    return seq_mvar_read_wait(out_user_data, mvar, NULL);
+}
+
+int
+takeSeqMVar(void* const out_user_data, SeqMVar* const mvar) {
+    return seq_mvar_take(out_user_data, mvar, NULL);
+}
+
+int
+swapSeqMVar(void* const out_user_data, SeqMVar* const mvar, const void* const user_data) {
+    SeqMVar* const v = mvar;
+    int err = pthread_mutex_lock(&v->lock);
+    if (err != 0) {
+        return err;
+    }
+    seq_mvar_wait_locked(v, &v->takeCond, &v->takeWaiters, false, NULL);
+    if (out_user_data != NULL) {
+        seq_mvar_load(out_user_data, v);
+    }
+    seq_mvar_write_locked(v, user_data, false);
+    // Still full.  Others waiting to take may still do so.
+    if (v->takeWaiters > 0) {
+        pthread_cond_signal(&v->takeCond);
+    }
+    pthread_mutex_unlock(&v->lock);
+    return 0;
+}
+
+int
+timedPutSeqMVar(SeqMVar* const mvar, const long int timeout_in_msec, const void* const user_data) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return seq_mvar_put(mvar, user_data, &deadline);
+}
+
+int
+timedReadSeqMVar(void* const out_user_data, SeqMVar* const mvar, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return seq_mvar_read_wait(out_user_data, mvar, &deadline);
+}
+
+int
+timedTakeSeqMVar(void* const out_user_data, SeqMVar* const mvar, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return seq_mvar_take(out_user_data, mvar, &deadline);
+}
+
+int
+tryPutSeqMVar(SeqMVar* const mvar, const void* const user_data) {
+    SeqMVar* const v = mvar;
+    int err = pthread_mutex_trylock(&v->lock);
+    if (err != 0) {
+        return err;
+    }
+    if (!isEmptySeqMVar(v)) {
+        pthread_mutex_unlock(&v->lock);
+        return EBUSY;
+    }
+    seq_mvar_put_locked(v, user_data);
+    pthread_mutex_unlock(&v->lock);
+    return 0;
+}
+
+int
+tryReadSeqMVar(void* const out_user_data, SeqMVar* const mvar) {
+    return seq_mvar_read(out_user_data, mvar);
+}
+
+int
+tryTakeSeqMVar(void* const out_user_data, SeqMVar* const mvar) {
+    SeqMVar* const v = mvar;
+    int err = pthread_mutex_trylock(&v->lock);
+    if (err != 0) {
+        return err;
+    }
+    if (isEmptySeqMVar(v)) {
+        pthread_mutex_unlock(&v->lock);
+        return EBUSY;
+    }
+    seq_mvar_take_locked(out_user_data, v);
+    pthread_mutex_unlock(&v->lock);
+    return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef SEQMVAR_H
+#define SEQMVAR_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  SeqMVar is MVar for read mostly data such as configuration snapshots.  The payload lives inline as 64 bit
+//  words under a sequence lock: readSeqMVar() copies it out with plain loads and retries only if a writer
+//  got in between, so readers never write shared memory and scale with the number of cores.  put, take and
+//  swap keep MVar semantics and serialize on a mutex of their own, in another cache line.
+//
+//  Readers only take the mutex to block while the SeqMVar is empty.  swapSeqMVar() replaces a full value
+//  without ever making it empty, which is what publishing a new snapshot wants.
+//
+//  The payload is copied as raw bytes; it must not contain anything needing more than a copy.  Allocate
+//  seqMVarSize(payload_size) bytes, aligned to MVAR_CACHE_LINE_SIZE, e.g. with aligned_alloc().
+//
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mvar.h"
+
+typedef struct {
+    // Written by writers only.
+    _Alignas(MVAR_CACHE_LINE_SIZE) pthread_mutex_t lock;
+    pthread_cond_t putCond;
+    pthread_cond_t takeCond;
+    pthread_cond_t readCond;
+    unsigned putWaiters;
+    unsigned takeWaiters;
+    unsigned readWaiters;
+    size_t payloadSize;
+    // Read by readers.  seq is odd while a writer changes empty or the payload.
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_uint seq;
+    atomic_bool empty;
+    _Atomic uint64_t payload[];
+} SeqMVar;
+
+size_t seqMVarSize(const size_t payload_size);
+void initSeqMVar(SeqMVar* const out_mvar, const size_t payload_size);
+void destroySeqMVar(SeqMVar* const mvar);
+bool isEmptySeqMVar(const SeqMVar* const mvar);
+int putSeqMVar(SeqMVar* const mvar, const void* const user_data);
+int readSeqMVar(void* const out_user_data, SeqMVar* const mvar);
+int takeSeqMVar(void* const out_user_data, SeqMVar* const mvar);
+// Block until full, then replace the value in one step, storing the old one in *out_user_data unless NULL.
+int swapSeqMVar(void* const out_user_data, SeqMVar* const mvar, const void* const user_data);
+int timedPutSeqMVar(SeqMVar* const mvar, const long int timeout_in_msec, const void* const user_data);
+int timedReadSeqMVar(void* const out_user_data, SeqMVar* const mvar, const long int timeout_in_msec);
+int timedTakeSeqMVar(void* const out_user_data, SeqMVar* const mvar, const long int timeout_in_msec);
+int tryPutSeqMVar(SeqMVar* const mvar, const void* const user_data);
+// Never blocks on writers; EBUSY only when empty.
+int tryReadSeqMVar(void* const out_user_data, SeqMVar* const mvar);
+int tryTakeSeqMVar(void* const out_user_data, SeqMVar* const mvar);
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "atomic_wait.h"
+#include "numaalloc.h"
+#include "shardedqueue.h"
+
+int
+initShardedQueue(ShardedQueue* const out_queue, const size_t capacity_per_shard, const size_t slot_size,
+                 write_callback write, read_callback read) {
+    ShardedQueue* const q = out_queue;
+    if (capacity_per_shard == 0 || (capacity_per_shard & (capacity_per_shard - 1)) != 0) {
+        return EINVAL;
+    }
+    q->nshards = numaNodeCount();
+    q->shards = calloc(q->nshards, sizeof q->shards[0]);
+    if (q->shards == NULL) {
+        return ENOMEM;
+    }
+    for (int node = 0; node < q->nshards; node++) {
+        q->shards[node] = allocMVarOnNumaNode(sizeof(BoundedQueue), node);
+        if (q->shards[node] == NULL || initBoundedQueueOnNode(q->shards[node], BOUNDED_QUEUE_MPMC, capacity_per_shard,
+                                                              slot_size, write, read, node) != 0) {
+            freeMVarOnNumaNode(q->shards[node], sizeof(BoundedQueue));
+            q->nshards = node;
+            destroyShardedQueue(q);
+            return ENOMEM;
+        }
+    }
+    atomic_init(&q->notEmpty, 0);
+    atomic_init(&q->takeWaiters, 0);
+    return 0;
+}
+
+void
+destroyShardedQueue(ShardedQueue* const queue) {
+    for (int node = 0; node < queue->nshards; node++) {
+        destroyBoundedQueue(queue->shards[node]);
+        freeMVarOnNumaNode(queue->shards[node], sizeof(BoundedQueue));
+    }
+    free(queue->shards);
+    queue->shards = NULL;
+}
+
+bool
+isEmptyShardedQueue(const ShardedQueue* const queue) {
+    for (int node = 0; node < queue->nshards; node++) {
+        if (!isEmptyBoundedQueue(queue->shards[node])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The ring of the node the caller runs on.
+static BoundedQueue*
+sharded_queue_local(const ShardedQueue* const q, int* const node) {
+    *node = q->nshards == 1 ? 0 : currentNumaNode() % q->nshards;
+    return q->shards[*node];
+}
+
+// Wake a consumer sleeping on the whole queue, if any, after a put.
+static void
+sharded_queue_notify(ShardedQueue* const q) {
+    // Pairs with the fence in takeShardedQueue().  Either the sleeper sees our element or we see the sleeper.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&q->takeWaiters, memory_order_relaxed) != 0) {
+        atomic_fetch_add_explicit(&q->notEmpty, 1, memory_order_relaxed);
+        atomicWakeOne(&q->notEmpty);
+    }
+}
+
+int
+putShardedQueue(ShardedQueue* const queue, const void* const user_data) {
+    int node;
+    const int err = putBoundedQueue(sharded_queue_local(queue, &node), user_data);
+    if (err == 0) {
+        sharded_queue_notify(queue);
+    }
+    return err;
+}
+
+int
+timedPutShardedQueue(ShardedQueue* const queue, const long int timeout_in_msec, const void* const user_data) {
+    int node;
+    const int err = timedPutBoundedQueue(sharded_queue_local(queue, &node), timeout_in_msec, user_data);
+    if (err == 0) {
+        sharded_queue_notify(queue);
+    }
+    return err;
+}
+
+int
+tryPutShardedQueue(ShardedQueue* const queue, const void* const user_data) {
+    int node;
+    const int err = tryPutBoundedQueue(sharded_queue_local(queue, &node), user_data);
+    if (err == 0) {
+        sharded_queue_notify(queue);
+    }
+    return err;
+}
+
+int
+tryTakeShardedQueue(void* const out_user_data, ShardedQueue* const queue) {
+    int node;
+    if (tryTakeBoundedQueue(out_user_data, sharded_queue_local(queue, &node)) == 0) {
+        return 0;
+    }
+    // Local ring empty.  Steal from the other nodes, nearest numbered first.
+    for (int i = 1; i < queue->nshards; i++) {
+        if (tryTakeBoundedQueue(out_user_data, queue->shards[(node + i) % queue->nshards]) == 0) {
+            return 0;
+        }
+    }
+    return EBUSY;
+}
+
+// Take, sleeping on the queue wide event while every ring is empty.  deadline NULL waits forever.
+static int
+sharded_queue_take(void* const out_user_data, ShardedQueue* const q, const struct timespec* const deadline) {
+    int err = tryTakeShardedQueue(out_user_data, q);
+    if (err != EBUSY) {
+        return err;
+    }
+    atomic_fetch_add_explicit(&q->takeWaiters, 1, memory_order_relaxed);
+    for (;;) {
+        const unsigned seen = atomic_load_explicit(&q->notEmpty, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        err = tryTakeShardedQueue(out_user_data, q);
+        if (err != EBUSY) {
+            break;
+        }
+        const int wait_err = atomicWait(&q->notEmpty, seen, deadline);
+        if (wait_err != 0 && wait_err != EINTR) {
+            err = wait_err;
+            break;
+        }
+    }
+    atomic_fetch_sub_explicit(&q->takeWaiters, 1, memory_order_relaxed);
+    return err;
+}
+
+int
+takeShardedQueue(void* const out_user_data, ShardedQueue* const queue) {
+    return sharded_queue_take(out_user_data, queue, NULL);
+}
+
+int
+timedTakeShardedQueue(void* const out_user_data, ShardedQueue* const queue, const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return sharded_queue_take(out_user_data, queue, &deadline);
+}
@@ -0,0 +1,67 @@
+#ifndef SHARDEDQUEUE_H
+#define SHARDEDQUEUE_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  ShardedQueue is a BoundedQueue split into one MPMC ring per NUMA node (numaalloc.h), each ring and its
+//  indices allocated on its node.  Producers put into the ring of the node they run on, consumers take from
+//  theirs and only reach across to the other nodes' rings when their own is empty, so on a loaded queue the
+//  slots and indices stay in node local caches and memory.  There is no ordering between elements put on
+//  different nodes.  Payloads move through the same write_callback and read_callback as MVar and BoundedQueue.
+//
+//  Consumers finding every ring empty sleep on one queue wide event that every put bumps, so a put on any
+//  node wakes them.  A put into a full local ring blocks on that ring until a consumer, local or stealing,
+//  makes room.
+//
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "boundedqueue.h"
+
+typedef struct {
+    // Consumers finding every ring empty.
+    _Alignas(MVAR_CACHE_LINE_SIZE) atomic_uint notEmpty;
+    atomic_uint takeWaiters;
+    // Read only after init.
+    _Alignas(MVAR_CACHE_LINE_SIZE) BoundedQueue** shards;   // One per node, each on its node.
+    int nshards;
+} ShardedQueue;
+
+// One ring of capacity_per_shard (a power of two) slots of slot_size bytes per NUMA node.  On a single node
+// host it is one BoundedQueue with a little bookkeeping on top.  Returns 0, EINVAL or ENOMEM.
+int initShardedQueue(ShardedQueue* const out_queue, const size_t capacity_per_shard, const size_t slot_size,
+                     write_callback write, read_callback read);
+void destroyShardedQueue(ShardedQueue* const queue);
+bool isEmptyShardedQueue(const ShardedQueue* const queue);
+int putShardedQueue(ShardedQueue* const queue, const void* const user_data);
+int takeShardedQueue(void* const out_user_data, ShardedQueue* const queue);
+int timedPutShardedQueue(ShardedQueue* const queue, const long int timeout_in_msec, const void* const user_data);
+int timedTakeShardedQueue(void* const out_user_data, ShardedQueue* const queue, const long int timeout_in_msec);
+// Return EBUSY when the local ring is full (put) or every ring is empty (take).
+int tryPutShardedQueue(ShardedQueue* const queue, const void* const user_data);
+int tryTakeShardedQueue(void* const out_user_data, ShardedQueue* const queue);
+
+#endif
@@ -0,0 +1,302 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// pthread_mutex_clocklock() is a GNU extension.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <string.h>
+
+#include "atomic_wait.h"
+#include "shmmvar.h"
+
+#define SHMMVAR_READY 0x4d566172u
+
+const struct timespec shmMVarNoWait = {0, 0};
+
+static size_t
+round_up(const size_t n, const size_t unit) {
+    return (n + unit - 1) / unit * unit;
+}
+
+static size_t
+shm_mvar_slots_offset(const size_t nslots) {
+    return round_up(offsetof(ShmMVar, lengths) + nslots * sizeof(size_t), MVAR_CACHE_LINE_SIZE);
+}
+
+size_t
+shmMVarSize(const size_t nslots, const size_t slot_size) {
+    return shm_mvar_slots_offset(nslots) + nslots * round_up(slot_size, _Alignof(max_align_t));
+}
+
+int
+initShmMVar(void* const segment, const size_t nslots, const size_t slot_size) {
+    ShmMVar* const v = segment;
+    if (nslots == 0 || slot_size == 0) {
+        return EINVAL;
+    }
+    pthread_mutexattr_t mutex_attr;
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    int err = pthread_mutex_init(&v->lock, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    if (err != 0) {
+        return err;
+    }
+    // Timed operations wait for CLOCK_MONOTONIC deadlines so that wall clock steps don't move them.
+    pthread_condattr_t cond_attr;
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+    err = pthread_cond_init(&v->notFull, &cond_attr);
+    if (err == 0) {
+        err = pthread_cond_init(&v->notEmpty, &cond_attr);
+        if (err != 0) {
+            pthread_cond_destroy(&v->notFull);
+        }
+    }
+    pthread_condattr_destroy(&cond_attr);
+    if (err != 0) {
+        pthread_mutex_destroy(&v->lock);
+        return err;
+    }
+    v->nslots = nslots;
+    v->slotSize = round_up(slot_size, _Alignof(max_align_t));
+    v->slotsOffset = shm_mvar_slots_offset(nslots);
+    v->head = 0;
+    v->count = 0;
+    atomic_store_explicit(&v->ready, SHMMVAR_READY, memory_order_release);
+    return 0;
+}
+
+ShmMVar*
+openShmMVar(void* const segment) {
+    ShmMVar* const v = segment;
+    return atomic_load_explicit(&v->ready, memory_order_acquire) == SHMMVAR_READY ? v : NULL;
+}
+
+void
+destroyShmMVar(ShmMVar* const mvar) {
+    atomic_store_explicit(&mvar->ready, 0, memory_order_relaxed);
+    pthread_cond_destroy(&mvar->notEmpty);
+    pthread_cond_destroy(&mvar->notFull);
+    pthread_mutex_destroy(&mvar->lock);
+}
+
+// Count, head and lengths only change when an operation is released, so whatever a dead owner left behind
+// is consistent.
+static int
+shm_mvar_recover(ShmMVar* const v, const int err) {
+    if (err == EOWNERDEAD) {
+        pthread_mutex_consistent(&v->lock);
+        return 0;
+    }
+    return err;
+}
+
+// Lock v->lock, giving up with ETIMEDOUT at the CLOCK_MONOTONIC deadline.  The zero copy operations hold the
+// lock across the caller's own code, so a timed operation may well find it held for longer than it may wait.
+static int
+shm_mvar_clocklock(ShmMVar* const v, const struct timespec* const deadline) {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 30))
+    return pthread_mutex_clocklock(&v->lock, CLOCK_MONOTONIC, deadline);
+#else
+    // Without pthread_mutex_clocklock the mutex only knows CLOCK_REALTIME.  Translate the remaining time.
+    int err = pthread_mutex_trylock(&v->lock);
+    if (err != EBUSY) {
+        return err;
+    }
+    struct timespec mono, real;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    clock_gettime(CLOCK_REALTIME, &real);
+    real.tv_sec += deadline->tv_sec - mono.tv_sec;
+    real.tv_nsec += deadline->tv_nsec - mono.tv_nsec;
+    if (real.tv_nsec >= 1000000000) {
+        real.tv_sec++;
+        real.tv_nsec -= 1000000000;
+    } else if (real.tv_nsec < 0) {
+        real.tv_sec--;
+        real.tv_nsec += 1000000000;
+    }
+    return pthread_mutex_timedlock(&v->lock, &real);
+#endif
+}
+
+static int
+shm_mvar_lock(ShmMVar* const v, const struct timespec* const deadline) {
+    if (deadline == SHMMVAR_NO_WAIT) {
+        return shm_mvar_recover(v, pthread_mutex_trylock(&v->lock));
+    }
+    if (deadline != NULL) {
+        return shm_mvar_recover(v, shm_mvar_clocklock(v, deadline));
+    }
+    return shm_mvar_recover(v, pthread_mutex_lock(&v->lock));
+}
+
+bool
+isEmptyShmMVar(ShmMVar* const mvar) {
+    if (shm_mvar_lock(mvar, NULL) != 0) {
+        // Unusable, so don't invite a put that would fail the same way.
+        return false;
+    }
+    const bool empty = mvar->count == 0;
+    pthread_mutex_unlock(&mvar->lock);
+    return empty;
+}
+
+// Lock and wait on cond until ready(v) holds.  Returns holding the lock on 0 only.  As in MVar, a wait which
+// times out just as ready(v) comes true succeeds.
+static int
+shm_mvar_acquire(ShmMVar* const v, pthread_cond_t* const cond, bool (*ready)(const ShmMVar* const v),
+                 const struct timespec* const deadline) {
+    int err = shm_mvar_lock(v, deadline);
+    if (err != 0) {
+        return err;
+    }
+    while (!ready(v)) {
+        if (deadline == SHMMVAR_NO_WAIT) {
+            err = EBUSY;
+        } else if (deadline == NULL) {
+            err = shm_mvar_recover(v, pthread_cond_wait(cond, &v->lock));
+        } else {
+            err = shm_mvar_recover(v, pthread_cond_timedwait(cond, &v->lock, deadline));
+        }
+        if (err == ETIMEDOUT && ready(v)) {
+            break;
+        }
+        if (err != 0) {
+            pthread_mutex_unlock(&v->lock);
+            return err;
+        }
+    }
+    return 0;
+}
+
+static bool
+shm_mvar_has_room(const ShmMVar* const v) {
+    return v->count < v->nslots;
+}
+
+static bool
+shm_mvar_has_payload(const ShmMVar* const v) {
+    return v->count > 0;
+}
+
+int
+acquirePutShmMVar(ShmMVarPayload* const out_payload, ShmMVar* const mvar, const struct timespec* const deadline) {
+    const int err = shm_mvar_acquire(mvar, &mvar->notFull, shm_mvar_has_room, deadline);
+    if (err == 0) {
+        const size_t slot = (mvar->head + mvar->count) % mvar->nslots;
+        out_payload->offset = mvar->slotsOffset + slot * mvar->slotSize;
+        out_payload->length = mvar->slotSize;
+    }
+    return err;
+}
+
+void
+releasePutShmMVar(ShmMVar* const mvar, const size_t length) {
+    mvar->lengths[(mvar->head + mvar->count) % mvar->nslots] = length;
+    mvar->count++;
+    pthread_cond_signal(&mvar->notEmpty);
+    pthread_mutex_unlock(&mvar->lock);
+}
+
+int
+acquireTakeShmMVar(ShmMVarPayload* const out_payload, ShmMVar* const mvar, const struct timespec* const deadline) {
+    const int err = shm_mvar_acquire(mvar, &mvar->notEmpty, shm_mvar_has_payload, deadline);
+    if (err == 0) {
+        out_payload->offset = mvar->slotsOffset + mvar->head * mvar->slotSize;
+        out_payload->length = mvar->lengths[mvar->head];
+    }
+    return err;
+}
+
+void
+releaseTakeShmMVar(ShmMVar* const mvar) {
+    mvar->head = (mvar->head + 1) % mvar->nslots;
+    mvar->count--;
+    pthread_cond_signal(&mvar->notFull);
+    pthread_mutex_unlock(&mvar->lock);
+}
+
+static int
+shm_mvar_put(ShmMVar* const v, const struct timespec* const deadline, const void* const data, const size_t length) {
+    if (length > v->slotSize) {
+        return EINVAL;
+    }
+    ShmMVarPayload slot;
+    const int err = acquirePutShmMVar(&slot, v, deadline);
+    if (err == 0) {
+        memcpy(shmMVarPayloadData(v, slot), data, length);
+        releasePutShmMVar(v, length);
+    }
+    return err;
+}
+
+static int
+shm_mvar_take(void* const out_data, size_t* const out_length, ShmMVar* const v,
+              const struct timespec* const deadline) {
+    ShmMVarPayload payload;
+    const int err = acquireTakeShmMVar(&payload, v, deadline);
+    if (err == 0) {
+        memcpy(out_data, shmMVarPayloadData(v, payload), payload.length);
+        *out_length = payload.length;
+        releaseTakeShmMVar(v);
+    }
+    return err;
+}
+
+int
+putShmMVar(ShmMVar* const mvar, const void* const data, const size_t length) {
+    return shm_mvar_put(mvar, NULL, data, length);
+}
+
+int
+takeShmMVar(void* const out_data, size_t* const out_length, ShmMVar* const mvar) {
+    return shm_mvar_take(out_data, out_length, mvar, NULL);
+}
+
+int
+timedPutShmMVar(ShmMVar* const mvar, const long int timeout_in_msec, const void* const data, const size_t length) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return shm_mvar_put(mvar, &deadline, data, length);
+}
+
+int
+timedTakeShmMVar(void* const out_data, size_t* const out_length, ShmMVar* const mvar,
+                 const long int timeout_in_msec) {
+    const struct timespec deadline = monotonicDeadline(timeout_in_msec);
+    return shm_mvar_take(out_data, out_length, mvar, &deadline);
+}
+
+int
+tryPutShmMVar(ShmMVar* const mvar, const void* const data, const size_t length) {
+    return shm_mvar_put(mvar, SHMMVAR_NO_WAIT, data, length);
+}
+
+int
+tryTakeShmMVar(void* const out_data, size_t* const out_length, ShmMVar* const mvar) {
+    return shm_mvar_take(out_data, out_length, mvar, SHMMVAR_NO_WAIT);
+}
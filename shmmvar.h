@@ -0,0 +1,111 @@
+#ifndef SHMMVAR_H
+#define SHMMVAR_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  ShmMVar is an MVar for processes sharing a memory segment (shm_open() or a MAP_SHARED file, mmap()ed by
+//  each process at any address).  The segment holds the ShmMVar followed by its payload slots, so frames are
+//  written once into shared memory and read from there, with no socket or serialization in between.
+//
+//  Function pointers and addresses mean nothing in another process, so there are no write and read
+//  callbacks.  Payloads are described by ShmMVarPayload, an offset from the start of the segment plus a
+//  length, valid in every mapping.  A ShmMVar of one slot is an MVar: put blocks while it is full and take
+//  blocks while it is empty.  With more slots it is a ring, and put blocks only while every slot is full.
+//
+//  The lock and condition variables are PTHREAD_PROCESS_SHARED, and the lock is robust.  If a process dies
+//  holding the lock, the next locker takes it over and the ShmMVar is as it was before that operation:
+//  a half written put is never published, and a half read take is not consumed.
+//
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "mvar.h"
+
+typedef struct {
+    size_t offset;      // From the start of the ShmMVar, in any process's mapping.
+    size_t length;
+} ShmMVarPayload;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t notFull;
+    pthread_cond_t notEmpty;
+    size_t nslots;
+    size_t slotSize;
+    size_t slotsOffset;
+    size_t head;        // Slot of the oldest payload.
+    size_t count;       // Slots full.
+    atomic_uint ready;  // Set last by initShmMVar().
+    // Payload length of each slot, followed at slotsOffset by the slots, each slotSize bytes.
+    _Alignas(MVAR_CACHE_LINE_SIZE) size_t lengths[];
+} ShmMVar;
+
+// Bytes of shared memory a ShmMVar of nslots slots of slot_size bytes needs, counting from its start.
+size_t shmMVarSize(const size_t nslots, const size_t slot_size);
+// Initialize a ShmMVar at the start of a shared segment of at least shmMVarSize() bytes.  Exactly one
+// process does this, before the others use it.  Returns 0, EINVAL or the error of the pthread init calls.
+int initShmMVar(void* const segment, const size_t nslots, const size_t slot_size);
+// The ShmMVar another process initialized in segment, or NULL while initShmMVar() hasn't finished there.
+ShmMVar* openShmMVar(void* const segment);
+// Once, after every process is done with it.
+void destroyShmMVar(ShmMVar* const mvar);
+// false also when the MVar can't be locked, e.g. after ENOTRECOVERABLE; the operations report the error.
+bool isEmptyShmMVar(ShmMVar* const mvar);
+
+// Address of payload in the caller's mapping.
+static inline void*
+shmMVarPayloadData(ShmMVar* const mvar, const ShmMVarPayload payload) {
+    return (unsigned char*) mvar + payload.offset;
+}
+
+// Copy length bytes, at most slotSize (EINVAL otherwise), into a free slot, blocking while there is none.
+int putShmMVar(ShmMVar* const mvar, const void* const data, const size_t length);
+// Copy the oldest payload out into out_data of slotSize bytes, store its length and free its slot.
+int takeShmMVar(void* const out_data, size_t* const out_length, ShmMVar* const mvar);
+int timedPutShmMVar(ShmMVar* const mvar, const long int timeout_in_msec, const void* const data, const size_t length);
+int timedTakeShmMVar(void* const out_data, size_t* const out_length, ShmMVar* const mvar,
+                     const long int timeout_in_msec);
+// Return EBUSY when every slot is full (put), none is (take) or the lock is held.
+int tryPutShmMVar(ShmMVar* const mvar, const void* const data, const size_t length);
+int tryTakeShmMVar(void* const out_data, size_t* const out_length, ShmMVar* const mvar);
+
+// Zero copy building blocks of the operations above.  acquirePutShmMVar() waits for a free slot and returns
+// holding the lock, with *out_payload describing the slot (length is slotSize).  Fill it, then publish
+// length bytes of it with releasePutShmMVar().  acquireTakeShmMVar() waits for the oldest payload and
+// returns holding the lock; releaseTakeShmMVar() frees its slot.  The lock is held in between, so keep it
+// short.  deadline is CLOCK_MONOTONIC and bounds waiting for the lock as well as for a slot or payload, NULL
+// waits forever and SHMMVAR_NO_WAIT returns EBUSY instead.
+extern const struct timespec shmMVarNoWait;
+#define SHMMVAR_NO_WAIT (&shmMVarNoWait)
+int acquirePutShmMVar(ShmMVarPayload* const out_payload, ShmMVar* const mvar, const struct timespec* const deadline);
+void releasePutShmMVar(ShmMVar* const mvar, const size_t length);
+int acquireTakeShmMVar(ShmMVarPayload* const out_payload, ShmMVar* const mvar, const struct timespec* const deadline);
+void releaseTakeShmMVar(ShmMVar* const mvar);
+
+#endif
@@ -0,0 +1,1164 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  Tests of hexdump.c, hexdump_simd.c and hexundump.c.  The sources are included rather than linked so that
+//  each vector kernel can be forced through the pointer the library caches, whatever the CPU would pick.
+//
+//  Usage: hexdump_test
+//  Prints one line per test and exits non zero when any check fails.
+//
+// For fopencookie().
+#define _GNU_SOURCE
+
+#include "hexdump.c"
+#include "hexdump_simd.c"
+#include "hexundump.c"
+
+#include <stdlib.h>
+
+// Failures printed in full before the rest are only counted.
+#define TEST_MAX_REPORTS 20
+
+static unsigned long failures;
+
+#define CHECK(cond, ...)                                                   \
+    do {                                                                   \
+        if (!(cond) && failures++ < TEST_MAX_REPORTS) {                    \
+            fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond);     \
+            fprintf(stderr, __VA_ARGS__);                                  \
+            fputc('\n', stderr);                                           \
+        }                                                                  \
+    } while (0)
+
+// Deterministic bytes of every value, printable or not.
+static void
+fill_random(uint8_t* const buf, const size_t len, uint64_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        buf[i] = (uint8_t) seed;
+    }
+}
+
+static void*
+test_alloc(const size_t len) {
+    void* const p = malloc(len);
+    if (p == NULL) {
+        perror("malloc");
+        exit(2);
+    }
+    return p;
+}
+
+typedef struct {
+    const char* name;
+    hexdump_body_kernel body;
+} test_body_kernel;
+
+// The body kernels the running CPU can execute, scalar first.
+static size_t
+test_body_kernels(test_body_kernel* const out) {
+    size_t n = 0;
+    out[n++] = (test_body_kernel) {"scalar", hexdump_body_scalar};
+#if defined(HEXDUMP_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        out[n++] = (test_body_kernel) {"sse2", hexdump_body_sse2};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        out[n++] = (test_body_kernel) {"avx2", hexdump_body_avx2};
+    }
+#elif defined(HEXDUMP_SIMD_NEON)
+    out[n++] = (test_body_kernel) {"neon", hexdump_body_neon};
+#endif
+    return n;
+}
+
+#define TEST_MAX_KERNELS 4
+
+static void
+force_body_kernel(const test_body_kernel* const kernel) {
+    atomic_store_explicit(&hexdump_kernel, kernel->body, memory_order_relaxed);
+}
+
+//
+//  hexdump() against the snprintf formatter it replaced.
+//
+
+// The original formatter, kept as the reference.  It starts at line first_line, writing that line to out_str
+// as the original would after the lines before it; no line depends on the ones before, so a truncation
+// sweep only reformats the line it cuts.  The one change is that a truncated line loses its '\n' instead of
+// having it written over the terminator's place and the terminator past the end of out_str.
+static size_t
+ref_hexdump(char* const out_str, const size_t max_len, const uint8_t* const src, const size_t src_len,
+            const size_t first_line) {
+    if (max_len == 0) {
+        return 0;
+    }
+
+    char* outp = out_str;
+    const char* const outp_fence = out_str + max_len - 1;
+    const uint8_t* inp = src + first_line * 16;
+    const uint8_t* const inp_fence = src + src_len;
+
+    while (outp < outp_fence && inp < inp_fence) {
+        const uint8_t* const line_head = inp;
+
+        size_t room = outp_fence - outp;
+        int needed = snprintf(outp, room, "%04lx  ", (unsigned long) (line_head - src));
+        outp += room - 1 < needed ? room - 1 : needed;
+
+        const uint8_t* const inp_block1_fence = line_head + 8;
+        while (outp < outp_fence && inp < inp_fence && inp < inp_block1_fence) {
+            size_t room = outp_fence - outp;
+            int needed = snprintf(outp, room, "%02x ", *inp++);
+            outp += room - 1 < needed ? room - 1 : needed;
+        }
+        while (outp < outp_fence && inp < inp_block1_fence) {
+            size_t room = outp_fence - outp;
+            int needed = snprintf(outp, room, "   ");
+            outp += room - 1 < needed ? room - 1 : needed;
+            inp++;
+        }
+
+        if (outp < outp_fence) {
+            *outp++ = ' ';
+        }
+
+        const uint8_t* const inp_block2_fence = line_head + 16;
+        while (outp < outp_fence && inp < inp_fence && inp < inp_block2_fence) {
+            size_t room = outp_fence - outp;
+            int needed = snprintf(outp, room, "%02x ", *inp++);
+            outp += room - 1 < needed ? room - 1 : needed;
+        }
+        while (outp < outp_fence && inp < inp_block2_fence) {
+            size_t room = outp_fence - outp;
+            int needed = snprintf(outp, room, "   ");
+            outp += room - 1 < needed ? room - 1 : needed;
+            inp++;
+        }
+
+        if (outp < outp_fence) {
+            *outp++ = ' ';
+        }
+
+        inp = line_head;
+        while (outp < outp_fence && inp < inp_fence && inp < inp_block1_fence) {
+            char c = *inp++;
+            *outp++ = 0x20 <= c && c <= 0x7e ? c : '.';
+        }
+        while (outp < outp_fence && inp < inp_block1_fence) {
+            *outp++ = ' ';
+            inp++;
+        }
+
+        if (outp < outp_fence) {
+            *outp++ = ' ';
+        }
+
+        while (outp < outp_fence && inp < inp_fence && inp < inp_block2_fence) {
+            char c = *inp++;
+            *outp++ = 0x20 <= c && c <= 0x7e ? c : '.';
+        }
+        while (outp < outp_fence && inp < inp_block2_fence) {
+            *outp++ = ' ';
+            inp++;
+        }
+        if (outp < outp_fence) {
+            *outp++ = '\n';
+        }
+    }
+    *outp = '\0';
+    return outp - out_str;
+}
+
+// Bytes past max_len checked to be left alone.
+#define TEST_GUARD_LEN 16
+#define TEST_GUARD_BYTE 0x5a
+// Room for a line of a dump of less than 16 MiB with its '\n' and '\0', and some to spare.
+#define TEST_LINE_ROOM 80
+
+// The reference dump of src up to its longest length checked.  A dump of fewer bytes is this text up to the
+// start of its last line, and that line cut to the room left.  Lines cut short are kept, because every
+// input which has them whole cuts them the same.
+typedef struct {
+    const uint8_t* src;
+    size_t src_len;
+    char* text;
+    size_t* line_pos;       // Start of each line in text, and the end of the last.
+    size_t first_line;      // First line kept cut.  The others are formatted each time.
+    size_t ncut_lines;
+    char (*cut)[TEST_LINE_ROOM][TEST_LINE_ROOM];    // "" until formatted.
+} test_ref;
+
+static void
+test_ref_init(test_ref* const ref, const uint8_t* const src, const size_t src_len, const size_t first_line) {
+    const size_t full = hexdump_output_size(src_len);
+    const size_t nlines = src_len / 16 + (src_len % 16 != 0);
+    ref->src = src;
+    ref->src_len = src_len;
+    ref->text = test_alloc(full);
+    ref->line_pos = test_alloc((nlines + 1) * sizeof ref->line_pos[0]);
+    const size_t len = ref_hexdump(ref->text, full, src, src_len, 0);
+    ref->line_pos[0] = 0;
+    for (size_t i = 0, line = 0; i < len; i++) {
+        if (ref->text[i] == '\n') {
+            ref->line_pos[++line] = i + 1;
+        }
+    }
+    ref->first_line = first_line;
+    ref->ncut_lines = nlines - first_line;
+    ref->cut = calloc(ref->ncut_lines, sizeof ref->cut[0]);
+    if (ref->cut == NULL) {
+        perror("calloc");
+        exit(2);
+    }
+}
+
+static void
+test_ref_destroy(test_ref* const ref) {
+    free(ref->cut);
+    free(ref->line_pos);
+    free(ref->text);
+}
+
+// Reference text of line cut to room, including its terminator, in a dump of src_len bytes.
+static const char*
+test_ref_cut(test_ref* const ref, const size_t src_len, const size_t line, const size_t room, char* const buf) {
+    if ((line + 1) * 16 > src_len || line < ref->first_line) {
+        ref_hexdump(buf, room, ref->src, src_len, line);
+        return buf;
+    }
+    // More room than the whole line needs formats the same.
+    const size_t r = room < TEST_LINE_ROOM ? room : TEST_LINE_ROOM - 1;
+    char* const cut = ref->cut[line - ref->first_line][r];
+    if (cut[0] == '\0') {
+        ref_hexdump(cut, r, ref->src, (line + 1) * 16, line);
+    }
+    return cut;
+}
+
+// Compare hexdump() of the first src_len bytes of ref->src with the reference for every max_len from
+// min_max_len to two past the full size.  The kernel rotates through kernels, starting at kernels[first].
+static void
+check_hexdump_truncations(test_ref* const ref, const size_t src_len, const size_t min_max_len,
+                          const test_body_kernel* const kernels, const size_t nkernels, size_t first) {
+    const size_t full = hexdump_output_size(src_len);
+    const size_t nlines = src_len / 16 + (src_len % 16 != 0);
+    char* const out = test_alloc(full + 2 + TEST_GUARD_LEN);
+    char buf[TEST_LINE_ROOM];
+    size_t line = 0;
+    for (size_t max_len = min_max_len; max_len <= full + 2; max_len++) {
+        const test_body_kernel* const kernel = &kernels[first++ % nkernels];
+        force_body_kernel(kernel);
+        memset(out + max_len, TEST_GUARD_BYTE, TEST_GUARD_LEN);
+        const size_t len = hexdump(out, max_len, ref->src, src_len);
+        for (size_t i = 0; i < TEST_GUARD_LEN; i++) {
+            CHECK(out[max_len + i] == TEST_GUARD_BYTE, "%s src_len %zu max_len %zu: wrote past max_len",
+                  kernel->name, src_len, max_len);
+        }
+        if (max_len <= 1) {
+            CHECK(len == 0 && (max_len == 0 || out[0] == '\0'), "%s src_len %zu max_len %zu: returned %zu",
+                  kernel->name, src_len, max_len, len);
+            continue;
+        }
+        // The reference cuts the last line it starts, the last one starting before the terminator's place.
+        while (line + 1 < nlines && ref->line_pos[line + 1] < max_len - 1) {
+            line++;
+        }
+        const size_t head_len = ref->line_pos[line];
+        const char* const tail = nlines == 0 ? "" : test_ref_cut(ref, src_len, line, max_len - head_len, buf);
+        const size_t tail_len = strlen(tail);
+        CHECK(len == head_len + tail_len && memcmp(out, ref->text, head_len) == 0 &&
+                  memcmp(out + head_len, tail, tail_len + 1) == 0,
+              "%s src_len %zu max_len %zu: %zu chars ending \"%s\", expected %zu ending \"%s\"", kernel->name,
+              src_len, max_len, len, out + (len < head_len ? 0 : head_len), head_len + tail_len, tail);
+    }
+    free(out);
+}
+
+// The whole dump of src_len bytes with each kernel.
+static void
+check_hexdump_kernels(test_ref* const ref, const size_t src_len, const test_body_kernel* const kernels,
+                      const size_t nkernels) {
+    for (size_t k = 0; k < nkernels; k++) {
+        check_hexdump_truncations(ref, src_len, hexdump_output_size(src_len), kernels + k, 1, 0);
+    }
+}
+
+// Every input length up to 75 lines, with every max_len.  The kernel changes with the length, so each formats
+// every length modulo 16 at every max_len.  The lines cut short are formatted by the same code whichever
+// kernel formats the whole ones.
+static void
+test_hexdump_small(const test_body_kernel* const kernels, const size_t nkernels) {
+    enum { max_src_len = 1200 };
+    uint8_t* const src = test_alloc(max_src_len);
+    fill_random(src, max_src_len, 1);
+    test_ref ref;
+    test_ref_init(&ref, src, max_src_len, 0);
+    for (size_t src_len = 0; src_len <= max_src_len; src_len++) {
+        check_hexdump_truncations(&ref, src_len, 0, kernels, nkernels, src_len);
+        check_hexdump_kernels(&ref, src_len, kernels, nkernels);
+    }
+    test_ref_destroy(&ref);
+    free(src);
+}
+
+// Lengths around the offsets where the offset column grows from 4 to 5 and from 5 to 6 digits.  Some are cut
+// at every max_len from three lines before the wider offsets start.
+static void
+test_hexdump_offset_widths(const test_body_kernel* const kernels, const size_t nkernels) {
+    static const size_t boundaries[] = {(size_t) 1 << 16, (size_t) 1 << 20};
+    static const ptrdiff_t cut[] = {-1, 0, 1, 16, 17, 49};
+    for (size_t b = 0; b < sizeof boundaries / sizeof boundaries[0]; b++) {
+        const size_t boundary = boundaries[b];
+        const size_t max_src_len = boundary + 49;
+        uint8_t* const src = test_alloc(max_src_len);
+        fill_random(src, max_src_len, 2 + b);
+        test_ref ref;
+        const size_t first_line = boundary / 16 - 3;
+        test_ref_init(&ref, src, max_src_len, first_line);
+        for (size_t src_len = boundary - 17; src_len <= max_src_len; src_len++) {
+            check_hexdump_kernels(&ref, src_len, kernels, nkernels);
+        }
+        for (size_t i = 0; i < sizeof cut / sizeof cut[0]; i++) {
+            check_hexdump_truncations(&ref, boundary + cut[i], ref.line_pos[first_line] + 2, kernels, nkernels, i);
+        }
+        test_ref_destroy(&ref);
+        free(src);
+    }
+}
+
+//
+//  hexdump_stream against hexdump().
+//
+
+// Text a sink has received.
+typedef struct {
+    char* buf;
+    size_t len;
+    size_t cap;
+} test_text;
+
+static int
+test_text_sink(void* const sink_context, const char* const text, const size_t len) {
+    test_text* const t = sink_context;
+    if (t->len + len > t->cap) {
+        t->cap = (t->len + len) * 2;
+        t->buf = realloc(t->buf, t->cap);
+        if (t->buf == NULL) {
+            perror("realloc");
+            exit(2);
+        }
+    }
+    memcpy(t->buf + t->len, text, len);
+    t->len += len;
+    return 0;
+}
+
+// Stream src in chunks of chunk_len bytes, the first of them first_len, into t.
+static void
+stream_dump(test_text* const t, const hexdump_opts* const opts, const uint8_t* const src, const size_t src_len,
+            const size_t first_len, const size_t chunk_len) {
+    hexdump_stream stream;
+    t->len = 0;
+    CHECK(hexdump_stream_init_ex(&stream, 0, opts, test_text_sink, t) == 0, "init failed");
+    size_t done = first_len < src_len ? first_len : src_len;
+    CHECK(hexdump_stream_feed(&stream, src, done) == 0, "feed failed");
+    while (done < src_len) {
+        const size_t len = src_len - done < chunk_len ? src_len - done : chunk_len;
+        CHECK(hexdump_stream_feed(&stream, src + done, len) == 0, "feed failed");
+        done += len;
+    }
+    CHECK(hexdump_stream_finish(&stream) == 0, "finish failed");
+}
+
+static void
+check_stream(test_text* const t, const char* const what, const char* const expected, const size_t expected_len,
+             const size_t src_len, const size_t first_len, const size_t chunk_len) {
+    CHECK(t->len == expected_len && memcmp(t->buf, expected, expected_len) == 0,
+          "%s src_len %zu split %zu then %zu: %zu chars, expected %zu", what, src_len, first_len, chunk_len, t->len,
+          expected_len);
+}
+
+// Every input up to 20 lines split once at every byte, or into chunks of every size up to two lines.
+static void
+test_stream_splits(const test_body_kernel* const kernels, const size_t nkernels) {
+    enum { max_src_len = 320 };
+    uint8_t src[max_src_len];
+    fill_random(src, max_src_len, 4);
+    char* const expected = test_alloc(hexdump_output_size(max_src_len));
+    test_text t = {NULL, 0, 0};
+    for (size_t k = 0; k < nkernels; k++) {
+        force_body_kernel(&kernels[k]);
+        for (size_t src_len = 0; src_len <= max_src_len; src_len++) {
+            const size_t expected_len = hexdump(expected, hexdump_output_size(src_len), src, src_len);
+            for (size_t split = 0; split <= src_len; split++) {
+                stream_dump(&t, NULL, src, src_len, split, src_len);
+                check_stream(&t, kernels[k].name, expected, expected_len, src_len, split, src_len);
+            }
+            for (size_t chunk_len = 1; chunk_len <= 32; chunk_len++) {
+                stream_dump(&t, NULL, src, src_len, chunk_len, chunk_len);
+                check_stream(&t, kernels[k].name, expected, expected_len, src_len, chunk_len, chunk_len);
+            }
+        }
+    }
+    free(t.buf);
+    free(expected);
+}
+
+// Chunks not of whole lines across the 64 KiB offset width change, filling the stream's buffer many times.
+static void
+test_stream_offset_width(const test_body_kernel* const kernels, const size_t nkernels) {
+    static const size_t chunk_lens[] = {1, 7, 1000, 4097, 65537};
+    const size_t src_len = ((size_t) 1 << 16) + 4099;
+    uint8_t* const src = test_alloc(src_len);
+    fill_random(src, src_len, 5);
+    char* const expected = test_alloc(hexdump_output_size(src_len));
+    const size_t expected_len = hexdump(expected, hexdump_output_size(src_len), src, src_len);
+    test_text t = {NULL, 0, 0};
+    for (size_t k = 0; k < nkernels; k++) {
+        force_body_kernel(&kernels[k]);
+        for (size_t i = 0; i < sizeof chunk_lens / sizeof chunk_lens[0]; i++) {
+            stream_dump(&t, NULL, src, src_len, chunk_lens[i], chunk_lens[i]);
+            check_stream(&t, kernels[k].name, expected, expected_len, src_len, chunk_lens[i], chunk_lens[i]);
+        }
+    }
+    free(t.buf);
+    free(expected);
+    free(src);
+}
+
+static int
+test_failing_sink(void* const sink_context, const char* const text, const size_t len) {
+    ++*(int*) sink_context;
+    return EPIPE;
+}
+
+// A sink's error stops the feed and is returned.
+static void
+test_stream_sink_error(const test_body_kernel* const kernels, const size_t nkernels) {
+    uint8_t src[40];
+    fill_random(src, sizeof src, 6);
+    int calls = 0;
+    hexdump_stream stream;
+    hexdump_stream_init(&stream, 0, test_failing_sink, &calls);
+    CHECK(hexdump_stream_feed(&stream, src, 8) == 0 && calls == 0, "partial line sent to the sink");
+    CHECK(hexdump_stream_feed(&stream, src + 8, sizeof src - 8) == EPIPE && calls == 1, "%d sink calls", calls);
+    CHECK(hexdump_stream_finish(&stream) == EPIPE && calls == 2, "%d sink calls", calls);
+}
+
+//
+//  hexdump_output_size().
+//
+
+// A dump's size counted line by line from the printed width of each line's offset, for inputs too large to
+// format.
+static size_t
+ref_output_size(const size_t src_len) {
+    const size_t nlines = src_len / 16 + (src_len % 16 != 0);
+    size_t size = 1;
+    size_t line = 0;
+    // Lines up to width_fence have offsets of at most width digits.
+    for (size_t width = 4, width_fence = (size_t) 1 << 12; line < nlines; width++, width_fence <<= 4) {
+        const size_t n = (nlines < width_fence ? nlines : width_fence) - line;
+        char offset[32];
+        CHECK(snprintf(offset, sizeof offset, "%04zx", line * 16) == (int) width, "width %zu", width);
+        // The offset, two spaces, 16 "xx " cells, the spaces before the second block and the ASCII column,
+        // 16 chars of it, the space between its blocks and the '\n'.
+        size += n * (width + 2 + 16 * 3 + 1 + 1 + 16 + 1 + 1);
+        line += n;
+    }
+    return size;
+}
+
+// The size is exactly what hexdump() needs: it formats the whole dump into it, and a char less truncates.
+static void
+check_output_size(const uint8_t* const src, const size_t src_len, char* const out) {
+    const size_t size = hexdump_output_size(src_len);
+    CHECK(size == ref_output_size(src_len), "src_len %zu: %zu, expected %zu", src_len, size, ref_output_size(src_len));
+    CHECK(hexdump(NULL, 0, src, src_len) == size && hexdump_parallel(NULL, 0, src, src_len, 1) == size,
+          "src_len %zu: size query differs from %zu", src_len, size);
+    const size_t whole = hexdump(out, size, src, src_len);
+    CHECK(whole == size - 1 && out[whole] == '\0', "src_len %zu: %zu chars in %zu", src_len, whole, size);
+    const size_t cut = hexdump(out, size - 1, src, src_len);
+    CHECK(src_len == 0 || cut == size - 2, "src_len %zu: %zu chars in %zu", src_len, cut, size - 1);
+}
+
+static void
+test_output_size(const test_body_kernel* const kernels, const size_t nkernels) {
+    static const size_t boundaries[] = {(size_t) 1 << 16, (size_t) 1 << 20, (size_t) 1 << 24};
+    static const ptrdiff_t around[] = {-17, -16, -1, 0, 1, 16, 17};
+    const size_t max_src_len = ((size_t) 1 << 24) + 17;
+    uint8_t* const src = test_alloc(max_src_len);
+    fill_random(src, max_src_len, 7);
+    char* const out = test_alloc(hexdump_output_size(max_src_len));
+    for (size_t src_len = 0; src_len <= 4096; src_len++) {
+        check_output_size(src, src_len, out);
+    }
+    for (size_t b = 0; b < sizeof boundaries / sizeof boundaries[0]; b++) {
+        for (size_t i = 0; i < sizeof around / sizeof around[0]; i++) {
+            check_output_size(src, boundaries[b] + around[i], out);
+        }
+    }
+    free(out);
+    free(src);
+    // Beyond what can be formatted here, up to offsets of 12 digits.
+    for (size_t src_len = (size_t) 1 << 28; src_len < (size_t) 1 << 48; src_len = src_len * 2 + 1) {
+        CHECK(hexdump_output_size(src_len) == ref_output_size(src_len), "src_len %zu: %zu, expected %zu", src_len,
+              hexdump_output_size(src_len), ref_output_size(src_len));
+    }
+}
+
+//
+//  hexdump_fd() and hexdump_file() against hexdump().
+//
+
+// Everything in the file behind fd, which is then emptied.
+static size_t
+take_file(const int fd, char* const buf, const size_t buf_len) {
+    const off_t len = lseek(fd, 0, SEEK_END);
+    CHECK(len >= 0 && (size_t) len <= buf_len && pread(fd, buf, len, 0) == len, "can't read back %lld bytes",
+          (long long) len);
+    CHECK(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0, "can't empty the file");
+    return len < 0 ? 0 : (size_t) len;
+}
+
+static void
+check_io(const char* const what, FILE* const file, const uint8_t* const src, const size_t src_len,
+         char* const expected, char* const got) {
+    const size_t size = hexdump_output_size(src_len);
+    const size_t expected_len = hexdump(expected, size, src, src_len);
+    const int fd = fileno(file);
+    CHECK(hexdump_fd(fd, src, src_len) == 0, "%s src_len %zu: hexdump_fd() failed", what, src_len);
+    size_t len = take_file(fd, got, size);
+    CHECK(len == expected_len && memcmp(got, expected, len) == 0, "%s src_len %zu: hexdump_fd() wrote %zu chars, "
+          "expected %zu", what, src_len, len, expected_len);
+    CHECK(hexdump_file(file, src, src_len) == 0 && fflush(file) == 0, "%s src_len %zu: hexdump_file() failed", what,
+          src_len);
+    len = take_file(fd, got, size);
+    rewind(file);
+    CHECK(len == expected_len && memcmp(got, expected, len) == 0, "%s src_len %zu: hexdump_file() wrote %zu chars, "
+          "expected %zu", what, src_len, len, expected_len);
+}
+
+// Lengths across the first pages of the stack buffer, around where it fills, and across the offset width
+// changes, which move page boundaries.
+static void
+test_io(const test_body_kernel* const kernels, const size_t nkernels) {
+    const size_t page_lines = HEXDUMP_IO_PAGE_LEN / HEXDUMP_LINE_LEN(4);
+    const size_t fill_len = HEXDUMP_IO_PAGES * page_lines * 16;
+    const size_t max_src_len = ((size_t) 1 << 20) + 17;
+    uint8_t* const src = test_alloc(max_src_len);
+    fill_random(src, max_src_len, 8);
+    char* const expected = test_alloc(hexdump_output_size(max_src_len));
+    char* const got = test_alloc(hexdump_output_size(max_src_len));
+    FILE* const file = tmpfile();
+    CHECK(file != NULL, "tmpfile() failed");
+    if (file == NULL) {
+        return;
+    }
+    for (size_t k = 0; k < nkernels; k++) {
+        force_body_kernel(&kernels[k]);
+        for (size_t src_len = 0; src_len <= 3 * page_lines * 16 + 17; src_len++) {
+            check_io(kernels[k].name, file, src, src_len, expected, got);
+        }
+        for (size_t fills = 1; fills <= 3; fills++) {
+            for (size_t src_len = fills * fill_len - 17; src_len <= fills * fill_len + 17; src_len++) {
+                check_io(kernels[k].name, file, src, src_len, expected, got);
+            }
+        }
+        check_io(kernels[k].name, file, src, ((size_t) 1 << 16) + 17, expected, got);
+        check_io(kernels[k].name, file, src, max_src_len, expected, got);
+    }
+    fclose(file);
+    free(got);
+    free(expected);
+    free(src);
+}
+
+// A failed write is returned, nothing is written for no input.
+#ifdef __GLIBC__
+static ssize_t
+test_failing_write(void* const cookie, const char* const buf, const size_t len) {
+    return 0;
+}
+#endif
+
+static void
+test_io_errors(const test_body_kernel* const kernels, const size_t nkernels) {
+    uint8_t src[40];
+    fill_random(src, sizeof src, 9);
+    CHECK(hexdump_fd(-1, src, sizeof src) == EBADF, "write to a bad fd succeeded");
+    CHECK(hexdump_fd(-1, src, 0) == 0, "wrote for no input");
+    FILE* const file = fopen("/dev/null", "r");
+    CHECK(file != NULL, "can't open /dev/null");
+    if (file != NULL) {
+        CHECK(hexdump_file(file, src, sizeof src) != 0, "write to a read only stream succeeded");
+        fclose(file);
+    }
+#ifdef __GLIBC__
+    // A stream failing without setting errno gets EIO, not whatever errno held before.
+    const cookie_io_functions_t failing = {.write = test_failing_write};
+    FILE* const stream = fopencookie(NULL, "w", failing);
+    CHECK(stream != NULL, "fopencookie");
+    if (stream != NULL) {
+        setvbuf(stream, NULL, _IONBF, 0);
+        errno = ENOSPC;
+        const int err = hexdump_file(stream, src, sizeof src);
+        CHECK(err == EIO, "failing stream: %d", err);
+        fclose(stream);
+    }
+#endif
+}
+
+//
+//  hexdump_parallel() against hexdump().
+//
+
+static void
+check_parallel(const uint8_t* const src, const size_t src_len, const size_t max_len, const unsigned nthreads,
+               char* const expected, char* const got) {
+    const size_t expected_len = hexdump(expected, max_len, src, src_len);
+    memset(got + max_len, TEST_GUARD_BYTE, TEST_GUARD_LEN);
+    const size_t len = hexdump_parallel(got, max_len, src, src_len, nthreads);
+    CHECK(len == expected_len && (max_len == 0 || memcmp(got, expected, len + 1) == 0),
+          "src_len %zu max_len %zu nthreads %u: %zu chars, expected %zu", src_len, max_len, nthreads, len,
+          expected_len);
+    for (size_t i = 0; i < TEST_GUARD_LEN; i++) {
+        CHECK(got[max_len + i] == TEST_GUARD_BYTE, "src_len %zu max_len %zu nthreads %u: wrote past max_len",
+              src_len, max_len, nthreads);
+    }
+}
+
+// Inputs too small for a second thread go through the same slicing on the caller, cut at every max_len.
+static void
+test_parallel_small(const test_body_kernel* const kernels, const size_t nkernels) {
+    enum { max_src_len = 320 };
+    uint8_t src[max_src_len];
+    fill_random(src, max_src_len, 10);
+    const size_t size = hexdump_output_size(max_src_len) + 2;
+    char* const expected = test_alloc(size);
+    char* const got = test_alloc(size + TEST_GUARD_LEN);
+    for (size_t src_len = 0; src_len <= max_src_len; src_len++) {
+        for (size_t max_len = 0; max_len <= hexdump_output_size(src_len) + 2; max_len++) {
+            check_parallel(src, src_len, max_len, max_len % 3, expected, got);
+        }
+    }
+    free(got);
+    free(expected);
+}
+
+// Enough input for 8 threads, at every thread count up to twice that, the default and around the most threads
+// used.  Each count cuts the dump in half, inside its last line and not at all, with the kernel rotating.
+static void
+test_parallel_threads(const test_body_kernel* const kernels, const size_t nkernels) {
+    static const unsigned many[] = {HEXDUMP_PARALLEL_MAX_THREADS - 1, HEXDUMP_PARALLEL_MAX_THREADS,
+                                    HEXDUMP_PARALLEL_MAX_THREADS + 1, 1000};
+    const size_t src_len = 8 * HEXDUMP_PARALLEL_MIN_SLICE + 17;
+    uint8_t* const src = test_alloc(src_len);
+    fill_random(src, src_len, 11);
+    const size_t full = hexdump_output_size(src_len);
+    char* const expected = test_alloc(full + 1);
+    char* const got = test_alloc(full + 1 + TEST_GUARD_LEN);
+    const size_t max_lens[] = {1, 2, full / 2, full / 2 + 1, full - 10, full - 1, full, full + 1};
+    for (size_t i = 0; i < 17 + sizeof many / sizeof many[0]; i++) {
+        const unsigned nthreads = i < 17 ? (unsigned) i : many[i - 17];
+        force_body_kernel(&kernels[i % nkernels]);
+        for (size_t j = 0; j < sizeof max_lens / sizeof max_lens[0]; j++) {
+            check_parallel(src, src_len, max_lens[j], nthreads, expected, got);
+        }
+    }
+    free(got);
+    free(expected);
+    free(src);
+}
+
+//
+//  hexdump_ex() layouts.
+//
+
+#define TEST_NUM_OPTS (2 * 3 * 4 * 2 * 2 * 2)
+
+// Every valid layout, squeeze off.
+static void
+test_all_opts(hexdump_opts* const out) {
+    static const unsigned bytes_per_line[] = {16, 32};
+    static const unsigned offset_digits[] = {4, 8, 16};
+    static const unsigned group_size[] = {1, 2, 4, 8};
+    size_t n = 0;
+    for (size_t b = 0; b < 2; b++) {
+        for (size_t d = 0; d < 3; d++) {
+            for (size_t g = 0; g < 4; g++) {
+                for (unsigned flags = 0; flags < 8; flags++) {
+                    out[n++] = (hexdump_opts) {bytes_per_line[b], offset_digits[d], group_size[g], flags & 1,
+                                               (flags & 2) != 0, (flags & 4) != 0, false};
+                }
+            }
+        }
+    }
+}
+
+static void
+describe_opts(char* const buf, const size_t len, const hexdump_opts* const opts) {
+    snprintf(buf, len, "%u/%u/%u%s%s%s%s", opts->bytes_per_line, opts->offset_digits, opts->group_size,
+             opts->big_endian ? " big endian" : "", opts->uppercase ? " uppercase" : "",
+             opts->hex_only ? " hex only" : "", opts->squeeze ? " squeeze" : "");
+}
+
+// hexdump_ex() text built a line at a time by the formatter of partial lines, which never takes the
+// specialized body functions.
+static size_t
+ref_hexdump_ex(char* const out, const hexdump_layout* const l, const uint8_t* const src, const size_t src_len) {
+    char* p = out;
+    for (size_t pos = 0; pos < src_len; pos += l->bytes_per_line) {
+        const size_t rest = src_len - pos;
+        p = hexdump_ex_line(l, p, src + pos, rest < l->bytes_per_line ? rest : l->bytes_per_line, pos);
+    }
+    *p = '\0';
+    return p - out;
+}
+
+// Each specialized body function, and each kernel of the layouts they format, writes what the generic body
+// writes for the same layout, and nothing between the bodies.
+static void
+test_ex_bodies(const test_body_kernel* const kernels, const size_t nkernels) {
+    enum { max_lines = 9 };
+    uint8_t src[max_lines * 32];
+    fill_random(src, sizeof src, 12);
+    char got[max_lines * HEXDUMP_EX_MAX_LINE_LEN];
+    char expected[max_lines * HEXDUMP_EX_MAX_LINE_LEN];
+    const size_t nvariants = sizeof hexdump_ex_variants / sizeof hexdump_ex_variants[0];
+    for (size_t i = 0; i < nvariants + nkernels; i++) {
+        const hexdump_ex_variant* const v = i < nvariants ? &hexdump_ex_variants[i] : NULL;
+        const hexdump_opts opts = v != NULL
+                                      ? (hexdump_opts) {v->bytes_per_line, 8, v->group, v->big_endian, v->uppercase,
+                                                        !v->ascii, false}
+                                      : (hexdump_opts) {16, 8, 1, false, false, false, false};
+        if (v == NULL) {
+            force_body_kernel(&kernels[i - nvariants]);
+        }
+        char name[64];
+        describe_opts(name, sizeof name, &opts);
+        hexdump_layout l;
+        CHECK(hexdump_layout_init(&l, &opts) == 0, "%s: invalid", name);
+        CHECK(l.body == (v != NULL ? v->body : kernels[i - nvariants].body), "%s: not specialized", name);
+        // Room for more than a body between bodies, where nothing may be written.
+        const size_t stride = l.body_len + 7;
+        for (size_t nlines = 1; nlines <= max_lines; nlines++) {
+            memset(got, '#', sizeof got);
+            memset(expected, '#', sizeof expected);
+            l.body(got, stride, src, nlines);
+            hexdump_ex_body_generic(&l, expected, stride, src, nlines);
+            CHECK(memcmp(got, expected, sizeof got) == 0, "%s %s nlines %zu: \"%.*s\", expected \"%.*s\"", name,
+                  v != NULL ? "body" : kernels[i - nvariants].name, nlines, (int) (stride * nlines), got,
+                  (int) (stride * nlines), expected);
+        }
+    }
+}
+
+static void
+check_ex_layout(const char* const name, const hexdump_opts* const opts, const uint8_t* const src,
+                const size_t src_len, char* const expected, char* const got, const size_t max_size,
+                test_text* const t) {
+    hexdump_layout l;
+    hexdump_layout_init(&l, opts);
+    const size_t expected_len = ref_hexdump_ex(expected, &l, src, src_len);
+    const size_t len = hexdump_ex(got, max_size, src, src_len, opts);
+    CHECK(len == expected_len && memcmp(got, expected, len + 1) == 0,
+          "%s src_len %zu: %zu chars \"%s\", expected %zu \"%s\"", name, src_len, len, len < 400 ? got : "...",
+          expected_len, len < 400 ? expected : "...");
+    for (size_t chunk_len = 1; chunk_len <= 7; chunk_len += 6) {
+        stream_dump(t, opts, src, src_len, chunk_len, chunk_len);
+        check_stream(t, name, expected, expected_len, src_len, chunk_len, chunk_len);
+    }
+}
+
+// Every layout, built whole and streamed in chunks of 1 and 7 bytes, against the text built a line at a time.
+// Lengths up to 7 lines of 32 bytes, and across the 64 KiB offset width change.
+static void
+test_ex_layouts(const test_body_kernel* const kernels, const size_t nkernels) {
+    const size_t boundary = (size_t) 1 << 16;
+    const size_t max_src_len = boundary + 40;
+    uint8_t* const src = test_alloc(max_src_len);
+    fill_random(src, max_src_len, 13);
+    const hexdump_opts widest = {16, 16, 1, false, false, false, false};
+    const size_t max_size = hexdump_ex_output_size(max_src_len, &widest) + HEXDUMP_EX_MAX_LINE_LEN;
+    char* const expected = test_alloc(max_size);
+    char* const got = test_alloc(max_size);
+    test_text t = {NULL, 0, 0};
+    hexdump_opts all[TEST_NUM_OPTS];
+    test_all_opts(all);
+    for (size_t i = 0; i < TEST_NUM_OPTS; i++) {
+        force_body_kernel(&kernels[i % nkernels]);
+        char name[64];
+        describe_opts(name, sizeof name, &all[i]);
+        for (size_t src_len = 0; src_len <= 7 * 32; src_len++) {
+            check_ex_layout(name, &all[i], src, src_len, expected, got, max_size, &t);
+        }
+        for (size_t src_len = boundary - 40; src_len <= max_src_len; src_len += 40) {
+            check_ex_layout(name, &all[i], src, src_len, expected, got, max_size, &t);
+        }
+    }
+    free(t.buf);
+    free(got);
+    free(expected);
+    free(src);
+}
+
+// Invalid layouts format nothing.
+static void
+test_ex_invalid(const test_body_kernel* const kernels, const size_t nkernels) {
+    static const hexdump_opts invalid[] = {
+        {8, 4, 1}, {24, 4, 1}, {64, 4, 1}, {16, 0, 1}, {16, 6, 1}, {16, 32, 1}, {16, 4, 0}, {16, 4, 3}, {16, 4, 16},
+    };
+    const uint8_t src[40] = {1, 2, 3};
+    char out[16] = "unchanged";
+    for (size_t i = 0; i < sizeof invalid / sizeof invalid[0]; i++) {
+        char name[64];
+        describe_opts(name, sizeof name, &invalid[i]);
+        strcpy(out, "unchanged");
+        CHECK(hexdump_ex(out, sizeof out, src, sizeof src, &invalid[i]) == 0 && out[0] == '\0', "%s: formatted", name);
+        CHECK(hexdump_ex_output_size(sizeof src, &invalid[i]) == 0, "%s: has a size", name);
+        hexdump_stream stream;
+        CHECK(hexdump_stream_init_ex(&stream, 0, &invalid[i], test_text_sink, NULL) == EINVAL, "%s: streams", name);
+    }
+}
+
+//
+//  hexdump_ex_output_size() and squeeze.
+//
+
+static void
+check_ex_output_size(const char* const name, const hexdump_opts* const opts, const uint8_t* const src,
+                     const size_t src_len, char* const out) {
+    const size_t size = hexdump_ex_output_size(src_len, opts);
+    CHECK(hexdump_ex(NULL, 0, src, src_len, opts) == size, "%s src_len %zu: size query differs from %zu", name,
+          src_len, size);
+    const size_t whole = hexdump_ex(out, size, src, src_len, opts);
+    CHECK(whole == size - 1 && out[whole] == '\0', "%s src_len %zu: %zu chars in %zu", name, src_len, whole, size);
+    const size_t cut = hexdump_ex(out, size - 1, src, src_len, opts);
+    CHECK(src_len == 0 || cut == size - 2, "%s src_len %zu: %zu chars in %zu", name, src_len, cut, size - 1);
+}
+
+// Without squeeze the size is exactly what hexdump_ex() needs, for every layout.  With squeeze it is at least
+// what is needed.
+static void
+test_ex_output_size(const test_body_kernel* const kernels, const size_t nkernels) {
+    const size_t boundary = (size_t) 1 << 16;
+    const size_t max_src_len = boundary + 33;
+    uint8_t* const src = test_alloc(max_src_len);
+    fill_random(src, max_src_len, 14);
+    // Zero lines in every other block of 8, to be squeezed.
+    for (size_t i = 0; i < max_src_len; i += 1024) {
+        memset(src + i, 0, max_src_len - i < 512 ? max_src_len - i : 512);
+    }
+    const hexdump_opts widest = {16, 16, 1, false, false, false, false};
+    char* const out = test_alloc(hexdump_ex_output_size(max_src_len, &widest));
+    hexdump_opts all[TEST_NUM_OPTS];
+    test_all_opts(all);
+    for (size_t i = 0; i < TEST_NUM_OPTS; i++) {
+        char name[64];
+        describe_opts(name, sizeof name, &all[i]);
+        for (size_t src_len = 0; src_len <= 10 * 32; src_len++) {
+            check_ex_output_size(name, &all[i], src, src_len, out);
+        }
+        for (size_t src_len = boundary - 33; src_len <= max_src_len; src_len += 11) {
+            check_ex_output_size(name, &all[i], src, src_len, out);
+        }
+        hexdump_opts squeezed = all[i];
+        squeezed.squeeze = true;
+        for (size_t src_len = 0; src_len <= 2048; src_len += 7) {
+            const size_t bound = hexdump_ex_output_size(src_len, &squeezed);
+            const size_t len = hexdump_ex(out, bound, src, src_len, &squeezed);
+            CHECK(bound == hexdump_ex_output_size(src_len, &all[i]) && len < bound && out[len] == '\0' &&
+                      hexdump_ex(NULL, 0, src, src_len, &squeezed) == bound,
+                  "%s squeeze src_len %zu: %zu chars in %zu", name, src_len, len, bound);
+        }
+    }
+    free(out);
+    free(src);
+}
+
+// Up to 8 lines, line i random when bit i of pattern is set and zeros otherwise, so that runs start and end
+// anywhere, followed by 5 bytes of no tail, random or zeros.
+#define TEST_RUN_LINES 8
+
+static size_t
+run_input(uint8_t* const out, const size_t nlines, const unsigned pattern, const unsigned tail,
+          const uint8_t* const random) {
+    size_t len = 0;
+    for (size_t i = 0; i < nlines; i++, len += 16) {
+        if (pattern >> i & 1) {
+            memcpy(out + len, random, 16);
+        } else {
+            memset(out + len, 0, 16);
+        }
+    }
+    if (tail != 0) {
+        static const uint8_t zeros[5];
+        memcpy(out + len, tail == 1 ? random : zeros, 5);
+        len += 5;
+    }
+    return len;
+}
+
+// hexundump() gets the bytes back from a squeezed dump, with each line decoder.
+static void
+test_squeeze_round_trip(const test_body_kernel* const kernels, const size_t nkernels) {
+    static const hexdump_opts squeeze = {16, 4, 1, false, false, false, true};
+    const hexundump_line_kernel decoders[] = {hexundump_line_scalar, hexdump_simd_undump_kernel()};
+    uint8_t random[16];
+    fill_random(random, sizeof random, 15);
+    uint8_t src[TEST_RUN_LINES * 16 + 16];
+    char text[hexdump_output_size(sizeof src)];
+    uint8_t back[sizeof src];
+    for (size_t d = 0; d < 2 && decoders[d] != NULL; d++) {
+        atomic_store_explicit(&hexundump_decoder, decoders[d], memory_order_relaxed);
+        for (size_t nlines = 0; nlines <= TEST_RUN_LINES; nlines++) {
+            for (unsigned pattern = 0; pattern < 1u << nlines; pattern++) {
+                for (unsigned tail = 0; tail < 3; tail++) {
+                    const size_t src_len = run_input(src, nlines, pattern, tail, random);
+                    const size_t text_len = hexdump_ex(text, sizeof text, src, src_len, &squeeze);
+                    size_t len = SIZE_MAX;
+                    const int err = hexundump(back, sizeof back, text, text_len, &len);
+                    CHECK(err == 0 && len == src_len && memcmp(back, src, len) == 0,
+                          "decoder %zu pattern %x/%zu tail %u: error %d, %zu bytes of %zu from \"%s\"", d, pattern,
+                          nlines, tail, err, len, src_len, text);
+                }
+            }
+        }
+    }
+}
+
+// lines_len bytes of lines, with every line doubled into src for 32 byte lines, streamed split every third
+// byte against hexdump_ex().
+static void
+check_squeeze_stream(test_text* const t, const char* const name, const hexdump_opts* const opts,
+                     const uint8_t* const lines, uint8_t* const src, const size_t lines_len) {
+    size_t src_len = lines_len;
+    if (opts->bytes_per_line == 32) {
+        for (size_t j = 0; j < lines_len; j += 16) {
+            memcpy(src + j * 2, lines + j, 16);
+            memcpy(src + j * 2 + 16, lines + j, 16);
+        }
+        src_len *= 2;
+    } else {
+        memcpy(src, lines, src_len);
+    }
+    char expected[(TEST_RUN_LINES + 1) * 2 * HEXDUMP_EX_MAX_LINE_LEN];
+    const size_t expected_len = hexdump_ex(expected, sizeof expected, src, src_len, opts);
+    for (size_t split = 0; split <= src_len; split += 3) {
+        stream_dump(t, opts, src, src_len, split, opts->bytes_per_line - 1);
+        check_stream(t, name, expected, expected_len, src_len, split, opts->bytes_per_line - 1);
+    }
+}
+
+// Squeezed runs carry across chunks: a stream split anywhere, in every layout, gives the text of hexdump_ex().
+static void
+test_squeeze_stream(const test_body_kernel* const kernels, const size_t nkernels) {
+    uint8_t random[16];
+    fill_random(random, sizeof random, 16);
+    uint8_t lines[TEST_RUN_LINES * 16 + 16];
+    uint8_t src[sizeof lines * 2];
+    test_text t = {NULL, 0, 0};
+    hexdump_opts all[TEST_NUM_OPTS];
+    test_all_opts(all);
+    for (size_t o = 0; o < TEST_NUM_OPTS; o++) {
+        hexdump_opts opts = all[o];
+        opts.squeeze = true;
+        char name[64];
+        describe_opts(name, sizeof name, &opts);
+        // A different fifth of the inputs for each layout.
+        unsigned input = 0;
+        for (size_t nlines = 0; nlines <= TEST_RUN_LINES; nlines++) {
+            for (unsigned pattern = 0; pattern < 1u << nlines; pattern++) {
+                for (unsigned tail = 0; tail < 3; tail++) {
+                    if (input++ % 5 == o % 5) {
+                        const size_t len = run_input(lines, nlines, pattern, tail, random);
+                        check_squeeze_stream(&t, name, &opts, lines, src, len);
+                    }
+                }
+            }
+        }
+    }
+    free(t.buf);
+}
+
+//
+//  hex_decode() and hexundump().
+//
+
+typedef struct {
+    const char* name;
+    hex_decode_kernel decode;
+} test_decode_kernel;
+
+// The decode kernels the running CPU can execute, scalar first.
+static size_t
+test_decode_kernels(test_decode_kernel* const out) {
+    size_t n = 0;
+    out[n++] = (test_decode_kernel) {"scalar", hex_decode_scalar};
+#if defined(HEXDUMP_SIMD_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        out[n++] = (test_decode_kernel) {"sse2", hex_decode_sse2};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        out[n++] = (test_decode_kernel) {"avx2", hex_decode_avx2};
+    }
+#elif defined(HEXDUMP_SIMD_NEON)
+    out[n++] = (test_decode_kernel) {"neon", hex_decode_neon};
+#endif
+    return n;
+}
+
+// Up to a few blocks of each kernel and a tail of every length.  Every char is replaced in turn with chars
+// next to the hex digits in ASCII and chars with the high bit set, which must be rejected wherever they are.
+static void
+test_hex_decode(const test_body_kernel* const kernels, const size_t nkernels) {
+    static const char bad[] = {'/', ':', '@', 'G', '`', 'g', ' ', '\0', 'x', (char) 0x80, (char) 0xb0, (char) 0xff};
+    enum { max_len = 4 * 32 + 31 };
+    uint8_t bytes[max_len];
+    fill_random(bytes, sizeof bytes, 17);
+    uint8_t cases[2 * max_len];
+    fill_random(cases, sizeof cases, 18);
+    char hex[2 * max_len + 1];
+    for (size_t i = 0; i < 2 * max_len; i++) {
+        const unsigned nibble = i % 2 == 0 ? bytes[i / 2] >> 4 : bytes[i / 2] & 0x0f;
+        hex[i] = (cases[i] & 1 ? "0123456789ABCDEF" : "0123456789abcdef")[nibble];
+    }
+    test_decode_kernel decoders[TEST_MAX_KERNELS];
+    const size_t ndecoders = test_decode_kernels(decoders);
+    uint8_t out[max_len];
+    for (size_t k = 0; k < ndecoders; k++) {
+        atomic_store_explicit(&hex_decoder, decoders[k].decode, memory_order_relaxed);
+        for (size_t n = 0; n <= max_len; n++) {
+            memset(out, 0, sizeof out);
+            CHECK(hex_decode(out, hex, 2 * n) == 0 && memcmp(out, bytes, n) == 0, "%s: %zu bytes", decoders[k].name,
+                  n);
+            CHECK(n == 0 || hex_decode(out, hex, 2 * n - 1) == EINVAL, "%s: odd length %zu", decoders[k].name,
+                  2 * n - 1);
+            for (size_t pos = 0; pos < 2 * n; pos++) {
+                const char c = hex[pos];
+                for (size_t b = 0; b < sizeof bad; b++) {
+                    hex[pos] = bad[b];
+                    CHECK(hex_decode(out, hex, 2 * n) == EINVAL, "%s: %zu bytes with 0x%02x at %zu accepted",
+                          decoders[k].name, n, (uint8_t) bad[b], pos);
+                }
+                hex[pos] = c;
+            }
+        }
+    }
+}
+
+// hexundump() of hexdump() gives the bytes back with each line decoder, reports ENOBUFS for too little room,
+// and rejects a bad hex digit anywhere in the hex column.
+static void
+test_hexundump(const test_body_kernel* const kernels, const size_t nkernels) {
+    const hexundump_line_kernel decoders[] = {hexundump_line_scalar, hexdump_simd_undump_kernel()};
+    enum { max_src_len = 5 * 16 + 15 };
+    uint8_t src[max_src_len];
+    fill_random(src, sizeof src, 19);
+    char text[hexdump_output_size(max_src_len)];
+    uint8_t back[max_src_len];
+    for (size_t d = 0; d < 2 && decoders[d] != NULL; d++) {
+        atomic_store_explicit(&hexundump_decoder, decoders[d], memory_order_relaxed);
+        for (size_t src_len = 0; src_len <= max_src_len; src_len++) {
+            const size_t text_len = hexdump(text, sizeof text, src, src_len);
+            size_t len = SIZE_MAX;
+            int err = hexundump(back, src_len, text, text_len, &len);
+            CHECK(err == 0 && len == src_len && memcmp(back, src, len) == 0,
+                  "decoder %zu src_len %zu: error %d, %zu bytes", d, src_len, err, len);
+            if (src_len > 0) {
+                err = hexundump(back, src_len - 1, text, text_len, &len);
+                CHECK(err == ENOBUFS, "decoder %zu src_len %zu: error %d with a byte too little room", d, src_len,
+                      err);
+            }
+            // The hex column of each line starts after the 4 digit offset and two spaces.
+            for (size_t line = 0; line * 16 < src_len; line++) {
+                for (size_t i = 0; i < 16 && line * 16 + i < src_len; i++) {
+                    for (size_t digit = 0; digit < 2; digit++) {
+                        char* const c = text + line * HEXDUMP_LINE_LEN(4) + 6 + i * 3 + (i < 8 ? 0 : 1) + digit;
+                        const char saved = *c;
+                        *c = 'g';
+                        err = hexundump(back, src_len, text, text_len, &len);
+                        CHECK(err == EINVAL, "decoder %zu src_len %zu: error %d with byte %zu of line %zu bad", d,
+                              src_len, err, i, line);
+                        *c = saved;
+                    }
+                }
+            }
+        }
+    }
+}
+
+typedef struct {
+    const char* name;
+    void (*run)(const test_body_kernel* const kernels, const size_t nkernels);
+} test_case;
+
+static const test_case tests[] = {
+    {"hexdump_small", test_hexdump_small},
+    {"hexdump_offset_widths", test_hexdump_offset_widths},
+    {"stream_splits", test_stream_splits},
+    {"stream_offset_width", test_stream_offset_width},
+    {"stream_sink_error", test_stream_sink_error},
+    {"output_size", test_output_size},
+    {"io", test_io},
+    {"io_errors", test_io_errors},
+    {"parallel_small", test_parallel_small},
+    {"parallel_threads", test_parallel_threads},
+    {"ex_bodies", test_ex_bodies},
+    {"ex_layouts", test_ex_layouts},
+    {"ex_invalid", test_ex_invalid},
+    {"ex_output_size", test_ex_output_size},
+    {"squeeze_round_trip", test_squeeze_round_trip},
+    {"squeeze_stream", test_squeeze_stream},
+    {"hex_decode", test_hex_decode},
+    {"hexundump", test_hexundump},
+};
+
+int
+main(void) {
+    test_body_kernel kernels[TEST_MAX_KERNELS];
+    const size_t nkernels = test_body_kernels(kernels);
+    printf("kernels:");
+    for (size_t k = 0; k < nkernels; k++) {
+        printf(" %s", kernels[k].name);
+    }
+    printf("\n");
+    for (size_t i = 0; i < sizeof tests / sizeof tests[0]; i++) {
+        const unsigned long before = failures;
+        tests[i].run(kernels, nkernels);
+        printf("%s %s\n", failures == before ? "ok  " : "FAIL", tests[i].name);
+    }
+    if (failures != 0) {
+        printf("%lu checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,452 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  Tests of libhexlog.a.  What the background thread writes is compared byte for byte with the header line
+//  and the hexdump() of every record, and a log held up by a full pipe shows what is dropped rather than
+//  blocking its producers.  Every test runs under an alarm, as in mvar_test.
+//
+//  Usage: hexlog_test
+//  Prints one line per test and exits non zero when any check fails.
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "hexdump.h"
+#include "hexlog.h"
+
+// Failures printed in full before the rest are only counted.
+#define TEST_MAX_REPORTS 20
+// Seconds one test may run before it is taken to hang.
+#define TEST_TIMEOUT 30
+// The header line of hexlog.c, clipped to this including its newline.
+#define TEST_HEADER_LEN 127
+
+static unsigned long failures;
+
+#define CHECK(cond, ...)                                                   \
+    do {                                                                   \
+        if (!(cond) && failures++ < TEST_MAX_REPORTS) {                    \
+            fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond);     \
+            fprintf(stderr, __VA_ARGS__);                                  \
+            fputc('\n', stderr);                                           \
+        }                                                                  \
+    } while (0)
+
+static void*
+test_alloc(const size_t len) {
+    void* const p = malloc(len);
+    if (p == NULL) {
+        perror("malloc");
+        exit(2);
+    }
+    return p;
+}
+
+static void
+test_create_thread(pthread_t* const thread, void* (*run)(void*), void* const arg) {
+    const int err = pthread_create(thread, NULL, run, arg);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        exit(2);
+    }
+}
+
+// Deterministic bytes of every value, printable or not.
+static void
+fill_random(uint8_t* const buf, const size_t len, uint64_t seed) {
+    for (size_t i = 0; i < len; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        buf[i] = (uint8_t) seed;
+    }
+}
+
+// Growable text, for what a log was expected to write and what it wrote.
+typedef struct {
+    char* data;
+    size_t len;
+    size_t capacity;
+} test_text;
+
+static void
+test_text_reserve(test_text* const t, const size_t more) {
+    if (t->len + more <= t->capacity) {
+        return;
+    }
+    size_t capacity = t->capacity == 0 ? 4096 : t->capacity;
+    while (capacity < t->len + more) {
+        capacity *= 2;
+    }
+    char* const data = realloc(t->data, capacity);
+    if (data == NULL) {
+        perror("realloc");
+        exit(2);
+    }
+    t->data = data;
+    t->capacity = capacity;
+}
+
+// Append what HexLog writes for a record of len bytes at src under tag.
+static void
+test_text_record(test_text* const t, const char* const tag, const uint8_t* const src, const size_t len) {
+    test_text_reserve(t, TEST_HEADER_LEN + 1 + hexdump_output_size(len));
+    int header = snprintf(t->data + t->len, TEST_HEADER_LEN + 1, "%s %zu bytes\n", tag, len);
+    if (header > TEST_HEADER_LEN) {
+        header = TEST_HEADER_LEN;
+        t->data[t->len + header - 1] = '\n';
+    }
+    t->len += header;
+    t->len += hexdump(t->data + t->len, t->capacity - t->len, src, len);
+}
+
+// Append everything fd has left to read.
+static void
+test_text_read(test_text* const t, const int fd) {
+    for (;;) {
+        test_text_reserve(t, 65536);
+        const ssize_t n = read(fd, t->data + t->len, t->capacity - t->len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        t->len += n;
+    }
+}
+
+// Offset of the first difference, or SIZE_MAX when equal.
+static size_t
+test_text_diff(const test_text* const got, const test_text* const want) {
+    const size_t n = got->len < want->len ? got->len : want->len;
+    for (size_t i = 0; i < n; i++) {
+        if (got->data[i] != want->data[i]) {
+            return i;
+        }
+    }
+    return got->len == want->len ? SIZE_MAX : n;
+}
+
+// An unlinked temporary file, which never fills up the way a pipe does.
+static int
+test_temp_fd(void) {
+    char path[] = "/tmp/hexlog_testXXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        exit(2);
+    }
+    unlink(path);
+    return fd;
+}
+
+//
+//  Output.
+//
+
+// Sizes around the 16 byte lines, one record with a dump too large for the write buffer of the background
+// thread, and a tag too long for the header line.
+static void
+test_hexlog_output(void) {
+    static const size_t sizes[] = {0, 1, 15, 16, 17, 100, 4096, 100000};
+    char long_tag[200];
+    memset(long_tag, 't', sizeof long_tag - 1);
+    long_tag[sizeof long_tag - 1] = '\0';
+    const int fd = test_temp_fd();
+    HexLog log;
+    CHECK(initHexLog(&log, fd, 6) == EINVAL, "queue capacity not a power of two");
+    CHECK(initHexLog(&log, fd, 16) == 0, "init");
+    HexLogProducer p;
+    CHECK(initHexLogProducer(&p, &log, 100) == EINVAL, "arena not a power of two");
+    CHECK(initHexLogProducer(&p, &log, 1 << 18) == 0, "producer init");
+    uint8_t* const data = test_alloc(100000);
+    fill_random(data, 100000, 1);
+    test_text want = {NULL, 0, 0};
+    for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        const char* const tag = i == 3 ? long_tag : i % 2 == 0 ? "request" : "reply";
+        int err;
+        while ((err = writeHexLog(&p, tag, data + i, sizes[i])) == EBUSY) {
+            sched_yield();
+        }
+        CHECK(err == 0, "record %zu: %d", i, err);
+        test_text_record(&want, tag, data + i, sizes[i]);
+    }
+    CHECK(writeHexLog(&p, "big", data, (1 << 18) + 1) == EINVAL, "record larger than the arena");
+    CHECK(flushHexLog(&log) == 0, "flush");
+    test_text got = {NULL, 0, 0};
+    lseek(fd, 0, SEEK_SET);
+    test_text_read(&got, fd);
+    const size_t diff = test_text_diff(&got, &want);
+    CHECK(diff == SIZE_MAX, "%zu bytes written, %zu expected, first difference at %zu", got.len, want.len, diff);
+    destroyHexLogProducer(&p);
+    destroyHexLog(&log);
+    close(fd);
+    free(got.data);
+    free(want.data);
+    free(data);
+}
+
+// The first failing write is reported by every flush after it.
+static void
+test_hexlog_write_error(void) {
+    const int fd = open("/dev/null", O_RDONLY);
+    HexLog log;
+    CHECK(initHexLog(&log, fd, 16) == 0, "init");
+    HexLogProducer p;
+    CHECK(initHexLogProducer(&p, &log, 4096) == 0, "producer init");
+    CHECK(flushHexLog(&log) == 0, "flush before any record");
+    CHECK(writeHexLog(&p, "x", "abc", 3) == 0, "write");
+    CHECK(flushHexLog(&log) == EBADF, "flush after a failed write");
+    CHECK(writeHexLog(&p, "x", "abc", 3) == 0, "write after the failure");
+    CHECK(flushHexLog(&log) == EBADF, "second flush");
+    destroyHexLogProducer(&p);
+    destroyHexLog(&log);
+    close(fd);
+}
+
+//
+//  Dropping.
+//
+
+// Larger than the write buffer of the background thread, so that it goes out with a blocking hexdump_fd()
+// and can't be done while nobody reads the pipe.
+#define TEST_STUCK_LEN 80000
+#define TEST_STUCK_ARENA (1 << 17)
+
+typedef struct {
+    int fd;
+    test_text text;
+} test_pipe_reader;
+
+static void*
+test_read_pipe(void* const arg) {
+    test_pipe_reader* const r = arg;
+    test_text_read(&r->text, r->fd);
+    return NULL;
+}
+
+// While the background thread is stuck writing to a full pipe, records are dropped and counted once the
+// arena or the queue is full, without their producer blocking, and everything accepted still comes out.
+static void
+test_hexlog_drops(void) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(2);
+    }
+    HexLog log;
+    CHECK(initHexLog(&log, fds[1], 4) == 0, "init");
+    HexLogProducer p;
+    CHECK(initHexLogProducer(&p, &log, TEST_STUCK_ARENA) == 0, "producer init");
+    uint8_t* const data = test_alloc(TEST_STUCK_LEN);
+    fill_random(data, TEST_STUCK_LEN, 2);
+    test_text want = {NULL, 0, 0};
+    CHECK(writeHexLog(&p, "stuck", data, TEST_STUCK_LEN) == 0, "first record");
+    test_text_record(&want, "stuck", data, TEST_STUCK_LEN);
+    // Its arena space is only freed once it is written, so another as large doesn't fit.
+    CHECK(writeHexLog(&p, "more", data, TEST_STUCK_ARENA - TEST_STUCK_LEN + 1) == EBUSY, "arena full");
+    CHECK(atomic_load(&p.dropped) == 1, "%zu dropped with the arena full", atomic_load(&p.dropped));
+    // The queue holds 4, the first record still among them unless the background thread has taken it.  Stuck,
+    // it takes no more.
+    unsigned accepted = 0;
+    int err = 0;
+    while (accepted < 100 && (err = writeHexLog(&p, "small", data + accepted, 1)) == 0) {
+        test_text_record(&want, "small", data + accepted, 1);
+        accepted++;
+    }
+    CHECK(err == EBUSY && accepted >= 3 && accepted < 100, "%u records until the queue was full: %d", accepted, err);
+    CHECK(atomic_load(&p.dropped) == 2, "%zu dropped with the queue full", atomic_load(&p.dropped));
+
+    test_pipe_reader reader = {fds[0], {NULL, 0, 0}};
+    pthread_t thread;
+    test_create_thread(&thread, test_read_pipe, &reader);
+    CHECK(flushHexLog(&log) == 0, "flush");
+    CHECK(writeHexLog(&p, "after", data, TEST_STUCK_ARENA - TEST_STUCK_LEN + 1) == 0, "arena free again");
+    test_text_record(&want, "after", data, TEST_STUCK_ARENA - TEST_STUCK_LEN + 1);
+    destroyHexLogProducer(&p);
+    destroyHexLog(&log);
+    close(fds[1]);
+    pthread_join(thread, NULL);
+    close(fds[0]);
+    const size_t diff = test_text_diff(&reader.text, &want);
+    CHECK(diff == SIZE_MAX, "%zu bytes written, %zu expected, first difference at %zu", reader.text.len, want.len,
+          diff);
+    free(reader.text.data);
+    free(want.data);
+    free(data);
+}
+
+//
+//  Several producers.
+//
+
+#define TEST_PRODUCERS 4
+#define TEST_PRODUCER_RECORDS 2000
+#define TEST_RECORD_MAX 64
+
+static const char* const test_producer_tags[TEST_PRODUCERS] = {"p0", "p1", "p2", "p3"};
+
+typedef struct {
+    HexLog* log;
+    unsigned index;
+} test_producer;
+
+static size_t
+test_record_len(const unsigned producer, const unsigned record) {
+    return (producer * 7 + record * 13) % TEST_RECORD_MAX;
+}
+
+static void
+test_record_data(uint8_t* const out, const unsigned producer, const unsigned record) {
+    fill_random(out, TEST_RECORD_MAX, (uint64_t) producer << 32 | (record + 1));
+}
+
+static void*
+test_produce(void* const arg) {
+    const test_producer* const t = arg;
+    HexLogProducer p;
+    if (initHexLogProducer(&p, t->log, 4096) != 0) {
+        fprintf(stderr, "initHexLogProducer failed\n");
+        exit(2);
+    }
+    uint8_t data[TEST_RECORD_MAX];
+    for (unsigned r = 0; r < TEST_PRODUCER_RECORDS; r++) {
+        test_record_data(data, t->index, r);
+        while (writeHexLog(&p, test_producer_tags[t->index], data, test_record_len(t->index, r)) == EBUSY) {
+            sched_yield();
+        }
+    }
+    destroyHexLogProducer(&p);
+    return NULL;
+}
+
+// Records of different producers interleave in any order, but each whole, and each producer's in the order
+// it wrote them.
+static void
+test_hexlog_producers(void) {
+    const int fd = test_temp_fd();
+    HexLog log;
+    CHECK(initHexLog(&log, fd, 64) == 0, "init");
+    test_producer producers[TEST_PRODUCERS];
+    pthread_t threads[TEST_PRODUCERS];
+    for (unsigned i = 0; i < TEST_PRODUCERS; i++) {
+        producers[i] = (test_producer){&log, i};
+        test_create_thread(&threads[i], test_produce, &producers[i]);
+    }
+    for (unsigned i = 0; i < TEST_PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK(flushHexLog(&log) == 0, "flush");
+    destroyHexLog(&log);
+    test_text got = {NULL, 0, 0};
+    lseek(fd, 0, SEEK_SET);
+    test_text_read(&got, fd);
+    close(fd);
+
+    unsigned next[TEST_PRODUCERS] = {0};
+    test_text want = {NULL, 0, 0};
+    uint8_t data[TEST_RECORD_MAX];
+    size_t at = 0;
+    unsigned bad = 0;
+    while (at < got.len && bad == 0) {
+        unsigned producer = TEST_PRODUCERS;
+        for (unsigned i = 0; i < TEST_PRODUCERS; i++) {
+            if (got.len - at > 3 && memcmp(got.data + at, test_producer_tags[i], 2) == 0 && got.data[at + 2] == ' ') {
+                producer = i;
+            }
+        }
+        if (producer == TEST_PRODUCERS || next[producer] == TEST_PRODUCER_RECORDS) {
+            bad++;
+            break;
+        }
+        want.len = 0;
+        test_record_data(data, producer, next[producer]);
+        test_text_record(&want, test_producer_tags[producer], data, test_record_len(producer, next[producer]));
+        if (got.len - at < want.len || memcmp(got.data + at, want.data, want.len) != 0) {
+            bad++;
+            break;
+        }
+        at += want.len;
+        next[producer]++;
+    }
+    CHECK(bad == 0, "unexpected record at %zu of %zu bytes", at, got.len);
+    for (unsigned i = 0; i < TEST_PRODUCERS; i++) {
+        CHECK(next[i] == TEST_PRODUCER_RECORDS, "%s: %u records written", test_producer_tags[i], next[i]);
+    }
+    free(got.data);
+    free(want.data);
+}
+
+typedef struct {
+    const char* name;
+    void (*run)(void);
+} test_case;
+
+static const test_case tests[] = {
+    {"hexlog_output", test_hexlog_output},
+    {"hexlog_write_error", test_hexlog_write_error},
+    {"hexlog_drops", test_hexlog_drops},
+    {"hexlog_producers", test_hexlog_producers},
+};
+
+static const char* running;
+
+static void
+test_on_alarm(const int sig) {
+    static const char msg[] = "timed out: ";
+    (void) sig;
+    if (write(STDERR_FILENO, msg, sizeof msg - 1) < 0 || write(STDERR_FILENO, running, strlen(running)) < 0 ||
+        write(STDERR_FILENO, "\n", 1) < 0) {
+    }
+    _exit(1);
+}
+
+int
+main(void) {
+    signal(SIGALRM, test_on_alarm);
+    for (size_t i = 0; i < sizeof tests / sizeof tests[0]; i++) {
+        const unsigned long before = failures;
+        running = tests[i].name;
+        alarm(TEST_TIMEOUT);
+        tests[i].run();
+        alarm(0);
+        printf("%s %s\n", failures == before ? "ok  " : "FAIL", tests[i].name);
+        fflush(stdout);
+    }
+    if (failures != 0) {
+        printf("%lu checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,2204 @@
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  Tests of libmvar.a: MVar and its siblings, their queues and pools, and the Executor.  Most of what can go
+//  wrong in them is a thread that never wakes up, so every test runs under an alarm and a test still running
+//  when it goes off fails the whole run instead of hanging it.
+//
+//  Usage: mvar_test
+//  Prints one line per test and exits non zero when any check fails.
+//
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "boundedqueue.h"
+#include "eventnotify.h"
+#include "executor.h"
+#include "fastmvar.h"
+#include "mvar.h"
+#include "numaalloc.h"
+#include "objpool.h"
+#include "ptrmvar.h"
+#include "seqmvar.h"
+#include "shardedqueue.h"
+#include "shmmvar.h"
+
+// Failures printed in full before the rest are only counted.
+#define TEST_MAX_REPORTS 20
+// Seconds one test may run before it is taken to hang.
+#define TEST_TIMEOUT 30
+
+static unsigned long failures;
+
+#define CHECK(cond, ...)                                                   \
+    do {                                                                   \
+        if (!(cond) && failures++ < TEST_MAX_REPORTS) {                    \
+            fprintf(stderr, "%s:%d: %s: ", __FILE__, __LINE__, #cond);     \
+            fprintf(stderr, __VA_ARGS__);                                  \
+            fputc('\n', stderr);                                           \
+        }                                                                  \
+    } while (0)
+
+static void
+test_create_thread(pthread_t* const thread, void* (*run)(void*), void* const arg) {
+    const int err = pthread_create(thread, NULL, run, arg);
+    if (err != 0) {
+        fprintf(stderr, "pthread_create: %s\n", strerror(err));
+        exit(2);
+    }
+}
+
+// Whether fd polls readable within timeout_in_msec.
+static bool
+test_readable(const int fd, const int timeout_in_msec) {
+    struct pollfd p = {.fd = fd, .events = POLLIN};
+    int n;
+    while ((n = poll(&p, 1, timeout_in_msec)) < 0 && errno == EINTR) {
+    }
+    return n > 0 && (p.revents & POLLIN) != 0;
+}
+
+//
+//  EventNotify.
+//
+
+// Readable once signalled, however many times, and not after a drain.
+static void
+test_event_notify(void) {
+    EventNotify n;
+    CHECK(initEventNotify(&n) == 0, "init");
+    const int fd = eventNotifyFd(&n);
+    CHECK(!test_readable(fd, 0), "readable before any signal");
+    signalEventNotify(&n);
+    CHECK(test_readable(fd, 0), "not readable after a signal");
+    for (int i = 0; i < 1000; i++) {
+        signalEventNotify(&n);
+    }
+    CHECK(test_readable(fd, 0), "not readable after more signals");
+    drainEventNotify(&n);
+    CHECK(!test_readable(fd, 0), "readable after a drain");
+    CHECK(!atomic_load(&n.pending), "pending after a drain");
+    drainEventNotify(&n);
+    CHECK(!test_readable(fd, 0), "readable after draining twice");
+    signalEventNotify(&n);
+    CHECK(test_readable(fd, 0), "not readable after a signal following a drain");
+    destroyEventNotify(&n);
+}
+
+// How long the signaller keeps signalling.  Long enough for the scheduler to preempt the loop between any
+// two steps of a drain even on a single CPU.
+#define TEST_NOTIFY_MSEC 1000
+
+typedef struct {
+    EventNotify notify;
+    atomic_uint published;
+    atomic_bool done;
+} test_notify_race;
+
+static void*
+test_notify_signaller(void* const arg) {
+    test_notify_race* const r = arg;
+    struct timespec start, now;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned i = 1;; i++) {
+        atomic_store_explicit(&r->published, i, memory_order_relaxed);
+        signalEventNotify(&r->notify);
+        if (i % 256 == 0) {
+            sched_yield();
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 >= TEST_NOTIFY_MSEC) {
+                break;
+            }
+        }
+    }
+    atomic_store_explicit(&r->done, true, memory_order_relaxed);
+    signalEventNotify(&r->notify);
+    return NULL;
+}
+
+// A loop polling, draining and then consuming keeps up with a thread signalling all along: whatever was
+// published before a signal is seen after the drain of a readable descriptor, and the descriptor never stays
+// quiet while something is left to consume.  A drain swallowing a signal it then forgets would leave pending
+// set on an empty descriptor and every later signal skipping its write.
+static void
+test_event_notify_race(void) {
+    test_notify_race r;
+    CHECK(initEventNotify(&r.notify) == 0, "init");
+    atomic_init(&r.published, 0);
+    atomic_init(&r.done, false);
+    pthread_t signaller;
+    test_create_thread(&signaller, test_notify_signaller, &r);
+    while (!atomic_load_explicit(&r.done, memory_order_relaxed)) {
+        if (!test_readable(eventNotifyFd(&r.notify), 2000)) {
+            CHECK(false, "stalled at %u signals with pending %d", atomic_load(&r.published),
+                  atomic_load(&r.notify.pending));
+            break;
+        }
+        drainEventNotify(&r.notify);
+    }
+    pthread_join(signaller, NULL);
+    destroyEventNotify(&r.notify);
+}
+
+//
+//  BoundedQueue.
+//
+
+static void
+test_slot_write(void* const slot, const void* const user_data) {
+    *(unsigned*) slot = *(const unsigned*) user_data;
+}
+
+static void
+test_slot_read(void* const out_user_data, void* const slot) {
+    *(unsigned*) out_user_data = *(unsigned*) slot;
+}
+
+static const BoundedQueueKind test_queue_kinds[] = {BOUNDED_QUEUE_SPSC, BOUNDED_QUEUE_MPMC};
+static const char* const test_queue_kind_names[] = {"spsc", "mpmc"};
+
+// Batches of every size against a queue holding every count, without blocking: a take of up to n returns
+// what there is, a put of n what fits, and n == 0 moves nothing and returns at once, queue empty or not.
+static void
+test_queue_batches(void) {
+    enum { capacity = 8 };
+    for (size_t k = 0; k < 2; k++) {
+        const char* const kind = test_queue_kind_names[k];
+        BoundedQueue q;
+        CHECK(initBoundedQueue(&q, test_queue_kinds[k], capacity, sizeof(unsigned), test_slot_write,
+                               test_slot_read) == 0, "%s: init", kind);
+        unsigned in[2 * capacity], out[2 * capacity];
+        for (unsigned i = 0; i < 2 * capacity; i++) {
+            in[i] = 100 + i;
+        }
+        size_t taken = SIZE_MAX;
+        CHECK(takeManyBoundedQueue(out, sizeof out[0], &q, 0, &taken) == 0 && taken == 0, "%s: empty, n 0", kind);
+        CHECK(putManyBoundedQueue(&q, in, sizeof in[0], 0) == 0 && isEmptyBoundedQueue(&q), "%s: put 0", kind);
+        unsigned next_in = 0;
+        for (size_t held = 0; held <= capacity; held++) {
+            for (size_t n = 0; n <= capacity + 1; n++) {
+                // Fill to held, then take up to n.
+                const size_t put = tryPutManyBoundedQueue(&q, in + next_in % capacity, sizeof in[0], held);
+                CHECK(put == held, "%s: put %zu of %zu", kind, put, held);
+                taken = SIZE_MAX;
+                CHECK(takeManyBoundedQueue(out, sizeof out[0], &q, 0, &taken) == 0 && taken == 0,
+                      "%s: %zu held, n 0 took %zu", kind, held, taken);
+                const size_t want = held < n ? held : n;
+                size_t got = 0;
+                if (want > 0) {
+                    CHECK(takeManyBoundedQueue(out, sizeof out[0], &q, n, &got) == 0 && got == want,
+                          "%s: %zu held, n %zu took %zu", kind, held, n, got);
+                }
+                got += tryTakeManyBoundedQueue(out + got, sizeof out[0], &q, capacity + 1);
+                CHECK(got == held, "%s: %zu held, %zu came out", kind, held, got);
+                for (size_t i = 0; i < got; i++) {
+                    CHECK(out[i] == in[next_in % capacity + i], "%s: element %zu of %zu is %u", kind, i, held,
+                          out[i]);
+                }
+                CHECK(isEmptyBoundedQueue(&q), "%s: not empty after taking all", kind);
+                next_in += held;
+            }
+        }
+        // A full queue takes nothing more.
+        CHECK(tryPutManyBoundedQueue(&q, in, sizeof in[0], 2 * capacity) == capacity, "%s: fill", kind);
+        CHECK(tryPutManyBoundedQueue(&q, in, sizeof in[0], 1) == 0, "%s: put to full", kind);
+        CHECK(tryPutBoundedQueue(&q, &in[0]) == EBUSY, "%s: try put to full", kind);
+        CHECK(putManyBoundedQueue(&q, in, sizeof in[0], 0) == 0, "%s: put 0 to full", kind);
+        destroyBoundedQueue(&q);
+    }
+}
+
+//
+//  Timed MVar operations.
+//
+
+static const MVarWaitOrder test_wait_orders[] = {MVAR_WAIT_ANY, MVAR_WAIT_FIFO, MVAR_WAIT_PRIORITY};
+static const char* const test_wait_order_names[] = {"any", "fifo", "priority"};
+
+typedef struct {
+    MVar_abs base;
+    unsigned value;
+} test_uint_mvar;
+
+static void
+test_mvar_write(void* const mvar_context, const void* const user_data) {
+    ((test_uint_mvar*) mvar_context)->value = *(const unsigned*) user_data;
+}
+
+static void
+test_mvar_read(void* const out_user_data, void* const mvar_context) {
+    *(unsigned*) out_user_data = ((test_uint_mvar*) mvar_context)->value;
+}
+
+static void
+test_init_mvar(test_uint_mvar* const m, const MVarWaitOrder order) {
+    MVarAttr attr;
+    initMVarAttr(&attr);
+    attr.waitOrder = order;
+    initMVarWithAttr(m, test_mvar_write, test_mvar_read, &attr);
+}
+
+// Past deadlines time out, deadlines with tv_nsec out of range fail with EINVAL instead of spinning on them,
+// and neither touches the value or keeps the MVar from working afterwards.
+static void
+test_mvar_deadlines(void) {
+    const struct timespec bad[] = {{0, 1000000000}, {0, 2000000000}, {0, -1}};
+    const struct timespec past = {0, 0};
+    for (size_t o = 0; o < 3; o++) {
+        const char* const order = test_wait_order_names[o];
+        test_uint_mvar m;
+        test_init_mvar(&m, test_wait_orders[o]);
+        unsigned x = 0;
+        CHECK(timedTakeMVarUntil(&x, &m, &past) == ETIMEDOUT, "%s: take past deadline", order);
+        CHECK(timedReadMVarUntil(&x, &m, &past) == ETIMEDOUT, "%s: read past deadline", order);
+        CHECK(timedTakeMVar(&x, &m, 0) == ETIMEDOUT, "%s: take 0 msec", order);
+        CHECK(timedTakeMVarNsec(&x, &m, 1000) == ETIMEDOUT, "%s: take 1 usec", order);
+        for (size_t b = 0; b < sizeof bad / sizeof bad[0]; b++) {
+            CHECK(timedTakeMVarUntil(&x, &m, &bad[b]) == EINVAL, "%s: take, tv_nsec %ld", order, bad[b].tv_nsec);
+            CHECK(timedReadMVarUntil(&x, &m, &bad[b]) == EINVAL, "%s: read, tv_nsec %ld", order, bad[b].tv_nsec);
+        }
+        const unsigned v = 7;
+        CHECK(timedPutMVarUntil(&m, &past, &v) == 0, "%s: put to empty past deadline", order);
+        CHECK(timedPutMVarUntil(&m, &past, &v) == ETIMEDOUT, "%s: put to full past deadline", order);
+        CHECK(timedPutMVar(&m, 0, &v) == ETIMEDOUT, "%s: put to full 0 msec", order);
+        for (size_t b = 0; b < sizeof bad / sizeof bad[0]; b++) {
+            CHECK(timedPutMVarUntil(&m, &bad[b], &v) == EINVAL, "%s: put, tv_nsec %ld", order, bad[b].tv_nsec);
+        }
+        MVar_abs* const set[] = {&m.base};
+        void* const outs[] = {&x};
+        size_t which = SIZE_MAX;
+        CHECK(timedReadMVarUntil(&x, &m, &bad[0]) == 0 && x == 7, "%s: read full, bad deadline", order);
+        CHECK(timedTakeMVarUntil(&x, &m, &past) == 0 && x == 7, "%s: take full past deadline", order);
+        CHECK(timedSelectTakeMVarUntil(outs, set, 1, &past, &which) == ETIMEDOUT, "%s: select past deadline",
+              order);
+        CHECK(timedSelectTakeMVarUntil(outs, set, 1, &bad[0], &which) == EINVAL, "%s: select, bad deadline",
+              order);
+        CHECK(isEmptyMVar(&m), "%s: not empty", order);
+        x = 0;
+        CHECK(putMVar(&m, &v) == 0 && takeMVar(&x, &m) == 0 && x == 7, "%s: put and take after", order);
+    }
+    FastMVar f;
+    initFastMVar_unit(&f);
+    CHECK(acquireFastMVar(&f, FASTMVAR_FULL, FASTMVAR_READING, &past) == ETIMEDOUT, "fast: past deadline");
+    CHECK(acquireFastMVar(&f, FASTMVAR_FULL, FASTMVAR_READING, &bad[0]) == EINVAL, "fast: bad deadline");
+    CHECK(acquireFastMVar(&f, FASTMVAR_EMPTY, FASTMVAR_WRITING, &bad[0]) == 0, "fast: bad deadline, no wait");
+    releaseFastMVar(&f, FASTMVAR_WRITING, FASTMVAR_FULL);
+    CHECK(!isEmptyFastMVar(&f), "fast: empty after put");
+}
+
+//
+//  Layout and allocMVarArray().
+//
+
+// Elements on their own cache lines, the hot and the read only parts of MVar_abs too, and NULL rather than
+// a short allocation when the array doesn't fit in a size_t.
+static void
+test_mvar_array(void) {
+    CHECK(_Alignof(MVar_abs) == MVAR_CACHE_LINE_SIZE && _Alignof(FastMVar) == MVAR_CACHE_LINE_SIZE,
+          "alignment %zu and %zu", _Alignof(MVar_abs), _Alignof(FastMVar));
+    CHECK(offsetof(MVar_abs, write) % MVAR_CACHE_LINE_SIZE == 0 && offsetof(MVar_abs, write) >=
+          offsetof(MVar_abs, spinBudget) + sizeof(atomic_uint), "write at %zu", offsetof(MVar_abs, write));
+    const size_t sizes[] = {1, sizeof(test_uint_mvar), MVAR_CACHE_LINE_SIZE, MVAR_CACHE_LINE_SIZE + 1};
+    for (size_t i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+        size_t stride = 0;
+        char* const array = allocMVarArray(5, sizes[i], &stride);
+        CHECK(array != NULL && (uintptr_t) array % MVAR_CACHE_LINE_SIZE == 0, "elem_size %zu: %p", sizes[i],
+              (void*) array);
+        CHECK(stride >= sizes[i] && stride % MVAR_CACHE_LINE_SIZE == 0 && stride < sizes[i] + MVAR_CACHE_LINE_SIZE,
+              "elem_size %zu: stride %zu", sizes[i], stride);
+        CHECK((char*) mVarArrayAt(array, stride, 4) == array + 4 * stride, "elem_size %zu: element 4", sizes[i]);
+        free(array);
+    }
+    size_t stride;
+    CHECK(allocMVarArray(SIZE_MAX / MVAR_CACHE_LINE_SIZE + 1, MVAR_CACHE_LINE_SIZE, &stride) == NULL,
+          "count overflows");
+    CHECK(allocMVarArray(SIZE_MAX / 128 + 1, 65, &stride) == NULL, "count overflows with padding");
+    CHECK(allocMVarArray(2, SIZE_MAX, &stride) == NULL, "elem_size overflows");
+    CHECK(allocMVarArray(1, SIZE_MAX - 10, &stride) == NULL, "elem_size overflows with padding");
+}
+
+//
+//  ShmMVar.
+//
+
+static double
+test_now_msec(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+}
+
+static void
+test_sleep_msec(const long msec) {
+    const struct timespec t = {msec / 1000, msec % 1000 * 1000000};
+    nanosleep(&t, NULL);
+}
+
+// A ShmMVar in a shared anonymous mapping, which a fork()ed child shares too.
+static ShmMVar*
+test_shm_mvar(const size_t nslots, const size_t slot_size, size_t* const out_size) {
+    *out_size = shmMVarSize(nslots, slot_size);
+    void* const segment = mmap(NULL, *out_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (segment == MAP_FAILED) {
+        perror("mmap");
+        exit(2);
+    }
+    if (initShmMVar(segment, nslots, slot_size) != 0) {
+        fprintf(stderr, "initShmMVar failed\n");
+        exit(2);
+    }
+    return openShmMVar(segment);
+}
+
+static void
+test_free_shm_mvar(ShmMVar* const v, const size_t size) {
+    destroyShmMVar(v);
+    munmap(v, size);
+}
+
+// Holds the lock of a ShmMVar through acquirePutShmMVar() for TEST_SHM_HOLD_MSEC, then puts.
+#define TEST_SHM_HOLD_MSEC 400
+
+typedef struct {
+    ShmMVar* mvar;
+    atomic_bool holding;
+} test_shm_holder;
+
+static void*
+test_shm_hold(void* const arg) {
+    test_shm_holder* const h = arg;
+    ShmMVarPayload slot;
+    if (acquirePutShmMVar(&slot, h->mvar, NULL) != 0) {
+        atomic_store(&h->holding, true);
+        return NULL;
+    }
+    atomic_store(&h->holding, true);
+    test_sleep_msec(TEST_SHM_HOLD_MSEC);
+    memcpy(shmMVarPayloadData(h->mvar, slot), "held", 4);
+    releasePutShmMVar(h->mvar, 4);
+    return NULL;
+}
+
+// A timed operation gives up on time while another thread holds the lock for longer through the zero copy
+// API, instead of waiting for it to be released.
+static void
+test_shm_mvar_timed_lock(void) {
+    size_t size;
+    ShmMVar* const v = test_shm_mvar(1, 16, &size);
+    test_shm_holder h = {.mvar = v};
+    atomic_init(&h.holding, false);
+    pthread_t holder;
+    test_create_thread(&holder, test_shm_hold, &h);
+    while (!atomic_load(&h.holding)) {
+        sched_yield();
+    }
+    char out[16];
+    size_t len = 0;
+    const double start = test_now_msec();
+    int err = timedTakeShmMVar(out, &len, v, 20);
+    const double waited = test_now_msec() - start;
+    CHECK(err == ETIMEDOUT, "take while the lock is held: %d", err);
+    CHECK(waited < TEST_SHM_HOLD_MSEC / 2, "take waited %.0f msec for a 20 msec timeout", waited);
+    err = timedPutShmMVar(v, 20, "x", 1);
+    CHECK(err == ETIMEDOUT, "put while the lock is held: %d", err);
+    CHECK(tryTakeShmMVar(out, &len, v) == EBUSY, "try take while the lock is held");
+    err = timedTakeShmMVar(out, &len, v, 10 * TEST_SHM_HOLD_MSEC);
+    CHECK(err == 0 && len == 4 && memcmp(out, "held", 4) == 0, "take after the release: %d", err);
+    pthread_join(holder, NULL);
+    test_free_shm_mvar(v, size);
+}
+
+//
+//  MVar_abs and FastMVar semantics.
+//
+
+// An MVar implementation under test.  Both take the same arguments, only the types differ.
+typedef struct {
+    const char* name;
+    size_t size;
+    void (*init)(void* const out_mvar);
+    bool (*isEmpty)(const void* const mvar);
+    int (*put)(void* const mvar, const void* const user_data);
+    int (*read)(void* const out_user_data, void* const mvar);
+    int (*take)(void* const out_user_data, void* const mvar);
+    int (*timedPut)(void* const mvar, const long int timeout_in_msec, const void* const user_data);
+    int (*timedRead)(void* const out_user_data, void* const mvar, const long int timeout_in_msec);
+    int (*timedTake)(void* const out_user_data, void* const mvar, const long int timeout_in_msec);
+    int (*tryPut)(void* const mvar, const void* const user_data);
+    int (*tryRead)(void* const out_user_data, void* const mvar);
+    int (*tryTake)(void* const out_user_data, void* const mvar);
+} test_mvar_impl;
+
+typedef struct {
+    FastMVar base;
+    unsigned value;
+} test_uint_fastmvar;
+
+static void
+test_fastmvar_write(void* const mvar_context, const void* const user_data) {
+    ((test_uint_fastmvar*) mvar_context)->value = *(const unsigned*) user_data;
+}
+
+static void
+test_fastmvar_read(void* const out_user_data, void* const mvar_context) {
+    *(unsigned*) out_user_data = ((test_uint_fastmvar*) mvar_context)->value;
+}
+
+static void
+test_init_plain_mvar(void* const out_mvar) {
+    initMVar(out_mvar, test_mvar_write, test_mvar_read);
+}
+
+static void
+test_init_fastmvar(void* const out_mvar) {
+    initFastMVar(out_mvar, test_fastmvar_write, test_fastmvar_read);
+}
+
+static const test_mvar_impl test_mvar_impls[] = {
+    {"mvar", sizeof(test_uint_mvar), test_init_plain_mvar, isEmptyMVar, putMVar, readMVar, takeMVar, timedPutMVar,
+     timedReadMVar, timedTakeMVar, tryPutMVar, tryReadMVar, tryTakeMVar},
+    {"fastmvar", sizeof(test_uint_fastmvar), test_init_fastmvar, isEmptyFastMVar, putFastMVar, readFastMVar,
+     takeFastMVar, timedPutFastMVar, timedReadFastMVar, timedTakeFastMVar, tryPutFastMVar, tryReadFastMVar,
+     tryTakeFastMVar},
+};
+
+static void*
+test_alloc_mvar(const test_mvar_impl* const impl) {
+    size_t stride;
+    void* const mvar = allocMVarArray(1, impl->size, &stride);
+    if (mvar == NULL) {
+        perror("allocMVarArray");
+        exit(2);
+    }
+    impl->init(mvar);
+    return mvar;
+}
+
+// Every operation against an empty and a full MVar from one thread.
+static void
+test_mvar_semantics(void) {
+    for (size_t i = 0; i < sizeof test_mvar_impls / sizeof test_mvar_impls[0]; i++) {
+        const test_mvar_impl* const m = &test_mvar_impls[i];
+        void* const v = test_alloc_mvar(m);
+        unsigned x = 0;
+        CHECK(m->isEmpty(v), "%s: not empty after init", m->name);
+        CHECK(m->tryTake(&x, v) == EBUSY && m->tryRead(&x, v) == EBUSY, "%s: try from empty", m->name);
+        CHECK(m->timedTake(&x, v, 10) == ETIMEDOUT, "%s: timed take from empty", m->name);
+        CHECK(m->timedRead(&x, v, 10) == ETIMEDOUT, "%s: timed read from empty", m->name);
+        const unsigned a = 11, b = 22;
+        CHECK(m->put(v, &a) == 0 && !m->isEmpty(v), "%s: put", m->name);
+        CHECK(m->tryPut(v, &b) == EBUSY, "%s: try put to full", m->name);
+        CHECK(m->timedPut(v, 10, &b) == ETIMEDOUT, "%s: timed put to full", m->name);
+        CHECK(m->read(&x, v) == 0 && x == a && !m->isEmpty(v), "%s: read %u", m->name, x);
+        x = 0;
+        CHECK(m->tryRead(&x, v) == 0 && x == a, "%s: try read %u", m->name, x);
+        x = 0;
+        CHECK(m->timedRead(&x, v, 10) == 0 && x == a, "%s: timed read %u", m->name, x);
+        x = 0;
+        CHECK(m->take(&x, v) == 0 && x == a && m->isEmpty(v), "%s: take %u", m->name, x);
+        CHECK(m->tryPut(v, &b) == 0, "%s: try put to empty", m->name);
+        CHECK(m->tryTake(&x, v) == 0 && x == b, "%s: try take %u", m->name, x);
+        CHECK(m->timedPut(v, 10, &a) == 0, "%s: timed put to empty", m->name);
+        CHECK(m->timedTake(&x, v, 10) == 0 && x == a, "%s: timed take %u", m->name, x);
+        CHECK(m->isEmpty(v), "%s: not empty at the end", m->name);
+        free(v);
+    }
+}
+
+#define TEST_PING_PONG_ROUNDS 20000
+
+typedef struct {
+    const test_mvar_impl* impl;
+    void* to;
+    void* from;
+} test_ping_pong;
+
+// Takes every value from p->to and puts it back incremented to p->from, with each kind of blocking call.
+static void*
+test_ponger(void* const arg) {
+    const test_ping_pong* const p = arg;
+    for (unsigned i = 0; i < TEST_PING_PONG_ROUNDS; i++) {
+        unsigned x;
+        int err = i % 3 == 0 ? p->impl->take(&x, p->to) : p->impl->timedTake(&x, p->to, 10000);
+        if (err == 0) {
+            x++;
+            err = i % 2 == 0 ? p->impl->put(p->from, &x) : p->impl->timedPut(p->from, 10000, &x);
+        }
+        if (err != 0) {
+            fprintf(stderr, "%s: ponger: %s\n", p->impl->name, strerror(err));
+            exit(1);
+        }
+    }
+    return NULL;
+}
+
+// Values bounce between two threads through two MVars, each thread blocking on every round.
+static void
+test_mvar_ping_pong(void) {
+    for (size_t i = 0; i < sizeof test_mvar_impls / sizeof test_mvar_impls[0]; i++) {
+        const test_mvar_impl* const m = &test_mvar_impls[i];
+        test_ping_pong p = {m, test_alloc_mvar(m), test_alloc_mvar(m)};
+        pthread_t ponger;
+        test_create_thread(&ponger, test_ponger, &p);
+        unsigned bad = 0;
+        for (unsigned r = 0; r < TEST_PING_PONG_ROUNDS; r++) {
+            const unsigned x = 2 * r;
+            unsigned y = 0;
+            if (m->put(p.to, &x) != 0 || m->take(&y, p.from) != 0 || y != x + 1) {
+                bad++;
+            }
+        }
+        pthread_join(ponger, NULL);
+        CHECK(bad == 0, "%s: %u rounds wrong", m->name, bad);
+        CHECK(m->isEmpty(p.to) && m->isEmpty(p.from), "%s: not empty at the end", m->name);
+        free(p.to);
+        free(p.from);
+    }
+}
+
+typedef struct {
+    const test_mvar_impl* impl;
+    void* mvar;
+    unsigned sum;
+} test_mvar_taker;
+
+#define TEST_MVAR_THREADS 4
+#define TEST_MVAR_PER_THREAD 5000
+
+static void*
+test_mvar_take_many(void* const arg) {
+    test_mvar_taker* const t = arg;
+    for (unsigned i = 0; i < TEST_MVAR_PER_THREAD; i++) {
+        unsigned x = 0;
+        t->impl->take(&x, t->mvar);
+        t->sum += x;
+    }
+    return NULL;
+}
+
+static void*
+test_mvar_put_many(void* const arg) {
+    test_mvar_taker* const t = arg;
+    for (unsigned i = 1; i <= TEST_MVAR_PER_THREAD; i++) {
+        t->impl->put(t->mvar, &i);
+    }
+    return NULL;
+}
+
+// Several putters and takers on one MVar: every value is taken exactly once.
+static void
+test_mvar_contended(void) {
+    for (size_t i = 0; i < sizeof test_mvar_impls / sizeof test_mvar_impls[0]; i++) {
+        const test_mvar_impl* const m = &test_mvar_impls[i];
+        void* const v = test_alloc_mvar(m);
+        test_mvar_taker takers[TEST_MVAR_THREADS], putters[TEST_MVAR_THREADS];
+        pthread_t threads[2 * TEST_MVAR_THREADS];
+        for (size_t t = 0; t < TEST_MVAR_THREADS; t++) {
+            takers[t] = (test_mvar_taker) {m, v, 0};
+            putters[t] = (test_mvar_taker) {m, v, 0};
+            test_create_thread(&threads[2 * t], test_mvar_take_many, &takers[t]);
+            test_create_thread(&threads[2 * t + 1], test_mvar_put_many, &putters[t]);
+        }
+        unsigned sum = 0;
+        for (size_t t = 0; t < TEST_MVAR_THREADS; t++) {
+            pthread_join(threads[2 * t], NULL);
+            pthread_join(threads[2 * t + 1], NULL);
+            sum += takers[t].sum;
+        }
+        const unsigned expected = TEST_MVAR_THREADS * (TEST_MVAR_PER_THREAD * (TEST_MVAR_PER_THREAD + 1) / 2);
+        CHECK(sum == expected && m->isEmpty(v), "%s: took a sum of %u, expected %u", m->name, sum, expected);
+        free(v);
+    }
+}
+
+//
+//  BoundedQueue semantics and threads.
+//
+
+// Single thread: FIFO over many laps of the ring, full and empty, and capacities that aren't powers of two.
+static void
+test_queue_semantics(void) {
+    enum { capacity = 4 };
+    for (size_t k = 0; k < 2; k++) {
+        const char* const kind = test_queue_kind_names[k];
+        BoundedQueue q;
+        CHECK(initBoundedQueue(&q, test_queue_kinds[k], 3, sizeof(unsigned), test_slot_write, test_slot_read)
+              == EINVAL, "%s: capacity 3", kind);
+        CHECK(initBoundedQueue(&q, test_queue_kinds[k], 0, sizeof(unsigned), test_slot_write, test_slot_read)
+              == EINVAL, "%s: capacity 0", kind);
+        CHECK(initBoundedQueue(&q, test_queue_kinds[k], capacity, sizeof(unsigned), test_slot_write,
+                               test_slot_read) == 0, "%s: init", kind);
+        unsigned x = 0;
+        CHECK(isEmptyBoundedQueue(&q) && tryTakeBoundedQueue(&x, &q) == EBUSY, "%s: try take from empty", kind);
+        CHECK(timedTakeBoundedQueue(&x, &q, 10) == ETIMEDOUT, "%s: timed take from empty", kind);
+        unsigned next_in = 0, next_out = 0;
+        for (unsigned lap = 0; lap < 10; lap++) {
+            for (unsigned i = 0; i < capacity; i++, next_in++) {
+                const int err = i % 3 == 0   ? putBoundedQueue(&q, &next_in)
+                                : i % 3 == 1 ? timedPutBoundedQueue(&q, 10, &next_in)
+                                             : tryPutBoundedQueue(&q, &next_in);
+                CHECK(err == 0, "%s: lap %u put %u: %d", kind, lap, i, err);
+            }
+            CHECK(tryPutBoundedQueue(&q, &next_in) == EBUSY, "%s: lap %u: try put to full", kind, lap);
+            CHECK(timedPutBoundedQueue(&q, 10, &next_in) == ETIMEDOUT, "%s: lap %u: timed put to full", kind, lap);
+            // Half out and half in again, so the ring wraps mid lap.
+            for (unsigned i = 0; i < capacity / 2; i++, next_out++) {
+                CHECK(takeBoundedQueue(&x, &q) == 0 && x == next_out, "%s: lap %u: took %u, expected %u", kind, lap,
+                      x, next_out);
+            }
+            for (unsigned i = 0; i < capacity / 2; i++, next_in++) {
+                CHECK(tryPutBoundedQueue(&q, &next_in) == 0, "%s: lap %u: refill", kind, lap);
+            }
+            while (next_out < next_in) {
+                const int err = next_out % 2 == 0 ? timedTakeBoundedQueue(&x, &q, 10) : tryTakeBoundedQueue(&x, &q);
+                CHECK(err == 0 && x == next_out, "%s: lap %u: took %u, expected %u", kind, lap, x, next_out);
+                next_out++;
+            }
+            CHECK(isEmptyBoundedQueue(&q), "%s: lap %u: not empty", kind, lap);
+        }
+        destroyBoundedQueue(&q);
+    }
+}
+
+#define TEST_QUEUE_PER_PRODUCER 20000
+#define TEST_QUEUE_THREADS 3
+// Elements of a batch in the threaded tests.
+#define TEST_QUEUE_BATCH 5
+
+typedef struct {
+    BoundedQueue* queue;
+    unsigned id;
+    bool batches;
+    // Consumers: the next sequence number expected from each producer, and failures seen.
+    unsigned next[TEST_QUEUE_THREADS];
+    unsigned taken;
+    unsigned bad;
+} test_queue_thread;
+
+// Values carry the producer in the top bits and its sequence number below.
+#define TEST_QUEUE_ID_SHIFT 24
+
+static void*
+test_queue_produce(void* const arg) {
+    test_queue_thread* const t = arg;
+    unsigned batch[TEST_QUEUE_BATCH];
+    for (unsigned i = 0; i < TEST_QUEUE_PER_PRODUCER;) {
+        if (t->batches && TEST_QUEUE_PER_PRODUCER - i >= TEST_QUEUE_BATCH) {
+            for (unsigned j = 0; j < TEST_QUEUE_BATCH; j++) {
+                batch[j] = t->id << TEST_QUEUE_ID_SHIFT | (i + j);
+            }
+            putManyBoundedQueue(t->queue, batch, sizeof batch[0], TEST_QUEUE_BATCH);
+            i += TEST_QUEUE_BATCH;
+        } else {
+            const unsigned x = t->id << TEST_QUEUE_ID_SHIFT | i;
+            putBoundedQueue(t->queue, &x);
+            i++;
+        }
+    }
+    return NULL;
+}
+
+static void
+test_queue_check(test_queue_thread* const t, const unsigned x) {
+    const unsigned id = x >> TEST_QUEUE_ID_SHIFT, seq = x & ((1u << TEST_QUEUE_ID_SHIFT) - 1);
+    // Each producer's values come out in the order it put them, whoever takes them.
+    if (id >= TEST_QUEUE_THREADS || seq < t->next[id]) {
+        t->bad++;
+    } else {
+        t->next[id] = seq + 1;
+    }
+    t->taken++;
+}
+
+// Consumes until a value with the stop id, TEST_QUEUE_THREADS, comes out.
+static void*
+test_queue_consume(void* const arg) {
+    test_queue_thread* const t = arg;
+    unsigned batch[TEST_QUEUE_BATCH];
+    for (;;) {
+        size_t n = 1;
+        if (t->batches) {
+            takeManyBoundedQueue(batch, sizeof batch[0], t->queue, TEST_QUEUE_BATCH, &n);
+        } else {
+            takeBoundedQueue(&batch[0], t->queue);
+        }
+        for (size_t i = 0; i < n; i++) {
+            if (batch[i] >> TEST_QUEUE_ID_SHIFT == TEST_QUEUE_THREADS) {
+                // Hand the rest of the batch back for the other consumers.
+                putManyBoundedQueue(t->queue, batch + i + 1, sizeof batch[0], n - i - 1);
+                return NULL;
+            }
+            test_queue_check(t, batch[i]);
+        }
+    }
+}
+
+// nproducers and nconsumers threads through a small queue, so both sides keep blocking: every value comes
+// out exactly once and each producer's in order.
+static void
+test_queue_threads(const BoundedQueueKind kind, const char* const name, const size_t nproducers,
+                   const size_t nconsumers, const bool batches) {
+    BoundedQueue q;
+    CHECK(initBoundedQueue(&q, kind, 8, sizeof(unsigned), test_slot_write, test_slot_read) == 0, "%s: init", name);
+    test_queue_thread producers[TEST_QUEUE_THREADS], consumers[TEST_QUEUE_THREADS];
+    pthread_t threads[2 * TEST_QUEUE_THREADS];
+    for (size_t i = 0; i < nconsumers; i++) {
+        consumers[i] = (test_queue_thread) {.queue = &q, .batches = batches};
+        test_create_thread(&threads[nproducers + i], test_queue_consume, &consumers[i]);
+    }
+    for (size_t i = 0; i < nproducers; i++) {
+        producers[i] = (test_queue_thread) {.queue = &q, .id = i, .batches = batches};
+        test_create_thread(&threads[i], test_queue_produce, &producers[i]);
+    }
+    for (size_t i = 0; i < nproducers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    const unsigned stop = TEST_QUEUE_THREADS << TEST_QUEUE_ID_SHIFT;
+    for (size_t i = 0; i < nconsumers; i++) {
+        putBoundedQueue(&q, &stop);
+    }
+    unsigned taken = 0, bad = 0;
+    unsigned last[TEST_QUEUE_THREADS] = {0};
+    for (size_t i = 0; i < nconsumers; i++) {
+        pthread_join(threads[nproducers + i], NULL);
+        taken += consumers[i].taken;
+        bad += consumers[i].bad;
+        for (size_t p = 0; p < nproducers; p++) {
+            if (consumers[i].next[p] > last[p]) {
+                last[p] = consumers[i].next[p];
+            }
+        }
+    }
+    CHECK(taken == nproducers * TEST_QUEUE_PER_PRODUCER && bad == 0, "%s: %u taken, %u out of order", name, taken,
+          bad);
+    for (size_t p = 0; p < nproducers; p++) {
+        CHECK(last[p] == TEST_QUEUE_PER_PRODUCER, "%s: producer %zu: last value %u", name, p, last[p]);
+    }
+    CHECK(isEmptyBoundedQueue(&q), "%s: not empty at the end", name);
+    destroyBoundedQueue(&q);
+}
+
+static void
+test_queue_spsc(void) {
+    test_queue_threads(BOUNDED_QUEUE_SPSC, "spsc", 1, 1, false);
+    test_queue_threads(BOUNDED_QUEUE_SPSC, "spsc batches", 1, 1, true);
+}
+
+static void
+test_queue_mpmc(void) {
+    test_queue_threads(BOUNDED_QUEUE_MPMC, "mpmc", TEST_QUEUE_THREADS, TEST_QUEUE_THREADS, false);
+    test_queue_threads(BOUNDED_QUEUE_MPMC, "mpmc batches", TEST_QUEUE_THREADS, TEST_QUEUE_THREADS, true);
+}
+
+//
+//  PtrMVar.
+//
+
+// put, take, borrow and their timed and try forms from one thread, and the borrow count's limit.
+static void
+test_ptr_mvar_semantics(void) {
+    PtrMVar v;
+    initPtrMVar(&v);
+    int a = 1, b = 2;
+    void* p = NULL;
+    CHECK(isEmptyPtrMVar(&v), "not empty after init");
+    CHECK(tryTakePtrMVar(&p, &v) == EBUSY && tryReadPtrMVar(&p, &v) == EBUSY, "try from empty");
+    CHECK(timedTakePtrMVar(&p, &v, 10) == ETIMEDOUT && timedReadPtrMVar(&p, &v, 10) == ETIMEDOUT,
+          "timed from empty");
+    CHECK(putPtrMVar(&v, NULL) == EINVAL && tryPutPtrMVar(&v, NULL) == EINVAL &&
+          timedPutPtrMVar(&v, 10, NULL) == EINVAL, "put NULL");
+    CHECK(putPtrMVar(&v, &a) == 0 && !isEmptyPtrMVar(&v), "put");
+    CHECK(tryPutPtrMVar(&v, &b) == EBUSY && timedPutPtrMVar(&v, 10, &b) == ETIMEDOUT, "put to full");
+    // Borrowed twice: try take refuses until both are released, and the pointer stays.
+    CHECK(readPtrMVar(&p, &v) == 0 && p == &a, "read");
+    p = NULL;
+    CHECK(tryReadPtrMVar(&p, &v) == 0 && p == &a, "try read");
+    CHECK(tryTakePtrMVar(&p, &v) == EBUSY && !isEmptyPtrMVar(&v), "try take while borrowed twice");
+    releasePtrMVar(&v);
+    CHECK(tryTakePtrMVar(&p, &v) == EBUSY, "try take while borrowed once");
+    releasePtrMVar(&v);
+    p = NULL;
+    CHECK(tryTakePtrMVar(&p, &v) == 0 && p == &a && isEmptyPtrMVar(&v), "try take");
+    CHECK(tryPutPtrMVar(&v, &b) == 0, "try put");
+    p = NULL;
+    CHECK(timedReadPtrMVar(&p, &v, 10) == 0 && p == &b, "timed read");
+    releasePtrMVar(&v);
+    CHECK(timedTakePtrMVar(&p, &v, 10) == 0 && p == &b, "timed take");
+    CHECK(timedPutPtrMVar(&v, 10, &a) == 0 && takePtrMVar(&p, &v) == 0 && p == &a, "timed put and take");
+    // The count is full at PTRMVAR_BORROW_MASK borrows.
+    putPtrMVar(&v, &a);
+    unsigned borrowed = 0;
+    while (borrowed <= PTRMVAR_BORROW_MASK && tryReadPtrMVar(&p, &v) == 0) {
+        borrowed++;
+    }
+    CHECK(borrowed == PTRMVAR_BORROW_MASK, "%u borrows", borrowed);
+    CHECK(tryReadPtrMVar(&p, &v) == EAGAIN && readPtrMVar(&p, &v) == EAGAIN, "borrow beyond the limit");
+    CHECK(tryTakePtrMVar(&p, &v) == EBUSY, "try take while fully borrowed");
+    while (borrowed-- > 0) {
+        releasePtrMVar(&v);
+    }
+    CHECK(atomic_load(&v.borrows) == 0, "borrows %#x after releasing all", atomic_load(&v.borrows));
+    CHECK(takePtrMVar(&p, &v) == 0 && p == &a, "take after releasing all");
+}
+
+typedef struct {
+    PtrMVar* mvar;
+    void* taken;
+    atomic_bool done;
+} test_ptr_taker;
+
+static void*
+test_ptr_take(void* const arg) {
+    test_ptr_taker* const t = arg;
+    takePtrMVar(&t->taken, t->mvar);
+    atomic_store(&t->done, true);
+    return NULL;
+}
+
+// A take returns only after the borrow outstanding when it took the pointer is released, and a borrow
+// attempted meanwhile doesn't get the pointer.
+static void
+test_ptr_mvar_drain(void) {
+    PtrMVar v;
+    initPtrMVar(&v);
+    int a = 1;
+    void* p = NULL;
+    putPtrMVar(&v, &a);
+    CHECK(readPtrMVar(&p, &v) == 0 && p == &a, "read");
+    test_ptr_taker t = {.mvar = &v};
+    atomic_init(&t.done, false);
+    pthread_t taker;
+    test_create_thread(&taker, test_ptr_take, &t);
+    while (isEmptyPtrMVar(&v) == false) {
+        sched_yield();
+    }
+    test_sleep_msec(50);
+    CHECK(!atomic_load(&t.done), "take returned while the pointer was borrowed");
+    CHECK(tryReadPtrMVar(&p, &v) == EBUSY, "borrowed while a take drains");
+    releasePtrMVar(&v);
+    pthread_join(taker, NULL);
+    CHECK(t.taken == &a, "took %p", t.taken);
+    CHECK(atomic_load(&v.borrows) == 0, "borrows %#x after the drain", atomic_load(&v.borrows));
+}
+
+#define TEST_PTR_OBJECTS 4
+#define TEST_PTR_ROUNDS 20000
+#define TEST_PTR_POISON 0xdeadu
+
+typedef struct {
+    PtrMVar* mvar;
+    unsigned values[TEST_PTR_OBJECTS];
+    atomic_bool stop;
+    atomic_uint bad;
+    atomic_uint borrows;
+} test_ptr_race;
+
+// Borrow and look at whatever is in the MVar, which the taker must not have poisoned yet.
+static void*
+test_ptr_borrower(void* const arg) {
+    test_ptr_race* const r = arg;
+    while (!atomic_load_explicit(&r->stop, memory_order_relaxed)) {
+        void* p;
+        if (tryReadPtrMVar(&p, r->mvar) != 0) {
+            sched_yield();
+            continue;
+        }
+        const unsigned x = *(volatile unsigned*) p;
+        sched_yield();
+        const unsigned y = *(volatile unsigned*) p;
+        if (x == TEST_PTR_POISON || y != x) {
+            atomic_fetch_add(&r->bad, 1);
+        }
+        releasePtrMVar(r->mvar);
+        atomic_fetch_add_explicit(&r->borrows, 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+static void*
+test_ptr_putter(void* const arg) {
+    test_ptr_race* const r = arg;
+    for (unsigned i = 0; i < TEST_PTR_ROUNDS; i++) {
+        unsigned* const obj = &r->values[i % TEST_PTR_OBJECTS];
+        // Reused only after the taker below poisoned it, so nobody can still be looking.
+        while (*(volatile unsigned*) obj != TEST_PTR_POISON) {
+            sched_yield();
+        }
+        *(volatile unsigned*) obj = i;
+        putPtrMVar(r->mvar, obj);
+    }
+    return NULL;
+}
+
+// A putter and a taker hand objects around under two borrowers.  The taker poisons every object as soon as
+// its take returns, so a borrower seeing poison or a value changing under it means a take didn't wait for it.
+static void
+test_ptr_mvar_threads(void) {
+    PtrMVar v;
+    initPtrMVar(&v);
+    test_ptr_race r = {.mvar = &v};
+    for (size_t i = 0; i < TEST_PTR_OBJECTS; i++) {
+        r.values[i] = TEST_PTR_POISON;
+    }
+    atomic_init(&r.stop, false);
+    atomic_init(&r.bad, 0);
+    atomic_init(&r.borrows, 0);
+    pthread_t threads[3];
+    test_create_thread(&threads[0], test_ptr_putter, &r);
+    test_create_thread(&threads[1], test_ptr_borrower, &r);
+    test_create_thread(&threads[2], test_ptr_borrower, &r);
+    unsigned bad_order = 0;
+    for (unsigned i = 0; i < TEST_PTR_ROUNDS; i++) {
+        void* p = NULL;
+        takePtrMVar(&p, &v);
+        unsigned* const obj = p;
+        if (obj != &r.values[i % TEST_PTR_OBJECTS] || *obj != i) {
+            bad_order++;
+        }
+        *(volatile unsigned*) obj = TEST_PTR_POISON;
+    }
+    atomic_store(&r.stop, true);
+    for (size_t i = 0; i < 3; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    CHECK(bad_order == 0, "%u takes out of order", bad_order);
+    CHECK(atomic_load(&r.bad) == 0, "%u of %u borrows saw a taken object", atomic_load(&r.bad),
+          atomic_load(&r.borrows));
+    CHECK(isEmptyPtrMVar(&v) && atomic_load(&v.borrows) == 0, "left %#x borrows", atomic_load(&v.borrows));
+}
+
+//
+//  ObjPool.
+//
+
+#define TEST_POOL_COUNT 100
+
+// Every object once, each on its own cache line within the slab, then NULL; freed objects are handed out
+// again, through caches or not.
+static void
+test_obj_pool_reuse(void) {
+    ObjPool pool;
+    CHECK(initObjPool(&pool, 0, 4) == EINVAL && initObjPool(&pool, 8, 0) == EINVAL, "empty pool");
+    CHECK(initObjPool(&pool, 24, TEST_POOL_COUNT) == 0, "init");
+    void* objs[TEST_POOL_COUNT + 1];
+    ObjPoolCache cache;
+    for (int round = 0; round < 4; round++) {
+        // Rounds 0 and 2 without a cache, 1 and 3 through one.
+        ObjPoolCache* const c = round % 2 == 0 ? NULL : &cache;
+        if (c != NULL) {
+            initObjPoolCache(c, &pool);
+        }
+        bool seen[TEST_POOL_COUNT] = {false};
+        size_t n = 0;
+        while (n <= TEST_POOL_COUNT && (objs[n] = objPoolAlloc(&pool, c)) != NULL) {
+            const size_t offset = (unsigned char*) objs[n] - pool.slab;
+            const size_t index = offset / pool.stride;
+            CHECK(offset % MVAR_CACHE_LINE_SIZE == 0 && index < TEST_POOL_COUNT && !seen[index],
+                  "round %d: object %zu at offset %zu", round, n, offset);
+            if (index < TEST_POOL_COUNT) {
+                seen[index] = true;
+            }
+            memset(objs[n], round, 24);
+            n++;
+        }
+        CHECK(n == TEST_POOL_COUNT, "round %d: %zu objects", round, n);
+        for (size_t i = 0; i < n; i++) {
+            objPoolFree(&pool, c, objs[i]);
+        }
+        if (c != NULL) {
+            CHECK(c->stats.misses > 0 && c->stats.hits + c->stats.misses == TEST_POOL_COUNT + 1 &&
+                  c->stats.crossReturns == 0, "round %d: %zu hits %zu misses %zu cross returns", round,
+                  c->stats.hits, c->stats.misses, c->stats.crossReturns);
+            // With the cache holding freed objects, the next alloc is a hit of the last one freed.
+            void* const again = objPoolAlloc(&pool, c);
+            CHECK(again == objs[n - 1], "round %d: cache returned %p, not %p", round, again, objs[n - 1]);
+            objPoolFree(&pool, c, again);
+            destroyObjPoolCache(c);
+        }
+    }
+    ObjPoolStats stats;
+    getObjPoolStats(&pool, &stats);
+    CHECK(stats.hits + stats.misses == 2 * (TEST_POOL_COUNT + 2), "pool stats: %zu hits %zu misses", stats.hits,
+          stats.misses);
+    destroyObjPool(&pool);
+}
+
+#define TEST_POOL_ROUNDS 50000
+#define TEST_POOL_OBJ_SIZE 48
+
+typedef struct {
+    ObjPool* pool;
+    BoundedQueue* queue;
+    size_t crossReturns;
+} test_pool_pipe;
+
+// Allocate through a cache, fill every byte with the round and hand the object on; retry while all are out.
+static void*
+test_pool_producer(void* const arg) {
+    test_pool_pipe* const t = arg;
+    ObjPoolCache cache;
+    initObjPoolCache(&cache, t->pool);
+    for (unsigned i = 0; i < TEST_POOL_ROUNDS; i++) {
+        unsigned char* obj;
+        while ((obj = objPoolAlloc(t->pool, &cache)) == NULL) {
+            sched_yield();
+        }
+        memset(obj, (unsigned char) i, TEST_POOL_OBJ_SIZE);
+        putBoundedQueue(t->queue, &obj);
+    }
+    destroyObjPoolCache(&cache);
+    return NULL;
+}
+
+static void
+test_ptr_slot_write(void* const slot, const void* const user_data) {
+    *(void**) slot = *(void* const*) user_data;
+}
+
+static void
+test_ptr_slot_read(void* const out_user_data, void* const slot) {
+    *(void**) out_user_data = *(void**) slot;
+}
+
+// A producer and a consumer recycle a pool much smaller than the number of objects they pass, the consumer
+// freeing what the producer allocated into its own cache.  Nothing is handed out twice.
+static void
+test_obj_pool_pipeline(void) {
+    ObjPool pool;
+    CHECK(initObjPool(&pool, TEST_POOL_OBJ_SIZE, TEST_POOL_COUNT) == 0, "init");
+    BoundedQueue q;
+    CHECK(initBoundedQueue(&q, BOUNDED_QUEUE_SPSC, 128, sizeof(void*), test_ptr_slot_write,
+                           test_ptr_slot_read) == 0, "queue init");
+    test_pool_pipe t = {&pool, &q, 0};
+    pthread_t producer;
+    test_create_thread(&producer, test_pool_producer, &t);
+    ObjPoolCache cache;
+    initObjPoolCache(&cache, &pool);
+    unsigned bad = 0;
+    for (unsigned i = 0; i < TEST_POOL_ROUNDS; i++) {
+        unsigned char* obj;
+        takeBoundedQueue(&obj, &q);
+        for (size_t j = 0; j < TEST_POOL_OBJ_SIZE; j++) {
+            if (obj[j] != (unsigned char) i) {
+                bad++;
+                break;
+            }
+        }
+        objPoolFree(&pool, &cache, obj);
+    }
+    pthread_join(producer, NULL);
+    CHECK(bad == 0, "%u objects changed while in flight", bad);
+    CHECK(cache.stats.crossReturns == TEST_POOL_ROUNDS, "%zu cross returns", cache.stats.crossReturns);
+    destroyObjPoolCache(&cache);
+    // Everything is back on the global list.
+    size_t n = 0;
+    while (objPoolAlloc(&pool, NULL) != NULL) {
+        n++;
+    }
+    CHECK(n == TEST_POOL_COUNT, "%zu objects left at the end", n);
+    destroyBoundedQueue(&q);
+    destroyObjPool(&pool);
+}
+
+//
+//  selectTakeMVar().
+//
+
+#define TEST_SELECT_N 4
+
+// Bad set sizes, the lowest full index first, the values where they belong and a timeout when none is full.
+static void
+test_select_semantics(void) {
+    test_uint_mvar m[TEST_SELECT_N];
+    MVar_abs* set[MVAR_SELECT_MAX + 1];
+    unsigned x[TEST_SELECT_N];
+    void* outs[MVAR_SELECT_MAX + 1];
+    for (size_t i = 0; i < MVAR_SELECT_MAX + 1; i++) {
+        set[i] = &m[i % TEST_SELECT_N].base;
+        outs[i] = &x[i % TEST_SELECT_N];
+    }
+    for (size_t i = 0; i < TEST_SELECT_N; i++) {
+        test_init_mvar(&m[i], test_wait_orders[i % 3]);
+    }
+    size_t which = SIZE_MAX;
+    CHECK(selectTakeMVar(outs, set, 0, &which) == EINVAL, "select of 0");
+    CHECK(trySelectTakeMVar(outs, set, 0, &which) == EINVAL, "try select of 0");
+    CHECK(timedSelectTakeMVar(outs, set, MVAR_SELECT_MAX + 1, 0, &which) == EINVAL, "timed select of too many");
+    CHECK(trySelectTakeMVar(outs, set, MVAR_SELECT_MAX + 1, &which) == EINVAL, "try select of too many");
+    CHECK(which == SIZE_MAX, "which set on EINVAL");
+    CHECK(trySelectTakeMVar(outs, set, TEST_SELECT_N, &which) == EBUSY, "try select of empty MVars");
+    const double start = test_now_msec();
+    CHECK(timedSelectTakeMVar(outs, set, TEST_SELECT_N, 50, &which) == ETIMEDOUT, "timed select of empty MVars");
+    CHECK(test_now_msec() - start >= 45, "timed select returned after %.1f msec", test_now_msec() - start);
+
+    const unsigned v2 = 20, v1 = 10, v3 = 30;
+    putMVar(&m[2], &v2);
+    putMVar(&m[3], &v3);
+    putMVar(&m[1], &v1);
+    const unsigned want[][2] = {{1, 10}, {2, 20}, {3, 30}};
+    for (size_t i = 0; i < 3; i++) {
+        memset(x, 0, sizeof x);
+        const int err = i == 1 ? timedSelectTakeMVar(outs, set, TEST_SELECT_N, 0, &which)
+                               : trySelectTakeMVar(outs, set, TEST_SELECT_N, &which);
+        CHECK(err == 0 && which == want[i][0] && x[which % TEST_SELECT_N] == want[i][1],
+              "select %zu: %d, MVar %zu, value %u", i, err, which, x[which % TEST_SELECT_N]);
+        CHECK(isEmptyMVar(&m[want[i][0]]), "select %zu: MVar %u still full", i, want[i][0]);
+    }
+    CHECK(trySelectTakeMVar(outs, set, TEST_SELECT_N, &which) == EBUSY, "try select after draining");
+    // An MVar in the set twice is taken from once, through the lower index.
+    MVar_abs* const twice[] = {&m[0].base, &m[0].base};
+    unsigned y[2] = {0, 0};
+    void* const youts[] = {&y[0], &y[1]};
+    const unsigned v0 = 5;
+    putMVar(&m[0], &v0);
+    CHECK(trySelectTakeMVar(youts, twice, 2, &which) == 0 && which == 0 && y[0] == 5 && y[1] == 0,
+          "select of a repeated MVar: %zu, %u %u", which, y[0], y[1]);
+    CHECK(trySelectTakeMVar(youts, twice, 2, &which) == EBUSY, "repeated MVar taken twice");
+}
+
+#define TEST_SELECT_PER_PRODUCER 3000
+
+typedef struct {
+    test_uint_mvar* mvar;
+    unsigned delay_msec;
+} test_select_producer;
+
+static void*
+test_select_put(void* const arg) {
+    const test_select_producer* const p = arg;
+    test_sleep_msec(p->delay_msec);
+    for (unsigned i = 1; i <= TEST_SELECT_PER_PRODUCER; i++) {
+        putMVar(p->mvar, &i);
+    }
+    return NULL;
+}
+
+// A blocked selector wakes for a put to any MVar of its set, late or not, and gets each producer's values in
+// the order it put them.
+static void
+test_select_threads(void) {
+    test_uint_mvar m[TEST_SELECT_N];
+    MVar_abs* set[TEST_SELECT_N];
+    unsigned x[TEST_SELECT_N];
+    void* outs[TEST_SELECT_N];
+    test_select_producer producers[TEST_SELECT_N];
+    pthread_t threads[TEST_SELECT_N];
+    for (size_t i = 0; i < TEST_SELECT_N; i++) {
+        test_init_mvar(&m[i], test_wait_orders[i % 3]);
+        set[i] = &m[i].base;
+        outs[i] = &x[i];
+        // The last producer starts only after the selector has blocked.
+        producers[i] = (test_select_producer){&m[i], i == TEST_SELECT_N - 1 ? 50 : 0};
+    }
+    // Only the late producer, so that the selector surely blocks first.
+    const double start = test_now_msec();
+    test_create_thread(&threads[TEST_SELECT_N - 1], test_select_put, &producers[TEST_SELECT_N - 1]);
+    size_t which = SIZE_MAX;
+    CHECK(selectTakeMVar(outs, set, TEST_SELECT_N, &which) == 0 && which == TEST_SELECT_N - 1 &&
+          x[TEST_SELECT_N - 1] == 1, "first select: MVar %zu, value %u", which, x[which % TEST_SELECT_N]);
+    CHECK(test_now_msec() - start >= 45, "select returned after %.1f msec", test_now_msec() - start);
+    for (size_t i = 0; i < TEST_SELECT_N - 1; i++) {
+        test_create_thread(&threads[i], test_select_put, &producers[i]);
+    }
+    unsigned last[TEST_SELECT_N] = {0};
+    last[TEST_SELECT_N - 1] = 1;
+    for (size_t n = 1; n < TEST_SELECT_N * TEST_SELECT_PER_PRODUCER; n++) {
+        if (selectTakeMVar(outs, set, TEST_SELECT_N, &which) != 0 || which >= TEST_SELECT_N) {
+            CHECK(false, "select %zu failed", n);
+            break;
+        }
+        CHECK(x[which] == last[which] + 1, "MVar %zu: %u after %u", which, x[which], last[which]);
+        last[which] = x[which];
+    }
+    for (size_t i = 0; i < TEST_SELECT_N; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(last[i] == TEST_SELECT_PER_PRODUCER && isEmptyMVar(&m[i]), "MVar %zu: last value %u", i, last[i]);
+    }
+}
+
+//
+//  EventNotify attached to MVars and BoundedQueues.
+//
+
+#define TEST_LOOP_VALUES 20000
+
+static void*
+test_notify_producer(void* const arg) {
+    for (unsigned i = 1; i <= TEST_LOOP_VALUES; i++) {
+        putMVar(arg, &i);
+    }
+    return NULL;
+}
+
+// The descriptors turn readable on the transitions they are attached to, and an event loop following the
+// pattern of eventnotify.h, drain then try until empty, sees every value a producer thread puts.
+static void
+test_notify_attached(void) {
+    EventNotify full, empty;
+    CHECK(initEventNotify(&full) == 0 && initEventNotify(&empty) == 0, "init");
+    const int full_fd = eventNotifyFd(&full), empty_fd = eventNotifyFd(&empty);
+    test_uint_mvar m;
+    test_init_mvar(&m, MVAR_WAIT_ANY);
+    setMVarNotify(&m.base, &full, &empty);
+    const unsigned v = 3;
+    unsigned x = 0;
+    CHECK(!test_readable(full_fd, 0) && !test_readable(empty_fd, 0), "mvar: readable after attaching");
+    putMVar(&m, &v);
+    CHECK(test_readable(full_fd, 0) && !test_readable(empty_fd, 0), "mvar: after put");
+    drainEventNotify(&full);
+    takeMVar(&x, &m);
+    CHECK(!test_readable(full_fd, 0) && test_readable(empty_fd, 0), "mvar: after take");
+    drainEventNotify(&empty);
+    CHECK(tryTakeMVar(&x, &m) == EBUSY && !test_readable(empty_fd, 0), "mvar: after a failed take");
+
+    BoundedQueue q;
+    CHECK(initBoundedQueue(&q, BOUNDED_QUEUE_MPMC, 4, sizeof(unsigned), test_slot_write, test_slot_read) == 0,
+          "queue init");
+    setBoundedQueueNotify(&q, &full, &empty);
+    putBoundedQueue(&q, &v);
+    CHECK(test_readable(full_fd, 0) && !test_readable(empty_fd, 0), "queue: after put");
+    drainEventNotify(&full);
+    takeBoundedQueue(&x, &q);
+    CHECK(!test_readable(full_fd, 0) && test_readable(empty_fd, 0), "queue: after take");
+    drainEventNotify(&empty);
+    destroyBoundedQueue(&q);
+
+    setMVarNotify(&m.base, &full, NULL);
+    pthread_t producer;
+    test_create_thread(&producer, test_notify_producer, &m);
+    unsigned last = 0;
+    while (last < TEST_LOOP_VALUES) {
+        if (!test_readable(full_fd, 1000)) {
+            CHECK(false, "loop: no notification after value %u", last);
+            break;
+        }
+        drainEventNotify(&full);
+        while (!isEmptyMVar(&m)) {
+            if (tryTakeMVar(&x, &m) == 0) {
+                CHECK(x == last + 1, "loop: %u after %u", x, last);
+                last = x;
+            }
+        }
+    }
+    pthread_join(producer, NULL);
+    setMVarNotify(&m.base, NULL, NULL);
+    destroyEventNotify(&full);
+    destroyEventNotify(&empty);
+}
+
+//
+//  putMVarAsync(), takeMVarAsync() and their executor.
+//
+
+#define TEST_ASYNC_OPS 3
+
+// Which ops were called back, in order.
+typedef struct {
+    MVarAsyncOp* ops[16];
+    size_t n;
+} test_async_log;
+
+static void
+test_async_logged(MVarAsyncOp* const op) {
+    test_async_log* const log = op->context;
+    if (log->n < sizeof log->ops / sizeof log->ops[0]) {
+        log->ops[log->n] = op;
+    }
+    log->n++;
+}
+
+// Completed at once when possible, queued otherwise and called back in arrival order by the thread whose
+// operation lets them go through; cancelled operations never are.
+static void
+test_mvar_async(void) {
+    for (size_t o = 0; o < 3; o++) {
+        const char* const order = test_wait_order_names[o];
+        test_uint_mvar m;
+        test_init_mvar(&m, test_wait_orders[o]);
+        test_async_log log = {.n = 0};
+        MVarAsyncOp ops[TEST_ASYNC_OPS];
+        unsigned x[TEST_ASYNC_OPS] = {0};
+        const unsigned values[TEST_ASYNC_OPS] = {1, 2, 3};
+
+        CHECK(putMVarAsync(&m, &values[0], &ops[0], test_async_logged, &log) == 0 && !isEmptyMVar(&m),
+              "%s: put to empty", order);
+        CHECK(takeMVarAsync(&x[0], &m, &ops[0], test_async_logged, &log) == 0 && x[0] == 1 && isEmptyMVar(&m),
+              "%s: take from full", order);
+        CHECK(log.n == 0, "%s: %zu callbacks for operations done at once", order, log.n);
+
+        for (size_t i = 0; i < TEST_ASYNC_OPS; i++) {
+            x[i] = 0;
+            CHECK(takeMVarAsync(&x[i], &m, &ops[i], test_async_logged, &log) == EINPROGRESS, "%s: take %zu",
+                  order, i);
+        }
+        CHECK(log.n == 0, "%s: called back before any put", order);
+        for (size_t i = 0; i < TEST_ASYNC_OPS; i++) {
+            CHECK(putMVar(&m, &values[i]) == 0 && log.n == i + 1 && log.ops[i] == &ops[i] && x[i] == values[i],
+                  "%s: put %zu: %zu callbacks, value %u", order, i, log.n, x[i]);
+            CHECK(isEmptyMVar(&m), "%s: put %zu not taken", order, i);
+        }
+
+        log.n = 0;
+        unsigned y = 0;
+        putMVar(&m, &values[0]);
+        for (size_t i = 1; i < TEST_ASYNC_OPS; i++) {
+            CHECK(putMVarAsync(&m, &values[i], &ops[i], test_async_logged, &log) == EINPROGRESS, "%s: put %zu",
+                  order, i);
+        }
+        for (size_t i = 0; i < TEST_ASYNC_OPS; i++) {
+            CHECK(takeMVar(&y, &m) == 0 && y == values[i], "%s: take %zu: %u", order, i, y);
+            // Each take but the last lets the next queued put through.
+            const size_t called = i < TEST_ASYNC_OPS - 1 ? i + 1 : i;
+            CHECK(log.n == called && isEmptyMVar(&m) == (i == TEST_ASYNC_OPS - 1), "%s: take %zu: %zu callbacks",
+                  order, i, log.n);
+        }
+
+        log.n = 0;
+        CHECK(takeMVarAsync(&x[0], &m, &ops[0], test_async_logged, &log) == EINPROGRESS, "%s: take to cancel",
+              order);
+        CHECK(cancelMVarAsync(&m, &ops[0]) == 0, "%s: cancel", order);
+        CHECK(cancelMVarAsync(&m, &ops[0]) == ENOENT, "%s: cancel twice", order);
+        putMVar(&m, &values[1]);
+        CHECK(log.n == 0 && !isEmptyMVar(&m), "%s: cancelled take went through", order);
+        CHECK(putMVarAsync(&m, &values[2], &ops[1], test_async_logged, &log) == EINPROGRESS, "%s: put to cancel",
+              order);
+        CHECK(cancelMVarAsync(&m, &ops[1]) == 0, "%s: cancel put", order);
+        CHECK(takeMVar(&y, &m) == 0 && y == values[1] && isEmptyMVar(&m) && log.n == 0, "%s: cancelled put", order);
+        CHECK(cancelMVarAsync(&m, &ops[1]) == ENOENT, "%s: cancel of a cancelled put", order);
+    }
+}
+
+// Keeps every op it is handed and calls none back.
+static void
+test_async_defer(void* const executor_context, MVarAsyncOp* const op) {
+    test_async_log* const deferred = executor_context;
+    deferred->ops[deferred->n++] = op;
+}
+
+// Re-arms itself until it has taken every value.
+typedef struct {
+    test_uint_mvar* mvar;
+    unsigned value;
+    unsigned last;
+    unsigned bad;
+} test_async_taker;
+
+static void
+test_async_rearm(MVarAsyncOp* const op) {
+    test_async_taker* const t = op->context;
+    t->bad += t->value != t->last + 1;
+    t->last = t->value;
+    while (t->last < TEST_LOOP_VALUES && takeMVarAsync(&t->value, t->mvar, op, test_async_rearm, t) == 0) {
+        t->bad += t->value != t->last + 1;
+        t->last = t->value;
+    }
+}
+
+// An executor gets the completed ops instead of their callbacks running inline.  Callbacks may issue the next
+// operation on the MVar.
+static void
+test_mvar_async_executor(void) {
+    test_uint_mvar m;
+    test_init_mvar(&m, MVAR_WAIT_FIFO);
+    test_async_log deferred = {.n = 0}, log = {.n = 0};
+    setMVarExecutor(&m, test_async_defer, &deferred);
+    MVarAsyncOp op;
+    unsigned x = 0;
+    const unsigned v = 9;
+    CHECK(takeMVarAsync(&x, &m, &op, test_async_logged, &log) == EINPROGRESS, "take");
+    putMVar(&m, &v);
+    CHECK(deferred.n == 1 && deferred.ops[0] == &op && log.n == 0 && x == 9, "executor: %zu handed, %zu called",
+          deferred.n, log.n);
+    op.callback(&op);
+    CHECK(log.n == 1, "callback of a deferred op");
+    setMVarExecutor(&m, NULL, NULL);
+
+    test_async_taker t = {&m, 0, 0, 0};
+    pthread_t producer;
+    test_create_thread(&producer, test_notify_producer, &m);
+    if (takeMVarAsync(&t.value, &m, &op, test_async_rearm, &t) == 0) {
+        test_async_rearm(&op);
+    }
+    pthread_join(producer, NULL);
+    CHECK(t.last == TEST_LOOP_VALUES && t.bad == 0, "re-arming taker: last %u, %u out of order", t.last, t.bad);
+    CHECK(isEmptyMVar(&m), "not empty after the re-arming taker");
+}
+
+//
+//  Executor.
+//
+
+#define TEST_EXECUTOR_TASKS 1000
+
+static void*
+test_task_increment(void* const arg) {
+    return (void*) ((uintptr_t) arg + 1);
+}
+
+static void*
+test_task_count(void* const arg) {
+    atomic_fetch_add_explicit((atomic_uint*) arg, 1, memory_order_relaxed);
+    return NULL;
+}
+
+// Returns one more than what it takes from the gate.
+static void*
+test_task_gated(void* const arg) {
+    unsigned x = 0;
+    takeMVar(&x, arg);
+    return (void*) ((uintptr_t) x + 1);
+}
+
+static void*
+test_future_waiter(void* const arg) {
+    void* result = NULL;
+    waitExecutorFuture(&result, arg);
+    return result;
+}
+
+// Bad sizes, many more tasks than the queues hold, each with its own result, several threads waiting on one
+// future, and destroyExecutor() running whatever is still queued.
+static void
+test_executor(void) {
+    Executor e;
+    CHECK(initExecutor(&e, 0, 16) == EINVAL && initExecutor(&e, 2, 0) == EINVAL && initExecutor(&e, 2, 24) == EINVAL,
+          "bad sizes");
+    CHECK(initExecutor(&e, 3, 16) == 0, "init");
+    ExecutorFuture* const futures = aligned_alloc(MVAR_CACHE_LINE_SIZE, TEST_EXECUTOR_TASKS * sizeof *futures);
+    for (uintptr_t i = 0; i < TEST_EXECUTOR_TASKS; i++) {
+        CHECK(submitExecutor(&e, &futures[i], test_task_increment, (void*) i) == 0, "submit %zu", (size_t) i);
+    }
+    for (uintptr_t i = 0; i < TEST_EXECUTOR_TASKS; i++) {
+        void* result = NULL;
+        CHECK(waitExecutorFuture(&result, &futures[i]) == 0 && (uintptr_t) result == i + 1, "task %zu: %zu",
+              (size_t) i, (size_t) (uintptr_t) result);
+    }
+    void* result = NULL;
+    CHECK(waitExecutorFuture(&result, &futures[0]) == 0 && (uintptr_t) result == 1, "second wait");
+
+    // The task holds on until the waiters have blocked.
+    test_uint_mvar gate;
+    test_init_mvar(&gate, MVAR_WAIT_ANY);
+    ExecutorFuture gated;
+    submitExecutor(&e, &gated, test_task_gated, &gate);
+    pthread_t waiters[3];
+    for (size_t i = 0; i < 3; i++) {
+        test_create_thread(&waiters[i], test_future_waiter, &gated);
+    }
+    test_sleep_msec(20);
+    const unsigned opened = 41;
+    putMVar(&gate, &opened);
+    for (size_t i = 0; i < 3; i++) {
+        pthread_join(waiters[i], &result);
+        CHECK((uintptr_t) result == 42, "waiter %zu: %zu", i, (size_t) (uintptr_t) result);
+    }
+
+    atomic_uint count;
+    atomic_init(&count, 0);
+    for (size_t i = 0; i < TEST_EXECUTOR_TASKS; i++) {
+        submitExecutor(&e, &futures[i], test_task_count, &count);
+    }
+    destroyExecutor(&e);
+    CHECK(atomic_load(&count) == TEST_EXECUTOR_TASKS, "%u tasks run by destroy", atomic_load(&count));
+    free(futures);
+}
+
+typedef struct {
+    Executor* executor;
+    unsigned n;
+} test_fib_arg;
+
+// Submits both halves and waits for them inside the worker, which has to run other tasks meanwhile: with one
+// worker and capacity 2 deques, only that keeps the pool from deadlocking on itself.
+static void*
+test_task_fib(void* const arg) {
+    const test_fib_arg* const a = arg;
+    if (a->n < 2) {
+        return (void*) (uintptr_t) a->n;
+    }
+    test_fib_arg halves[2] = {{a->executor, a->n - 1}, {a->executor, a->n - 2}};
+    ExecutorFuture futures[2];
+    uintptr_t sum = 0;
+    for (size_t i = 0; i < 2; i++) {
+        submitExecutor(a->executor, &futures[i], test_task_fib, &halves[i]);
+    }
+    for (size_t i = 0; i < 2; i++) {
+        void* result = NULL;
+        waitExecutorFuture(&result, &futures[i]);
+        sum += (uintptr_t) result;
+    }
+    return (void*) sum;
+}
+
+static void
+test_executor_nested(void) {
+    const size_t sizes[][2] = {{1, 2}, {2, 4}, {4, 64}};
+    for (size_t s = 0; s < sizeof sizes / sizeof sizes[0]; s++) {
+        Executor e;
+        CHECK(initExecutor(&e, sizes[s][0], sizes[s][1]) == 0, "%zu workers: init", sizes[s][0]);
+        test_fib_arg arg = {&e, 18};
+        ExecutorFuture future;
+        submitExecutor(&e, &future, test_task_fib, &arg);
+        void* result = NULL;
+        CHECK(waitExecutorFuture(&result, &future) == 0 && (uintptr_t) result == 2584, "%zu workers: fib 18 = %zu",
+              sizes[s][0], (size_t) (uintptr_t) result);
+        destroyExecutor(&e);
+    }
+}
+
+//
+//  SeqMVar.
+//
+
+// Not a multiple of the 64 bit payload words, so that copies out must stop short of the last word.
+#define TEST_SEQ_PAYLOAD 20
+#define TEST_SEQ_GUARD 0xa5
+
+static SeqMVar*
+test_alloc_seq_mvar(const size_t payload_size) {
+    const size_t size = seqMVarSize(payload_size);
+    SeqMVar* const v = aligned_alloc(MVAR_CACHE_LINE_SIZE, (size + MVAR_CACHE_LINE_SIZE - 1) &
+                                                               ~(size_t) (MVAR_CACHE_LINE_SIZE - 1));
+    initSeqMVar(v, payload_size);
+    return v;
+}
+
+static void
+test_free_seq_mvar(SeqMVar* const v) {
+    destroySeqMVar(v);
+    free(v);
+}
+
+// MVar semantics for every operation, swap keeping the MVar full, and copies of exactly payloadSize bytes.
+static void
+test_seq_mvar_semantics(void) {
+    SeqMVar* const v = test_alloc_seq_mvar(TEST_SEQ_PAYLOAD);
+    unsigned char a[TEST_SEQ_PAYLOAD], b[TEST_SEQ_PAYLOAD], out[TEST_SEQ_PAYLOAD + 8];
+    for (size_t i = 0; i < TEST_SEQ_PAYLOAD; i++) {
+        a[i] = (unsigned char) (i + 1);
+        b[i] = (unsigned char) (100 + i);
+    }
+    memset(out, TEST_SEQ_GUARD, sizeof out);
+    CHECK(isEmptySeqMVar(v), "empty after init");
+    CHECK(tryTakeSeqMVar(out, v) == EBUSY && tryReadSeqMVar(out, v) == EBUSY, "try take and read of empty");
+    CHECK(timedTakeSeqMVar(out, v, 20) == ETIMEDOUT && timedReadSeqMVar(out, v, 0) == ETIMEDOUT,
+          "timed take and read of empty");
+    CHECK(out[0] == TEST_SEQ_GUARD, "failed operations wrote out");
+    CHECK(putSeqMVar(v, a) == 0 && !isEmptySeqMVar(v), "put");
+    CHECK(tryPutSeqMVar(v, b) == EBUSY && timedPutSeqMVar(v, 20, b) == ETIMEDOUT, "put to full");
+    for (int i = 0; i < 2; i++) {
+        memset(out, TEST_SEQ_GUARD, sizeof out);
+        const int err = i == 0 ? readSeqMVar(out, v) : tryReadSeqMVar(out, v);
+        CHECK(err == 0 && memcmp(out, a, TEST_SEQ_PAYLOAD) == 0 && !isEmptySeqMVar(v), "read %d", i);
+        CHECK(out[TEST_SEQ_PAYLOAD] == TEST_SEQ_GUARD, "read %d copied past the payload", i);
+    }
+    memset(out, TEST_SEQ_GUARD, sizeof out);
+    CHECK(swapSeqMVar(out, v, b) == 0 && memcmp(out, a, TEST_SEQ_PAYLOAD) == 0 && !isEmptySeqMVar(v), "swap");
+    CHECK(out[TEST_SEQ_PAYLOAD] == TEST_SEQ_GUARD, "swap copied past the payload");
+    CHECK(swapSeqMVar(NULL, v, a) == 0 && swapSeqMVar(NULL, v, b) == 0, "swap without the old value");
+    memset(out, TEST_SEQ_GUARD, sizeof out);
+    CHECK(timedTakeSeqMVar(out, v, 20) == 0 && memcmp(out, b, TEST_SEQ_PAYLOAD) == 0 && isEmptySeqMVar(v), "take");
+    CHECK(out[TEST_SEQ_PAYLOAD] == TEST_SEQ_GUARD, "take copied past the payload");
+    CHECK(tryPutSeqMVar(v, a) == 0 && tryTakeSeqMVar(out, v) == 0 && memcmp(out, a, TEST_SEQ_PAYLOAD) == 0,
+          "try put and take");
+    CHECK(timedPutSeqMVar(v, 20, b) == 0 && takeSeqMVar(out, v) == 0 && memcmp(out, b, TEST_SEQ_PAYLOAD) == 0,
+          "timed put and take");
+    test_free_seq_mvar(v);
+}
+
+#define TEST_SEQ_WORDS 8
+#define TEST_SEQ_READERS 2
+#define TEST_SEQ_SNAPSHOTS 20000
+
+typedef struct {
+    SeqMVar* mvar;
+    uint64_t last;
+    unsigned torn;
+    unsigned backwards;
+} test_seq_reader;
+
+// Reads snapshots until the last; every word of a snapshot holds its number.
+static void*
+test_seq_read(void* const arg) {
+    test_seq_reader* const r = arg;
+    uint64_t snapshot[TEST_SEQ_WORDS];
+    do {
+        readSeqMVar(snapshot, r->mvar);
+        for (size_t i = 1; i < TEST_SEQ_WORDS; i++) {
+            if (snapshot[i] != snapshot[0]) {
+                r->torn++;
+                break;
+            }
+        }
+        r->backwards += snapshot[0] < r->last;
+        r->last = snapshot[0];
+    } while (r->last < TEST_SEQ_SNAPSHOTS);
+    return NULL;
+}
+
+// Readers blocked on an empty SeqMVar wake for the first put, then never see half a snapshot or an older one
+// while a writer swaps in new ones.
+static void
+test_seq_mvar_threads(void) {
+    SeqMVar* const v = test_alloc_seq_mvar(sizeof(uint64_t[TEST_SEQ_WORDS]));
+    test_seq_reader readers[TEST_SEQ_READERS];
+    pthread_t threads[TEST_SEQ_READERS];
+    for (size_t i = 0; i < TEST_SEQ_READERS; i++) {
+        readers[i] = (test_seq_reader){v, 0, 0, 0};
+        test_create_thread(&threads[i], test_seq_read, &readers[i]);
+    }
+    test_sleep_msec(20);
+    uint64_t snapshot[TEST_SEQ_WORDS];
+    for (uint64_t n = 1; n <= TEST_SEQ_SNAPSHOTS; n++) {
+        for (size_t i = 0; i < TEST_SEQ_WORDS; i++) {
+            snapshot[i] = n;
+        }
+        CHECK((n == 1 ? putSeqMVar(v, snapshot) : swapSeqMVar(NULL, v, snapshot)) == 0, "snapshot %zu",
+              (size_t) n);
+    }
+    for (size_t i = 0; i < TEST_SEQ_READERS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK(readers[i].torn == 0 && readers[i].backwards == 0, "reader %zu: %u torn, %u going backwards", i,
+              readers[i].torn, readers[i].backwards);
+    }
+    test_free_seq_mvar(v);
+}
+
+//
+//  getMVarStats().
+//
+
+#ifdef MVAR_STATS
+static size_t
+test_histogram_sum(const size_t* const histogram) {
+    size_t sum = 0;
+    for (size_t i = 0; i < MVAR_STATS_BUCKETS; i++) {
+        sum += histogram[i];
+    }
+    return sum;
+}
+
+static void*
+test_put_later(void* const arg) {
+    const unsigned v = 1;
+    test_sleep_msec(20);
+    putMVar(arg, &v);
+    return NULL;
+}
+#endif
+
+// ENOTSUP unless the library is built with MVAR_STATS, like this test, and then one count per operation.
+static void
+test_mvar_stats(void) {
+    test_uint_mvar m;
+    test_init_mvar(&m, MVAR_WAIT_ANY);
+    MVarStats stats;
+#ifndef MVAR_STATS
+    CHECK(getMVarStats(&m, &stats) == ENOTSUP, "stats without MVAR_STATS");
+#else
+    CHECK(getMVarStats(&m, &stats) == 0, "stats");
+    CHECK(stats.fastPuts == 0 && stats.fastTakes == 0 && stats.busy == 0 && test_histogram_sum(stats.lockWait) == 0,
+          "counters of a new MVar");
+    unsigned x = 0;
+    const unsigned v = 2;
+    tryTakeMVar(&x, &m);
+    timedTakeMVar(&x, &m, 0);
+    putMVar(&m, &v);
+    readMVar(&x, &m);
+    takeMVar(&x, &m);
+    pthread_t putter;
+    test_create_thread(&putter, test_put_later, &m);
+    takeMVar(&x, &m);
+    pthread_join(putter, NULL);
+    CHECK(getMVarStats(&m, &stats) == 0, "stats");
+    CHECK(stats.busy == 1 && stats.timeouts == 1, "%zu busy, %zu timeouts", stats.busy, stats.timeouts);
+    CHECK(stats.fastPuts == 2 && stats.blockedPuts == 0 && stats.fastReads == 1 && stats.blockedReads == 0,
+          "%zu fast puts, %zu blocked puts, %zu fast reads, %zu blocked reads", stats.fastPuts, stats.blockedPuts,
+          stats.fastReads, stats.blockedReads);
+    // The timed take that timed out blocked too.
+    CHECK(stats.fastTakes == 1 && stats.blockedTakes == 2, "%zu fast takes, %zu blocked takes", stats.fastTakes,
+          stats.blockedTakes);
+    CHECK(test_histogram_sum(stats.lockWait) >= 5 && test_histogram_sum(stats.condWait) >= 1,
+          "%zu lock waits, %zu condition waits", test_histogram_sum(stats.lockWait),
+          test_histogram_sum(stats.condWait));
+#endif
+}
+
+//
+//  MVAR_WAIT_FIFO and MVAR_WAIT_PRIORITY handoff.
+//
+
+#define TEST_HANDOFF_THREADS 4
+// Long enough for a thread just started to block, after which the next one starts.
+#define TEST_HANDOFF_SETTLE_MSEC 30
+
+typedef struct {
+    test_uint_mvar* mvar;
+    int priority;
+    unsigned value;
+    int err;
+} test_handoff;
+
+static void*
+test_handoff_take(void* const arg) {
+    test_handoff* const h = arg;
+    h->err = h->priority == MVAR_DEFAULT_PRIORITY ? takeMVar(&h->value, h->mvar)
+                                                  : timedTakeMVarPrio(&h->value, h->mvar, 10000, h->priority);
+    return NULL;
+}
+
+static void*
+test_handoff_put(void* const arg) {
+    test_handoff* const h = arg;
+    h->err = putMVar(h->mvar, &h->value);
+    return NULL;
+}
+
+static void
+test_start_handoffs(test_handoff* const h, pthread_t* const threads, void* (*run)(void*)) {
+    for (size_t i = 0; i < TEST_HANDOFF_THREADS; i++) {
+        test_create_thread(&threads[i], run, &h[i]);
+        test_sleep_msec(TEST_HANDOFF_SETTLE_MSEC);
+    }
+}
+
+// Blocked takers get values the order they queued in, highest priority first for MVAR_WAIT_PRIORITY, and a
+// value handed to one can't be taken by anybody else in between.  Blocked putters are taken from in order.
+static void
+test_mvar_handoff_order(void) {
+    // Taker i is served rank[i]th.
+    const int priorities[TEST_HANDOFF_THREADS] = {1, 5, 3, 5};
+    const unsigned priority_rank[TEST_HANDOFF_THREADS] = {3, 0, 2, 1};
+    for (size_t o = 1; o < 3; o++) {
+        const char* const order = test_wait_order_names[o];
+        const bool prio = test_wait_orders[o] == MVAR_WAIT_PRIORITY;
+        test_uint_mvar m;
+        test_init_mvar(&m, test_wait_orders[o]);
+        test_handoff h[TEST_HANDOFF_THREADS];
+        pthread_t threads[TEST_HANDOFF_THREADS];
+        for (size_t i = 0; i < TEST_HANDOFF_THREADS; i++) {
+            h[i] = (test_handoff){&m, prio ? priorities[i] : MVAR_DEFAULT_PRIORITY, UINT32_MAX, -1};
+        }
+        test_start_handoffs(h, threads, test_handoff_take);
+        for (unsigned i = 0; i < TEST_HANDOFF_THREADS; i++) {
+            unsigned x = 0;
+            CHECK(putMVar(&m, &i) == 0 && tryTakeMVar(&x, &m) == EBUSY, "%s: put %u barged", order, i);
+        }
+        for (size_t i = 0; i < TEST_HANDOFF_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+            const unsigned want = prio ? priority_rank[i] : i;
+            CHECK(h[i].err == 0 && h[i].value == want, "%s: taker %zu got %u, not %u", order, i, h[i].value, want);
+        }
+        CHECK(isEmptyMVar(&m), "%s: full after the takers", order);
+
+        unsigned x = 100;
+        putMVar(&m, &x);
+        for (size_t i = 0; i < TEST_HANDOFF_THREADS; i++) {
+            h[i] = (test_handoff){&m, MVAR_DEFAULT_PRIORITY, (unsigned) i, -1};
+        }
+        test_start_handoffs(h, threads, test_handoff_put);
+        CHECK(takeMVar(&x, &m) == 0 && x == 100, "%s: first take %u", order, x);
+        for (size_t i = 0; i < TEST_HANDOFF_THREADS; i++) {
+            CHECK(takeMVar(&x, &m) == 0 && x == i, "%s: take %zu got %u", order, i, x);
+        }
+        for (size_t i = 0; i < TEST_HANDOFF_THREADS; i++) {
+            pthread_join(threads[i], NULL);
+            CHECK(h[i].err == 0, "%s: putter %zu: %d", order, i, h[i].err);
+        }
+        CHECK(isEmptyMVar(&m), "%s: full after the putters", order);
+    }
+}
+
+//
+//  ShardedQueue and NUMA placement.
+//
+
+static void
+test_numa_alloc(void) {
+    const int nodes = numaNodeCount();
+    CHECK(nodes >= 1, "%d nodes", nodes);
+    const int node = currentNumaNode();
+    CHECK(node >= 0 && node < nodes, "current node %d of %d", node, nodes);
+    const long page = sysconf(_SC_PAGESIZE);
+    const size_t size = 3 * (size_t) page + 100;
+    const int wanted[] = {-1, 0, nodes - 1};
+    for (size_t w = 0; w < sizeof wanted / sizeof wanted[0]; w++) {
+        unsigned char* const p = allocOnNumaNode(size, wanted[w]);
+        if (p == NULL) {
+            CHECK(false, "node %d: no memory", wanted[w]);
+            continue;
+        }
+        CHECK((uintptr_t) p % (uintptr_t) page == 0, "node %d: %p not page aligned", wanted[w], (void*) p);
+        size_t nonzero = 0;
+        for (size_t i = 0; i < size; i++) {
+            nonzero += p[i] != 0;
+        }
+        CHECK(nonzero == 0, "node %d: %zu bytes not zero", wanted[w], nonzero);
+        memset(p, 0xff, size);
+        freeOnNumaNode(p, size);
+    }
+    test_uint_mvar* const m = allocMVarOnNumaNode(sizeof *m, node);
+    test_init_mvar(m, MVAR_WAIT_ANY);
+    const unsigned v = 5;
+    unsigned x = 0;
+    CHECK(putMVar(m, &v) == 0 && takeMVar(&x, m) == 0 && x == 5, "MVar on node %d", node);
+    freeMVarOnNumaNode(m, sizeof *m);
+}
+
+#define TEST_SHARD_CAPACITY 8
+
+// A full local ring, empty rings everywhere, and values in the order they were put on a single node.
+static void
+test_sharded_queue(void) {
+    ShardedQueue q;
+    CHECK(initShardedQueue(&q, 0, sizeof(unsigned), test_slot_write, test_slot_read) == EINVAL &&
+          initShardedQueue(&q, 6, sizeof(unsigned), test_slot_write, test_slot_read) == EINVAL, "bad capacity");
+    CHECK(initShardedQueue(&q, TEST_SHARD_CAPACITY, sizeof(unsigned), test_slot_write, test_slot_read) == 0, "init");
+    CHECK(q.nshards == numaNodeCount(), "%d shards on %d nodes", q.nshards, numaNodeCount());
+    unsigned x = 0;
+    CHECK(isEmptyShardedQueue(&q) && tryTakeShardedQueue(&x, &q) == EBUSY, "try take of empty");
+    CHECK(timedTakeShardedQueue(&x, &q, 20) == ETIMEDOUT, "timed take of empty");
+    unsigned n = 0;
+    while (n <= TEST_SHARD_CAPACITY && tryPutShardedQueue(&q, &n) == 0) {
+        n++;
+    }
+    // Without migrating to another node meanwhile, which only a multi node host could make us do.
+    CHECK(n == TEST_SHARD_CAPACITY || q.nshards > 1, "%u puts into a ring of %d", n, TEST_SHARD_CAPACITY);
+    CHECK(q.nshards > 1 || timedPutShardedQueue(&q, 20, &n) == ETIMEDOUT, "timed put to full");
+    CHECK(!isEmptyShardedQueue(&q), "empty after puts");
+    for (unsigned i = 0; i < n; i++) {
+        const int err = i % 2 == 0 ? takeShardedQueue(&x, &q) : timedTakeShardedQueue(&x, &q, 20);
+        CHECK(err == 0 && (x == i || q.nshards > 1), "take %u: %d, %u", i, err, x);
+    }
+    CHECK(isEmptyShardedQueue(&q) && tryTakeShardedQueue(&x, &q) == EBUSY, "not empty after takes");
+    destroyShardedQueue(&q);
+}
+
+#define TEST_SHARD_THREADS 2
+#define TEST_SHARD_PER_PRODUCER 20000
+
+typedef struct {
+    ShardedQueue* queue;
+    unsigned first;
+    unsigned count;
+    unsigned char* seen;    // consumers only, indexed by value
+    unsigned duplicates;
+} test_shard_worker;
+
+static void*
+test_shard_produce(void* const arg) {
+    const test_shard_worker* const w = arg;
+    for (unsigned i = w->first; i < w->first + w->count; i++) {
+        putShardedQueue(w->queue, &i);
+    }
+    return NULL;
+}
+
+static void*
+test_shard_consume(void* const arg) {
+    test_shard_worker* const w = arg;
+    for (unsigned i = 0; i < w->count; i++) {
+        unsigned x = 0;
+        takeShardedQueue(&x, w->queue);
+        // Each value goes to one consumer, so the byte is only ever written by one thread.
+        w->duplicates += w->seen[x]++ != 0;
+    }
+    return NULL;
+}
+
+// A consumer blocked on an empty queue wakes for a put, and every value put by several producers is taken by
+// exactly one of several consumers.
+static void
+test_sharded_queue_threads(void) {
+    ShardedQueue q;
+    CHECK(initShardedQueue(&q, TEST_SHARD_CAPACITY, sizeof(unsigned), test_slot_write, test_slot_read) == 0, "init");
+    const unsigned total = TEST_SHARD_THREADS * TEST_SHARD_PER_PRODUCER;
+    unsigned char* const seen = calloc(total, 1);
+    test_shard_worker consumers[TEST_SHARD_THREADS], producers[TEST_SHARD_THREADS];
+    pthread_t consumer_threads[TEST_SHARD_THREADS], producer_threads[TEST_SHARD_THREADS];
+    for (size_t i = 0; i < TEST_SHARD_THREADS; i++) {
+        consumers[i] = (test_shard_worker){&q, 0, TEST_SHARD_PER_PRODUCER, seen, 0};
+        test_create_thread(&consumer_threads[i], test_shard_consume, &consumers[i]);
+    }
+    test_sleep_msec(20);
+    for (size_t i = 0; i < TEST_SHARD_THREADS; i++) {
+        producers[i] =
+            (test_shard_worker){&q, (unsigned) i * TEST_SHARD_PER_PRODUCER, TEST_SHARD_PER_PRODUCER, NULL, 0};
+        test_create_thread(&producer_threads[i], test_shard_produce, &producers[i]);
+    }
+    unsigned duplicates = 0;
+    for (size_t i = 0; i < TEST_SHARD_THREADS; i++) {
+        pthread_join(producer_threads[i], NULL);
+        pthread_join(consumer_threads[i], NULL);
+        duplicates += consumers[i].duplicates;
+    }
+    unsigned missing = 0;
+    for (unsigned i = 0; i < total; i++) {
+        missing += seen[i] == 0;
+    }
+    CHECK(duplicates == 0 && missing == 0, "%u duplicates, %u missing", duplicates, missing);
+    CHECK(isEmptyShardedQueue(&q), "not empty at the end");
+    free(seen);
+    destroyShardedQueue(&q);
+}
+
+//
+//  ShmMVar across processes.
+//
+
+#define TEST_SHM_SLOT 32
+
+// Status the child exited with, -1 when it didn't exit normally.
+static int
+test_wait_child(const pid_t child) {
+    int status = 0;
+    while (waitpid(child, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// A ring of several slots in one process: payloads come out oldest first with their lengths, and oversized,
+// full and empty are reported rather than blocked on or truncated.
+static void
+test_shm_mvar_ring(void) {
+    unsigned char* const blank = calloc(1, shmMVarSize(1, TEST_SHM_SLOT));
+    CHECK(openShmMVar(blank) == NULL, "open of a segment nobody initialized");
+    free(blank);
+    size_t size;
+    ShmMVar* const v = test_shm_mvar(3, TEST_SHM_SLOT, &size);
+    char out[TEST_SHM_SLOT];
+    size_t len = 0;
+    CHECK(isEmptyShmMVar(v) && tryTakeShmMVar(out, &len, v) == EBUSY, "try take of empty");
+    CHECK(timedTakeShmMVar(out, &len, v, 20) == ETIMEDOUT, "timed take of empty");
+    char big[TEST_SHM_SLOT + 1];
+    memset(big, 'b', sizeof big);
+    CHECK(putShmMVar(v, big, sizeof big) == EINVAL, "oversized put");
+    const char* const words[] = {"one", "", "three-three-three-three-three-33"};
+    for (size_t round = 0; round < 2; round++) {
+        for (size_t i = 0; i < 3; i++) {
+            CHECK((i == 1 ? tryPutShmMVar(v, words[i], strlen(words[i])) : putShmMVar(v, words[i], strlen(words[i])))
+                      == 0, "round %zu: put %zu", round, i);
+        }
+        CHECK(tryPutShmMVar(v, "x", 1) == EBUSY && timedPutShmMVar(v, 20, "x", 1) == ETIMEDOUT, "put to full");
+        for (size_t i = 0; i < 3; i++) {
+            memset(out, 0, sizeof out);
+            const int err = i == 2 ? tryTakeShmMVar(out, &len, v) : timedTakeShmMVar(out, &len, v, 20);
+            CHECK(err == 0 && len == strlen(words[i]) && memcmp(out, words[i], len) == 0,
+                  "round %zu: take %zu: %d, %zu bytes", round, i, err, len);
+        }
+        CHECK(isEmptyShmMVar(v), "round %zu: not empty", round);
+    }
+    ShmMVarPayload slot;
+    CHECK(acquireTakeShmMVar(&slot, v, SHMMVAR_NO_WAIT) == EBUSY, "zero copy take of empty");
+    CHECK(acquirePutShmMVar(&slot, v, NULL) == 0 && slot.length == TEST_SHM_SLOT, "zero copy put");
+    memcpy(shmMVarPayloadData(v, slot), "zero", 4);
+    releasePutShmMVar(v, 4);
+    CHECK(acquireTakeShmMVar(&slot, v, NULL) == 0 && slot.length == 4 &&
+          memcmp(shmMVarPayloadData(v, slot), "zero", 4) == 0, "zero copy take");
+    releaseTakeShmMVar(v);
+    CHECK(isEmptyShmMVar(v), "not empty after zero copy take");
+    test_free_shm_mvar(v, size);
+}
+
+#define TEST_SHM_MESSAGES 5000
+
+// A child process echoes every request back reversed through a second ShmMVar, and both block on each other
+// through the process shared condition variables.
+static void
+test_shm_mvar_fork(void) {
+    size_t size;
+    ShmMVar* const requests = test_shm_mvar(2, TEST_SHM_SLOT, &size);
+    ShmMVar* const replies = test_shm_mvar(1, TEST_SHM_SLOT, &size);
+    fflush(stdout);
+    const pid_t child = fork();
+    if (child < 0) {
+        CHECK(false, "fork: %s", strerror(errno));
+        return;
+    }
+    if (child == 0) {
+        char in[TEST_SHM_SLOT], back[TEST_SHM_SLOT];
+        size_t len = 0;
+        for (unsigned i = 0; i < TEST_SHM_MESSAGES; i++) {
+            if (takeShmMVar(in, &len, requests) != 0) {
+                _exit(1);
+            }
+            for (size_t j = 0; j < len; j++) {
+                back[j] = in[len - 1 - j];
+            }
+            if (putShmMVar(replies, back, len) != 0) {
+                _exit(1);
+            }
+        }
+        _exit(0);
+    }
+    unsigned bad = 0;
+    char msg[TEST_SHM_SLOT], want[TEST_SHM_SLOT], out[TEST_SHM_SLOT];
+    for (unsigned i = 0; i < TEST_SHM_MESSAGES; i++) {
+        const int len = snprintf(msg, sizeof msg, "message %u", i);
+        for (int j = 0; j < len; j++) {
+            want[j] = msg[len - 1 - j];
+        }
+        size_t got = 0;
+        if (putShmMVar(requests, msg, (size_t) len) != 0 || takeShmMVar(out, &got, replies) != 0 ||
+            got != (size_t) len || memcmp(out, want, got) != 0) {
+            bad++;
+        }
+    }
+    CHECK(bad == 0, "%u bad replies", bad);
+    CHECK(test_wait_child(child) == 0, "child failed");
+    CHECK(isEmptyShmMVar(requests) && isEmptyShmMVar(replies), "not empty at the end");
+    test_free_shm_mvar(replies, size);
+    test_free_shm_mvar(requests, size);
+}
+
+// A child that dies holding the lock in the middle of a zero copy put or take leaves the ShmMVar as it was
+// before that operation, and the next locker carries on.
+static void
+test_shm_mvar_owner_died(void) {
+    size_t size;
+    ShmMVar* const v = test_shm_mvar(1, TEST_SHM_SLOT, &size);
+    char out[TEST_SHM_SLOT];
+    size_t len = 0;
+    for (int take = 0; take < 2; take++) {
+        const char* const what = take ? "take" : "put";
+        if (take) {
+            putShmMVar(v, "kept", 4);
+        }
+        fflush(stdout);
+        const pid_t child = fork();
+        if (child < 0) {
+            CHECK(false, "fork: %s", strerror(errno));
+            break;
+        }
+        if (child == 0) {
+            ShmMVarPayload slot;
+            if ((take ? acquireTakeShmMVar(&slot, v, NULL) : acquirePutShmMVar(&slot, v, NULL)) != 0) {
+                _exit(1);
+            }
+            if (!take) {
+                memcpy(shmMVarPayloadData(v, slot), "half", 4);
+            }
+            _exit(0);
+        }
+        CHECK(test_wait_child(child) == 0, "%s: child failed", what);
+        if (take) {
+            CHECK(timedTakeShmMVar(out, &len, v, 1000) == 0 && len == 4 && memcmp(out, "kept", 4) == 0,
+                  "%s: half read take consumed", what);
+        } else {
+            CHECK(isEmptyShmMVar(v), "%s: half written put published", what);
+        }
+        CHECK(timedPutShmMVar(v, 1000, "next", 4) == 0 && timedTakeShmMVar(out, &len, v, 1000) == 0 && len == 4 &&
+              memcmp(out, "next", 4) == 0, "%s: put and take after the owner died", what);
+    }
+    test_free_shm_mvar(v, size);
+}
+
+typedef struct {
+    const char* name;
+    void (*run)(void);
+} test_case;
+
+static const test_case tests[] = {
+    {"event_notify", test_event_notify},
+    {"event_notify_race", test_event_notify_race},
+    {"queue_batches", test_queue_batches},
+    {"mvar_deadlines", test_mvar_deadlines},
+    {"mvar_array", test_mvar_array},
+    {"shm_mvar_timed_lock", test_shm_mvar_timed_lock},
+    {"mvar_semantics", test_mvar_semantics},
+    {"mvar_ping_pong", test_mvar_ping_pong},
+    {"mvar_contended", test_mvar_contended},
+    {"queue_semantics", test_queue_semantics},
+    {"queue_spsc", test_queue_spsc},
+    {"queue_mpmc", test_queue_mpmc},
+    {"ptr_mvar_semantics", test_ptr_mvar_semantics},
+    {"ptr_mvar_drain", test_ptr_mvar_drain},
+    {"ptr_mvar_threads", test_ptr_mvar_threads},
+    {"obj_pool_reuse", test_obj_pool_reuse},
+    {"obj_pool_pipeline", test_obj_pool_pipeline},
+    {"select_semantics", test_select_semantics},
+    {"select_threads", test_select_threads},
+    {"notify_attached", test_notify_attached},
+    {"mvar_async", test_mvar_async},
+    {"mvar_async_executor", test_mvar_async_executor},
+    {"executor", test_executor},
+    {"executor_nested", test_executor_nested},
+    {"seq_mvar_semantics", test_seq_mvar_semantics},
+    {"seq_mvar_threads", test_seq_mvar_threads},
+    {"mvar_stats", test_mvar_stats},
+    {"mvar_handoff_order", test_mvar_handoff_order},
+    {"numa_alloc", test_numa_alloc},
+    {"sharded_queue", test_sharded_queue},
+    {"sharded_queue_threads", test_sharded_queue_threads},
+    {"shm_mvar_ring", test_shm_mvar_ring},
+    {"shm_mvar_fork", test_shm_mvar_fork},
+    {"shm_mvar_owner_died", test_shm_mvar_owner_died},
+};
+
+static const char* running;
+
+static void
+test_on_alarm(const int sig) {
+    static const char msg[] = "timed out: ";
+    (void) sig;
+    if (write(STDERR_FILENO, msg, sizeof msg - 1) < 0 || write(STDERR_FILENO, running, strlen(running)) < 0 ||
+        write(STDERR_FILENO, "\n", 1) < 0) {
+    }
+    _exit(1);
+}
+
+int
+main(void) {
+    signal(SIGALRM, test_on_alarm);
+    for (size_t i = 0; i < sizeof tests / sizeof tests[0]; i++) {
+        const unsigned long before = failures;
+        running = tests[i].name;
+        alarm(TEST_TIMEOUT);
+        tests[i].run();
+        alarm(0);
+        printf("%s %s\n", failures == before ? "ok  " : "FAIL", tests[i].name);
+        fflush(stdout);
+    }
+    if (failures != 0) {
+        printf("%lu checks failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,145 @@
+#ifndef TYPEDMVAR_H
+#define TYPEDMVAR_H
+/*
+ * MIT License
+ *
+ * Copyright (c) 2020 Naoto Shimazaki
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+//
+//  Typed MVars.  DEFINE_MVAR(Name, T) defines a struct Name holding a FastMVar and an inline T, and
+//  static inline operations on it that copy T by value with no write/read callback in between:
+//
+//      init_Name(Name* mvar)
+//      put_Name(Name* mvar, T value)                       take_Name(T* out, Name* mvar)
+//      timedPut_Name(Name* mvar, long msec, T value)       timedTake_Name(T* out, Name* mvar, long msec)
+//      tryPut_Name(Name* mvar, T value)                    tryTake_Name(T* out, Name* mvar)
+//      read_Name, timedRead_Name, tryRead_Name             like take, leaving the value in place
+//      isEmpty_Name(const Name* mvar)
+//
+//  Return values are those of the FastMVar operations.  init_Name also installs callbacks copying T, so a
+//  Name can be handed to the generic FastMVar functions as well.  Use initFastMVar() with callbacks of your
+//  own for payloads that need more than a copy.
+//
+//      DEFINE_MVAR(PointMVar, struct point)
+//
+#include <errno.h>
+
+#include "atomic_wait.h"
+#include "fastmvar.h"
+
+#define DEFINE_MVAR(Name, T) \
+    typedef struct { \
+        FastMVar base; \
+        T value; \
+    } Name; \
+    \
+    static void \
+    Name##_write(void* const mvar_context, const void* const user_data) { \
+        ((Name*) mvar_context)->value = *(const T*) user_data; \
+    } \
+    \
+    static void \
+    Name##_read(void* const out_user_data, void* const mvar_context) { \
+        *(T*) out_user_data = ((Name*) mvar_context)->value; \
+    } \
+    \
+    static inline void \
+    init_##Name(Name* const mvar) { \
+        initFastMVar(mvar, Name##_write, Name##_read); \
+    } \
+    \
+    static inline bool \
+    isEmpty_##Name(const Name* const mvar) { \
+        return isEmptyFastMVar(mvar); \
+    } \
+    \
+    static inline int \
+    Name##_put_until(Name* const mvar, const T* const value, const struct timespec* const deadline) { \
+        int err = acquireFastMVar(&mvar->base, FASTMVAR_EMPTY, FASTMVAR_WRITING, deadline); \
+        if (err != 0) { \
+            return err; \
+        } \
+        mvar->value = *value; \
+        releaseFastMVar(&mvar->base, FASTMVAR_WRITING, FASTMVAR_FULL); \
+        return 0; \
+    } \
+    \
+    static inline int \
+    Name##_get_until(T* const out, Name* const mvar, const unsigned after, const struct timespec* const deadline) { \
+        int err = acquireFastMVar(&mvar->base, FASTMVAR_FULL, FASTMVAR_READING, deadline); \
+        if (err != 0) { \
+            return err; \
+        } \
+        *out = mvar->value; \
+        releaseFastMVar(&mvar->base, FASTMVAR_READING, after); \
+        return 0; \
+    } \
+    \
+    static inline int \
+    put_##Name(Name* const mvar, const T value) { \
+        return Name##_put_until(mvar, &value, NULL); \
+    } \
+    \
+    static inline int \
+    timedPut_##Name(Name* const mvar, const long int timeout_in_msec, const T value) { \
+        const struct timespec deadline = monotonicDeadline(timeout_in_msec); \
+        return Name##_put_until(mvar, &value, &deadline); \
+    } \
+    \
+    static inline int \
+    tryPut_##Name(Name* const mvar, const T value) { \
+        return Name##_put_until(mvar, &value, FASTMVAR_NO_WAIT); \
+    } \
+    \
+    static inline int \
+    take_##Name(T* const out, Name* const mvar) { \
+        return Name##_get_until(out, mvar, FASTMVAR_EMPTY, NULL); \
+    } \
+    \
+    static inline int \
+    timedTake_##Name(T* const out, Name* const mvar, const long int timeout_in_msec) { \
+        const struct timespec deadline = monotonicDeadline(timeout_in_msec); \
+        return Name##_get_until(out, mvar, FASTMVAR_EMPTY, &deadline); \
+    } \
+    \
+    static inline int \
+    tryTake_##Name(T* const out, Name* const mvar) { \
+        return Name##_get_until(out, mvar, FASTMVAR_EMPTY, FASTMVAR_NO_WAIT); \
+    } \
+    \
+    static inline int \
+    read_##Name(T* const out, Name* const mvar) { \
+        return Name##_get_until(out, mvar, FASTMVAR_FULL, NULL); \
+    } \
+    \
+    static inline int \
+    timedRead_##Name(T* const out, Name* const mvar, const long int timeout_in_msec) { \
+        const struct timespec deadline = monotonicDeadline(timeout_in_msec); \
+        return Name##_get_until(out, mvar, FASTMVAR_FULL, &deadline); \
+    } \
+    \
+    static inline int \
+    tryRead_##Name(T* const out, Name* const mvar) { \
+        return Name##_get_until(out, mvar, FASTMVAR_FULL, FASTMVAR_NO_WAIT); \
+    }
+
+#endif